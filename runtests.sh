@@ -2,4 +2,16 @@
 set -e
 ./compile test && ./main
 ./compile cli && ./main -f fus/cli_test.fus
+./compile symtable_bench -pthread && ./main
+./compile lang && ./main -f fus/tools/eq.fus -m eqtools -d test -e
+./compile lang && ./main -f fus/cow_test.fus -m cowtest -d test -e
+./compile lang && ./main -f fus/vec_test.fus -m vectest -d test -e
+./compile lang && ./main -f fus/sort_test.fus -m sorttest -d test -e
+./compile lang && ./main -f fus/iarr_test.fus -m iarrtest -d test -e
+./compile lang && ./main -f fus/strbuf_test.fus -m strbuftest -d test -e
+./compile lang && ./main -f fus/str_test.fus -m strtest -d test -e
+./compile lang && ./main -f fus/map_test.fus -m maptest -d test -e
+./compile lang && ./main -f fus/omap_test.fus -m omaptest -d test -e
+./compile lang && ./main -f fus/pqueue_test.fus -m pqueuetest -d test -e
+./compile lang && ./main -g 1 -f fus/cow_test.fus -f fus/tools/eq.fus -m cowtest -d test -e -m eqtools -d test -e
 ./compile lang && ./main -f fus/lang_test.fus -d test -e
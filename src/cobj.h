@@ -4,17 +4,44 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 
 /* #define OBJ_DEBUG_TOKENS */
 
+/* If OBJ_SYMTABLE_THREADSAFE is defined, a symtable may be shared by
+pools, parsers and vms running on different threads.
+Looking up existing syms takes no lock; creating syms takes the
+symtable's mutex.
+Requires compiling with -pthread. */
+/* #define OBJ_SYMTABLE_THREADSAFE */
+
+#ifdef OBJ_SYMTABLE_THREADSAFE
+#   include <pthread.h>
+#   define OBJ_ATOMIC_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#   define OBJ_ATOMIC_STORE(ptr, val) \
+        __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+#   define OBJ_SYMTABLE_LOCK(table) pthread_mutex_lock(&(table)->lock)
+#   define OBJ_SYMTABLE_UNLOCK(table) pthread_mutex_unlock(&(table)->lock)
+#else
+#   define OBJ_ATOMIC_LOAD(ptr) (*(ptr))
+#   define OBJ_ATOMIC_STORE(ptr, val) (*(ptr) = (val))
+#   define OBJ_SYMTABLE_LOCK(table)
+#   define OBJ_SYMTABLE_UNLOCK(table)
+#endif
+
 
 #define OBJ_TYPE_MASK_BITS 4
 #define OBJ_TYPE_MASK ((2<<OBJ_TYPE_MASK_BITS)-1)
 #define OBJ_UNIQUE_MASK (2<<OBJ_TYPE_MASK_BITS)
 
 #define OBJ_TYPE(obj) ((obj)[0].tag & OBJ_TYPE_MASK)
+/* OBJ_UNIQUE: obj is known to have only one reference, so may be
+mutated in place. It's never set on hash-consed objs (see
+obj_pool_t.hashcons), which are shared by construction. */
 #define OBJ_UNIQUE(obj) ((obj)[0].tag & OBJ_UNIQUE_MASK)
 #define OBJ_SET_UNIQUE(obj) ((obj)[0].tag |= OBJ_UNIQUE_MASK)
 #define OBJ_UNSET_UNIQUE(obj) ((obj)[0].tag &= ~OBJ_UNIQUE_MASK)
@@ -22,9 +49,27 @@
 #define OBJ_INT(obj) (obj)[0].u.i
 #define OBJ_SYM(obj) (obj)[0].u.y
 #define OBJ_STRING(obj) (obj)[0].u.s
+/* OBJ_STR_IS_INLINE: str is short enough to be stored in the obj
+itself (in u.c, with its length in the tag), so it has no
+obj_string_t, and OBJ_STRING mustn't be used on it.
+Use obj_str_get to read strs of either kind. */
+#define OBJ_STR_INLINE_MASK (4<<OBJ_TYPE_MASK_BITS)
+#define OBJ_STR_INLINE_LEN_SHIFT 8
+#define OBJ_STR_INLINE_MAX 8
+#define OBJ_STR_IS_INLINE(obj) ((obj)[0].tag & OBJ_STR_INLINE_MASK)
+#define OBJ_STR_INLINE_LEN(obj) \
+    (((obj)[0].tag >> OBJ_STR_INLINE_LEN_SHIFT) & 0xf)
 #define OBJ_DICT(obj) (obj)[0].u.d
 #define OBJ_HEAD(obj) (obj)[0].u.o
 #define OBJ_TAIL(obj) (obj)[1].u.o
+/* OBJ_CELL_RUN: for a cell, the number of cells (including itself) which
+are laid out one after another in memory, each being the previous one's
+tail; or OBJ_TYPE_UNDEFINED (-1) if not known, which is as good as 1.
+Lists allocated all at once (e.g. by the parser) have runs, so
+obj_list_len and obj_list_iget can skip over them.
+So the tail of a cell in a run mustn't be changed, unless it's the
+run's last cell (e.g. appending to a list is fine). */
+#define OBJ_CELL_RUN(obj) (obj)[1].tag
 #define OBJ_QUEUE_LIST(obj) (obj)[0].u.o
 #define OBJ_QUEUE_END(obj) (obj)[1].u.o_ptr
 #define OBJ_CONTENTS(obj) (obj)[0].u.o
@@ -39,13 +84,44 @@
 #define OBJ_DICT_N_KEYS(obj) (obj)[0].u.d->n_entries
 #define OBJ_DICT_GET(obj, sym) obj_dict_get(obj, sym)
 #define OBJ_DICT_IGET(obj, i) &(obj)[0].u.d->entries[i]
-#define OBJ_STRUCT_LEN(obj) (obj)[0].u.i
-#define OBJ_STRUCT_IGET_KEY(obj, i) ((obj) + 1 + (i) * 2)
-#define OBJ_STRUCT_IGET_VAL(obj, i) ((obj) + 1 + (i) * 2 + 1)
+#define OBJ_STRUCT_SHAPE(obj) (obj)[0].u.h
+#define OBJ_STRUCT_LEN(obj) (obj)[0].u.h->n_keys
+#define OBJ_STRUCT_IGET_KEY(obj, i) (&(obj)[0].u.h->keys[i])
+#define OBJ_STRUCT_IGET_VAL(obj, i) ((obj) + 1 + (i))
 #define OBJ_STRUCT_GET(obj, sym) obj_struct_get(obj, sym)
 #define OBJ_FUN_MODULE_NAME(obj) (obj)[0].u.y
 #define OBJ_FUN_DEF_NAME(obj) (obj)[1].u.y
 #define OBJ_FUN_ARGS(obj) (obj)[2].u.o
+#define OBJ_VEC_LEN(obj) (obj)[0].u.i
+#define OBJ_VEC_SHIFT(obj) (obj)[1].tag
+#define OBJ_VEC_ROOT(obj) (obj)[1].u.o
+#define OBJ_VEC_IGET(obj, i) obj_vec_iget(obj, i)
+#define OBJ_INTARR_LEN(obj) (obj)[0].u.i
+#define OBJ_INTARR_KIND(obj) (obj)[1].tag
+#define OBJ_INTARR_DATA(obj) ((void*)((obj) + 2))
+#define OBJ_INTARR_I32(obj) ((int32_t*)OBJ_INTARR_DATA(obj))
+#define OBJ_INTARR_U8(obj) ((uint8_t*)OBJ_INTARR_DATA(obj))
+#define OBJ_INTARR_N_OBJS(obj) \
+    obj_intarr_n_objs(OBJ_INTARR_KIND(obj), OBJ_INTARR_LEN(obj))
+#define OBJ_MAP_N_KEYS(obj) (obj)[0].u.i
+#define OBJ_MAP_TABLE(obj) (obj)[1].u.o
+#define OBJ_MAP_CAP(obj) \
+    (OBJ_MAP_TABLE(obj)? OBJ_ARRAY_LEN(OBJ_MAP_TABLE(obj)) / 2: 0)
+#define OBJ_MAP_IGET_KEY(obj, i) OBJ_ARRAY_IGET(OBJ_MAP_TABLE(obj), (i) * 2)
+#define OBJ_MAP_IGET_VAL(obj, i) \
+    OBJ_ARRAY_IGET(OBJ_MAP_TABLE(obj), (i) * 2 + 1)
+#define OBJ_OMAP_LEN(obj) (obj)[0].u.i
+#define OBJ_OMAP_HEIGHT(obj) (obj)[1].tag
+#define OBJ_OMAP_ROOT(obj) (obj)[1].u.o
+#define OBJ_OMAP_IGET(obj, i) obj_omap_iget(obj, i)
+#define OBJ_PQUEUE_LEN(obj) (obj)[0].u.i
+#define OBJ_PQUEUE_HEAP(obj) (obj)[1].u.o
+#define OBJ_PQUEUE_CAP(obj) \
+    (OBJ_PQUEUE_HEAP(obj)? OBJ_ARRAY_LEN(OBJ_PQUEUE_HEAP(obj)) / 2: 0)
+#define OBJ_PQUEUE_IGET_PRIO(obj, i) \
+    OBJ_ARRAY_IGET(OBJ_PQUEUE_HEAP(obj), (i) * 2)
+#define OBJ_PQUEUE_IGET_VAL(obj, i) \
+    OBJ_ARRAY_IGET(OBJ_PQUEUE_HEAP(obj), (i) * 2 + 1)
 #define OBJ_GET(obj, sym) obj_get(obj, sym)
 #define OBJ_IGET(obj, i) obj_iget(obj, i)
 #define OBJ_LEN(obj) obj_len(obj)
@@ -56,8 +132,35 @@
 
 #define OBJ_SYMTABLE_DEFAULT_SIZE 16
 #define OBJ_PARSER_TOKEN_BUFFER_DEFAULT_SIZE 512
+#define OBJ_PARSER_ELEMS_DEFAULT_SIZE 64
 #define OBJ_DICT_DEFAULT_SIZE 16
 
+#ifndef OBJ_DICT_SMALL_LEN
+#   define OBJ_DICT_SMALL_LEN 8
+#endif
+#define OBJ_DICT_IS_SMALL(dict) ((dict)->entries == (dict)->small_entries)
+
+#ifndef OBJ_POOL_DICT_CHUNK_LEN
+#   define OBJ_POOL_DICT_CHUNK_LEN 64
+#endif
+
+#define OBJ_POOL_SHAPE_BUCKETS 64
+#define OBJ_POOL_HASHCONS_DEFAULT_LEN 256
+
+#define OBJ_VEC_BITS 5
+#define OBJ_VEC_WIDTH (1 << OBJ_VEC_BITS)
+#define OBJ_VEC_MASK (OBJ_VEC_WIDTH - 1)
+
+#define OBJ_OMAP_WIDTH 16
+#define OBJ_OMAP_MIN_ITEMS 4
+#define OBJ_PQUEUE_ARITY 4
+
+#define OBJ_WRITER_DEFAULT_SIZE 4096
+#define OBJ_WRITER_DEFAULT_STACK_LEN 16
+#ifndef OBJ_WRITER_FLUSH_SIZE
+#   define OBJ_WRITER_FLUSH_SIZE 65536
+#endif
+
 const char ASCII_OPERATORS[] = "!$%&'*+,-./<=>?@^`|~";
 const char ASCII_LOWER[] = "abcdefghijklmnopqrstuvwxyz";
 const char ASCII_UPPER[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
@@ -67,14 +170,31 @@ typedef struct obj_string obj_string_t;
 typedef struct obj_string_list obj_string_list_t;
 typedef struct obj_sym obj_sym_t;
 typedef struct obj_symtable obj_symtable_t;
+typedef struct obj_symtable_slots obj_symtable_slots_t;
 typedef struct obj_dict obj_dict_t;
 typedef struct obj_dict_entry obj_dict_entry_t;
-typedef struct obj_dict_list obj_dict_list_t;
+typedef struct obj_dict_chunk obj_dict_chunk_t;
+typedef struct obj_shape obj_shape_t;
 typedef struct obj_pool obj_pool_t;
 typedef struct obj_pool_chunk obj_pool_chunk_t;
 typedef struct obj_parser obj_parser_t;
+typedef struct obj_writer obj_writer_t;
+typedef struct obj_writer_frame obj_writer_frame_t;
+typedef struct obj_binary_frame obj_binary_frame_t;
+typedef struct obj_image obj_image_t;
+typedef struct obj_image_header obj_image_header_t;
+typedef struct obj_json_options obj_json_options_t;
+typedef struct obj_hash_memo obj_hash_memo_t;
+typedef struct obj_hash_memo_entry obj_hash_memo_entry_t;
+typedef struct obj_copier obj_copier_t;
+typedef struct obj_copier_entry obj_copier_entry_t;
+typedef struct obj_copier_item obj_copier_item_t;
 typedef struct obj_parser_stack obj_parser_stack_t;
 
+typedef int obj_lt_t(obj_t *x, obj_t *y, void *data, bool *lt_ptr);
+    /* Comparison used by obj_sort etc: sets *lt_ptr to whether x
+    should come before y. Returns nonzero on error. */
+
 enum {
     OBJ_TYPE_NULL,
     OBJ_TYPE_BOOL,
@@ -89,19 +209,50 @@ enum {
     OBJ_TYPE_STRUCT,
     OBJ_TYPE_FUN,
     OBJ_TYPE_BOX,
+    OBJ_TYPE_VEC,
+    OBJ_TYPE_INTARR,
+    OBJ_TYPE_STRBUF,
+    OBJ_TYPE_MAP,
+    OBJ_TYPE_OMAP,
+    OBJ_TYPE_PQUEUE,
     OBJ_TYPES,
     OBJ_TYPE_UNDEFINED=-1
 };
 const char *obj_type_msg(int type){
     static const char *msgs[OBJ_TYPES] = {
         "null", "bool", "int", "sym", "str", "nil", "cell",
-        "queue", "array", "dict", "struct", "fun", "box"
+        "queue", "array", "dict", "struct", "fun", "box", "vec",
+        "intarr", "strbuf", "map", "omap", "pqueue"
     };
     if(type == OBJ_TYPE_UNDEFINED)return "undefined";
     if(type < 0 || type >= OBJ_TYPES)return "unknown";
     return msgs[type];
 }
 
+/* Intarr element kinds */
+enum {
+    OBJ_INTARR_I32,
+    OBJ_INTARR_U8,
+    OBJ_INTARR_KINDS
+};
+const char *obj_intarr_kind_msg(int kind){
+    static const char *msgs[OBJ_INTARR_KINDS] = {"i32", "u8"};
+    if(kind < 0 || kind >= OBJ_INTARR_KINDS)return "unknown";
+    return msgs[kind];
+}
+
+/* Intarr bulk operations (see obj_intarr_binop, obj_intarr_reduce) */
+enum {
+    OBJ_INTARR_ADD,
+    OBJ_INTARR_SUB,
+    OBJ_INTARR_MUL,
+    OBJ_INTARR_EQ,
+    OBJ_INTARR_LT,
+    OBJ_INTARR_SUM,
+    OBJ_INTARR_MIN,
+    OBJ_INTARR_MAX
+};
+
 enum {
     OBJ_TOKEN_TYPE_INVALID,
     OBJ_TOKEN_TYPE_EOF,
@@ -145,6 +296,8 @@ struct obj {
         obj_t *o;
         obj_t **o_ptr;
         obj_dict_t *d;
+        obj_shape_t *h;
+        char c[OBJ_STR_INLINE_MAX];
     } u;
 };
 
@@ -156,6 +309,9 @@ struct obj_string {
 struct obj_string_list {
     obj_string_list_t *next;
     obj_string_t string;
+    bool is_slice;
+        /* is_slice: string's data belongs to some other string (see
+        obj_pool_string_add_slice), so isn't freed along with it */
 };
 
 struct obj_sym {
@@ -163,13 +319,41 @@ struct obj_sym {
     obj_string_t string;
 };
 
+struct obj_symtable_slots {
+    obj_symtable_slots_t *prev;
+    size_t len;
+    obj_sym_t *syms[];
+        /* prev: if OBJ_SYMTABLE_THREADSAFE, slots which were replaced
+        when table grew, kept around until obj_symtable_cleanup in case
+        other threads are still reading them */
+        /* len: size of syms, always a power of 2 */
+        /* syms: open-addressed hash table.
+        Syms are never removed, so a search may stop at the first
+        NULL. */
+};
+
 struct obj_symtable {
-    obj_sym_t **syms;
-    size_t syms_len;
+    obj_symtable_slots_t *slots;
     size_t n_syms;
-        /* syms_len - size of allocated space */
+        /* slots: NULL until first sym is added.
+        Grown by allocating new slots and swapping table->slots, so
+        readers always see a complete (if possibly stale) table */
         /* n_syms - number of symbols stored in table */
-        /* n_syms <= syms_len */
+        /* n_syms <= slots->len */
+
+#ifdef OBJ_SYMTABLE_THREADSAFE
+    pthread_mutex_t lock;
+        /* lock: held while adding syms and growing */
+#endif
+};
+
+struct obj_dict_entry {
+    obj_sym_t *sym;
+    obj_t value;
+        /* Values are stored inline, so like array elements and
+        struct values, they are limited to what can be represented
+        as a single obj_t.
+        Boxes can be used to indirectly store values of any type. */
 };
 
 struct obj_dict {
@@ -179,23 +363,68 @@ struct obj_dict {
         /* entries_len - size of allocated space */
         /* n_entries - number of entries stored in dict */
         /* n_entries <= entries_len */
+
+    obj_dict_entry_t small_entries[OBJ_DICT_SMALL_LEN];
+        /* Most dicts only ever hold a handful of keys, so they start
+        out "small": entries points at small_entries, the first
+        n_entries of which are in use, and lookups are a linear scan
+        (which for a few keys beats hashing).
+        Once a dict outgrows small_entries, it's promoted to a
+        malloc'd hash table, and small_entries goes unused. */
 };
 
-struct obj_dict_entry {
-    obj_sym_t *sym;
-    void *value;
+struct obj_shape {
+    obj_shape_t *next;
+    size_t hash;
+        /* next: next shape in same bucket of pool->shapes */
+        /* hash: combined hash of keys, for finding shape in pool */
+
+    int n_keys;
+    obj_t *keys;
+        /* keys: array of n_keys syms (OBJ_TYPE_SYM) */
+
+    int *index;
+    size_t index_len;
+    int index_bits;
+    uint32_t index_mult;
+        /* index: maps keys' hashes to their position in keys.
+        It's an open addressing table of index_len slots (a power of
+        2), each either -1 (empty) or a position in keys.
+        A key's slot is the top index_bits bits of its hash times
+        index_mult, and index_mult is chosen (if possible) such that
+        there are no collisions, so that looking up a key which is
+        present takes exactly one probe. */
 };
 
-struct obj_dict_list {
-    obj_dict_list_t *next;
-    obj_dict_t dict;
+struct obj_dict_chunk {
+    obj_dict_chunk_t *next;
+    obj_dict_t dicts[OBJ_POOL_DICT_CHUNK_LEN];
+    size_t len;
 };
 
 struct obj_pool {
     obj_symtable_t *symtable;
     obj_pool_chunk_t *chunk_list;
+    size_t n_objs;
+        /* n_objs: number of objs allocated from chunk_list */
     obj_string_list_t *string_list;
-    obj_dict_list_t *dict_list;
+    obj_dict_chunk_t *dict_chunk_list;
+    obj_shape_t *shapes[OBJ_POOL_SHAPE_BUCKETS];
+        /* shapes: hash table of the struct shapes used by this pool,
+        so that structs with the same keys share the same shape */
+
+    bool hashcons;
+    obj_t **hashcons_table;
+    size_t hashcons_table_len;
+    size_t hashcons_n_objs;
+        /* hashcons: if set, obj_pool_add_int, obj_pool_add_sym,
+        obj_pool_add_str and obj_pool_add_cell return the pool's existing
+        obj with the same contents, if any, instead of allocating a new
+        one. So identical subtrees share storage, and can be compared
+        by pointer.
+        Such objs are shared, and must never be mutated in place. */
+        /* hashcons_table: open addressing table of hashcons_table_len
+        slots (0 or a power of 2), each NULL or a hash-consed obj */
 
     /* Unique objects, doesn't make sense to keep allocating them */
     obj_t null;
@@ -206,8 +435,49 @@ struct obj_pool {
 
 struct obj_pool_chunk {
     obj_pool_chunk_t *next;
-    obj_t objs[OBJ_POOL_CHUNK_LEN];
     size_t len;
+    size_t size;
+    obj_t objs[];
+        /* size: number of objs allocated; usually OBJ_POOL_CHUNK_LEN,
+        but may be more, e.g. for large arrays, or when space was
+        reserved with obj_pool_reserve */
+};
+
+struct obj_writer_frame {
+    int type;
+    int depth;
+    size_t i;
+    size_t n;
+    union {
+        obj_t *o;
+        obj_dict_t *d;
+    } u;
+        /* type: OBJ_TYPE_CELL (for lists & queues), OBJ_TYPE_ARRAY,
+        OBJ_TYPE_DICT, OBJ_TYPE_STRUCT, OBJ_TYPE_FUN, OBJ_TYPE_VEC,
+        OBJ_TYPE_MAP, OBJ_TYPE_OMAP or OBJ_TYPE_PQUEUE */
+        /* depth: indentation of the container; its elements are
+        written at depth + 2 */
+        /* i: index of next element (or, for lists, unused) */
+        /* n: number of elements written so far */
+        /* u: the container; for lists, the next cell */
+};
+
+struct obj_writer {
+    FILE *file;
+    char *buffer;
+    size_t buffer_len;
+    size_t buffer_size;
+        /* file: if not NULL, buffer is flushed to it whenever it
+        reaches OBJ_WRITER_FLUSH_SIZE, and by obj_writer_flush.
+        Otherwise, output just accumulates in buffer. */
+        /* buffer_len: number of bytes written to buffer */
+        /* buffer_size: size of memory allocated for buffer */
+
+    obj_writer_frame_t *stack;
+    size_t stack_len;
+    size_t stack_tos;
+        /* stack: containers currently being written, so that we
+        don't recurse in C once per nesting level */
 };
 
 struct obj_parser {
@@ -242,6 +512,15 @@ struct obj_parser {
         Then when we push to this->stack, we pop from
         this->free_stack if available, only otherwise do we
         malloc. */
+
+    obj_t **elems;
+    size_t elems_len;
+    size_t elems_size;
+        /* elems: elements of the lists currently being parsed, the
+        innermost list's last.
+        Each list's cells are only created once it's closed, working
+        backwards from its last element, so that every cell is complete
+        when created (see obj_pool_t.hashcons). */
 };
 
 struct obj_parser_stack {
@@ -250,14 +529,14 @@ struct obj_parser_stack {
     size_t token_row;
     size_t line_col;
 
-    obj_t **tail;
-        /* The tail ptr of last node in list we were working on
-        when we encountered this COLON or LPAREN token.
+    size_t elems_start;
+        /* The length of parser->elems when we encountered this
+        COLON or LPAREN token.
         At that time, we pushed this stack entry, and started
         working on a fresh list.
         When we encounter the closing token (e.g. RPAREN), we
-        pop this stack entry and continue working on the old
-        list. */
+        pop this stack entry, turn the elems after elems_start
+        into a list, and continue working on the old list. */
 };
 
 
@@ -270,8 +549,16 @@ static void obj_fprint(obj_t *obj, FILE *file, int depth);
 void obj_init_null(obj_t *obj);
 void obj_init_bool(obj_t *obj, bool b);
 void obj_init_nil(obj_t *obj);
+void obj_init_sym(obj_t *obj, obj_sym_t *sym);
+obj_string_t *obj_str_get(obj_t *obj, obj_string_t *view);
 int obj_list_len(obj_t *obj);
+obj_t *obj_resolve(obj_t *obj);
 obj_t **obj_list_get_end(obj_t **obj);
+obj_t *obj_vec_iget(obj_t *obj, int i);
+obj_t *obj_omap_iget(obj_t *obj, int i);
+int obj_cmp(obj_t *x, obj_t *y, int *cmp_ptr);
+size_t obj_intarr_n_objs(int kind, int len);
+int obj_intarr_get(obj_t *obj, int i);
 
 
 /************
@@ -302,6 +589,11 @@ int obj_hash(const char *s, int len){
     return hash;
 }
 
+static size_t obj_hash_mix(size_t h, size_t x){
+    /* Combines x into h, order-dependently */
+    return h ^ (x + (size_t)0x9e3779b9 + (h << 6) + (h >> 2));
+}
+
 int obj_symbol_type(const char *token, size_t token_len){
     if(!token_len)return OBJ_SYMBOL_TYPE_LONGSYM;
 
@@ -364,29 +656,112 @@ bool obj_string_eq(obj_string_t *string1, obj_string_t *string2){
     return obj_string_eq_raw(string1, string2->data, string2->len);
 }
 
+bool obj_string_startswith(obj_string_t *string, obj_string_t *prefix){
+    return string->len >= prefix->len &&
+        !memcmp(string->data, prefix->data, prefix->len);
+}
+
+int obj_string_find_byte(obj_string_t *string, char c){
+    /* Returns index of first c in string, or -1 */
+    const char *p = memchr(string->data, c, string->len);
+    return p? (int)(p - string->data): -1;
+}
+
+int obj_string_find(obj_string_t *string, obj_string_t *sub){
+    /* Returns index of first occurrence of sub in string, or -1.
+    memchr finds candidates for sub's first byte, so we only compare
+    the rest of sub where that matches. */
+    if(!sub->len)return 0;
+    const char *data = string->data;
+    const char *end = string->data + string->len;
+    while((size_t)(end - data) >= sub->len){
+        const char *p = memchr(data, sub->data[0],
+            end - data - sub->len + 1);
+        if(!p)break;
+        if(!memcmp(p + 1, sub->data + 1, sub->len - 1)){
+            return (int)(p - string->data);
+        }
+        data = p + 1;
+    }
+    return -1;
+}
+
+bool obj_string_toint(obj_string_t *string, int *i_ptr){
+    /* Parses string as a decimal int, with optional leading '-'.
+    Returns false (leaving *i_ptr alone) if it's anything else, or
+    doesn't fit in an int. */
+    const char *data = string->data;
+    size_t len = string->len;
+    bool is_neg = len && data[0] == '-';
+    size_t i = is_neg? 1: 0;
+    if(i >= len)return false;
+    long long n = 0;
+    for(; i < len; i++){
+        if(data[i] < '0' || data[i] > '9')return false;
+        n = n * 10 + (data[i] - '0');
+        if(n > (long long)INT_MAX + 1)return false;
+    }
+    if(is_neg)n = -n;
+    if(n > INT_MAX)return false;
+    *i_ptr = (int)n;
+    return true;
+}
+
+/* Bytes which need a backslash in front of them when written out */
+static const bool obj_string_escape_table[256] = {
+    ['\\'] = true, ['\n'] = true, ['"'] = true
+};
+static const bool obj_sym_escape_table[256] = {
+    ['\\'] = true, ['\n'] = true, ['['] = true, [']'] = true
+};
+
+static size_t obj_escape_run(
+    const char *data, size_t len, const bool *escape_table
+){
+    /* Returns length of the initial run of data which needs no
+    escaping */
+    size_t i = 0;
+    while(i < len && !escape_table[(unsigned char)data[i]])i++;
+    return i;
+}
+
+static void obj_fwrite_escaped(
+    const char *data, size_t len, FILE *file, const bool *escape_table
+){
+    size_t i = 0;
+    while(i < len){
+        size_t run = obj_escape_run(data + i, len - i, escape_table);
+        fwrite(data + i, 1, run, file);
+        i += run;
+        if(i < len){
+            char c = data[i++];
+            putc('\\', file);
+            putc(c == '\n'? 'n': c, file);
+        }
+    }
+}
+
 void obj_string_fprint_raw(
     obj_string_t *s, FILE *file, char lc, char rc,
     const char *escaped_chars
 ){
     if(lc)putc(lc, file);
     if(!escaped_chars){
-        int len = size_to_int(s->len, -1);
-        fprintf(file, "%.*s", len, s->data);
+        fwrite(s->data, 1, s->len, file);
     }else{
-        for(size_t i = 0; i < s->len; i++){
-            char c = s->data[i];
-            if(strchr(escaped_chars, c)){
-                putc('\\', file);
-                if(c == '\n')c = 'n';
-            }
-            putc(c, file);
+        bool escape_table[256] = {false};
+        for(const char *c = escaped_chars; *c; c++){
+            escape_table[(unsigned char)*c] = true;
         }
+        obj_fwrite_escaped(s->data, s->len, file, escape_table);
     }
     if(rc)putc(rc, file);
 }
 
 void obj_string_fprint(obj_string_t *s, FILE *file){
-    obj_string_fprint_raw(s, file, '"', '"', "\\\n\"");
+    putc('"', file);
+    obj_fwrite_escaped(s->data, s->len, file, obj_string_escape_table);
+    putc('"', file);
 }
 
 void obj_sym_fprint(obj_sym_t *sym, FILE *file){
@@ -397,7 +772,399 @@ void obj_sym_fprint(obj_sym_t *sym, FILE *file){
         lc = '[';
         rc = ']';
     }
-    obj_string_fprint_raw(&sym->string, file, lc, rc, "\\\n[]");
+    if(lc)putc(lc, file);
+    obj_fwrite_escaped(sym->string.data, sym->string.len, file,
+        obj_sym_escape_table);
+    if(rc)putc(rc, file);
+}
+
+
+/*************
+* obj_writer *
+*************/
+
+void obj_writer_init(obj_writer_t *writer, FILE *file){
+    memset(writer, 0, sizeof(*writer));
+    writer->file = file;
+}
+
+void obj_writer_cleanup(obj_writer_t *writer){
+    free(writer->buffer);
+    free(writer->stack);
+}
+
+int obj_writer_flush(obj_writer_t *writer){
+    if(!writer->file || !writer->buffer_len)return 0;
+    size_t len = writer->buffer_len;
+    writer->buffer_len = 0;
+    if(fwrite(writer->buffer, 1, len, writer->file) != len){
+        fprintf(stderr, "%s: Couldn't write %zu bytes. ", __func__, len);
+        perror("fwrite");
+        return 1;
+    }
+    return 0;
+}
+
+char *obj_writer_reserve(obj_writer_t *writer, size_t len){
+    /* Returns pointer to len bytes at end of buffer, which caller may
+    write to; caller must then add len to writer->buffer_len. */
+    if(writer->file &&
+        writer->buffer_len + len > OBJ_WRITER_FLUSH_SIZE
+    ){
+        if(obj_writer_flush(writer))return NULL;
+    }
+    if(writer->buffer_len + len > writer->buffer_size){
+        size_t size = writer->buffer_size? writer->buffer_size:
+            OBJ_WRITER_DEFAULT_SIZE;
+        while(writer->buffer_len + len > size)size *= 2;
+        char *buffer = realloc(writer->buffer, size);
+        if(!buffer){
+            fprintf(stderr, "%s: Couldn't grow buffer to %zu bytes. ",
+                __func__, size);
+            perror("realloc");
+            return NULL;
+        }
+        writer->buffer = buffer;
+        writer->buffer_size = size;
+    }
+    return writer->buffer + writer->buffer_len;
+}
+
+int obj_writer_write(obj_writer_t *writer, const char *data, size_t len){
+    char *s = obj_writer_reserve(writer, len);
+    if(!s)return 1;
+    memcpy(s, data, len);
+    writer->buffer_len += len;
+    return 0;
+}
+
+int obj_writer_putc(obj_writer_t *writer, char c){
+    char *s = obj_writer_reserve(writer, 1);
+    if(!s)return 1;
+    *s = c;
+    writer->buffer_len++;
+    return 0;
+}
+
+int obj_writer_newline(obj_writer_t *writer, int depth){
+    /* Writes a newline followed by depth spaces */
+    char *s = obj_writer_reserve(writer, 1 + depth);
+    if(!s)return 1;
+    s[0] = '\n';
+    memset(s + 1, ' ', depth);
+    writer->buffer_len += 1 + depth;
+    return 0;
+}
+
+int obj_writer_write_int(obj_writer_t *writer, int i){
+    char *s = obj_writer_reserve(writer, 16);
+    if(!s)return 1;
+    writer->buffer_len += snprintf(s, 16, "%i", i);
+    return 0;
+}
+
+int obj_writer_write_escaped(obj_writer_t *writer,
+    const char *data, size_t len, const bool *escape_table
+){
+    /* Writes data, with a backslash before each byte marked in
+    escape_table (see obj_escape_run).
+    Since each byte becomes at most 2, we reserve space once and copy
+    the unescaped runs in bulk. */
+    char *s = obj_writer_reserve(writer, len * 2);
+    if(!s)return 1;
+    char *s0 = s;
+    size_t i = 0;
+    while(i < len){
+        size_t run = obj_escape_run(data + i, len - i, escape_table);
+        memcpy(s, data + i, run);
+        s += run;
+        i += run;
+        if(i < len){
+            char c = data[i++];
+            *s++ = '\\';
+            *s++ = c == '\n'? 'n': c;
+        }
+    }
+    writer->buffer_len += s - s0;
+    return 0;
+}
+
+int obj_writer_write_string(obj_writer_t *writer, obj_string_t *s){
+    if(obj_writer_putc(writer, '"'))return 1;
+    if(obj_writer_write_escaped(writer, s->data, s->len,
+        obj_string_escape_table))return 1;
+    return obj_writer_putc(writer, '"');
+}
+
+int obj_writer_write_sym(obj_writer_t *writer, obj_sym_t *sym){
+    obj_string_t *s = &sym->string;
+    bool longsym = obj_symbol_type(s->data, s->len)
+        == OBJ_SYMBOL_TYPE_LONGSYM;
+    if(longsym && obj_writer_putc(writer, '['))return 1;
+    if(obj_writer_write_escaped(writer, s->data, s->len,
+        obj_sym_escape_table))return 1;
+    if(longsym && obj_writer_putc(writer, ']'))return 1;
+    return 0;
+}
+
+static int obj_writer_push(obj_writer_t *writer,
+    int type, int depth, obj_t *obj, obj_dict_t *dict
+){
+    if(writer->stack_tos >= writer->stack_len){
+        size_t stack_len = writer->stack_len? writer->stack_len * 2:
+            OBJ_WRITER_DEFAULT_STACK_LEN;
+        obj_writer_frame_t *stack = realloc(writer->stack,
+            stack_len * sizeof(*stack));
+        if(!stack){
+            fprintf(stderr, "%s: Couldn't grow stack to %zu frames. ",
+                __func__, stack_len);
+            perror("realloc");
+            return 1;
+        }
+        writer->stack = stack;
+        writer->stack_len = stack_len;
+    }
+    obj_writer_frame_t *frame = &writer->stack[writer->stack_tos++];
+    frame->type = type;
+    frame->depth = depth;
+    frame->i = 0;
+    frame->n = 0;
+    if(dict)frame->u.d = dict;
+    else frame->u.o = obj;
+    return 0;
+}
+
+static int obj_writer_run(obj_writer_t *writer, obj_t *obj, int depth){
+    /* Writes obj (if not NULL), and then elements of containers pushed
+    onto writer->stack, until the stack drops back to its size when we
+    were called.
+    Each container is represented by a frame, which we use to find its
+    next element to write (and which we pop when there are none left),
+    so arbitrarily deep nesting costs heap rather than C stack. */
+    size_t base = writer->stack_tos;
+    for(;;){
+        while(obj){
+            obj = OBJ_RESOLVE(obj);
+            int type = OBJ_TYPE(obj);
+            switch(type){
+                case OBJ_TYPE_BOOL:
+                    if(obj_writer_write(writer,
+                        OBJ_BOOL(obj)? "{bool}T": "{bool}F", 7))return 1;
+                    break;
+                case OBJ_TYPE_INT:
+                    if(obj_writer_write_int(writer, OBJ_INT(obj)))return 1;
+                    break;
+                case OBJ_TYPE_STRBUF:
+                    if(obj_writer_write(writer, "{strbuf}", 8))return 1;
+                    /* fall through */
+                case OBJ_TYPE_STR: {
+                    obj_string_t view;
+                    if(obj_writer_write_string(writer,
+                        obj_str_get(obj, &view)))return 1;
+                    break;
+                }
+                case OBJ_TYPE_SYM:
+                    if(obj_writer_write_sym(writer, OBJ_SYM(obj)))return 1;
+                    break;
+                case OBJ_TYPE_QUEUE:
+                    if(obj_writer_write(writer, "{queue}", 7))return 1;
+                    obj = OBJ_QUEUE_LIST(obj);
+                    /* fall through */
+                case OBJ_TYPE_NIL:
+                case OBJ_TYPE_CELL:
+                    if(obj_writer_putc(writer, ':'))return 1;
+                    if(obj_writer_push(writer, OBJ_TYPE_CELL,
+                        depth, obj, NULL))return 1;
+                    break;
+                case OBJ_TYPE_ARRAY:
+                    if(obj_writer_write(writer, "{arr}:", 6))return 1;
+                    if(obj_writer_push(writer, type,
+                        depth, obj, NULL))return 1;
+                    break;
+                case OBJ_TYPE_DICT:
+                    if(obj_writer_write(writer, "{dict}:", 7))return 1;
+                    if(obj_writer_push(writer, type,
+                        depth, NULL, OBJ_DICT(obj)))return 1;
+                    break;
+                case OBJ_TYPE_STRUCT:
+                    if(obj_writer_write(writer, "{obj}:", 6))return 1;
+                    if(obj_writer_push(writer, type,
+                        depth, obj, NULL))return 1;
+                    break;
+                case OBJ_TYPE_FUN:
+                    if(obj_writer_write(writer, "{fun}:", 6))return 1;
+                    if(obj_writer_push(writer, type,
+                        depth, obj, NULL))return 1;
+                    break;
+                case OBJ_TYPE_VEC:
+                    if(obj_writer_write(writer, "{vec}:", 6))return 1;
+                    if(obj_writer_push(writer, type,
+                        depth, obj, NULL))return 1;
+                    break;
+                case OBJ_TYPE_MAP:
+                    if(obj_writer_write(writer, "{map}:", 6))return 1;
+                    if(obj_writer_push(writer, type,
+                        depth, obj, NULL))return 1;
+                    break;
+                case OBJ_TYPE_OMAP:
+                    if(obj_writer_write(writer, "{omap}:", 7))return 1;
+                    if(obj_writer_push(writer, type,
+                        depth, obj, NULL))return 1;
+                    break;
+                case OBJ_TYPE_PQUEUE:
+                    if(obj_writer_write(writer, "{pqueue}:", 9))return 1;
+                    if(obj_writer_push(writer, type,
+                        depth, obj, NULL))return 1;
+                    break;
+                case OBJ_TYPE_INTARR: {
+                    /* Elements are plain ints, so no need for a frame */
+                    if(obj_writer_write(writer,
+                        OBJ_INTARR_KIND(obj) == OBJ_INTARR_U8?
+                            "{u8arr}:": "{i32arr}:",
+                        OBJ_INTARR_KIND(obj) == OBJ_INTARR_U8? 8: 9)
+                    )return 1;
+                    for(int i = 0; i < OBJ_INTARR_LEN(obj); i++){
+                        if(obj_writer_newline(writer, depth + 2))return 1;
+                        if(obj_writer_write_int(writer,
+                            obj_intarr_get(obj, i)))return 1;
+                    }
+                    break;
+                }
+                case OBJ_TYPE_NULL:
+                    if(obj_writer_write(writer, "{null}null", 10))return 1;
+                    break;
+                default:
+                    if(obj_writer_write(writer,
+                        "{unknown}unknown", 16))return 1;
+                    break;
+            }
+            obj = NULL;
+        }
+
+        if(writer->stack_tos == base)break;
+
+        /* Find the next element of the innermost container */
+        obj_writer_frame_t *frame = &writer->stack[writer->stack_tos - 1];
+        depth = frame->depth + 2;
+        switch(frame->type){
+            case OBJ_TYPE_CELL: {
+                obj_t *cell = frame->u.o;
+                if(OBJ_TYPE(cell) != OBJ_TYPE_CELL)break;
+                if(obj_writer_newline(writer, depth))return 1;
+                obj = OBJ_HEAD(cell);
+                frame->u.o = OBJ_TAIL(cell);
+                continue;
+            }
+            case OBJ_TYPE_ARRAY: {
+                if(frame->i >= OBJ_ARRAY_LEN(frame->u.o))break;
+                if(obj_writer_newline(writer, depth))return 1;
+                obj = OBJ_ARRAY_IGET(frame->u.o, frame->i++);
+                continue;
+            }
+            case OBJ_TYPE_DICT: {
+                obj_dict_t *dict = frame->u.d;
+                while(frame->i < dict->entries_len &&
+                    !dict->entries[frame->i].sym)frame->i++;
+                if(frame->i >= dict->entries_len)break;
+                obj_dict_entry_t *entry = &dict->entries[frame->i++];
+                if(obj_writer_newline(writer, depth))return 1;
+                if(obj_writer_write_sym(writer, entry->sym))return 1;
+                if(obj_writer_putc(writer, ' '))return 1;
+                obj = &entry->value;
+                continue;
+            }
+            case OBJ_TYPE_STRUCT: {
+                obj_t *s_obj = frame->u.o;
+                if(frame->i >= OBJ_STRUCT_LEN(s_obj))break;
+                obj_sym_t *key = OBJ_SYM(
+                    OBJ_STRUCT_IGET_KEY(s_obj, frame->i));
+                if(obj_writer_newline(writer, depth))return 1;
+                if(obj_writer_write_sym(writer, key))return 1;
+                if(obj_writer_putc(writer, ' '))return 1;
+                obj = OBJ_STRUCT_IGET_VAL(s_obj, frame->i++);
+                continue;
+            }
+            case OBJ_TYPE_FUN: {
+                obj_t *f_obj = frame->u.o;
+                size_t i = frame->i++;
+                if(i >= 3)break;
+                if(obj_writer_newline(writer, depth))return 1;
+                if(i == 0){
+                    if(obj_writer_write_sym(writer,
+                        OBJ_FUN_MODULE_NAME(f_obj)))return 1;
+                }else if(i == 1){
+                    if(obj_writer_write_sym(writer,
+                        OBJ_FUN_DEF_NAME(f_obj)))return 1;
+                }else{
+                    obj = OBJ_FUN_ARGS(f_obj);
+                }
+                continue;
+            }
+            case OBJ_TYPE_VEC: {
+                if(frame->i >= OBJ_VEC_LEN(frame->u.o))break;
+                if(obj_writer_newline(writer, depth))return 1;
+                obj = OBJ_VEC_IGET(frame->u.o, frame->i++);
+                continue;
+            }
+            case OBJ_TYPE_MAP:
+            case OBJ_TYPE_OMAP:
+            case OBJ_TYPE_PQUEUE: {
+                /* Keys are ints, strs or syms, so are written directly,
+                like a dict's (a pqueue's priorities are written as its
+                keys, in heap order) */
+                obj_t *m_obj = frame->u.o;
+                obj_t *key;
+                if(frame->type == OBJ_TYPE_OMAP){
+                    key = OBJ_OMAP_IGET(m_obj, frame->i++);
+                    if(!key)break;
+                }else if(frame->type == OBJ_TYPE_PQUEUE){
+                    if(frame->i >= OBJ_PQUEUE_LEN(m_obj))break;
+                    key = OBJ_PQUEUE_IGET_PRIO(m_obj, frame->i++);
+                }else{
+                    while(frame->i < OBJ_MAP_CAP(m_obj) && OBJ_TYPE(
+                        OBJ_MAP_IGET_KEY(m_obj, frame->i)) == OBJ_TYPE_NULL
+                    )frame->i++;
+                    if(frame->i >= OBJ_MAP_CAP(m_obj))break;
+                    key = OBJ_MAP_IGET_KEY(m_obj, frame->i++);
+                }
+                if(obj_writer_newline(writer, depth))return 1;
+                if(OBJ_TYPE(key) == OBJ_TYPE_INT){
+                    if(obj_writer_write_int(writer, OBJ_INT(key)))return 1;
+                }else if(OBJ_TYPE(key) == OBJ_TYPE_SYM){
+                    if(obj_writer_write_sym(writer, OBJ_SYM(key)))return 1;
+                }else{
+                    obj_string_t view;
+                    if(obj_writer_write_string(writer,
+                        obj_str_get(key, &view)))return 1;
+                }
+                if(obj_writer_putc(writer, ' '))return 1;
+                obj = key + 1;
+                continue;
+            }
+            default: break;
+        }
+
+        /* Container has no more elements */
+        writer->stack_tos--;
+    }
+    return 0;
+}
+
+int obj_writer_write_obj(obj_writer_t *writer, obj_t *obj, int depth){
+    /* Writes obj in the text format, with nested values indented
+    relative to depth */
+    return obj_writer_run(writer, obj, depth);
+}
+
+int obj_writer_write_dict_entries(obj_writer_t *writer,
+    obj_dict_t *dict, int depth
+){
+    /* Writes dict's entries (without the "{dict}:" prefix), each on a
+    new line indented by depth */
+    if(obj_writer_push(writer, OBJ_TYPE_DICT, depth - 2, NULL, dict)){
+        return 1;
+    }
+    return obj_writer_run(writer, NULL, 0);
 }
 
 
@@ -407,23 +1174,43 @@ void obj_sym_fprint(obj_sym_t *sym, FILE *file){
 
 void obj_symtable_init(obj_symtable_t *table){
     memset(table, 0, sizeof(*table));
+#ifdef OBJ_SYMTABLE_THREADSAFE
+    pthread_mutex_init(&table->lock, NULL);
+#endif
 }
 
 void obj_symtable_cleanup(obj_symtable_t *table){
-    for(size_t i = 0; i < table->syms_len; i++){
-        obj_sym_t *sym = table->syms[i];
-        if(!sym)continue;
-        obj_string_cleanup(&sym->string);
-        free(sym);
+    obj_symtable_slots_t *slots = table->slots;
+    if(slots){
+        for(size_t i = 0; i < slots->len; i++){
+            obj_sym_t *sym = slots->syms[i];
+            if(!sym)continue;
+            obj_string_cleanup(&sym->string);
+            free(sym);
+        }
     }
-    free(table->syms);
+    while(slots){
+        obj_symtable_slots_t *prev = slots->prev;
+        free(slots);
+        slots = prev;
+    }
+#ifdef OBJ_SYMTABLE_THREADSAFE
+    pthread_mutex_destroy(&table->lock);
+#endif
+}
+
+size_t obj_symtable_len(obj_symtable_t *table){
+    obj_symtable_slots_t *slots = OBJ_ATOMIC_LOAD(&table->slots);
+    return slots? slots->len: 0;
 }
 
 void obj_symtable_dump(obj_symtable_t *table, FILE *file){
+    obj_symtable_slots_t *slots = table->slots;
+    size_t syms_len = slots? slots->len: 0;
     fprintf(file, "SYMTABLE %p (%zu/%zu):\n",
-        table, table->n_syms, table->syms_len);
-    for(size_t i = 0; i < table->syms_len; i++){
-        obj_sym_t *sym = table->syms[i];
+        table, table->n_syms, syms_len);
+    for(size_t i = 0; i < syms_len; i++){
+        obj_sym_t *sym = slots->syms[i];
         fprintf(file, "  SYM %p", sym);
         if(!sym){
             fprintf(file, "\n");
@@ -437,56 +1224,83 @@ void obj_symtable_dump(obj_symtable_t *table, FILE *file){
 
 void obj_symtable_errmsg(obj_symtable_t *table, const char *funcname){
     fprintf(stderr, "%s [%zu/%zu]: ",
-        funcname, table->n_syms, table->syms_len);
+        funcname, table->n_syms, obj_symtable_len(table));
 }
 
-obj_sym_t **obj_symtable_find_free_slot(obj_symtable_t *table, size_t hash){
-    /* Finds next free slot (pointer into table->syms) for given hash.
+obj_sym_t **obj_symtable_find_free_slot(
+    obj_symtable_slots_t *slots, size_t hash
+){
+    /* Finds next free slot (pointer into slots->syms) for given hash.
     Returns NULL if no free slots. */
-    size_t mask = table->syms_len - 1;
+    size_t mask = slots->len - 1;
     size_t i0 = hash & mask;
     size_t i = i0;
     do {
-        obj_sym_t *sym = table->syms[i];
+        obj_sym_t *sym = slots->syms[i];
         if(sym == NULL){
-            return &table->syms[i];
+            return &slots->syms[i];
+        }
+        i = (i + 1) & mask;
+    }while(i != i0);
+    return NULL;
+}
+
+obj_sym_t *obj_symtable_find_sym(obj_symtable_slots_t *slots,
+    const char *text, size_t text_len, size_t hash
+){
+    /* Returns the sym for given text if it's in slots, otherwise NULL.
+    Safe to call without holding the table's lock. */
+    if(!slots)return NULL;
+    size_t mask = slots->len - 1;
+    size_t i0 = hash & mask;
+    size_t i = i0;
+    do {
+        obj_sym_t *sym = OBJ_ATOMIC_LOAD(&slots->syms[i]);
+        if(sym == NULL)break;
+        if(sym->hash == hash){
+            if(obj_string_eq_raw(&sym->string, text, text_len)){
+                /* Found sym matching given text! */
+                return sym;
+            }
         }
         i = (i + 1) & mask;
     }while(i != i0);
     return NULL;
 }
 
-obj_sym_t *obj_symtable_add_sym(obj_symtable_t *table, obj_sym_t *sym){
-    /* Adds the given sym to the table. Returns sym if there was space,
+obj_sym_t *obj_symtable_add_sym(
+    obj_symtable_slots_t *slots, obj_sym_t *sym
+){
+    /* Adds the given sym to the slots. Returns sym if there was space,
     NULL otherwise. */
-    obj_sym_t **slot_ptr = obj_symtable_find_free_slot(table, sym->hash);
+    obj_sym_t **slot_ptr = obj_symtable_find_free_slot(slots, sym->hash);
     if(!slot_ptr)return NULL;
-    *slot_ptr = sym;
+    OBJ_ATOMIC_STORE(slot_ptr, sym);
     return sym;
 }
 
 int obj_symtable_grow(obj_symtable_t *table){
-    obj_sym_t **old_syms = table->syms;
-    size_t old_syms_len = table->syms_len;
+    /* Caller must hold table's lock */
+    obj_symtable_slots_t *old_slots = table->slots;
+    size_t old_syms_len = old_slots? old_slots->len: 0;
 
     size_t syms_len = old_syms_len? old_syms_len * 2:
         OBJ_SYMTABLE_DEFAULT_SIZE;
-    obj_sym_t **syms = calloc(sizeof(*syms), syms_len);
-    if(!syms){
+    obj_symtable_slots_t *slots = calloc(
+        sizeof(*slots) + syms_len * sizeof(*slots->syms), 1);
+    if(!slots){
         obj_symtable_errmsg(table, __func__);
         fprintf(stderr,
             "Trying to allocate new syms of size %zu. ", syms_len);
         perror("calloc");
         return 1;
     }
-
-    table->syms = syms;
-    table->syms_len = syms_len;
+    slots->len = syms_len;
 
     for(size_t i = 0; i < old_syms_len; i++){
-        obj_sym_t *old_sym = old_syms[i];
+        obj_sym_t *old_sym = old_slots->syms[i];
         if(!old_sym)continue;
-        obj_sym_t *new_sym = obj_symtable_add_sym(table, old_sym);
+        obj_sym_t *new_sym = obj_symtable_add_sym(slots, old_sym);
         if(!new_sym){
             /* Shouldn't be possible for space not to be found for
             sym, since we just grew the table!
@@ -494,24 +1308,29 @@ int obj_symtable_grow(obj_symtable_t *table){
             obj_symtable_errmsg(table, __func__);
             fprintf(stderr, "Couldn't move sym %zu/%zu\n",
                 i, old_syms_len);
-            table->syms = old_syms;
-            table->syms_len = old_syms_len;
-            free(syms);
+            free(slots);
             return 1;
         }
     }
 
-    free(old_syms);
+#ifdef OBJ_SYMTABLE_THREADSAFE
+    /* Other threads may still be searching old_slots */
+    slots->prev = old_slots;
+#else
+    free(old_slots);
+#endif
+    OBJ_ATOMIC_STORE(&table->slots, slots);
     return 0;
 }
 
 obj_sym_t *obj_symtable_create_sym_raw(
     obj_symtable_t *table, const char *text, size_t text_len, size_t hash
 ){
-    /* Allocates & adds a new sym to the table with given text etc */
+    /* Allocates & adds a new sym to the table with given text etc.
+    Caller must hold table's lock. */
 
     /* We grow table once its 3/4 full */
-    if(table->n_syms >= table->syms_len / 4 * 3){
+    if(table->n_syms >= obj_symtable_len(table) / 4 * 3){
         if(obj_symtable_grow(table))return NULL;
     }
 
@@ -535,7 +1354,7 @@ obj_sym_t *obj_symtable_create_sym_raw(
     }
     memcpy(string->data, text, text_len);
     sym->hash = hash;
-    if(!obj_symtable_add_sym(table, sym))return NULL;
+    if(!obj_symtable_add_sym(table->slots, sym))return NULL;
 
     table->n_syms++;
     return sym;
@@ -550,28 +1369,20 @@ obj_sym_t *obj_symtable_get_sym_raw(
 
     size_t hash = obj_hash(text, text_len);
 
-    if(!table->syms_len){
-        /* If table is empty, skip the search for existing sym & just
-        create a new one */
-        return obj_symtable_create_sym_raw(table, text, text_len, hash);
-    }
-
-    size_t mask = table->syms_len - 1;
-    size_t i0 = hash & mask;
-    size_t i = i0;
-    do {
-        obj_sym_t *sym = table->syms[i];
-        if(sym != NULL && sym->hash == hash){
-            if(obj_string_eq_raw(&sym->string, text, text_len)){
-                /* Found sym matching given text! */
-                return sym;
-            }
-        }
-        i = (i + 1) & mask;
-    }while(i != i0);
+    obj_symtable_slots_t *slots = OBJ_ATOMIC_LOAD(&table->slots);
+    obj_sym_t *sym = obj_symtable_find_sym(slots, text, text_len, hash);
+    if(sym)return sym;
 
-    /* Found no sym matching given text, so we'll add a new one. */
-    return obj_symtable_create_sym_raw(table, text, text_len, hash);
+    /* Found no sym matching given text, so we'll add a new one.
+    But first, search again with the lock held, in case another thread
+    added it (or grew the table) since we looked. */
+    OBJ_SYMTABLE_LOCK(table);
+#ifdef OBJ_SYMTABLE_THREADSAFE
+    sym = obj_symtable_find_sym(table->slots, text, text_len, hash);
+#endif
+    if(!sym)sym = obj_symtable_create_sym_raw(table, text, text_len, hash);
+    OBJ_SYMTABLE_UNLOCK(table);
+    return sym;
 }
 
 obj_sym_t *obj_symtable_get_sym(obj_symtable_t *table, const char *text){
@@ -585,10 +1396,12 @@ obj_sym_t *obj_symtable_get_sym(obj_symtable_t *table, const char *text){
 
 void obj_dict_init(obj_dict_t *dict){
     memset(dict, 0, sizeof(*dict));
+    dict->entries = dict->small_entries;
+    dict->entries_len = OBJ_DICT_SMALL_LEN;
 }
 
 void obj_dict_cleanup(obj_dict_t *dict){
-    free(dict->entries);
+    if(!OBJ_DICT_IS_SMALL(dict))free(dict->entries);
 }
 
 void obj_dict_dump(obj_dict_t *dict, FILE *file){
@@ -605,23 +1418,19 @@ void obj_dict_dump(obj_dict_t *dict, FILE *file){
         fprintf(file, ": ");
         obj_sym_fprint(sym, file);
         putc('\n', file);
-        fprintf(file, "    -> %p\n", entry->value);
+        fprintf(file, "    -> ");
+        obj_fprint(&entry->value, file, 4);
+        putc('\n', file);
     }
 }
 
 void obj_dict_fprint(obj_dict_t *dict, FILE *file, int depth){
-    for(size_t i = 0; i < dict->entries_len; i++){
-        obj_dict_entry_t *entry = &dict->entries[i];
-        if(!entry->sym)continue;
-
-        putc('\n', file);
-        _print_tabs(file, depth);
-
-        obj_sym_fprint(entry->sym, file);
-
-        putc(' ', file);
-        obj_fprint((obj_t*)entry->value, file, depth);
+    obj_writer_t _writer, *writer=&_writer;
+    obj_writer_init(writer, file);
+    if(!obj_writer_write_dict_entries(writer, dict, depth)){
+        obj_writer_flush(writer);
     }
+    obj_writer_cleanup(writer);
 }
 
 void obj_dict_errmsg(obj_dict_t *dict, const char *funcname){
@@ -629,38 +1438,63 @@ void obj_dict_errmsg(obj_dict_t *dict, const char *funcname){
         funcname, dict->n_entries, dict->entries_len);
 }
 
-obj_dict_entry_t *obj_dict_find_free_entry(obj_dict_t *dict, size_t hash){
-    /* Finds next free (sym == NULL) entry for given hash.
-    Returns NULL if no free entries. */
+size_t obj_dict_probe_len(obj_dict_t *dict, size_t i){
+    /* Distance of the (non-empty) entry at index i from its "home"
+    index, i.e. the index its sym's hash maps to.
+    This is what Robin Hood hashing compares when deciding who gets
+    to keep a slot: entries further from home are "poorer", and are
+    never displaced by entries closer to home. */
     size_t mask = dict->entries_len - 1;
-    size_t i0 = hash & mask;
-    size_t i = i0;
-    do {
-        obj_sym_t *sym = dict->entries[i].sym;
-        if(sym == NULL){
-            return &dict->entries[i];
-        }
-        i = (i + 1) & mask;
-    }while(i != i0);
-    return NULL;
+    return (i - (dict->entries[i].sym->hash & mask)) & mask;
 }
 
-obj_dict_entry_t *obj_dict_add_entry(obj_dict_t *dict, obj_sym_t *sym, void *value){
-    /* Adds an entry to the dict. Returns entry if there was space,
-    NULL otherwise. */
-    obj_dict_entry_t *entry = obj_dict_find_free_entry(dict, sym->hash);
-    if(!entry)return NULL;
-    entry->sym = sym;
-    entry->value = value;
-    return entry;
+obj_dict_entry_t *obj_dict_add_entry(obj_dict_t *dict, obj_sym_t *sym, obj_t *value){
+    /* Adds an entry to the dict, which is assumed not to already
+    contain sym. Returns entry if there was space, NULL otherwise.
+    Entries we pass along the way may be shifted further from home,
+    if they are closer to home than the entry being added. */
+    if(dict->n_entries >= dict->entries_len)return NULL;
+
+    if(OBJ_DICT_IS_SMALL(dict)){
+        obj_dict_entry_t *entry = &dict->entries[dict->n_entries];
+        entry->sym = sym;
+        entry->value = *value;
+        return entry;
+    }
+
+    obj_dict_entry_t *added_entry = NULL;
+    obj_dict_entry_t carry = {sym, *value};
+    size_t mask = dict->entries_len - 1;
+    size_t i = sym->hash & mask;
+    size_t probe_len = 0;
+    for(;;){
+        obj_dict_entry_t *entry = &dict->entries[i];
+        if(!entry->sym){
+            *entry = carry;
+            return added_entry? added_entry: entry;
+        }
+        size_t entry_probe_len = obj_dict_probe_len(dict, i);
+        if(entry_probe_len < probe_len){
+            /* Rob the rich: carry gets this slot, and we continue
+            looking for a slot for the entry which was here */
+            obj_dict_entry_t swap = *entry;
+            *entry = carry;
+            carry = swap;
+            probe_len = entry_probe_len;
+            if(!added_entry)added_entry = entry;
+        }
+        i = (i + 1) & mask;
+        probe_len++;
+    }
 }
 
 int obj_dict_grow(obj_dict_t *dict){
     obj_dict_entry_t *old_entries = dict->entries;
     size_t old_entries_len = dict->entries_len;
 
-    size_t entries_len = old_entries_len? old_entries_len * 2:
-        OBJ_DICT_DEFAULT_SIZE;
+    bool was_small = OBJ_DICT_IS_SMALL(dict);
+    size_t entries_len = was_small? OBJ_DICT_DEFAULT_SIZE:
+        old_entries_len * 2;
     obj_dict_entry_t *entries = calloc(sizeof(*entries), entries_len);
     if(!entries){
         obj_dict_errmsg(dict, __func__);
@@ -677,7 +1511,7 @@ int obj_dict_grow(obj_dict_t *dict){
         obj_dict_entry_t *old_entry = &old_entries[i];
         if(!old_entry->sym)continue;
         obj_dict_entry_t *new_entry = obj_dict_add_entry(dict,
-            old_entry->sym, old_entry->value);
+            old_entry->sym, &old_entry->value);
         if(!new_entry){
             /* Shouldn't be possible for space not to be found for
             entry, since we just grew the dict!
@@ -692,58 +1526,108 @@ int obj_dict_grow(obj_dict_t *dict){
         }
     }
 
-    free(old_entries);
+    if(!was_small)free(old_entries);
     return 0;
 }
 
 obj_dict_entry_t *obj_dict_get_entry(obj_dict_t *dict, obj_sym_t *sym){
     /* Gets the entry for given sym, or NULL if not found. */
 
-    if(!dict->entries_len){
-        /* If dict is empty, return NULL immediately.
-        Otherwise, mask will be borked due to underflow. */
+    if(OBJ_DICT_IS_SMALL(dict)){
+        obj_dict_entry_t *entries = dict->entries;
+        size_t n_entries = dict->n_entries;
+        for(size_t i = 0; i < n_entries; i++){
+            if(entries[i].sym == sym)return &entries[i];
+        }
         return NULL;
     }
 
     size_t mask = dict->entries_len - 1;
-    size_t i0 = sym->hash & mask;
-    size_t i = i0;
-    do {
+    size_t i = sym->hash & mask;
+    size_t probe_len = 0;
+    for(;;){
         obj_dict_entry_t *entry = &dict->entries[i];
         if(entry->sym == sym)return entry;
+
+        /* Thanks to Robin Hood insertion, we can stop looking as soon
+        as we hit an empty entry, or an entry closer to home than
+        sym's entry would be */
+        if(!entry->sym)return NULL;
+        if(obj_dict_probe_len(dict, i) < probe_len)return NULL;
+
         i = (i + 1) & mask;
-    }while(i != i0);
-    return NULL;
+        probe_len++;
+    }
 }
 
-void *obj_dict_get(obj_dict_t *dict, obj_sym_t *sym){
-    /* Gets the value for given sym, or NULL if not found. */
+obj_t *obj_dict_get(obj_dict_t *dict, obj_sym_t *sym){
+    /* Gets the value for given sym, or NULL if not found.
+    NOTE: the returned pointer points into dict's entries, so it's only
+    valid until the next obj_dict_set or obj_dict_del. */
     obj_dict_entry_t *entry = obj_dict_get_entry(dict, sym);
     if(!entry)return NULL;
-    return entry->value;
+    return &entry->value;
 }
 
-void *obj_dict_del(obj_dict_t *dict, obj_sym_t *sym){
-    /* Gets the value for given sym, or NULL if not found, and
-    removes it from dict. */
+bool obj_dict_del(obj_dict_t *dict, obj_sym_t *sym, obj_t *value){
+    /* Removes the entry for given sym, copying its value into *value
+    (unless value is NULL).
+    Returns false if not found. */
     obj_dict_entry_t *entry = obj_dict_get_entry(dict, sym);
-    if(!entry || !entry->sym)return NULL;
-    entry->sym = NULL;
+    if(!entry)return false;
+    if(value)*value = entry->value;
+
+    if(OBJ_DICT_IS_SMALL(dict)){
+        /* Shift the following entries down, keeping small dicts
+        packed (and in insertion order) */
+        obj_dict_entry_t *end = &dict->entries[dict->n_entries - 1];
+        memmove(entry, entry + 1, (end - entry) * sizeof(*entry));
+        end->sym = NULL;
+        obj_init_null(&end->value);
+        dict->n_entries--;
+        return true;
+    }
+
+    /* Backward-shift deletion: entries following the deleted one are
+    moved back by one slot, until we hit an empty entry or an entry
+    which is already at home.
+    So we never leave "tombstones" behind, and probe lengths stay
+    as short as if the deleted entry had never been added. */
+    size_t mask = dict->entries_len - 1;
+    size_t i = entry - dict->entries;
+    for(;;){
+        size_t next_i = (i + 1) & mask;
+        obj_dict_entry_t *next_entry = &dict->entries[next_i];
+        if(!next_entry->sym || !obj_dict_probe_len(dict, next_i))break;
+        dict->entries[i] = *next_entry;
+        i = next_i;
+    }
+    dict->entries[i].sym = NULL;
+    obj_init_null(&dict->entries[i].value);
+
     dict->n_entries--;
-    return entry->value;
+    return true;
 }
 
-obj_dict_entry_t *obj_dict_set(obj_dict_t *dict, obj_sym_t *sym, void *value){
-    /* Adds (or updates existing) entry with given sym and value. */
+obj_dict_entry_t *obj_dict_set(obj_dict_t *dict, obj_sym_t *sym, obj_t *value){
+    /* Adds (or updates existing) entry with given sym, copying *value
+    into it.
+    NOTE: adding an entry may move other entries around, so pointers
+    to entries are only valid until the next obj_dict_set or
+    obj_dict_del. */
 
     obj_dict_entry_t *entry = obj_dict_get_entry(dict, sym);
     if(entry){
-        entry->value = value;
+        entry->value = *value;
         return entry;
     }
 
-    /* We grow dict once its 3/4 full */
-    if(dict->n_entries >= dict->entries_len / 4 * 3){
+    /* We promote small dicts once they're full, and grow hash tables
+    once they're 3/4 full */
+    if(OBJ_DICT_IS_SMALL(dict)?
+        dict->n_entries >= dict->entries_len:
+        dict->n_entries >= dict->entries_len / 4 * 3
+    ){
         if(obj_dict_grow(dict))return NULL;
     }
 
@@ -754,21 +1638,146 @@ obj_dict_entry_t *obj_dict_set(obj_dict_t *dict, obj_sym_t *sym, void *value){
 }
 
 
-/***********
-* obj_pool *
-***********/
+/************
+* obj_shape *
+************/
 
-void obj_pool_init(obj_pool_t *pool, obj_symtable_t *symtable){
-    memset(pool, 0, sizeof(*pool));
-    pool->symtable = symtable;
+static const uint32_t OBJ_SHAPE_INDEX_MULTS[] = {
+    0x9E3779B1, 0x85EBCA77, 0xC2B2AE3D, 0x27D4EB2F,
+    0x165667B1, 0xD3A2646D, 0xFD7046C5, 0xB55A4F09
+};
+#define OBJ_SHAPE_INDEX_N_MULTS \
+    (sizeof(OBJ_SHAPE_INDEX_MULTS) / sizeof(*OBJ_SHAPE_INDEX_MULTS))
 
-    obj_init_null(&pool->null);
-    obj_init_nil(&pool->nil);
-    obj_init_bool(&pool->T, true);
-    obj_init_bool(&pool->F, false);
+size_t obj_shape_hash(obj_sym_t **syms, int n_keys){
+    size_t hash = 5381;
+    for(int i = 0; i < n_keys; i++)hash = hash * 33 + syms[i]->hash;
+    return hash;
 }
 
-void obj_pool_cleanup(obj_pool_t *pool){
+size_t obj_shape_index_slot(int bits, uint32_t mult, size_t hash){
+    if(!bits)return 0;
+    return (uint32_t)((uint32_t)hash * mult) >> (32 - bits);
+}
+
+bool obj_shape_find_index_mult(obj_sym_t **syms, int n_keys,
+    int *bits_ptr, uint32_t *mult_ptr
+){
+    /* Looks for a (bits, mult) pair which maps each of the given syms
+    to a different slot, trying table sizes from the smallest power of
+    2 >= n_keys up to 8 times that.
+    Returns false if none was found. */
+    int min_bits = 0;
+    while(((size_t)1 << min_bits) < n_keys)min_bits++;
+    size_t max_len = (size_t)1 << (min_bits + 3);
+    bool *used = malloc(max_len * sizeof(*used));
+    if(!used)return false;
+    for(int bits = min_bits; bits <= min_bits + 3 && bits <= 32; bits++){
+        size_t len = (size_t)1 << bits;
+        for(int j = 0; j < OBJ_SHAPE_INDEX_N_MULTS; j++){
+            uint32_t mult = OBJ_SHAPE_INDEX_MULTS[j];
+            memset(used, 0, len * sizeof(*used));
+            int i;
+            for(i = 0; i < n_keys; i++){
+                size_t slot = obj_shape_index_slot(
+                    bits, mult, syms[i]->hash);
+                if(used[slot])break;
+                used[slot] = true;
+            }
+            if(i == n_keys){
+                free(used);
+                *bits_ptr = bits;
+                *mult_ptr = mult;
+                return true;
+            }
+        }
+    }
+    free(used);
+    return false;
+}
+
+obj_shape_t *obj_shape_create(obj_sym_t **syms, int n_keys){
+    /* Allocates a shape, its keys, and its index in a single block of
+    memory, which the caller is responsible for freeing */
+    int bits;
+    uint32_t mult;
+    if(!obj_shape_find_index_mult(syms, n_keys, &bits, &mult)){
+        /* No perfect hash (e.g. duplicate keys, or keys whose hashes
+        collide): fall back to a table with room to spare, and
+        linear probing */
+        bits = 1;
+        while(((size_t)1 << bits) < n_keys * 2)bits++;
+        mult = OBJ_SHAPE_INDEX_MULTS[0];
+    }
+    size_t index_len = (size_t)1 << bits;
+
+    obj_shape_t *shape = malloc(sizeof(*shape)
+        + n_keys * sizeof(*shape->keys)
+        + index_len * sizeof(*shape->index));
+    if(!shape){
+        fprintf(stderr, "%s: Couldn't allocate shape with %i keys. ",
+            __func__, n_keys);
+        perror("malloc");
+        return NULL;
+    }
+    shape->next = NULL;
+    shape->hash = obj_shape_hash(syms, n_keys);
+    shape->n_keys = n_keys;
+    shape->keys = (obj_t*)(shape + 1);
+    shape->index = (int*)(shape->keys + n_keys);
+    shape->index_len = index_len;
+    shape->index_bits = bits;
+    shape->index_mult = mult;
+
+    for(size_t i = 0; i < index_len; i++)shape->index[i] = -1;
+    size_t mask = index_len - 1;
+    for(int i = 0; i < n_keys; i++){
+        obj_init_sym(&shape->keys[i], syms[i]);
+        size_t slot = obj_shape_index_slot(bits, mult, syms[i]->hash);
+        while(shape->index[slot] >= 0)slot = (slot + 1) & mask;
+        shape->index[slot] = i;
+    }
+    return shape;
+}
+
+bool obj_shape_eq_raw(obj_shape_t *shape, obj_sym_t **syms, int n_keys){
+    if(shape->n_keys != n_keys)return false;
+    for(int i = 0; i < n_keys; i++){
+        if(OBJ_SYM(&shape->keys[i]) != syms[i])return false;
+    }
+    return true;
+}
+
+int obj_shape_get_index(obj_shape_t *shape, obj_sym_t *sym){
+    /* Returns position of sym in shape's keys, or -1 if not found */
+    size_t mask = shape->index_len - 1;
+    size_t slot = obj_shape_index_slot(
+        shape->index_bits, shape->index_mult, sym->hash);
+    for(size_t n = 0; n < shape->index_len; n++){
+        int i = shape->index[slot];
+        if(i < 0)return -1;
+        if(OBJ_SYM(&shape->keys[i]) == sym)return i;
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+
+/***********
+* obj_pool *
+***********/
+
+void obj_pool_init(obj_pool_t *pool, obj_symtable_t *symtable){
+    memset(pool, 0, sizeof(*pool));
+    pool->symtable = symtable;
+
+    obj_init_null(&pool->null);
+    obj_init_nil(&pool->nil);
+    obj_init_bool(&pool->T, true);
+    obj_init_bool(&pool->F, false);
+}
+
+void obj_pool_cleanup(obj_pool_t *pool){
     for(obj_pool_chunk_t *chunk = pool->chunk_list; chunk;){
         obj_pool_chunk_t *next = chunk->next;
         free(chunk);
@@ -776,16 +1785,52 @@ void obj_pool_cleanup(obj_pool_t *pool){
     }
     for(obj_string_list_t *string_list = pool->string_list; string_list;){
         obj_string_list_t *next = string_list->next;
-        obj_string_cleanup(&string_list->string);
+        if(!string_list->is_slice)obj_string_cleanup(&string_list->string);
         free(string_list);
         string_list = next;
     }
-    for(obj_dict_list_t *dict_list = pool->dict_list; dict_list;){
-        obj_dict_list_t *next = dict_list->next;
-        obj_dict_cleanup(&dict_list->dict);
-        free(dict_list);
-        dict_list = next;
+    for(obj_dict_chunk_t *chunk = pool->dict_chunk_list; chunk;){
+        obj_dict_chunk_t *next = chunk->next;
+        for(size_t i = 0; i < chunk->len; i++){
+            obj_dict_cleanup(&chunk->dicts[i]);
+        }
+        free(chunk);
+        chunk = next;
+    }
+    for(int i = 0; i < OBJ_POOL_SHAPE_BUCKETS; i++){
+        for(obj_shape_t *shape = pool->shapes[i]; shape;){
+            obj_shape_t *next = shape->next;
+            free(shape);
+            shape = next;
+        }
     }
+    free(pool->hashcons_table);
+}
+
+void obj_pool_move(obj_pool_t *pool, obj_pool_t *dst){
+    /* Moves everything allocated from pool into dst (which should be
+    newly initialized), leaving pool empty.
+    The pool's unique objs (null, nil, T, F) stay where they are, so
+    anything still referring to them isn't affected.
+    Used e.g. by a copying collector, which copies what it wants to
+    keep back into pool, then calls obj_pool_cleanup(dst). */
+    dst->chunk_list = pool->chunk_list;
+    dst->n_objs = pool->n_objs;
+    dst->string_list = pool->string_list;
+    dst->dict_chunk_list = pool->dict_chunk_list;
+    memcpy(dst->shapes, pool->shapes, sizeof(pool->shapes));
+    dst->hashcons_table = pool->hashcons_table;
+    dst->hashcons_table_len = pool->hashcons_table_len;
+    dst->hashcons_n_objs = pool->hashcons_n_objs;
+
+    pool->chunk_list = NULL;
+    pool->n_objs = 0;
+    pool->string_list = NULL;
+    pool->dict_chunk_list = NULL;
+    memset(pool->shapes, 0, sizeof(pool->shapes));
+    pool->hashcons_table = NULL;
+    pool->hashcons_table_len = 0;
+    pool->hashcons_n_objs = 0;
 }
 
 void obj_pool_errmsg(obj_pool_t *pool, const char *funcname){
@@ -801,7 +1846,7 @@ void obj_pool_dump(obj_pool_t *pool, FILE *file){
         chunk; chunk = chunk->next
     ){
         fprintf(file, "    CHUNK %p: %zu/%zu\n",
-            chunk, chunk->len, (size_t)OBJ_POOL_CHUNK_LEN);
+            chunk, chunk->len, chunk->size);
     }
 
     fprintf(file, "  STRINGS:\n");
@@ -809,24 +1854,46 @@ void obj_pool_dump(obj_pool_t *pool, FILE *file){
         string_list; string_list = string_list->next
     ){
         obj_string_t *string = &string_list->string;
-        fprintf(file, "    STRING %p (%zu): \"%.*s\"%s\n",
+        fprintf(file, "    STRING %p (%zu): \"%.*s\"%s%s\n",
             string, string->len, size_to_int(string->len, 40),
-            string->data, string->len > 40? "...": "");
+            string->data, string->len > 40? "...": "",
+            string_list->is_slice? " (slice)": "");
     }
 
     fprintf(file, "  DICTS:\n");
-    for(obj_dict_list_t *dict_list = pool->dict_list;
-        dict_list; dict_list = dict_list->next
+    for(obj_dict_chunk_t *chunk = pool->dict_chunk_list;
+        chunk; chunk = chunk->next
     ){
-        obj_dict_t *dict = &dict_list->dict;
-        fprintf(file, "    DICT %p (%zu/%zu)\n",
-            dict, dict->n_entries, dict->entries_len);
+        for(size_t i = 0; i < chunk->len; i++){
+            obj_dict_t *dict = &chunk->dicts[i];
+            fprintf(file, "    DICT %p (%zu/%zu)%s\n",
+                dict, dict->n_entries, dict->entries_len,
+                OBJ_DICT_IS_SMALL(dict)? " (small)": "");
+        }
     }
-}
 
-obj_string_t *obj_pool_string_alloc(obj_pool_t *pool, size_t len){
+    fprintf(file, "  SHAPES:\n");
+    for(int i = 0; i < OBJ_POOL_SHAPE_BUCKETS; i++){
+        for(obj_shape_t *shape = pool->shapes[i];
+            shape; shape = shape->next
+        ){
+            fprintf(file, "    SHAPE %p (%i keys, %zu slots):",
+                shape, shape->n_keys, shape->index_len);
+            for(int j = 0; j < shape->n_keys; j++){
+                putc(' ', file);
+                obj_sym_fprint(OBJ_SYM(&shape->keys[j]), file);
+            }
+            putc('\n', file);
+        }
+    }
 
-    /* add new linked list entry */
+    if(pool->hashcons){
+        fprintf(file, "  HASHCONS: %zu/%zu\n",
+            pool->hashcons_n_objs, pool->hashcons_table_len);
+    }
+}
+
+static obj_string_list_t *obj_pool_string_list_alloc(obj_pool_t *pool){
     obj_string_list_t *string_list = calloc(sizeof(*string_list), 1);
     if(!string_list){
         fprintf(stderr, "%s: Couldn't allocate new string list node. ",
@@ -834,8 +1901,14 @@ obj_string_t *obj_pool_string_alloc(obj_pool_t *pool, size_t len){
         perror("calloc");
         return NULL;
     }
-    string_list->next = pool->string_list;
-    pool->string_list = string_list;
+    return string_list;
+}
+
+obj_string_t *obj_pool_string_alloc(obj_pool_t *pool, size_t len){
+
+    /* add new linked list entry */
+    obj_string_list_t *string_list = obj_pool_string_list_alloc(pool);
+    if(!string_list)return NULL;
 
     /* alloc new string */
     obj_string_t *string = &string_list->string;
@@ -845,9 +1918,29 @@ obj_string_t *obj_pool_string_alloc(obj_pool_t *pool, size_t len){
         return NULL;
     }
 
+    string_list->next = pool->string_list;
+    pool->string_list = string_list;
     return string;
 }
 
+obj_string_t *obj_pool_string_add_slice(obj_pool_t *pool,
+    const char *data, size_t len
+){
+    /* Returns a string whose data is data itself, not a copy of it,
+    e.g. part of another string's data.
+    The slice doesn't own its data, so whatever does must outlive it,
+    and mustn't change it: in practice, data should come from a str
+    in pool (strbufs' data moves as they grow), or an image. */
+    obj_string_list_t *string_list = obj_pool_string_list_alloc(pool);
+    if(!string_list)return NULL;
+    string_list->is_slice = true;
+    string_list->string.len = len;
+    string_list->string.data = (char*)data;
+    string_list->next = pool->string_list;
+    pool->string_list = string_list;
+    return &string_list->string;
+}
+
 obj_string_t *obj_pool_string_add_raw(obj_pool_t *pool, const char *data, size_t len){
     /* "raw" meaning length is specified, instead of NUL-terminated */
     obj_string_t *string = obj_pool_string_alloc(pool, len);
@@ -862,40 +1955,112 @@ obj_string_t *obj_pool_string_add(obj_pool_t *pool, const char *data){
 
 obj_dict_t *obj_pool_dict_alloc(obj_pool_t *pool){
 
-    /* add new linked list entry */
-    obj_dict_list_t *dict_list = calloc(sizeof(*dict_list), 1);
-    if(!dict_list){
-        fprintf(stderr, "%s: Couldn't allocate new dict list node. ",
-            __func__);
-        perror("calloc");
-        return NULL;
+    /* dicts are allocated in chunks, so that creating lots of (small)
+    dicts doesn't mean lots of mallocs */
+    obj_dict_chunk_t *chunk = pool->dict_chunk_list;
+    if(!chunk || chunk->len >= OBJ_POOL_DICT_CHUNK_LEN){
+        obj_dict_chunk_t *new_chunk = malloc(sizeof(*new_chunk));
+        if(!new_chunk){
+            fprintf(stderr, "%s: Couldn't allocate new dict chunk. ",
+                __func__);
+            perror("malloc");
+            return NULL;
+        }
+        new_chunk->next = chunk;
+        new_chunk->len = 0;
+        chunk = new_chunk;
+        pool->dict_chunk_list = chunk;
     }
-    dict_list->next = pool->dict_list;
-    pool->dict_list = dict_list;
 
     /* initialize dict */
-    obj_dict_t *dict = &dict_list->dict;
+    obj_dict_t *dict = &chunk->dicts[chunk->len++];
     obj_dict_init(dict);
 
     return dict;
 }
 
-obj_t *obj_pool_objs_alloc(obj_pool_t *pool, size_t n_objs){
-    obj_pool_chunk_t *chunk = pool->chunk_list;
-    if(!chunk || chunk->len + n_objs >= OBJ_POOL_CHUNK_LEN){
-        obj_pool_chunk_t *new_chunk = calloc(sizeof(*new_chunk), 1);
-        if(new_chunk == NULL){
+obj_shape_t *obj_pool_get_shape_raw(obj_pool_t *pool,
+    obj_sym_t **syms, int n_keys
+){
+    /* Gets (first creating, if necessary) the pool's shape with the
+    given keys */
+    size_t hash = obj_shape_hash(syms, n_keys);
+    obj_shape_t **bucket = &pool->shapes[hash % OBJ_POOL_SHAPE_BUCKETS];
+    for(obj_shape_t *shape = *bucket; shape; shape = shape->next){
+        if(shape->hash == hash && obj_shape_eq_raw(shape, syms, n_keys)){
+            return shape;
+        }
+    }
+
+    obj_shape_t *shape = obj_shape_create(syms, n_keys);
+    if(!shape)return NULL;
+    shape->next = *bucket;
+    *bucket = shape;
+    return shape;
+}
+
+obj_shape_t *obj_pool_get_shape(obj_pool_t *pool, obj_t *keys){
+    /* Like obj_pool_get_shape_raw, but keys is a list of syms */
+    obj_sym_t *small_syms[16];
+    int n_keys = OBJ_LIST_LEN(keys);
+    obj_sym_t **syms = small_syms;
+    if(n_keys > 16){
+        syms = malloc(n_keys * sizeof(*syms));
+        if(!syms){
             obj_pool_errmsg(pool, __func__);
-            perror("calloc");
+            perror("malloc");
             return NULL;
         }
-        new_chunk->next = chunk;
-        chunk = new_chunk;
-        pool->chunk_list = chunk;
     }
 
+    obj_shape_t *shape = NULL;
+    for(int i = 0; i < n_keys; i++){
+        obj_t *key = OBJ_HEAD(keys);
+        if(OBJ_TYPE(key) != OBJ_TYPE_SYM){
+            obj_pool_errmsg(pool, __func__);
+            fprintf(stderr, "Struct key %i wasn't a sym: %s\n",
+                i, obj_type_msg(OBJ_TYPE(key)));
+            goto done;
+        }
+        syms[i] = OBJ_SYM(key);
+        keys = OBJ_TAIL(keys);
+    }
+    shape = obj_pool_get_shape_raw(pool, syms, n_keys);
+
+done:
+    if(syms != small_syms)free(syms);
+    return shape;
+}
+
+obj_pool_chunk_t *obj_pool_reserve(obj_pool_t *pool, size_t n_objs){
+    /* Makes sure the next n_objs objs can be allocated from the
+    current chunk, e.g. so that a loader which knows in advance how
+    many objs it will need can get them all from one allocation */
+    obj_pool_chunk_t *chunk = pool->chunk_list;
+    if(chunk && chunk->len + n_objs <= chunk->size)return chunk;
+
+    size_t size = n_objs > OBJ_POOL_CHUNK_LEN? n_objs: OBJ_POOL_CHUNK_LEN;
+    obj_pool_chunk_t *new_chunk = calloc(
+        sizeof(*new_chunk) + size * sizeof(*new_chunk->objs), 1);
+    if(new_chunk == NULL){
+        obj_pool_errmsg(pool, __func__);
+        fprintf(stderr, "Trying to allocate chunk of %zu objs. ", size);
+        perror("calloc");
+        return NULL;
+    }
+    new_chunk->next = chunk;
+    new_chunk->size = size;
+    pool->chunk_list = new_chunk;
+    return new_chunk;
+}
+
+obj_t *obj_pool_objs_alloc(obj_pool_t *pool, size_t n_objs){
+    obj_pool_chunk_t *chunk = obj_pool_reserve(pool, n_objs);
+    if(!chunk)return NULL;
+
     obj_t *obj = &chunk->objs[chunk->len];
     chunk->len += n_objs;
+    pool->n_objs += n_objs;
     memset(obj, 0, sizeof(*obj));
     return obj;
 }
@@ -924,6 +2089,59 @@ void obj_init_str(obj_t *obj, obj_string_t *string){
     OBJ_STRING(obj) = string;
 }
 
+bool obj_init_str_inline(obj_t *obj, const char *data, size_t len){
+    /* Makes obj an inline str (see OBJ_STR_IS_INLINE), if len is small
+    enough. data may point into obj. */
+    if(len > OBJ_STR_INLINE_MAX)return false;
+    char c[OBJ_STR_INLINE_MAX] = {0};
+    memcpy(c, data, len);
+    obj->tag = OBJ_TYPE_STR | OBJ_STR_INLINE_MASK |
+        (int)len << OBJ_STR_INLINE_LEN_SHIFT;
+    memcpy(obj->u.c, c, OBJ_STR_INLINE_MAX);
+    return true;
+}
+
+obj_t *obj_init_str_raw(obj_pool_t *pool, obj_t *obj,
+    const char *data, size_t len
+){
+    /* Makes obj a str holding a copy of data: inline if it fits,
+    otherwise in a new string from pool */
+    if(obj_init_str_inline(obj, data, len))return obj;
+    obj_string_t *string = obj_pool_string_add_raw(pool, data, len);
+    if(!string)return NULL;
+    obj_init_str(obj, string);
+    return obj;
+}
+
+obj_t *obj_init_str_slice(obj_pool_t *pool, obj_t *obj, obj_t *str,
+    size_t start, size_t len
+){
+    /* Makes obj a str holding bytes start..start+len of str, which
+    should be in range.
+    Unless they fit inline, they aren't copied: the new string is a
+    slice of str's (see obj_pool_string_add_slice), so str mustn't be
+    changed in place afterwards.
+    obj may be str itself. */
+    obj_string_t view;
+    obj_string_t *s = obj_str_get(str, &view);
+    if(obj_init_str_inline(obj, s->data + start, len))return obj;
+    obj_string_t *slice = obj_pool_string_add_slice(pool,
+        s->data + start, len);
+    if(!slice)return NULL;
+    obj_init_str(obj, slice);
+    return obj;
+}
+
+obj_string_t *obj_str_get(obj_t *obj, obj_string_t *view){
+    /* Returns the string of obj, a str or strbuf.
+    For an inline str, that's view, filled in to point at obj's own
+    bytes, so it's only good for as long as obj stays put. */
+    if(!OBJ_STR_IS_INLINE(obj))return OBJ_STRING(obj);
+    view->len = OBJ_STR_INLINE_LEN(obj);
+    view->data = obj->u.c;
+    return view;
+}
+
 void obj_init_nil(obj_t *obj){
     obj->tag = OBJ_TYPE_NIL;
 }
@@ -938,6 +2156,100 @@ void obj_init_box(obj_t *obj, obj_t *contents){
     OBJ_CONTENTS(obj) = contents;
 }
 
+size_t obj_pool_hashcons_hash(obj_t *obj){
+    /* Hashes obj's contents, as compared by obj_pool_hashcons_eq.
+    A cell's head and tail are hashed by address, which is enough
+    since they were themselves hash-consed. */
+    int type = OBJ_TYPE(obj);
+    size_t hash = obj_hash_mix(0, type);
+    switch(type){
+        case OBJ_TYPE_INT:
+            return obj_hash_mix(hash, (unsigned)OBJ_INT(obj));
+        case OBJ_TYPE_SYM:
+            return obj_hash_mix(hash, OBJ_SYM(obj)->hash);
+        case OBJ_TYPE_STR: {
+            obj_string_t view;
+            obj_string_t *s = obj_str_get(obj, &view);
+            return obj_hash_mix(hash, (unsigned)obj_hash(s->data, s->len));
+        }
+        case OBJ_TYPE_CELL:
+            hash = obj_hash_mix(hash, (uintptr_t)OBJ_HEAD(obj) >> 4);
+            return obj_hash_mix(hash, (uintptr_t)OBJ_TAIL(obj) >> 4);
+        default: return hash;
+    }
+}
+
+bool obj_pool_hashcons_eq(obj_t *x, obj_t *y){
+    int type = OBJ_TYPE(x);
+    if(type != OBJ_TYPE(y))return false;
+    switch(type){
+        case OBJ_TYPE_INT: return OBJ_INT(x) == OBJ_INT(y);
+        case OBJ_TYPE_SYM: return OBJ_SYM(x) == OBJ_SYM(y);
+        case OBJ_TYPE_STR: {
+            obj_string_t view_x, view_y;
+            obj_string_t *sx = obj_str_get(x, &view_x);
+            obj_string_t *sy = obj_str_get(y, &view_y);
+            return sx->len == sy->len &&
+                !memcmp(sx->data, sy->data, sx->len);
+        }
+        case OBJ_TYPE_CELL:
+            return OBJ_HEAD(x) == OBJ_HEAD(y) && OBJ_TAIL(x) == OBJ_TAIL(y);
+        default: return false;
+    }
+}
+
+obj_t **obj_pool_hashcons_slot(obj_pool_t *pool, obj_t *obj){
+    /* Returns the slot of pool's hash-consed obj with the same contents
+    as obj, or of the empty slot where it would go.
+    Table must not be empty. */
+    size_t mask = pool->hashcons_table_len - 1;
+    size_t i = obj_pool_hashcons_hash(obj) * (size_t)0x9e3779b9 & mask;
+    for(;;){
+        obj_t **slot = &pool->hashcons_table[i];
+        if(!*slot || obj_pool_hashcons_eq(*slot, obj))return slot;
+        i = (i + 1) & mask;
+    }
+}
+
+obj_t *obj_pool_hashcons_add(obj_pool_t *pool, obj_t *key, int n_objs){
+    /* Returns pool's hash-consed obj with the same contents as key, first
+    creating it (as a copy of key's n_objs objs) if necessary */
+    if(pool->hashcons_table_len){
+        obj_t **slot = obj_pool_hashcons_slot(pool, key);
+        if(*slot)return *slot;
+    }
+
+    /* We grow once we're half full */
+    if((pool->hashcons_n_objs + 1) * 2 > pool->hashcons_table_len){
+        obj_t **old_table = pool->hashcons_table;
+        size_t old_table_len = pool->hashcons_table_len;
+        size_t table_len = old_table_len? old_table_len * 2:
+            OBJ_POOL_HASHCONS_DEFAULT_LEN;
+        obj_t **table = calloc(table_len, sizeof(*table));
+        if(!table){
+            obj_pool_errmsg(pool, __func__);
+            fprintf(stderr, "Couldn't grow table to %zu slots. ",
+                table_len);
+            perror("calloc");
+            return NULL;
+        }
+        pool->hashcons_table = table;
+        pool->hashcons_table_len = table_len;
+        for(size_t i = 0; i < old_table_len; i++){
+            obj_t *old_obj = old_table[i];
+            if(old_obj)*obj_pool_hashcons_slot(pool, old_obj) = old_obj;
+        }
+        free(old_table);
+    }
+
+    obj_t *obj = obj_pool_objs_alloc(pool, n_objs);
+    if(!obj)return NULL;
+    memcpy(obj, key, n_objs * sizeof(*obj));
+    *obj_pool_hashcons_slot(pool, obj) = obj;
+    pool->hashcons_n_objs++;
+    return obj;
+}
+
 obj_t *obj_pool_add_null(obj_pool_t *pool){
     return &pool->null;
 }
@@ -947,6 +2259,11 @@ obj_t *obj_pool_add_bool(obj_pool_t *pool, bool b){
 }
 
 obj_t *obj_pool_add_int(obj_pool_t *pool, int i){
+    if(pool->hashcons){
+        obj_t key;
+        obj_init_int(&key, i);
+        return obj_pool_hashcons_add(pool, &key, 1);
+    }
     obj_t *obj = obj_pool_objs_alloc(pool, 1);
     if(!obj)return NULL;
     obj->tag = OBJ_TYPE_INT;
@@ -955,6 +2272,11 @@ obj_t *obj_pool_add_int(obj_pool_t *pool, int i){
 }
 
 obj_t *obj_pool_add_sym(obj_pool_t *pool, obj_sym_t *sym){
+    if(pool->hashcons){
+        obj_t key;
+        obj_init_sym(&key, sym);
+        return obj_pool_hashcons_add(pool, &key, 1);
+    }
     obj_t *obj = obj_pool_objs_alloc(pool, 1);
     if(!obj)return NULL;
     obj->tag = OBJ_TYPE_SYM;
@@ -963,6 +2285,11 @@ obj_t *obj_pool_add_sym(obj_pool_t *pool, obj_sym_t *sym){
 }
 
 obj_t *obj_pool_add_str(obj_pool_t *pool, obj_string_t *string){
+    if(pool->hashcons){
+        obj_t key;
+        obj_init_str(&key, string);
+        return obj_pool_hashcons_add(pool, &key, 1);
+    }
     obj_t *obj = obj_pool_objs_alloc(pool, 1);
     if(!obj)return NULL;
     obj->tag = OBJ_TYPE_STR;
@@ -974,7 +2301,43 @@ obj_t *obj_pool_add_nil(obj_pool_t *pool){
     return &pool->nil;
 }
 
+obj_t *obj_pool_add_str_raw(obj_pool_t *pool,
+    const char *data, size_t len
+){
+    /* Like obj_pool_add_str, but copies data into a new string (or
+    into the obj itself, if it's short), unless pool is hash-consing
+    and already has an equal one */
+    obj_t inline_obj;
+    if(obj_init_str_inline(&inline_obj, data, len)){
+        if(pool->hashcons)return obj_pool_hashcons_add(pool, &inline_obj, 1);
+        obj_t *obj = obj_pool_objs_alloc(pool, 1);
+        if(!obj)return NULL;
+        *obj = inline_obj;
+        return obj;
+    }
+    if(pool->hashcons && pool->hashcons_n_objs){
+        obj_string_t string = {.len = len, .data = (char*)data};
+        obj_t key;
+        obj_init_str(&key, &string);
+        obj_t *obj = *obj_pool_hashcons_slot(pool, &key);
+        if(obj)return obj;
+    }
+    obj_string_t *string = obj_pool_string_add_raw(pool, data, len);
+    if(!string)return NULL;
+    return obj_pool_add_str(pool, string);
+}
+
 obj_t *obj_pool_add_cell(obj_pool_t *pool, obj_t *head, obj_t *tail){
+    /* If head or tail is NULL, the cell is a placeholder to be filled
+    in later, so it's never hash-consed */
+    if(pool->hashcons && head && tail){
+        obj_t key[2];
+        key[0].tag = OBJ_TYPE_CELL;
+        key[1].tag = OBJ_TYPE_UNDEFINED;
+        OBJ_HEAD(key) = head;
+        OBJ_TAIL(key) = tail;
+        return obj_pool_hashcons_add(pool, key, 2);
+    }
     obj_t *obj = obj_pool_objs_alloc(pool, 2);
     if(!obj)return NULL;
     obj[0].tag = OBJ_TYPE_CELL;
@@ -994,12 +2357,121 @@ obj_t *obj_pool_add_queue(obj_pool_t *pool, obj_t *list){
     return obj;
 }
 
+static obj_t *obj_pool_alloc_list(obj_pool_t *pool, size_t n){
+    /* Allocates a list of n cells (n > 0) in one go, so it has a run
+    (see OBJ_CELL_RUN), with NULL heads.
+    Returns its first cell. */
+    obj_t *obj = obj_pool_objs_alloc(pool, n * 2);
+    if(!obj)return NULL;
+    obj_t *nil = obj_pool_add_nil(pool);
+    for(size_t i = 0; i < n; i++){
+        obj_t *cell = obj + i * 2;
+        cell[0].tag = OBJ_TYPE_CELL;
+        OBJ_CELL_RUN(cell) = n - i > INT_MAX? INT_MAX: n - i;
+        OBJ_HEAD(cell) = NULL;
+        OBJ_TAIL(cell) = i < n - 1? cell + 2: nil;
+    }
+    return obj;
+}
+
+obj_t *obj_pool_add_list(obj_pool_t *pool, obj_t **elems, size_t n){
+    /* Returns a list of the n objs in elems (nil if n == 0), with all
+    its cells allocated together */
+    if(!n)return obj_pool_add_nil(pool);
+    if(pool->hashcons){
+        obj_t *lst = obj_pool_add_nil(pool);
+        while(lst && n)lst = obj_pool_add_cell(pool, elems[--n], lst);
+        return lst;
+    }
+    obj_t *lst = obj_pool_alloc_list(pool, n);
+    if(!lst)return NULL;
+    for(size_t i = 0; i < n; i++)OBJ_HEAD(lst + i * 2) = elems[i];
+    return lst;
+}
+
+obj_t *obj_pool_add_list_cat(obj_pool_t *pool, obj_t *list, obj_t *tail){
+    /* Returns a copy of list's cells, ending in tail instead of nil,
+    so tail itself is shared rather than copied */
+    int n = obj_list_len(list);
+    if(!n)return tail;
+    if(pool->hashcons){
+        obj_t **elems = malloc(n * sizeof(*elems));
+        if(!elems){
+            perror("malloc");
+            return NULL;
+        }
+        for(int i = 0; i < n; i++){
+            elems[i] = OBJ_HEAD(list);
+            list = OBJ_TAIL(list);
+        }
+        obj_t *lst = tail;
+        while(lst && n)lst = obj_pool_add_cell(pool, elems[--n], lst);
+        free(elems);
+        return lst;
+    }
+    obj_t *lst = obj_pool_alloc_list(pool, n);
+    if(!lst)return NULL;
+    for(int i = 0; i < n; i++){
+        OBJ_HEAD(lst + i * 2) = OBJ_HEAD(list);
+        list = OBJ_TAIL(list);
+    }
+    OBJ_TAIL(lst + (n - 1) * 2) = tail;
+    return lst;
+}
+
+obj_t *obj_pool_add_str_split(obj_pool_t *pool, obj_t *str, char sep){
+    /* Returns a list of the parts of str between occurrences of sep
+    (so n occurrences give n + 1 parts, some maybe empty).
+    The parts are slices of str (see obj_init_str_slice). */
+    obj_string_t view;
+    obj_string_t *s = obj_str_get(str, &view);
+    const char *end = s->data + s->len;
+    size_t n = 1;
+    for(const char *p = s->data;
+        (p = memchr(p, sep, end - p)); p++)n++;
+
+    obj_t *parts = obj_pool_objs_alloc(pool, n);
+    obj_t **elems = malloc(n * sizeof(*elems));
+    if(!parts || !elems){
+        perror("malloc");
+        free(elems);
+        return NULL;
+    }
+    const char *start = s->data;
+    for(size_t i = 0; i < n; i++){
+        const char *p = i < n - 1? memchr(start, sep, end - start): end;
+        if(!obj_init_str_slice(pool, &parts[i], str,
+            start - s->data, p - start)
+        ){
+            free(elems);
+            return NULL;
+        }
+        elems[i] = &parts[i];
+        start = p + 1;
+    }
+    obj_t *lst = obj_pool_add_list(pool, elems, n);
+    free(elems);
+    return lst;
+}
+
 obj_t *obj_pool_add_rev_list(obj_pool_t *pool, obj_t *list){
-    obj_t *rev = obj_pool_add_nil(pool);
-    if(!rev)return NULL;
-    while(OBJ_TYPE(list) == OBJ_TYPE_CELL){
-        rev = obj_pool_add_cell(pool, OBJ_HEAD(list), rev);
+    if(pool->hashcons){
+        obj_t *rev = obj_pool_add_nil(pool);
         if(!rev)return NULL;
+        while(OBJ_TYPE(list) == OBJ_TYPE_CELL){
+            rev = obj_pool_add_cell(pool, OBJ_HEAD(list), rev);
+            if(!rev)return NULL;
+            list = OBJ_TAIL(list);
+        }
+        return rev;
+    }
+
+    int n = obj_list_len(list);
+    if(!n)return obj_pool_add_nil(pool);
+    obj_t *rev = obj_pool_alloc_list(pool, n);
+    if(!rev)return NULL;
+    for(int i = n - 1; i >= 0; i--){
+        OBJ_HEAD(rev + i * 2) = OBJ_HEAD(list);
         list = OBJ_TAIL(list);
     }
     return rev;
@@ -1056,13 +2528,16 @@ obj_t *obj_pool_add_dict(obj_pool_t *pool){
     return obj_pool_add_dict_raw(pool, dict);
 }
 
-obj_t *obj_pool_add_struct(obj_pool_t *pool, int n_keys){
-    obj_t *obj = obj_pool_objs_alloc(pool, 1 + n_keys * 2);
+obj_t *obj_pool_add_struct(obj_pool_t *pool, obj_shape_t *shape){
+    /* Structs don't store their own keys, they point to a shape
+    (see obj_pool_get_shape), which is shared by all structs with the
+    same keys */
+    int n_keys = shape->n_keys;
+    obj_t *obj = obj_pool_objs_alloc(pool, 1 + n_keys);
     if(!obj)return NULL;
     obj->tag = OBJ_TYPE_STRUCT;
-    OBJ_STRUCT_LEN(obj) = n_keys;
+    OBJ_STRUCT_SHAPE(obj) = shape;
     for(int i = 0; i < n_keys; i++){
-        obj_init_sym(OBJ_STRUCT_IGET_KEY(obj, i), NULL);
         obj_init_null(OBJ_STRUCT_IGET_VAL(obj, i));
     }
     return obj;
@@ -1092,724 +2567,6239 @@ obj_t *obj_pool_add_box(obj_pool_t *pool, obj_t *contents){
 }
 
 
-/*************
-* obj_parser *
-*************/
-
-void obj_parser_init(
-    obj_parser_t *parser, obj_pool_t *pool,
-    const char *filename, const char *data, size_t data_len
-){
-    memset(parser, 0, sizeof(*parser));
-    /* parser->use_extended_types = true; */
-    parser->pool = pool;
-    parser->filename = filename;
-    parser->data = data;
-    parser->data_len = data_len;
+/**********
+* obj_vec *
+**********/
+
+/* Vecs are persistent vectors: "changing" one (obj_pool_vec_iset,
+obj_pool_vec_push) returns a new vec, and leaves the old one as it was,
+with the two sharing all but the O(log n) nodes on the path to the
+changed element.
+A vec is 2 objs, holding its length, and its tree of nodes, which are
+arrays: leaves hold the elements (OBJ_VEC_WIDTH to a leaf), and the
+other nodes hold boxes of their children (OBJ_VEC_WIDTH to a node).
+Elements are filled in from the left, so every node is full except
+those on the rightmost path, and the tree's shape depends only on the
+vec's length.
+OBJ_VEC_SHIFT is the number of bits of an index which are used below
+the root (0 if the root is a leaf); OBJ_VEC_ROOT is NULL if the vec is
+empty. */
+
+static int obj_vec_shift_for_len(int len){
+    /* Returns the shift of the root of a tree big enough for len */
+    int shift = 0;
+    while(shift + OBJ_VEC_BITS < 31 &&
+        (size_t)len > (size_t)OBJ_VEC_WIDTH << shift)shift += OBJ_VEC_BITS;
+    return shift;
 }
 
-void obj_parser_stack_cleanup(obj_parser_stack_t *stack){
-    while(stack){
-        obj_parser_stack_t *next = stack->next;
-        free(stack);
-        stack = next;
+static obj_t *obj_pool_add_vec_node(obj_pool_t *pool, int shift, int len){
+    /* Returns a node with given shift, under which are len (> 0) null
+    elements */
+    if(!shift)return obj_pool_add_array(pool, len);
+    int child_len = 1 << shift;
+    int n_children = (len - 1) / child_len + 1;
+    obj_t *node = obj_pool_add_array(pool, n_children);
+    if(!node)return NULL;
+    for(int i = 0; i < n_children; i++){
+        obj_t *child = obj_pool_add_vec_node(pool, shift - OBJ_VEC_BITS,
+            i < n_children - 1? child_len: len - i * child_len);
+        if(!child)return NULL;
+        obj_init_box(OBJ_ARRAY_IGET(node, i), child);
     }
+    return node;
 }
 
-void obj_parser_cleanup(obj_parser_t *parser){
-    free(parser->token_buffer);
-    obj_parser_stack_cleanup(parser->stack);
-    obj_parser_stack_cleanup(parser->free_stack);
+static obj_t *obj_pool_add_vec_raw(obj_pool_t *pool,
+    int len, int shift, obj_t *root
+){
+    obj_t *obj = obj_pool_objs_alloc(pool, 2);
+    if(!obj)return NULL;
+    obj[0].tag = OBJ_TYPE_VEC;
+    OBJ_VEC_LEN(obj) = len;
+    OBJ_VEC_SHIFT(obj) = shift;
+    OBJ_VEC_ROOT(obj) = root;
+    return obj;
 }
 
-void obj_parser_dump(obj_parser_t *parser, FILE *file){
-    fprintf(file, "OBJ PARSER %p:\n", parser);
-    fprintf(file, "  TOKEN BUFFER: %p (%zu)\n",
-        parser->token_buffer, parser->token_buffer_len);
-    fprintf(file, "  STACK:\n");
-    for(obj_parser_stack_t *stack = parser->stack;
-        stack; stack = stack->next
-    ){
-        fprintf(file, "    ENTRY %p: row=%zu col=%zu type=%i\n", stack,
-            stack->token_row, stack->line_col, stack->token_type);
+obj_t *obj_pool_add_vec(obj_pool_t *pool, int len){
+    /* Returns a new vec of len nulls, whose elements the caller may
+    then fill in with OBJ_VEC_IGET (as long as nothing else refers to
+    the vec yet) */
+    int shift = obj_vec_shift_for_len(len);
+    obj_t *root = NULL;
+    if(len > 0){
+        root = obj_pool_add_vec_node(pool, shift, len);
+        if(!root)return NULL;
     }
-    fprintf(file, "  FREE-STACK:\n");
-    for(obj_parser_stack_t *free_stack = parser->free_stack;
-        free_stack; free_stack = free_stack->next
-    ){
-        fprintf(file, "    ENTRY %p\n", free_stack);
+    return obj_pool_add_vec_raw(pool, len, shift, root);
+}
+
+obj_t *obj_vec_iget(obj_t *obj, int i){
+    /* Returns the i-th element of vec, or NULL if i is out of range */
+    if(i < 0 || i >= OBJ_VEC_LEN(obj))return NULL;
+    obj_t *node = OBJ_VEC_ROOT(obj);
+    for(int shift = OBJ_VEC_SHIFT(obj); shift > 0; shift -= OBJ_VEC_BITS){
+        node = OBJ_CONTENTS(OBJ_ARRAY_IGET(node,
+            (i >> shift) & OBJ_VEC_MASK));
     }
+    return OBJ_ARRAY_IGET(node, i & OBJ_VEC_MASK);
 }
 
-void obj_parser_errmsg(obj_parser_t *parser, const char *funcname){
-    fprintf(stderr, "%s [pos=%zu/%zu row=%zu col=%zu]: ",
-        funcname, parser->token_pos, parser->data_len,
-        parser->token_row+1, parser->token_col+1);
-    fprintf(stderr, "Token was: \"%.*s\"\n",
-        size_to_int(parser->token_len, 256), parser->token);
+static obj_t *obj_pool_copy_vec_node(obj_pool_t *pool, obj_t *node,
+    int extra
+){
+    /* Returns a copy of node with room for extra more elements */
+    int len = OBJ_ARRAY_LEN(node);
+    obj_t *copy = obj_pool_add_array(pool, len + extra);
+    if(!copy)return NULL;
+    memcpy(OBJ_ARRAY_IGET(copy, 0), OBJ_ARRAY_IGET(node, 0),
+        len * sizeof(*copy));
+    return copy;
 }
 
-char *obj_parser_get_token_buffer(obj_parser_t *parser, size_t want_len){
-    if(parser->token_buffer_len >= want_len)return parser->token_buffer;
-    size_t len = parser->token_buffer_len;
-    if(!len)len = OBJ_PARSER_TOKEN_BUFFER_DEFAULT_SIZE;
-    while(len < want_len){
-        size_t old_len = len;
-        len = len / 2 * 3;
-        if(len < old_len){
-            /* C is... silly */
-            fprintf(stderr,
-                "%s: Token buffer overflow while requesting %zu bytes\n",
-                __func__, want_len);
-            return NULL;
+obj_t *obj_pool_vec_iset(obj_pool_t *pool, obj_t *obj, int i, obj_t *val){
+    /* Returns a new vec, like obj but with its i-th element set to
+    *val. Returns NULL if i is out of range. */
+    if(i < 0 || i >= OBJ_VEC_LEN(obj)){
+        fprintf(stderr, "%s: Index %i out of range for len: %i\n",
+            __func__, i, OBJ_VEC_LEN(obj));
+        return NULL;
+    }
+
+    /* Copy the path from the root to the element */
+    obj_t *root = NULL;
+    obj_t **node_ptr = &root;
+    obj_t *node = OBJ_VEC_ROOT(obj);
+    int shift = OBJ_VEC_SHIFT(obj);
+    for(;;){
+        obj_t *copy = obj_pool_copy_vec_node(pool, node, 0);
+        if(!copy)return NULL;
+        *node_ptr = copy;
+        obj_t *slot = OBJ_ARRAY_IGET(copy, (i >> shift) & OBJ_VEC_MASK);
+        if(!shift){
+            *slot = *val;
+            break;
         }
+        node = OBJ_CONTENTS(slot);
+        node_ptr = &OBJ_CONTENTS(slot);
+        shift -= OBJ_VEC_BITS;
     }
-    char *buffer = malloc(len);
-    if(!buffer)return NULL;
-    parser->token_buffer_len = len;
-    parser->token_buffer = buffer;
-    return buffer;
+    return obj_pool_add_vec_raw(pool, OBJ_VEC_LEN(obj),
+        OBJ_VEC_SHIFT(obj), root);
 }
 
-bool obj_parser_token_is_sym(obj_parser_t *parser){
-    int type = parser->token_type;
-    return
-        type == OBJ_TOKEN_TYPE_NAME ||
-        type == OBJ_TOKEN_TYPE_OPER ||
-        type == OBJ_TOKEN_TYPE_LONGSYM;
+static obj_t *obj_pool_add_vec_path(obj_pool_t *pool, int shift,
+    obj_t *val
+){
+    /* Returns a node with given shift, with a single element: *val */
+    obj_t *node = obj_pool_add_array(pool, 1);
+    if(!node)return NULL;
+    *OBJ_ARRAY_IGET(node, 0) = *val;
+    for(; shift > 0; shift -= OBJ_VEC_BITS){
+        obj_t *parent = obj_pool_add_array(pool, 1);
+        if(!parent)return NULL;
+        obj_init_box(OBJ_ARRAY_IGET(parent, 0), node);
+        node = parent;
+    }
+    return node;
 }
 
-bool obj_parser_token_is_string(obj_parser_t *parser){
-    int type = parser->token_type;
-    return
-        type == OBJ_TOKEN_TYPE_STRING ||
-        type == OBJ_TOKEN_TYPE_LINESTRING;
+obj_t *obj_pool_vec_push(obj_pool_t *pool, obj_t *obj, obj_t *val){
+    /* Returns a new vec, like obj but with *val added to the end */
+    int len = OBJ_VEC_LEN(obj);
+    int shift = OBJ_VEC_SHIFT(obj);
+    obj_t *root = OBJ_VEC_ROOT(obj);
+    if(len == INT_MAX){
+        fprintf(stderr, "%s: Vec is full\n", __func__);
+        return NULL;
+    }
+
+    if(!root){
+        root = obj_pool_add_vec_path(pool, 0, val);
+    }else if((size_t)len >= (size_t)OBJ_VEC_WIDTH << shift){
+        /* Tree is full, so it becomes the first child of a new root */
+        obj_t *path = obj_pool_add_vec_path(pool, shift, val);
+        obj_t *new_root = path? obj_pool_add_array(pool, 2): NULL;
+        if(!new_root)return NULL;
+        obj_init_box(OBJ_ARRAY_IGET(new_root, 0), root);
+        obj_init_box(OBJ_ARRAY_IGET(new_root, 1), path);
+        root = new_root;
+        shift += OBJ_VEC_BITS;
+    }else{
+        /* Copy the rightmost path, down to the first node with room for
+        another child */
+        obj_t *node = root;
+        obj_t **node_ptr = &root;
+        for(;;){
+            int i = (len >> shift) & OBJ_VEC_MASK;
+            if(i < OBJ_ARRAY_LEN(node)){
+                /* The new element goes under node's last child */
+                obj_t *copy = obj_pool_copy_vec_node(pool, node, 0);
+                if(!copy)return NULL;
+                *node_ptr = copy;
+                obj_t *slot = OBJ_ARRAY_IGET(copy, i);
+                node = OBJ_CONTENTS(slot);
+                node_ptr = &OBJ_CONTENTS(slot);
+                shift -= OBJ_VEC_BITS;
+                continue;
+            }
+            obj_t *copy = obj_pool_copy_vec_node(pool, node, 1);
+            if(!copy)return NULL;
+            *node_ptr = copy;
+            obj_t *slot = OBJ_ARRAY_IGET(copy, i);
+            if(!shift){
+                *slot = *val;
+            }else{
+                obj_t *path = obj_pool_add_vec_path(pool,
+                    shift - OBJ_VEC_BITS, val);
+                if(!path)return NULL;
+                obj_init_box(slot, path);
+            }
+            break;
+        }
+        shift = OBJ_VEC_SHIFT(obj);
+    }
+    if(!root)return NULL;
+    return obj_pool_add_vec_raw(pool, len + 1, shift, root);
 }
 
-bool obj_parser_token_eq(obj_parser_t *parser, const char *text){
-    size_t text_len = strlen(text);
-    return parser->token_len == text_len &&
-        !strncmp(parser->token, text, text_len);
+obj_t *obj_pool_add_vec_from_list(obj_pool_t *pool, obj_t *list){
+    int len = OBJ_LIST_LEN(list);
+    obj_t *obj = obj_pool_add_vec(pool, len);
+    if(!obj)return NULL;
+    for(int i = 0; i < len; i++){
+        *OBJ_VEC_IGET(obj, i) = *OBJ_HEAD(list);
+        list = OBJ_TAIL(list);
+    }
+    return obj;
 }
 
-obj_parser_stack_t *obj_parser_stack_push(obj_parser_t *parser, obj_t **tail){
-    obj_parser_stack_t *stack;
-    if(parser->free_stack){
-        stack = parser->free_stack;
-        parser->free_stack = parser->free_stack->next;
-    }else{
-        stack = calloc(sizeof(*stack), 1);
-        if(!stack){
-            obj_parser_errmsg(parser, __func__);
-            perror("calloc");
-            return NULL;
-        }
+obj_t *obj_pool_add_vec_from_array(obj_pool_t *pool, obj_t *array){
+    int len = OBJ_ARRAY_LEN(array);
+    obj_t *obj = obj_pool_add_vec(pool, len);
+    if(!obj)return NULL;
+    for(int i = 0; i < len; i++){
+        *OBJ_VEC_IGET(obj, i) = *OBJ_ARRAY_IGET(array, i);
     }
+    return obj;
+}
 
-    memset(stack, 0, sizeof(*stack));
-    stack->token_type = parser->token_type;
-    stack->token_row = parser->token_row;
-    stack->line_col = parser->line_col;
-    stack->tail = tail;
+obj_t *obj_pool_add_array_from_vec(obj_pool_t *pool, obj_t *vec){
+    int len = OBJ_VEC_LEN(vec);
+    obj_t *obj = obj_pool_add_array(pool, len);
+    if(!obj)return NULL;
+    for(int i = 0; i < len; i++){
+        *OBJ_ARRAY_IGET(obj, i) = *OBJ_VEC_IGET(vec, i);
+    }
+    return obj;
+}
 
-    stack->next = parser->stack;
-    parser->stack = stack;
-    return stack;
+obj_t *obj_pool_add_list_from_vec(obj_pool_t *pool, obj_t *vec){
+    /* The list's heads are copies of vec's elements, since (like
+    those of arrays) they're stored inline */
+    int len = OBJ_VEC_LEN(vec);
+    if(!len)return obj_pool_add_nil(pool);
+    obj_t *heads = obj_pool_objs_alloc(pool, len);
+    obj_t *list = heads? obj_pool_alloc_list(pool, len): NULL;
+    if(!list)return NULL;
+    for(int i = 0; i < len; i++){
+        heads[i] = *OBJ_VEC_IGET(vec, i);
+        OBJ_HEAD(list + i * 2) = &heads[i];
+    }
+    return list;
 }
 
-obj_t **obj_parser_stack_pop(obj_parser_t *parser, obj_t **tail){
-    *tail = obj_pool_add_nil(parser->pool);
-    if(!*tail)return NULL;
+/*************
+* obj_intarr *
+*************/
 
-    tail = parser->stack->tail;
+/* Intarrs are arrays of raw ints, packed into the objs following a
+2-obj header (len, then kind), instead of taking a whole obj_t per
+element.
+Their bulk operations work on 16 bytes at a time, using GCC's vector
+extensions if available (the data is only 8-byte aligned, like any
+obj, so the vector types are declared accordingly).
+Elementwise operations are applied to the whole of the last obj,
+including any padding after the last element, which is harmless
+since nothing else looks at it. */
+
+#if defined(__GNUC__) && !defined(OBJ_INTARR_NO_VECTORS)
+#   define OBJ_INTARR_VECTORS
+typedef int32_t obj_i32x4_t
+    __attribute__((vector_size(16), aligned(8), may_alias));
+typedef uint32_t obj_u32x4_t
+    __attribute__((vector_size(16), aligned(8), may_alias));
+typedef uint8_t obj_u8x16_t
+    __attribute__((vector_size(16), aligned(8), may_alias));
+#endif
 
-    obj_parser_stack_t *next = parser->stack->next;
-    parser->stack->next = parser->free_stack;
-    parser->free_stack = parser->stack;
-    parser->stack = next;
+size_t obj_intarr_elem_size(int kind){
+    return kind == OBJ_INTARR_U8? 1: 4;
+}
 
-    return tail;
+size_t obj_intarr_n_objs(int kind, int len){
+    /* Number of objs taken up by an intarr, including its header */
+    size_t size = (size_t)len * obj_intarr_elem_size(kind);
+    return 2 + (size + sizeof(obj_t) - 1) / sizeof(obj_t);
 }
 
-int obj_parser_get_c(obj_parser_t *parser, int c){
-    if(parser->pos >= parser->data_len)return EOF;
-    parser->pos++;
-    if(c == '\n'){
-        parser->row++;
-        parser->col = 0;
-        parser->line_col = 0;
-        parser->line_col_is_set = false;
+bool obj_intarr_fits(int kind, int x){
+    return kind != OBJ_INTARR_U8 || x >= 0 && x <= UINT8_MAX;
+}
+
+obj_t *obj_pool_add_intarr(obj_pool_t *pool, int kind, int len){
+    /* Returns a new intarr of len zeroes */
+    size_t n_objs = obj_intarr_n_objs(kind, len);
+    obj_t *obj = obj_pool_objs_alloc(pool, n_objs);
+    if(!obj)return NULL;
+    memset(obj, 0, n_objs * sizeof(*obj));
+    obj[0].tag = OBJ_TYPE_INTARR;
+    OBJ_INTARR_LEN(obj) = len;
+    OBJ_INTARR_KIND(obj) = kind;
+    return obj;
+}
+
+int obj_intarr_get(obj_t *obj, int i){
+    return OBJ_INTARR_KIND(obj) == OBJ_INTARR_U8?
+        OBJ_INTARR_U8(obj)[i]: OBJ_INTARR_I32(obj)[i];
+}
+
+void obj_intarr_set(obj_t *obj, int i, int x){
+    /* Caller should check obj_intarr_fits(kind, x) */
+    if(OBJ_INTARR_KIND(obj) == OBJ_INTARR_U8){
+        OBJ_INTARR_U8(obj)[i] = (uint8_t)x;
     }else{
-        parser->col++;
+        OBJ_INTARR_I32(obj)[i] = x;
     }
-    return parser->pos >= parser->data_len? EOF:
-        parser->data[parser->pos];
 }
 
+obj_t *obj_pool_add_intarr_from_array(obj_pool_t *pool,
+    int kind, obj_t *array
+){
+    int len = OBJ_ARRAY_LEN(array);
+    for(int i = 0; i < len; i++){
+        obj_t *val = OBJ_ARRAY_IGET(array, i);
+        if(OBJ_TYPE(val) != OBJ_TYPE_INT ||
+            !obj_intarr_fits(kind, OBJ_INT(val))
+        ){
+            fprintf(stderr, "%s: Element %i doesn't fit in %sarr: ",
+                __func__, i, obj_intarr_kind_msg(kind));
+            obj_fprint(val, stderr, 0);
+            putc('\n', stderr);
+            return NULL;
+        }
+    }
+    obj_t *obj = obj_pool_add_intarr(pool, kind, len);
+    if(!obj)return NULL;
+    for(int i = 0; i < len; i++){
+        obj_intarr_set(obj, i, OBJ_INT(OBJ_ARRAY_IGET(array, i)));
+    }
+    return obj;
+}
 
-int obj_parser_get_token(obj_parser_t *parser){
-    /* Updates parser->token, parser->token_len.
-    If end of parser->data is reached (that is,
-    parser->pos >= parser->data_len), then parser->token is set to NULL.
-    NOTE: parser->data is not allowed to contain NUL bytes. */
+obj_t *obj_pool_add_array_from_intarr(obj_pool_t *pool, obj_t *intarr){
+    int len = OBJ_INTARR_LEN(intarr);
+    obj_t *obj = obj_pool_add_array(pool, len);
+    if(!obj)return NULL;
+    for(int i = 0; i < len; i++){
+        obj_init_int(OBJ_ARRAY_IGET(obj, i), obj_intarr_get(intarr, i));
+    }
+    return obj;
+}
 
-    /* No matter what, token starts from current location.
-    So, possible "tokens" include whitespace, newlines, EOF,
-    as well as regular stuff like numbers, symbols, strings,
-    etc. */
-    parser->token = &parser->data[parser->pos];
-    parser->token_pos = parser->pos;
-    parser->token_row = parser->row;
-    parser->token_col = parser->col;
+void obj_intarr_fill(obj_t *obj, int x){
+    size_t n_blocks = obj_intarr_n_objs(
+        OBJ_INTARR_KIND(obj), OBJ_INTARR_LEN(obj)) - 2;
+#ifdef OBJ_INTARR_VECTORS
+    if(OBJ_INTARR_KIND(obj) == OBJ_INTARR_U8){
+        obj_u8x16_t v = {0};
+        v += (uint8_t)x;
+        obj_u8x16_t *data = OBJ_INTARR_DATA(obj);
+        for(size_t i = 0; i < n_blocks; i++)data[i] = v;
+    }else{
+        obj_i32x4_t v = {x, x, x, x};
+        obj_i32x4_t *data = OBJ_INTARR_DATA(obj);
+        for(size_t i = 0; i < n_blocks; i++)data[i] = v;
+    }
+#else
+    for(int i = 0; i < OBJ_INTARR_LEN(obj); i++)obj_intarr_set(obj, i, x);
+#endif
+}
 
-    int c = parser->pos >= parser->data_len? EOF:
-        parser->data[parser->pos];
+int obj_intarr_binop(obj_t *x, obj_t *y, int op){
+    /* Applies op elementwise, storing the results in x.
+    Arithmetic wraps around (for i32, as if done on uint32_t);
+    comparisons give 1 or 0. */
+    int kind = OBJ_INTARR_KIND(x);
+    int len = OBJ_INTARR_LEN(x);
+    if(OBJ_INTARR_KIND(y) != kind || OBJ_INTARR_LEN(y) != len){
+        fprintf(stderr, "%s: Mismatched intarrs: %sarr of len %i vs "
+            "%sarr of len %i\n", __func__,
+            obj_intarr_kind_msg(kind), len,
+            obj_intarr_kind_msg(OBJ_INTARR_KIND(y)), OBJ_INTARR_LEN(y));
+        return 1;
+    }
 
-    if(c == EOF){
-        /* EOF */
-        parser->token_type = OBJ_TOKEN_TYPE_EOF;
-        /* Return empty token */
-    }else if(c == '\n'){
-        /* Newline */
-        parser->token_type = OBJ_TOKEN_TYPE_NEWLINE;
-        c = obj_parser_get_c(parser, c);
-    }else if(c == '('){
-        /* Left paren */
-        parser->token_type = OBJ_TOKEN_TYPE_LPAREN;
-        c = obj_parser_get_c(parser, c);
-    }else if(c == ')'){
-        /* Right paren */
-        parser->token_type = OBJ_TOKEN_TYPE_RPAREN;
-        c = obj_parser_get_c(parser, c);
-    }else if(c == ':'){
-        /* Colon */
-        parser->token_type = OBJ_TOKEN_TYPE_COLON;
-        c = obj_parser_get_c(parser, c);
-    }else if(c == ' '){
-        /* Whitespace */
-        parser->token_type = OBJ_TOKEN_TYPE_WHITESPACE;
-        do{
-            c = obj_parser_get_c(parser, c);
-        }while(c == ' ');
-    }else if(c == '#' || c == ';'){
-        /* Comment or linestring */
-        parser->token_type = c == '#'?
-            OBJ_TOKEN_TYPE_COMMENT:
-            OBJ_TOKEN_TYPE_LINESTRING;
-        do{
-            c = obj_parser_get_c(parser, c);
-        }while(c != '\n' && c != EOF);
-    }else if(c == '"'){
-        /* String */
-        parser->token_type = OBJ_TOKEN_TYPE_STRING;
-        c = obj_parser_get_c(parser, c);
-        while(c != '"' && c != EOF){
-            if(c == '\\'){
-                c = obj_parser_get_c(parser, c);
-            }
-            c = obj_parser_get_c(parser, c);
+#ifdef OBJ_INTARR_VECTORS
+#   define OBJ_INTARR_BINOP_LOOP(T, EXPR) { \
+        T *xs = OBJ_INTARR_DATA(x), *ys = OBJ_INTARR_DATA(y); \
+        for(size_t i = 0; i < n_blocks; i++){ \
+            T a = xs[i], b = ys[i]; \
+            xs[i] = (EXPR); \
+        } \
+    }
+    size_t n_blocks = obj_intarr_n_objs(kind, len) - 2;
+    if(kind == OBJ_INTARR_U8){
+        switch(op){
+            case OBJ_INTARR_ADD: OBJ_INTARR_BINOP_LOOP(obj_u8x16_t, a + b) break;
+            case OBJ_INTARR_SUB: OBJ_INTARR_BINOP_LOOP(obj_u8x16_t, a - b) break;
+            case OBJ_INTARR_MUL: OBJ_INTARR_BINOP_LOOP(obj_u8x16_t, a * b) break;
+            case OBJ_INTARR_EQ:
+                OBJ_INTARR_BINOP_LOOP(obj_u8x16_t, (obj_u8x16_t)(a == b) & 1)
+                break;
+            case OBJ_INTARR_LT:
+                OBJ_INTARR_BINOP_LOOP(obj_u8x16_t, (obj_u8x16_t)(a < b) & 1)
+                break;
+            default: goto err;
         }
-        if(c == '"')c = obj_parser_get_c(parser, c);
-    }else if(c == '['){
-        /* Long Symbol */
-        parser->token_type = OBJ_TOKEN_TYPE_LONGSYM;
-        do{
-            c = obj_parser_get_c(parser, c);
-            if(c == '\\'){
-                c = obj_parser_get_c(parser, c);
+    }else{
+        switch(op){
+            case OBJ_INTARR_ADD: OBJ_INTARR_BINOP_LOOP(obj_u32x4_t, a + b) break;
+            case OBJ_INTARR_SUB: OBJ_INTARR_BINOP_LOOP(obj_u32x4_t, a - b) break;
+            case OBJ_INTARR_MUL: OBJ_INTARR_BINOP_LOOP(obj_u32x4_t, a * b) break;
+            case OBJ_INTARR_EQ:
+                OBJ_INTARR_BINOP_LOOP(obj_i32x4_t, (a == b) & 1)
+                break;
+            case OBJ_INTARR_LT:
+                OBJ_INTARR_BINOP_LOOP(obj_i32x4_t, (a < b) & 1)
+                break;
+            default: goto err;
+        }
+    }
+#   undef OBJ_INTARR_BINOP_LOOP
+#else
+    for(int i = 0; i < len; i++){
+        int a = obj_intarr_get(x, i), b = obj_intarr_get(y, i);
+        int c;
+        switch(op){
+            case OBJ_INTARR_ADD: c = (uint32_t)a + (uint32_t)b; break;
+            case OBJ_INTARR_SUB: c = (uint32_t)a - (uint32_t)b; break;
+            case OBJ_INTARR_MUL: c = (uint32_t)a * (uint32_t)b; break;
+            case OBJ_INTARR_EQ: c = a == b; break;
+            case OBJ_INTARR_LT: c = a < b; break;
+            default: goto err;
+        }
+        obj_intarr_set(x, i, c);
+    }
+#endif
+    return 0;
+err:
+    fprintf(stderr, "%s: Unknown op: %i\n", __func__, op);
+    return 1;
+}
+
+int obj_intarr_reduce(obj_t *obj, int op, int *result_ptr){
+    /* Sets *result_ptr to the sum (wrapping around, for i32), min or
+    max of obj's elements. The min or max of no elements is an
+    error. */
+    int kind = OBJ_INTARR_KIND(obj);
+    int len = OBJ_INTARR_LEN(obj);
+    if(op != OBJ_INTARR_SUM && !len){
+        fprintf(stderr, "%s: Empty intarr has no min or max\n", __func__);
+        return 1;
+    }
+    int i = 0;
+    uint32_t r = op == OBJ_INTARR_SUM? 0: obj_intarr_get(obj, 0);
+
+#ifdef OBJ_INTARR_VECTORS
+    /* Whole blocks of elements, then the rest one by one */
+    if(kind == OBJ_INTARR_U8 && op != OBJ_INTARR_SUM){
+        obj_u8x16_t *data = OBJ_INTARR_DATA(obj);
+        obj_u8x16_t v = {0};
+        v += (uint8_t)r;
+        for(; i + 16 <= len; i += 16){
+            obj_u8x16_t a = data[i / 16];
+            obj_u8x16_t m = (obj_u8x16_t)(op == OBJ_INTARR_MIN?
+                a < v: a > v);
+            v = a & m | v & ~m;
+        }
+        for(int j = 0; j < 16; j++){
+            if(op == OBJ_INTARR_MIN? v[j] < r: v[j] > r)r = v[j];
+        }
+    }else if(kind == OBJ_INTARR_I32){
+        obj_i32x4_t *data = OBJ_INTARR_DATA(obj);
+        obj_i32x4_t v = {(int)r, (int)r, (int)r, (int)r};
+        if(op == OBJ_INTARR_SUM){
+            obj_u32x4_t s = {0};
+            for(; i + 4 <= len; i += 4)s += (obj_u32x4_t)data[i / 4];
+            r = s[0] + s[1] + s[2] + s[3];
+        }else{
+            for(; i + 4 <= len; i += 4){
+                obj_i32x4_t a = data[i / 4];
+                obj_i32x4_t m = op == OBJ_INTARR_MIN? a < v: a > v;
+                v = a & m | v & ~m;
             }
-        }while(c != ']' && c != EOF);
-        if(c == ']')c = obj_parser_get_c(parser, c);
-    }else if(c == '{'){
-        /* Typecast */
-        parser->token_type = OBJ_TOKEN_TYPE_TYPECAST;
-        do{
-            c = obj_parser_get_c(parser, c);
-            if(c == '\\'){
-                c = obj_parser_get_c(parser, c);
+            for(int j = 0; j < 4; j++){
+                if(op == OBJ_INTARR_MIN? v[j] < (int)r: v[j] > (int)r){
+                    r = v[j];
+                }
             }
-        }while(c != '}' && c != EOF);
-        if(c == '}')c = obj_parser_get_c(parser, c);
-    }else if((c >= '0' && c <= '9') || strchr(ASCII_OPERATORS, c)){
-        if(c == '-'){
-            /* Integers and operators can both start with '-' */
-            c = obj_parser_get_c(parser, c);
         }
-        if(c >= '0' && c <= '9'){
-            /* Integer */
-            parser->token_type = OBJ_TOKEN_TYPE_INT;
-            do{
-                c = obj_parser_get_c(parser, c);
-            }while(c >= '0' && c <= '9');
-        }else if(strchr(ASCII_OPERATORS, c)){
-            /* Operator */
-            parser->token_type = OBJ_TOKEN_TYPE_OPER;
-            do{
-                c = obj_parser_get_c(parser, c);
-            }while(strchr(ASCII_OPERATORS, c));
-        }else{
-            /* We're parsing the token "-" by itself! */
-            parser->token_type = OBJ_TOKEN_TYPE_OPER;
+    }
+#endif
+
+    for(; i < len; i++){
+        int x = obj_intarr_get(obj, i);
+        switch(op){
+            case OBJ_INTARR_SUM: r += (uint32_t)x; break;
+            case OBJ_INTARR_MIN: if(x < (int)r)r = x; break;
+            case OBJ_INTARR_MAX: if(x > (int)r)r = x; break;
+            default:
+                fprintf(stderr, "%s: Unknown op: %i\n", __func__, op);
+                return 1;
         }
-    }else if(c == '_' || strchr(ASCII_LOWER, c) || strchr(ASCII_UPPER, c)){
-        /* Name */
-        parser->token_type = OBJ_TOKEN_TYPE_NAME;
-        do{
-            c = obj_parser_get_c(parser, c);
-        }while(
-            c == '_' ||
-            (c >= '0' && c <= '9') ||
-            strchr(ASCII_LOWER, c) ||
-            strchr(ASCII_UPPER, c)
-        );
+    }
+    *result_ptr = (int)r;
+    return 0;
+}
+
+
+/*************
+* obj_strbuf *
+*************/
+
+/* Strbufs are strings which can be appended to in place, for building
+up a string piece by piece without copying it all each time.
+A strbuf's string is a regular pool string, whose data is allocated
+with room to spare: its size is always obj_strbuf_size(len), so we
+know when it's full without having to store its size anywhere, and
+appending is amortized O(1). */
+
+#define OBJ_STRBUF_MIN_SIZE 16
+
+size_t obj_strbuf_size(size_t len){
+    size_t size = OBJ_STRBUF_MIN_SIZE;
+    while(size < len)size *= 2;
+    return size;
+}
+
+obj_string_t *obj_pool_strbuf_string_add_raw(obj_pool_t *pool,
+    const char *data, size_t len
+){
+    obj_string_t *string = obj_pool_string_alloc(pool,
+        obj_strbuf_size(len));
+    if(!string)return NULL;
+    memcpy(string->data, data, len);
+    string->len = len;
+    return string;
+}
+
+void obj_init_strbuf(obj_t *obj, obj_string_t *string){
+    /* string must have come from obj_pool_strbuf_string_add_raw */
+    obj->tag = OBJ_TYPE_STRBUF;
+    OBJ_STRING(obj) = string;
+}
+
+obj_t *obj_pool_add_strbuf(obj_pool_t *pool, const char *data, size_t len){
+    obj_string_t *string = obj_pool_strbuf_string_add_raw(pool, data, len);
+    if(!string)return NULL;
+    obj_t *obj = obj_pool_objs_alloc(pool, 1);
+    if(!obj)return NULL;
+    obj_init_strbuf(obj, string);
+    return obj;
+}
+
+static int obj_strbuf_reserve(obj_t *obj, size_t len){
+    /* Makes room for len more bytes */
+    obj_string_t *string = OBJ_STRING(obj);
+    size_t size = obj_strbuf_size(string->len);
+    size_t new_size = obj_strbuf_size(string->len + len);
+    if(new_size == size)return 0;
+    char *new_data = realloc(string->data, new_size);
+    if(!new_data){
+        fprintf(stderr, "%s: Couldn't grow strbuf to %zu bytes. ",
+            __func__, new_size);
+        perror("realloc");
+        return 1;
+    }
+    string->data = new_data;
+    return 0;
+}
+
+int obj_strbuf_add_raw(obj_t *obj, const char *data, size_t len){
+    /* data mustn't point into obj's own string, which may move */
+    if(obj_strbuf_reserve(obj, len))return 1;
+    obj_string_t *string = OBJ_STRING(obj);
+    memcpy(string->data + string->len, data, len);
+    string->len += len;
+    return 0;
+}
+
+int obj_strbuf_add_int(obj_t *obj, int i){
+    char buffer[20];
+    int len = snprintf(buffer, sizeof(buffer), "%i", i);
+    return obj_strbuf_add_raw(obj, buffer, len);
+}
+
+int obj_strbuf_add(obj_t *obj, obj_t *x){
+    /* Appends x, which may be a str, strbuf, sym (its name) or int (in
+    decimal) */
+    x = OBJ_RESOLVE(x);
+    int type = OBJ_TYPE(x);
+    if(type == OBJ_TYPE_STR || type == OBJ_TYPE_STRBUF){
+        obj_string_t view;
+        obj_string_t *s = obj_str_get(x, &view);
+        if(s == OBJ_STRING(obj)){
+            /* Doubling obj, whose data may move as we grow it */
+            size_t len = s->len;
+            if(obj_strbuf_reserve(obj, len))return 1;
+            memcpy(s->data + len, s->data, len);
+            s->len += len;
+            return 0;
+        }
+        return obj_strbuf_add_raw(obj, s->data, s->len);
+    }else if(type == OBJ_TYPE_SYM){
+        obj_string_t *s = &OBJ_SYM(x)->string;
+        return obj_strbuf_add_raw(obj, s->data, s->len);
+    }else if(type == OBJ_TYPE_INT){
+        return obj_strbuf_add_int(obj, OBJ_INT(x));
+    }
+    fprintf(stderr, "%s: Can't add %s to strbuf\n",
+        __func__, obj_type_msg(type));
+    return 1;
+}
+
+
+
+/**********
+* obj_map *
+**********/
+
+/* Maps are hash tables keyed by ints, strs or syms, so e.g. counting
+distinct strs doesn't mean interning them all as syms (which live as
+long as their symtable), the way a dict would.
+A map is 2 objs, holding its number of keys, and its table: an array
+of OBJ_MAP_CAP (a power of 2) key-value pairs, or NULL if the map has
+never had any keys. Empty slots have null keys.
+The table is open-addressed with linear probing, and deleting an entry
+shifts back the ones after it, so there are no tombstones. Once it's
+3/4 full, it's replaced by one twice the size, allocated from the pool
+like any other array.
+Keys are hashed and compared by value, as for hash-consing (see
+obj_pool_hashcons_hash). */
+
+#define OBJ_MAP_DEFAULT_CAP 8
+
+static bool obj_map_is_key(obj_t *key){
+    int type = OBJ_TYPE(key);
+    return type == OBJ_TYPE_INT || type == OBJ_TYPE_STR ||
+        type == OBJ_TYPE_SYM;
+}
+
+obj_t *obj_pool_add_map(obj_pool_t *pool){
+    obj_t *obj = obj_pool_objs_alloc(pool, 2);
+    if(!obj)return NULL;
+    obj[0].tag = OBJ_TYPE_MAP;
+    OBJ_MAP_N_KEYS(obj) = 0;
+    obj[1].tag = 0;
+    OBJ_MAP_TABLE(obj) = NULL;
+    return obj;
+}
+
+static int obj_map_find(obj_t *obj, obj_t *key){
+    /* Returns the index of key's slot in obj's table (which mustn't be
+    NULL), or if it's not there, of the empty slot where it would go */
+    obj_t *table = OBJ_MAP_TABLE(obj);
+    size_t mask = OBJ_MAP_CAP(obj) - 1;
+    size_t i = obj_pool_hashcons_hash(key) & mask;
+    for(;; i = (i + 1) & mask){
+        obj_t *slot_key = OBJ_ARRAY_IGET(table, i * 2);
+        if(OBJ_TYPE(slot_key) == OBJ_TYPE_NULL ||
+            obj_pool_hashcons_eq(slot_key, key))return (int)i;
+    }
+}
+
+obj_t *obj_map_get(obj_t *obj, obj_t *key){
+    /* Returns key's value in obj, or NULL if it has none.
+    NOTE: the returned pointer points into obj's table, so it's only
+    valid until the next obj_map_set or obj_map_del. */
+    if(!OBJ_MAP_TABLE(obj))return NULL;
+    obj_t *slot = OBJ_MAP_IGET_KEY(obj, obj_map_find(obj, key));
+    return OBJ_TYPE(slot) == OBJ_TYPE_NULL? NULL: slot + 1;
+}
+
+static int obj_map_grow(obj_pool_t *pool, obj_t *obj){
+    obj_t *old_table = OBJ_MAP_TABLE(obj);
+    int old_cap = OBJ_MAP_CAP(obj);
+    int cap = old_cap? old_cap * 2: OBJ_MAP_DEFAULT_CAP;
+    obj_t *table = obj_pool_add_array(pool, cap * 2);
+    if(!table)return 1;
+    OBJ_MAP_TABLE(obj) = table;
+    for(int i = 0; i < old_cap; i++){
+        obj_t *key = OBJ_ARRAY_IGET(old_table, i * 2);
+        if(OBJ_TYPE(key) == OBJ_TYPE_NULL)continue;
+        obj_t *slot = OBJ_MAP_IGET_KEY(obj, obj_map_find(obj, key));
+        slot[0] = key[0];
+        slot[1] = key[1];
+    }
+    return 0;
+}
+
+obj_t *obj_map_set(obj_pool_t *pool, obj_t *obj, obj_t *key, obj_t *value){
+    /* Sets key's value in obj, returning a pointer to where it's stored
+    (see obj_map_get), or NULL if key isn't an int, str or sym, or we
+    couldn't grow obj's table */
+    if(!obj_map_is_key(key)){
+        fprintf(stderr, "%s: Can't use %s as a map key\n",
+            __func__, obj_type_msg(OBJ_TYPE(key)));
+        return NULL;
+    }
+    obj_t *val = obj_map_get(obj, key);
+    if(val){
+        *val = *value;
+        return val;
+    }
+    if(OBJ_MAP_N_KEYS(obj) >= OBJ_MAP_CAP(obj) / 4 * 3){
+        if(obj_map_grow(pool, obj))return NULL;
+    }
+    obj_t *slot = OBJ_MAP_IGET_KEY(obj, obj_map_find(obj, key));
+    slot[0] = *key;
+    slot[1] = *value;
+
+    /* Keys are never changed in place, since that would move them */
+    OBJ_UNSET_UNIQUE(&slot[0]);
+    OBJ_MAP_N_KEYS(obj)++;
+    return &slot[1];
+}
+
+bool obj_map_del(obj_t *obj, obj_t *key, obj_t *value){
+    /* Removes key from obj, returning whether it was there.
+    If it was, and value isn't NULL, *value is set to its value. */
+    if(!OBJ_MAP_TABLE(obj))return false;
+    size_t mask = OBJ_MAP_CAP(obj) - 1;
+    size_t i = obj_map_find(obj, key);
+    obj_t *slot = OBJ_MAP_IGET_KEY(obj, i);
+    if(OBJ_TYPE(slot) == OBJ_TYPE_NULL)return false;
+    if(value)*value = slot[1];
+
+    /* Fill the hole at i with the next entry which may move back into
+    it (one whose home slot isn't between i and where it is now), then
+    fill the hole that leaves, and so on, until we reach an empty slot */
+    for(size_t j = (i + 1) & mask;; j = (j + 1) & mask){
+        obj_t *next = OBJ_MAP_IGET_KEY(obj, j);
+        if(OBJ_TYPE(next) == OBJ_TYPE_NULL)break;
+        size_t home = obj_pool_hashcons_hash(next) & mask;
+        if(((j - home) & mask) < ((j - i) & mask))continue;
+        slot = OBJ_MAP_IGET_KEY(obj, i);
+        slot[0] = next[0];
+        slot[1] = next[1];
+        i = j;
+    }
+    slot = OBJ_MAP_IGET_KEY(obj, i);
+    obj_init_null(&slot[0]);
+    obj_init_null(&slot[1]);
+    OBJ_MAP_N_KEYS(obj)--;
+    return true;
+}
+
+obj_t *obj_pool_add_map_clone(obj_pool_t *pool, obj_t *obj){
+    /* Returns a copy of obj with its own table, so either can be
+    changed without affecting the other.
+    The copy is shallow, so the keys and values are now shared, and
+    no longer OBJ_UNIQUE. */
+    obj_t *copy = obj_pool_add_map(pool);
+    if(!copy)return NULL;
+    obj_t *table = OBJ_MAP_TABLE(obj);
+    if(!table)return copy;
+    int len = OBJ_ARRAY_LEN(table);
+    obj_t *table_copy = obj_pool_add_array(pool, len);
+    if(!table_copy)return NULL;
+    for(int i = 0; i < len; i++){
+        OBJ_UNSET_UNIQUE(OBJ_ARRAY_IGET(table, i));
+    }
+    memcpy(OBJ_ARRAY_IGET(table_copy, 0), OBJ_ARRAY_IGET(table, 0),
+        len * sizeof(*table));
+    OBJ_MAP_N_KEYS(copy) = OBJ_MAP_N_KEYS(obj);
+    OBJ_MAP_TABLE(copy) = table_copy;
+    return copy;
+}
+
+obj_t *obj_pool_add_map_keys(obj_pool_t *pool, obj_t *obj){
+    /* Returns a list of copies of obj's keys, in table order */
+    int n = OBJ_MAP_N_KEYS(obj);
+    if(!n)return obj_pool_add_nil(pool);
+    obj_t *keys = obj_pool_objs_alloc(pool, n);
+    obj_t **elems = malloc(n * sizeof(*elems));
+    if(!keys || !elems){
+        perror("malloc");
+        free(elems);
+        return NULL;
+    }
+    int j = 0;
+    for(int i = 0; i < OBJ_MAP_CAP(obj); i++){
+        obj_t *key = OBJ_MAP_IGET_KEY(obj, i);
+        if(OBJ_TYPE(key) == OBJ_TYPE_NULL)continue;
+        keys[j] = *key;
+        elems[j] = &keys[j];
+        j++;
+    }
+    obj_t *lst = obj_pool_add_list(pool, elems, n);
+    free(elems);
+    return lst;
+}
+
+
+
+/***********
+* obj_omap *
+***********/
+
+/* Omaps are ordered maps: B+ trees keyed by ints, strs or syms (all of
+one type, ordered as by obj_cmp), so besides lookups, they can be
+iterated in order of their keys, and searched and sliced by key range.
+Like vecs, they're persistent: "changing" one (obj_pool_omap_set,
+obj_pool_omap_del) returns a new omap, sharing all but the O(log n)
+nodes on the path to the changed entry with the old one.
+An omap is 2 objs, holding its number of entries, and its tree (NULL if
+it's empty), of height OBJ_OMAP_HEIGHT (0 if the root is a leaf).
+Nodes are arrays of up to OBJ_OMAP_WIDTH items: a leaf's items are
+entries (key, value), in order; other nodes' items are (box of child,
+number of entries under child, child's smallest key).
+Every node but the root has at least OBJ_OMAP_MIN_ITEMS items, and
+the root (unless it's a leaf) has at least 2.
+The counts let us find the i-th entry, or the rank of a key, without
+visiting more than one node per level. */
+
+#define OBJ_OMAP_ITEM_LEN(height) ((height)? 3: 2)
+#define OBJ_OMAP_N_ITEMS(node, height) \
+    (OBJ_ARRAY_LEN(node) / OBJ_OMAP_ITEM_LEN(height))
+#define OBJ_OMAP_ITEM(node, height, j) \
+    OBJ_ARRAY_IGET(node, (j) * OBJ_OMAP_ITEM_LEN(height))
+#define OBJ_OMAP_ITEM_KEY(item, height) ((height)? (item) + 2: (item))
+#define OBJ_OMAP_ITEM_COUNT(item, height) ((height)? OBJ_INT((item) + 1): 1)
+
+/* Enough for the items of two nodes being merged */
+#define OBJ_OMAP_BUFFER_LEN (OBJ_OMAP_WIDTH * 2 * 3)
+
+static obj_t *obj_pool_add_omap_raw(obj_pool_t *pool,
+    int len, int height, obj_t *root
+){
+    obj_t *obj = obj_pool_objs_alloc(pool, 2);
+    if(!obj)return NULL;
+    obj[0].tag = OBJ_TYPE_OMAP;
+    OBJ_OMAP_LEN(obj) = len;
+    OBJ_OMAP_HEIGHT(obj) = height;
+    OBJ_OMAP_ROOT(obj) = root;
+    return obj;
+}
+
+obj_t *obj_pool_add_omap(obj_pool_t *pool){
+    return obj_pool_add_omap_raw(pool, 0, 0, NULL);
+}
+
+bool obj_omap_key_ok(obj_t *obj, obj_t *key){
+    /* Whether key can be compared with obj's keys, i.e. it's an int,
+    str or sym, of the same type as they are */
+    int type = OBJ_TYPE(key);
+    if(type != OBJ_TYPE_INT && type != OBJ_TYPE_STR &&
+        type != OBJ_TYPE_SYM)return false;
+    obj_t *root = OBJ_OMAP_ROOT(obj);
+    if(!root)return true;
+    int height = OBJ_OMAP_HEIGHT(obj);
+    return OBJ_TYPE(OBJ_OMAP_ITEM_KEY(
+        OBJ_OMAP_ITEM(root, height, 0), height)) == type;
+}
+
+static int obj_omap_cmp(obj_t *x, obj_t *y){
+    /* Keys have been checked with obj_omap_key_ok, so obj_cmp can't
+    fail */
+    int cmp = 0;
+    obj_cmp(x, y, &cmp);
+    return cmp;
+}
+
+static int obj_omap_search(obj_t *node, int height, obj_t *key,
+    bool *eq_ptr
+){
+    /* Returns the index of the item of node under which key belongs:
+    for a leaf, the first entry whose key isn't less than key; for other
+    nodes, the last child whose smallest key isn't greater than key (or
+    the first child).
+    Sets *eq_ptr to whether key is that item's key. */
+    int lo = 0, hi = OBJ_OMAP_N_ITEMS(node, height);
+    int n = hi;
+    while(lo < hi){
+        int mid = lo + (hi - lo) / 2;
+        obj_t *item_key = OBJ_OMAP_ITEM_KEY(
+            OBJ_OMAP_ITEM(node, height, mid), height);
+        if(obj_omap_cmp(item_key, key) < 0)lo = mid + 1;
+        else hi = mid;
+    }
+    *eq_ptr = lo < n && !obj_omap_cmp(OBJ_OMAP_ITEM_KEY(
+        OBJ_OMAP_ITEM(node, height, lo), height), key);
+    if(!height || *eq_ptr)return lo;
+    return lo? lo - 1: 0;
+}
+
+static void obj_omap_init_item(obj_t *item, obj_t *node, int height){
+    /* Sets item (3 objs) to refer to node, of given height, as an item
+    of node's parent */
+    int n = OBJ_OMAP_N_ITEMS(node, height);
+    int count = 0;
+    for(int j = 0; j < n; j++){
+        count += OBJ_OMAP_ITEM_COUNT(OBJ_OMAP_ITEM(node, height, j), height);
+    }
+    obj_init_box(&item[0], node);
+    obj_init_int(&item[1], count);
+    item[2] = *OBJ_OMAP_ITEM_KEY(OBJ_OMAP_ITEM(node, height, 0), height);
+}
+
+static int obj_pool_add_omap_nodes(obj_pool_t *pool,
+    obj_t *items, int n, int height, obj_t **nodes
+){
+    /* Puts n (> 0) items into a new node, or if there are too many for
+    one, into 2 new nodes with half each.
+    Returns the number of nodes, or -1 on error. */
+    int item_len = OBJ_OMAP_ITEM_LEN(height);
+    int n_nodes = n > OBJ_OMAP_WIDTH? 2: 1;
+    int start = 0;
+    for(int k = 0; k < n_nodes; k++){
+        int end = k < n_nodes - 1? n / 2: n;
+        obj_t *node = obj_pool_add_array(pool, (end - start) * item_len);
+        if(!node)return -1;
+        memcpy(OBJ_ARRAY_IGET(node, 0), items + start * item_len,
+            (end - start) * item_len * sizeof(*items));
+        nodes[k] = node;
+        start = end;
+    }
+    return n_nodes;
+}
+
+obj_t *obj_omap_iget(obj_t *obj, int i){
+    /* Returns obj's i-th entry, in order of keys: a pointer to its key,
+    which is followed by its value; or NULL if i is out of range */
+    if(i < 0 || i >= OBJ_OMAP_LEN(obj))return NULL;
+    obj_t *node = OBJ_OMAP_ROOT(obj);
+    for(int height = OBJ_OMAP_HEIGHT(obj); height > 0; height--){
+        obj_t *item = OBJ_OMAP_ITEM(node, height, 0);
+        while(i >= OBJ_INT(item + 1)){
+            i -= OBJ_INT(item + 1);
+            item += 3;
+        }
+        node = OBJ_CONTENTS(item);
+    }
+    return OBJ_OMAP_ITEM(node, 0, i);
+}
+
+obj_t *obj_omap_get(obj_t *obj, obj_t *key){
+    /* Returns key's value in obj, or NULL if it has none */
+    if(!OBJ_OMAP_ROOT(obj) || !obj_omap_key_ok(obj, key))return NULL;
+    obj_t *node = OBJ_OMAP_ROOT(obj);
+    bool eq;
+    for(int height = OBJ_OMAP_HEIGHT(obj);; height--){
+        int j = obj_omap_search(node, height, key, &eq);
+        obj_t *item = OBJ_OMAP_ITEM(node, height, j);
+        if(!height)return eq? item + 1: NULL;
+        node = OBJ_CONTENTS(item);
+    }
+}
+
+int obj_omap_rank(obj_t *obj, obj_t *key, bool *eq_ptr){
+    /* Returns the number of obj's keys which are less than key (which
+    must pass obj_omap_key_ok), and sets *eq_ptr to whether key is one
+    of obj's keys */
+    int rank = 0;
+    *eq_ptr = false;
+    obj_t *node = OBJ_OMAP_ROOT(obj);
+    if(!node)return 0;
+    for(int height = OBJ_OMAP_HEIGHT(obj);; height--){
+        int j = obj_omap_search(node, height, key, eq_ptr);
+        if(!height)return rank + j;
+        for(int k = 0; k < j; k++){
+            rank += OBJ_INT(OBJ_OMAP_ITEM(node, height, k) + 1);
+        }
+        node = OBJ_CONTENTS(OBJ_OMAP_ITEM(node, height, j));
+    }
+}
+
+static int obj_pool_omap_set_rec(obj_pool_t *pool, obj_t *node,
+    int height, obj_t *key, obj_t *val, obj_t **nodes, bool *added_ptr
+){
+    /* Copies the path from node to where key belongs, setting key's
+    value to val (and *added_ptr to true if key is new).
+    Returns the number of new nodes replacing node (2 if it had to be
+    split), or -1 on error. */
+    obj_t items[OBJ_OMAP_BUFFER_LEN];
+    int item_len = OBJ_OMAP_ITEM_LEN(height);
+    int n = OBJ_OMAP_N_ITEMS(node, height);
+    bool eq;
+    int j = obj_omap_search(node, height, key, &eq);
+    memcpy(items, OBJ_ARRAY_IGET(node, 0), n * item_len * sizeof(*items));
+    if(!height){
+        if(!eq){
+            memmove(items + (j + 1) * 2, items + j * 2,
+                (n - j) * 2 * sizeof(*items));
+            items[j * 2] = *key;
+            n++;
+            *added_ptr = true;
+        }
+        items[j * 2 + 1] = *val;
+    }else{
+        obj_t *children[2];
+        int n_children = obj_pool_omap_set_rec(pool,
+            OBJ_CONTENTS(&items[j * 3]), height - 1,
+            key, val, children, added_ptr);
+        if(n_children < 0)return -1;
+        if(n_children == 2){
+            memmove(items + (j + 2) * 3, items + (j + 1) * 3,
+                (n - j - 1) * 3 * sizeof(*items));
+            n++;
+        }
+        for(int k = 0; k < n_children; k++){
+            obj_omap_init_item(&items[(j + k) * 3], children[k], height - 1);
+        }
+    }
+    return obj_pool_add_omap_nodes(pool, items, n, height, nodes);
+}
+
+obj_t *obj_pool_omap_set(obj_pool_t *pool, obj_t *obj,
+    obj_t *key, obj_t *val
+){
+    /* Returns a new omap, like obj but with key's value set to val.
+    key must be an int, str or sym, like obj's other keys.
+    key and val are shared with obj's other versions, so they're stored
+    without OBJ_UNIQUE. */
+    if(!obj_omap_key_ok(obj, key)){
+        fprintf(stderr, "%s: Can't use %s as a key of this omap\n",
+            __func__, obj_type_msg(OBJ_TYPE(key)));
+        return NULL;
+    }
+    obj_t entry[2] = {*key, *val};
+    OBJ_UNSET_UNIQUE(&entry[0]);
+    OBJ_UNSET_UNIQUE(&entry[1]);
+    obj_t *root = OBJ_OMAP_ROOT(obj);
+    int height = OBJ_OMAP_HEIGHT(obj);
+    if(!root){
+        root = obj_pool_add_array(pool, 2);
+        if(!root)return NULL;
+        memcpy(OBJ_ARRAY_IGET(root, 0), entry, sizeof(entry));
+        return obj_pool_add_omap_raw(pool, 1, 0, root);
+    }
+
+    obj_t *nodes[2];
+    bool added = false;
+    int n_nodes = obj_pool_omap_set_rec(pool, root, height,
+        &entry[0], &entry[1], nodes, &added);
+    if(n_nodes < 0)return NULL;
+    if(n_nodes == 2){
+        /* The root was split, so the tree grows a level */
+        root = obj_pool_add_array(pool, 6);
+        if(!root)return NULL;
+        obj_omap_init_item(OBJ_ARRAY_IGET(root, 0), nodes[0], height);
+        obj_omap_init_item(OBJ_ARRAY_IGET(root, 3), nodes[1], height);
+        height++;
+    }else{
+        root = nodes[0];
+    }
+    return obj_pool_add_omap_raw(pool,
+        OBJ_OMAP_LEN(obj) + added, height, root);
+}
+
+static obj_t *obj_pool_omap_del_rec(obj_pool_t *pool, obj_t *node,
+    int height, obj_t *key, obj_t *value
+){
+    /* Returns node itself if key isn't under it, otherwise a copy of
+    the path from node to key, without key (which may leave the copy
+    with too few items, for node's parent to fix).
+    Returns NULL on error. */
+    obj_t items[OBJ_OMAP_BUFFER_LEN];
+    int item_len = OBJ_OMAP_ITEM_LEN(height);
+    int n = OBJ_OMAP_N_ITEMS(node, height);
+    bool eq;
+    int j = obj_omap_search(node, height, key, &eq);
+    if(!height){
+        if(!eq)return node;
+        if(value)*value = *OBJ_ARRAY_IGET(node, j * 2 + 1);
+        memcpy(items, OBJ_ARRAY_IGET(node, 0), n * 2 * sizeof(*items));
+        memmove(items + j * 2, items + (j + 1) * 2,
+            (n - j - 1) * 2 * sizeof(*items));
+        n--;
+    }else{
+        obj_t *child = OBJ_CONTENTS(OBJ_OMAP_ITEM(node, height, j));
+        obj_t *new_child = obj_pool_omap_del_rec(pool, child, height - 1,
+            key, value);
+        if(!new_child)return NULL;
+        if(new_child == child)return node;
+        memcpy(items, OBJ_ARRAY_IGET(node, 0), n * 3 * sizeof(*items));
+        if(n == 1 ||
+            OBJ_OMAP_N_ITEMS(new_child, height - 1) >= OBJ_OMAP_MIN_ITEMS
+        ){
+            obj_omap_init_item(&items[j * 3], new_child, height - 1);
+        }else{
+            /* Merge the child with a neighbour, splitting them again
+            if that's too many items for one node */
+            int k = j + 1 < n? j: j - 1;
+            obj_t *left = k == j? new_child: OBJ_CONTENTS(&items[k * 3]);
+            obj_t *right = k == j?
+                OBJ_CONTENTS(&items[(k + 1) * 3]): new_child;
+            int left_len = OBJ_ARRAY_LEN(left);
+            int right_len = OBJ_ARRAY_LEN(right);
+            obj_t merged[OBJ_OMAP_BUFFER_LEN];
+            memcpy(merged, OBJ_ARRAY_IGET(left, 0),
+                left_len * sizeof(*merged));
+            memcpy(merged + left_len, OBJ_ARRAY_IGET(right, 0),
+                right_len * sizeof(*merged));
+            obj_t *children[2];
+            int n_children = obj_pool_add_omap_nodes(pool, merged,
+                (left_len + right_len) / OBJ_OMAP_ITEM_LEN(height - 1),
+                height - 1, children);
+            if(n_children < 0)return NULL;
+            for(int c = 0; c < n_children; c++){
+                obj_omap_init_item(&items[(k + c) * 3], children[c],
+                    height - 1);
+            }
+            if(n_children == 1){
+                memmove(items + (k + 1) * 3, items + (k + 2) * 3,
+                    (n - k - 2) * 3 * sizeof(*items));
+                n--;
+            }
+        }
+    }
+    obj_t *copy = obj_pool_add_array(pool, n * item_len);
+    if(!copy)return NULL;
+    memcpy(OBJ_ARRAY_IGET(copy, 0), items, n * item_len * sizeof(*items));
+    return copy;
+}
+
+obj_t *obj_pool_omap_del(obj_pool_t *pool, obj_t *obj,
+    obj_t *key, obj_t *value
+){
+    /* Returns a new omap, like obj but without key; or obj itself, if
+    key isn't in it.
+    If key was in obj, and value isn't NULL, *value is set to its
+    value. */
+    obj_t *root = OBJ_OMAP_ROOT(obj);
+    int height = OBJ_OMAP_HEIGHT(obj);
+    if(!root || !obj_omap_key_ok(obj, key))return obj;
+    obj_t *new_root = obj_pool_omap_del_rec(pool, root, height, key, value);
+    if(!new_root)return NULL;
+    if(new_root == root)return obj;
+    if(height && OBJ_OMAP_N_ITEMS(new_root, height) == 1){
+        /* The root's children were merged, so the tree shrinks a
+        level */
+        new_root = OBJ_CONTENTS(OBJ_ARRAY_IGET(new_root, 0));
+        height--;
+    }
+    int len = OBJ_OMAP_LEN(obj) - 1;
+    return obj_pool_add_omap_raw(pool, len, height, len? new_root: NULL);
+}
+
+obj_t *obj_pool_add_omap_from_entries(obj_pool_t *pool,
+    obj_t *entries, int n
+){
+    /* Returns a new omap of n entries (keys and values alternating),
+    whose keys must be ints, strs or syms, all of one type, in strictly
+    increasing order.
+    OBJ_UNIQUE is cleared on entries' keys and values, since they're
+    now shared.
+    The tree is built bottom up, a level at a time, with items spread
+    evenly over each level's nodes, so it costs O(n). */
+    for(int i = 0; i < n; i++){
+        obj_t *key = &entries[i * 2];
+        int type = OBJ_TYPE(key);
+        bool ok = i?
+            type == OBJ_TYPE(&entries[0]) &&
+                obj_omap_cmp(&entries[i * 2 - 2], key) < 0:
+            type == OBJ_TYPE_INT || type == OBJ_TYPE_STR ||
+                type == OBJ_TYPE_SYM;
+        if(!ok){
+            fprintf(stderr, "%s: Key %i (%s) isn't an int, str or sym "
+                "greater than the one before\n",
+                __func__, i, obj_type_msg(type));
+            return NULL;
+        }
+        OBJ_UNSET_UNIQUE(&entries[i * 2]);
+        OBJ_UNSET_UNIQUE(&entries[i * 2 + 1]);
+    }
+    if(!n)return obj_pool_add_omap(pool);
+
+    obj_t *items = entries;
+    int n_items = n;
+    int height = 0;
+    obj_t *root = NULL;
+    for(;;){
+        int item_len = OBJ_OMAP_ITEM_LEN(height);
+        int n_nodes = (n_items + OBJ_OMAP_WIDTH - 1) / OBJ_OMAP_WIDTH;
+        obj_t *parents = n_nodes > 1?
+            malloc(n_nodes * 3 * sizeof(*parents)): NULL;
+        if(n_nodes > 1 && !parents){
+            perror("malloc");
+            goto err;
+        }
+        for(int k = 0; k < n_nodes; k++){
+            int start = (int)((long long)n_items * k / n_nodes);
+            int end = (int)((long long)n_items * (k + 1) / n_nodes);
+            obj_t *node = obj_pool_add_array(pool,
+                (end - start) * item_len);
+            if(!node){
+                free(parents);
+                goto err;
+            }
+            memcpy(OBJ_ARRAY_IGET(node, 0), items + start * item_len,
+                (end - start) * item_len * sizeof(*items));
+            if(parents)obj_omap_init_item(&parents[k * 3], node, height);
+            else root = node;
+        }
+        if(items != entries)free(items);
+        items = entries;
+        if(!parents)break;
+        items = parents;
+        n_items = n_nodes;
+        height++;
+    }
+    return obj_pool_add_omap_raw(pool, n, height, root);
+
+err:
+    if(items != entries)free(items);
+    return NULL;
+}
+
+obj_t *obj_pool_omap_slice(obj_pool_t *pool, obj_t *obj, int i, int j){
+    /* Returns a new omap of obj's entries from the i-th up to (but not
+    including) the j-th */
+    int len = OBJ_OMAP_LEN(obj);
+    if(i < 0)i = 0;
+    if(j > len)j = len;
+    if(j < i)j = i;
+    obj_t *entries = j > i? malloc((j - i) * 2 * sizeof(*entries)): NULL;
+    if(j > i && !entries){
+        perror("malloc");
+        return NULL;
+    }
+    for(int k = i; k < j; k++){
+        memcpy(&entries[(k - i) * 2], obj_omap_iget(obj, k),
+            2 * sizeof(*entries));
+    }
+    obj_t *slice = obj_pool_add_omap_from_entries(pool, entries, j - i);
+    free(entries);
+    return slice;
+}
+
+obj_t *obj_pool_add_list_from_omap(obj_pool_t *pool, obj_t *obj,
+    bool vals
+){
+    /* Returns a list of obj's keys (or if vals, its values), in order
+    of keys.
+    The list's heads are copies, as for obj_pool_add_list_from_vec. */
+    int len = OBJ_OMAP_LEN(obj);
+    if(!len)return obj_pool_add_nil(pool);
+    obj_t *heads = obj_pool_objs_alloc(pool, len);
+    obj_t *list = heads? obj_pool_alloc_list(pool, len): NULL;
+    if(!list)return NULL;
+    for(int i = 0; i < len; i++){
+        heads[i] = obj_omap_iget(obj, i)[vals];
+        OBJ_HEAD(list + i * 2) = &heads[i];
+    }
+    return list;
+}
+
+
+
+/*************
+* obj_pqueue *
+*************/
+
+/* Pqueues are priority queues: min-heaps of values, each with an int
+priority, so the value with the least priority can be found in O(1),
+and popped (or a new one pushed) in O(log n).
+A pqueue is 2 objs, holding its number of values, and its heap: an
+array of OBJ_PQUEUE_CAP (priority, value) pairs, or NULL if the pqueue
+has never had any values. Like a map's table, it's replaced by one
+twice the size when full.
+The heap is implicit and OBJ_PQUEUE_ARITY-ary: entry i's children are
+entries i*ARITY+1 to i*ARITY+ARITY. With 4 children per entry, the heap
+is half as deep as a binary one, and each entry's children are next to
+each other in memory, so popping (which compares them all) visits half
+as many cache lines.
+Values with the same priority come out in no particular order. */
+
+#define OBJ_PQUEUE_DEFAULT_CAP 8
+
+obj_t *obj_pool_add_pqueue(obj_pool_t *pool){
+    obj_t *obj = obj_pool_objs_alloc(pool, 2);
+    if(!obj)return NULL;
+    obj[0].tag = OBJ_TYPE_PQUEUE;
+    OBJ_PQUEUE_LEN(obj) = 0;
+    obj[1].tag = 0;
+    OBJ_PQUEUE_HEAP(obj) = NULL;
+    return obj;
+}
+
+static void obj_pqueue_sift_up(obj_t *obj, int i, int prio, obj_t *val){
+    /* Puts (prio, val) in the hole at entry i, or wherever above it
+    keeps the heap in order, moving entries down to make room */
+    while(i > 0){
+        int parent = (i - 1) / OBJ_PQUEUE_ARITY;
+        obj_t *parent_prio = OBJ_PQUEUE_IGET_PRIO(obj, parent);
+        if(OBJ_INT(parent_prio) <= prio)break;
+        obj_t *slot = OBJ_PQUEUE_IGET_PRIO(obj, i);
+        slot[0] = parent_prio[0];
+        slot[1] = parent_prio[1];
+        i = parent;
+    }
+    obj_t *slot = OBJ_PQUEUE_IGET_PRIO(obj, i);
+    obj_init_int(&slot[0], prio);
+    slot[1] = *val;
+}
+
+static void obj_pqueue_sift_down(obj_t *obj, int i, int prio, obj_t *val){
+    /* Puts (prio, val) in the hole at entry i, or wherever below it
+    keeps the heap in order, moving entries up to make room */
+    int len = OBJ_PQUEUE_LEN(obj);
+    for(;;){
+        int first = i * OBJ_PQUEUE_ARITY + 1;
+        if(first >= len)break;
+        int last = first + OBJ_PQUEUE_ARITY;
+        if(last > len)last = len;
+        int min = first;
+        int min_prio = OBJ_INT(OBJ_PQUEUE_IGET_PRIO(obj, first));
+        for(int j = first + 1; j < last; j++){
+            int child_prio = OBJ_INT(OBJ_PQUEUE_IGET_PRIO(obj, j));
+            if(child_prio < min_prio){
+                min = j;
+                min_prio = child_prio;
+            }
+        }
+        if(min_prio >= prio)break;
+        obj_t *slot = OBJ_PQUEUE_IGET_PRIO(obj, i);
+        obj_t *child = OBJ_PQUEUE_IGET_PRIO(obj, min);
+        slot[0] = child[0];
+        slot[1] = child[1];
+        i = min;
+    }
+    obj_t *slot = OBJ_PQUEUE_IGET_PRIO(obj, i);
+    obj_init_int(&slot[0], prio);
+    slot[1] = *val;
+}
+
+int obj_pqueue_push(obj_pool_t *pool, obj_t *obj, int prio, obj_t *val){
+    int len = OBJ_PQUEUE_LEN(obj);
+    if(len >= OBJ_PQUEUE_CAP(obj)){
+        int cap = len? len * 2: OBJ_PQUEUE_DEFAULT_CAP;
+        obj_t *heap = obj_pool_add_array(pool, cap * 2);
+        if(!heap)return 1;
+        if(len)memcpy(OBJ_ARRAY_IGET(heap, 0),
+            OBJ_ARRAY_IGET(OBJ_PQUEUE_HEAP(obj), 0),
+            len * 2 * sizeof(*heap));
+        OBJ_PQUEUE_HEAP(obj) = heap;
+    }
+    OBJ_PQUEUE_LEN(obj)++;
+    obj_pqueue_sift_up(obj, len, prio, val);
+    return 0;
+}
+
+obj_t *obj_pqueue_peek(obj_t *obj){
+    /* Returns a pointer to obj's least priority, which is followed by
+    its value; or NULL if obj is empty */
+    return OBJ_PQUEUE_LEN(obj)? OBJ_PQUEUE_IGET_PRIO(obj, 0): NULL;
+}
+
+bool obj_pqueue_pop(obj_t *obj, int *prio, obj_t *val){
+    /* Removes the value with the least priority from obj, returning
+    whether there was one.
+    If there was, *val is set to it, and if prio isn't NULL, *prio is
+    set to its priority. */
+    int len = OBJ_PQUEUE_LEN(obj);
+    if(!len)return false;
+    obj_t *top = OBJ_PQUEUE_IGET_PRIO(obj, 0);
+    if(prio)*prio = OBJ_INT(&top[0]);
+    *val = top[1];
+
+    /* The last entry fills the hole, and sinks to where it belongs */
+    obj_t *last = OBJ_PQUEUE_IGET_PRIO(obj, len - 1);
+    obj_t last_val = last[1];
+    int last_prio = OBJ_INT(&last[0]);
+    obj_init_null(&last[0]);
+    obj_init_null(&last[1]);
+    OBJ_PQUEUE_LEN(obj)--;
+    if(len > 1)obj_pqueue_sift_down(obj, 0, last_prio, &last_val);
+    return true;
+}
+
+int obj_pqueue_heapify(obj_t *obj){
+    /* Puts obj's entries (in any order) into heap order, in O(n), by
+    sifting down each one which has children, from the last up.
+    Fails if any priority isn't an int. */
+    int len = OBJ_PQUEUE_LEN(obj);
+    for(int i = 0; i < len; i++){
+        obj_t *prio = OBJ_PQUEUE_IGET_PRIO(obj, i);
+        if(OBJ_TYPE(prio) != OBJ_TYPE_INT){
+            fprintf(stderr, "%s: Priority %i is a %s, not an int\n",
+                __func__, i, obj_type_msg(OBJ_TYPE(prio)));
+            return 1;
+        }
+    }
+    for(int i = (len - 2) / OBJ_PQUEUE_ARITY; len > 1 && i >= 0; i--){
+        obj_t *entry = OBJ_PQUEUE_IGET_PRIO(obj, i);
+        obj_t val = entry[1];
+        obj_pqueue_sift_down(obj, i, OBJ_INT(&entry[0]), &val);
+    }
+    return 0;
+}
+
+obj_t *obj_pool_add_pqueue_from_entries(obj_pool_t *pool,
+    obj_t *entries, int n
+){
+    /* Returns a new pqueue of n entries (priorities and values
+    alternating, in any order), built in O(n) */
+    obj_t *obj = obj_pool_add_pqueue(pool);
+    if(!obj)return NULL;
+    if(!n)return obj;
+    obj_t *heap = obj_pool_add_array(pool, n * 2);
+    if(!heap)return NULL;
+    memcpy(OBJ_ARRAY_IGET(heap, 0), entries, n * 2 * sizeof(*entries));
+    OBJ_PQUEUE_LEN(obj) = n;
+    OBJ_PQUEUE_HEAP(obj) = heap;
+    if(obj_pqueue_heapify(obj))return NULL;
+    return obj;
+}
+
+obj_t *obj_pool_add_pqueue_clone(obj_pool_t *pool, obj_t *obj){
+    /* Returns a copy of obj with its own heap, so either can be
+    changed without affecting the other.
+    The copy is shallow, so the values are now shared, and no longer
+    OBJ_UNIQUE. */
+    obj_t *copy = obj_pool_add_pqueue(pool);
+    if(!copy)return NULL;
+    int len = OBJ_PQUEUE_LEN(obj);
+    if(!len)return copy;
+    obj_t *heap = obj_pool_add_array(pool, len * 2);
+    if(!heap)return NULL;
+    for(int i = 0; i < len; i++){
+        OBJ_UNSET_UNIQUE(OBJ_PQUEUE_IGET_VAL(obj, i));
+    }
+    memcpy(OBJ_ARRAY_IGET(heap, 0), OBJ_PQUEUE_IGET_PRIO(obj, 0),
+        len * 2 * sizeof(*heap));
+    OBJ_PQUEUE_LEN(copy) = len;
+    OBJ_PQUEUE_HEAP(copy) = heap;
+    return copy;
+}
+
+
+
+/*************
+* obj_parser *
+*************/
+
+void obj_parser_init(
+    obj_parser_t *parser, obj_pool_t *pool,
+    const char *filename, const char *data, size_t data_len
+){
+    memset(parser, 0, sizeof(*parser));
+    /* parser->use_extended_types = true; */
+    parser->pool = pool;
+    parser->filename = filename;
+    parser->data = data;
+    parser->data_len = data_len;
+}
+
+void obj_parser_stack_cleanup(obj_parser_stack_t *stack){
+    while(stack){
+        obj_parser_stack_t *next = stack->next;
+        free(stack);
+        stack = next;
+    }
+}
+
+void obj_parser_cleanup(obj_parser_t *parser){
+    free(parser->token_buffer);
+    free(parser->elems);
+    obj_parser_stack_cleanup(parser->stack);
+    obj_parser_stack_cleanup(parser->free_stack);
+}
+
+void obj_parser_dump(obj_parser_t *parser, FILE *file){
+    fprintf(file, "OBJ PARSER %p:\n", parser);
+    fprintf(file, "  TOKEN BUFFER: %p (%zu)\n",
+        parser->token_buffer, parser->token_buffer_len);
+    fprintf(file, "  STACK:\n");
+    for(obj_parser_stack_t *stack = parser->stack;
+        stack; stack = stack->next
+    ){
+        fprintf(file, "    ENTRY %p: row=%zu col=%zu type=%i\n", stack,
+            stack->token_row, stack->line_col, stack->token_type);
+    }
+    fprintf(file, "  FREE-STACK:\n");
+    for(obj_parser_stack_t *free_stack = parser->free_stack;
+        free_stack; free_stack = free_stack->next
+    ){
+        fprintf(file, "    ENTRY %p\n", free_stack);
+    }
+}
+
+void obj_parser_errmsg(obj_parser_t *parser, const char *funcname){
+    fprintf(stderr, "%s [pos=%zu/%zu row=%zu col=%zu]: ",
+        funcname, parser->token_pos, parser->data_len,
+        parser->token_row+1, parser->token_col+1);
+    fprintf(stderr, "Token was: \"%.*s\"\n",
+        size_to_int(parser->token_len, 256), parser->token);
+}
+
+char *obj_parser_get_token_buffer(obj_parser_t *parser, size_t want_len){
+    if(parser->token_buffer_len >= want_len)return parser->token_buffer;
+    size_t len = parser->token_buffer_len;
+    if(!len)len = OBJ_PARSER_TOKEN_BUFFER_DEFAULT_SIZE;
+    while(len < want_len){
+        size_t old_len = len;
+        len = len / 2 * 3;
+        if(len < old_len){
+            /* C is... silly */
+            fprintf(stderr,
+                "%s: Token buffer overflow while requesting %zu bytes\n",
+                __func__, want_len);
+            return NULL;
+        }
+    }
+    char *buffer = malloc(len);
+    if(!buffer)return NULL;
+    parser->token_buffer_len = len;
+    parser->token_buffer = buffer;
+    return buffer;
+}
+
+bool obj_parser_token_is_sym(obj_parser_t *parser){
+    int type = parser->token_type;
+    return
+        type == OBJ_TOKEN_TYPE_NAME ||
+        type == OBJ_TOKEN_TYPE_OPER ||
+        type == OBJ_TOKEN_TYPE_LONGSYM;
+}
+
+bool obj_parser_token_is_string(obj_parser_t *parser){
+    int type = parser->token_type;
+    return
+        type == OBJ_TOKEN_TYPE_STRING ||
+        type == OBJ_TOKEN_TYPE_LINESTRING;
+}
+
+bool obj_parser_token_eq(obj_parser_t *parser, const char *text){
+    size_t text_len = strlen(text);
+    return parser->token_len == text_len &&
+        !strncmp(parser->token, text, text_len);
+}
+
+int obj_parser_push_elem(obj_parser_t *parser, obj_t *obj){
+    if(parser->elems_len >= parser->elems_size){
+        size_t size = parser->elems_size? parser->elems_size * 2:
+            OBJ_PARSER_ELEMS_DEFAULT_SIZE;
+        obj_t **elems = realloc(parser->elems, size * sizeof(*elems));
+        if(!elems){
+            obj_parser_errmsg(parser, __func__);
+            perror("realloc");
+            return 1;
+        }
+        parser->elems = elems;
+        parser->elems_size = size;
+    }
+    parser->elems[parser->elems_len++] = obj;
+    return 0;
+}
+
+obj_t *obj_parser_pop_list(obj_parser_t *parser, size_t elems_start){
+    /* Pops the elems after elems_start, returning them as a list */
+    obj_t *lst = obj_pool_add_list(parser->pool,
+        parser->elems + elems_start, parser->elems_len - elems_start);
+    parser->elems_len = elems_start;
+    return lst;
+}
+
+obj_parser_stack_t *obj_parser_stack_push(obj_parser_t *parser){
+    obj_parser_stack_t *stack;
+    if(parser->free_stack){
+        stack = parser->free_stack;
+        parser->free_stack = parser->free_stack->next;
+    }else{
+        stack = calloc(sizeof(*stack), 1);
+        if(!stack){
+            obj_parser_errmsg(parser, __func__);
+            perror("calloc");
+            return NULL;
+        }
+    }
+
+    memset(stack, 0, sizeof(*stack));
+    stack->token_type = parser->token_type;
+    stack->token_row = parser->token_row;
+    stack->line_col = parser->line_col;
+    stack->elems_start = parser->elems_len;
+
+    stack->next = parser->stack;
+    parser->stack = stack;
+    return stack;
+}
+
+int obj_parser_stack_pop(obj_parser_t *parser){
+    /* Closes the innermost list, adding it to the one containing it */
+    obj_t *lst = obj_parser_pop_list(parser, parser->stack->elems_start);
+    if(!lst || obj_parser_push_elem(parser, lst))return 1;
+
+    obj_parser_stack_t *next = parser->stack->next;
+    parser->stack->next = parser->free_stack;
+    parser->free_stack = parser->stack;
+    parser->stack = next;
+
+    return 0;
+}
+
+int obj_parser_get_c(obj_parser_t *parser, int c){
+    if(parser->pos >= parser->data_len)return EOF;
+    parser->pos++;
+    if(c == '\n'){
+        parser->row++;
+        parser->col = 0;
+        parser->line_col = 0;
+        parser->line_col_is_set = false;
+    }else{
+        parser->col++;
+    }
+    return parser->pos >= parser->data_len? EOF:
+        parser->data[parser->pos];
+}
+
+
+int obj_parser_get_token(obj_parser_t *parser){
+    /* Updates parser->token, parser->token_len.
+    If end of parser->data is reached (that is,
+    parser->pos >= parser->data_len), then parser->token is set to NULL.
+    NOTE: parser->data is not allowed to contain NUL bytes. */
+
+    /* No matter what, token starts from current location.
+    So, possible "tokens" include whitespace, newlines, EOF,
+    as well as regular stuff like numbers, symbols, strings,
+    etc. */
+    parser->token = &parser->data[parser->pos];
+    parser->token_pos = parser->pos;
+    parser->token_row = parser->row;
+    parser->token_col = parser->col;
+
+    int c = parser->pos >= parser->data_len? EOF:
+        parser->data[parser->pos];
+
+    if(c == EOF){
+        /* EOF */
+        parser->token_type = OBJ_TOKEN_TYPE_EOF;
+        /* Return empty token */
+    }else if(c == '\n'){
+        /* Newline */
+        parser->token_type = OBJ_TOKEN_TYPE_NEWLINE;
+        c = obj_parser_get_c(parser, c);
+    }else if(c == '('){
+        /* Left paren */
+        parser->token_type = OBJ_TOKEN_TYPE_LPAREN;
+        c = obj_parser_get_c(parser, c);
+    }else if(c == ')'){
+        /* Right paren */
+        parser->token_type = OBJ_TOKEN_TYPE_RPAREN;
+        c = obj_parser_get_c(parser, c);
+    }else if(c == ':'){
+        /* Colon */
+        parser->token_type = OBJ_TOKEN_TYPE_COLON;
+        c = obj_parser_get_c(parser, c);
+    }else if(c == ' '){
+        /* Whitespace */
+        parser->token_type = OBJ_TOKEN_TYPE_WHITESPACE;
+        do{
+            c = obj_parser_get_c(parser, c);
+        }while(c == ' ');
+    }else if(c == '#' || c == ';'){
+        /* Comment or linestring */
+        parser->token_type = c == '#'?
+            OBJ_TOKEN_TYPE_COMMENT:
+            OBJ_TOKEN_TYPE_LINESTRING;
+        do{
+            c = obj_parser_get_c(parser, c);
+        }while(c != '\n' && c != EOF);
+    }else if(c == '"'){
+        /* String */
+        parser->token_type = OBJ_TOKEN_TYPE_STRING;
+        c = obj_parser_get_c(parser, c);
+        while(c != '"' && c != EOF){
+            if(c == '\\'){
+                c = obj_parser_get_c(parser, c);
+            }
+            c = obj_parser_get_c(parser, c);
+        }
+        if(c == '"')c = obj_parser_get_c(parser, c);
+    }else if(c == '['){
+        /* Long Symbol */
+        parser->token_type = OBJ_TOKEN_TYPE_LONGSYM;
+        do{
+            c = obj_parser_get_c(parser, c);
+            if(c == '\\'){
+                c = obj_parser_get_c(parser, c);
+            }
+        }while(c != ']' && c != EOF);
+        if(c == ']')c = obj_parser_get_c(parser, c);
+    }else if(c == '{'){
+        /* Typecast */
+        parser->token_type = OBJ_TOKEN_TYPE_TYPECAST;
+        do{
+            c = obj_parser_get_c(parser, c);
+            if(c == '\\'){
+                c = obj_parser_get_c(parser, c);
+            }
+        }while(c != '}' && c != EOF);
+        if(c == '}')c = obj_parser_get_c(parser, c);
+    }else if((c >= '0' && c <= '9') || strchr(ASCII_OPERATORS, c)){
+        if(c == '-'){
+            /* Integers and operators can both start with '-' */
+            c = obj_parser_get_c(parser, c);
+        }
+        if(c >= '0' && c <= '9'){
+            /* Integer */
+            parser->token_type = OBJ_TOKEN_TYPE_INT;
+            do{
+                c = obj_parser_get_c(parser, c);
+            }while(c >= '0' && c <= '9');
+        }else if(strchr(ASCII_OPERATORS, c)){
+            /* Operator */
+            parser->token_type = OBJ_TOKEN_TYPE_OPER;
+            do{
+                c = obj_parser_get_c(parser, c);
+            }while(strchr(ASCII_OPERATORS, c));
+        }else{
+            /* We're parsing the token "-" by itself! */
+            parser->token_type = OBJ_TOKEN_TYPE_OPER;
+        }
+    }else if(c == '_' || strchr(ASCII_LOWER, c) || strchr(ASCII_UPPER, c)){
+        /* Name */
+        parser->token_type = OBJ_TOKEN_TYPE_NAME;
+        do{
+            c = obj_parser_get_c(parser, c);
+        }while(
+            c == '_' ||
+            (c >= '0' && c <= '9') ||
+            strchr(ASCII_LOWER, c) ||
+            strchr(ASCII_UPPER, c)
+        );
+    }else{
+        /* Invalid character: treat it like EOF, return empty token */
+        parser->token_type = OBJ_TOKEN_TYPE_INVALID;
+        obj_parser_errmsg(parser, __func__);
+        fprintf(stderr, "Invalid character: %c (#%i)\n",
+            isprint(c)? (char)c: ' ', c);
+        return 1;
+    }
+
+    parser->token_len = &parser->data[parser->pos] - parser->token;
+
+    if(
+        !parser->line_col_is_set &&
+        parser->token_type != OBJ_TOKEN_TYPE_WHITESPACE &&
+        parser->token_type != OBJ_TOKEN_TYPE_NEWLINE
+    ){
+        parser->line_col = parser->token_col;
+        parser->line_col_is_set = true;
+    }
+
+#   ifdef OBJ_DEBUG_TOKENS
+    fprintf(stderr, "TOKEN: \"%.*s\"\n",
+        size_to_int(parser->token_len, 256), parser->token);
+#   endif
+
+    return 0;
+}
+
+char *obj_parser_get_unescaped_token(
+    obj_parser_t *parser, const char *token, size_t token_len,
+    size_t *unescaped_token_len_ptr
+){
+    char *unescaped_token = obj_parser_get_token_buffer(
+        parser, parser->token_len);
+    if(!unescaped_token)return NULL;
+    size_t unescaped_token_len = 0;
+    for(size_t i = 0; i < token_len; i++){
+        char c = token[i];
+        if(c == '\\'){
+            if(i >= token_len - 1){
+                fprintf(stderr, "%s: '\\' at end of token: \"%.*s\"\n",
+                    __func__, size_to_int(token_len, -1), token);
+                return NULL;
+            }
+            c = token[++i];
+            if(c == 'n')c = '\n';
+        }
+        unescaped_token[unescaped_token_len++] = c;
+    }
+    *unescaped_token_len_ptr = unescaped_token_len;
+    return unescaped_token;
+}
+
+obj_t *obj_parser_get_str(obj_parser_t *parser){
+    if(!obj_parser_token_is_string(parser)){
+        obj_parser_errmsg(parser, __func__);
+        fprintf(stderr, "Expected string\n");
+        return NULL;
+    }
+    if(parser->token_type == OBJ_TOKEN_TYPE_LINESTRING){
+        return obj_pool_add_str_raw(
+            parser->pool, parser->token + 1, parser->token_len - 1);
+    }
+    size_t token_len;
+    char *token = obj_parser_get_unescaped_token(parser,
+        parser->token + 1, parser->token_len - 2, &token_len);
+    if(!token)return NULL;
+    return obj_pool_add_str_raw(
+        parser->pool, token, token_len);
+}
+
+obj_sym_t *obj_parser_get_sym(obj_parser_t *parser){
+    if(!obj_parser_token_is_sym(parser)){
+        obj_parser_errmsg(parser, __func__);
+        fprintf(stderr, "Expected sym\n");
+        return NULL;
+    }
+    if(parser->token_type != OBJ_TOKEN_TYPE_LONGSYM){
+        return obj_symtable_get_sym_raw(
+            parser->pool->symtable, parser->token,
+            parser->token_len);
+    }
+    size_t token_len;
+    char *token = obj_parser_get_unescaped_token(parser,
+        parser->token + 1, parser->token_len - 2, &token_len);
+    if(!token)return NULL;
+    return obj_symtable_get_sym_raw(
+        parser->pool->symtable, token, token_len);
+}
+
+obj_t *obj_parser_parse(obj_parser_t *parser){
+    int typecast = OBJ_TYPE_UNDEFINED;
+
+    if(parser->use_extended_types){
+        fprintf(stderr, "%s: Extended types not supported yet!\n",
+            __func__);
+        return NULL;
+    }
+
+    for(;;){
+        if(obj_parser_get_token(parser))return NULL;
+        if(parser->token_type == OBJ_TOKEN_TYPE_EOF)break;
+        if(parser->line_col_is_set){
+            while(
+                parser->stack &&
+                parser->stack->token_type == OBJ_TOKEN_TYPE_COLON &&
+                parser->token_row > parser->stack->token_row &&
+                parser->line_col <= parser->stack->line_col
+            ){
+                if(obj_parser_stack_pop(parser))return NULL;
+            }
+        }
+
+        obj_t *obj = NULL;
+        switch(parser->token_type){
+            case OBJ_TOKEN_TYPE_INT: {
+                bool is_neg = parser->token[0] == '-';
+                int n = 0;
+                for(int i = is_neg? 1: 0; i < parser->token_len; i++){
+                    int digit = parser->token[i] - '0';
+                    n *= 10;
+                    n += digit;
+                }
+                if(is_neg)n = -n;
+                obj = obj_pool_add_int(parser->pool, n);
+                if(!obj)return NULL;
+                break;
+            }
+            case OBJ_TOKEN_TYPE_NAME:
+            case OBJ_TOKEN_TYPE_OPER:
+            case OBJ_TOKEN_TYPE_LONGSYM: {
+                obj_sym_t *sym = obj_parser_get_sym(parser);
+                if(!sym)return NULL;
+                obj = obj_pool_add_sym(parser->pool, sym);
+                if(!obj)return NULL;
+                break;
+            }
+            case OBJ_TOKEN_TYPE_STRING:
+            case OBJ_TOKEN_TYPE_LINESTRING: {
+                obj = obj_parser_get_str(parser);
+                if(!obj)return NULL;
+                break;
+            }
+            case OBJ_TOKEN_TYPE_COLON:
+            case OBJ_TOKEN_TYPE_LPAREN: {
+                if(!obj_parser_stack_push(parser))return NULL;
+                break;
+            }
+            case OBJ_TOKEN_TYPE_RPAREN: {
+                while(
+                    parser->stack &&
+                    parser->stack->token_type != OBJ_TOKEN_TYPE_LPAREN
+                ){
+                    if(obj_parser_stack_pop(parser))return NULL;
+                }
+                if(!parser->stack){
+                    obj_parser_errmsg(parser, __func__);
+                    fprintf(stderr, "Too many closing parentheses\n");
+                    return NULL;
+                }
+                if(obj_parser_stack_pop(parser))return NULL;
+                break;
+            }
+            case OBJ_TOKEN_TYPE_TYPECAST: {
+                if(!parser->use_extended_types){
+                    /* It's cool, just carry on like you never saw a
+                    typecast token */
+                }else if(obj_parser_token_eq(parser, "{arr}")){
+                    typecast = OBJ_TYPE_ARRAY;
+                }else if(obj_parser_token_eq(parser, "{dict}")){
+                    typecast = OBJ_TYPE_DICT;
+                }else if(obj_parser_token_eq(parser, "{obj}")){
+                    typecast = OBJ_TYPE_STRUCT;
+                }else if(obj_parser_token_eq(parser, "{fun}")){
+                    typecast = OBJ_TYPE_FUN;
+                }else if(obj_parser_token_eq(parser, "{vec}")){
+                    typecast = OBJ_TYPE_VEC;
+                }else if(obj_parser_token_eq(parser, "{map}")){
+                    typecast = OBJ_TYPE_MAP;
+                }else if(obj_parser_token_eq(parser, "{omap}")){
+                    typecast = OBJ_TYPE_OMAP;
+                }else if(obj_parser_token_eq(parser, "{pqueue}")){
+                    typecast = OBJ_TYPE_PQUEUE;
+                }else if(
+                    obj_parser_token_eq(parser, "{i32arr}") ||
+                    obj_parser_token_eq(parser, "{u8arr}")
+                ){
+                    typecast = OBJ_TYPE_INTARR;
+                }else if(obj_parser_token_eq(parser, "{strbuf}")){
+                    typecast = OBJ_TYPE_STRBUF;
+                }else{
+                    obj_parser_errmsg(parser, __func__);
+                    fprintf(stderr, "Unrecognized typecast\n");
+                    return NULL;
+                }
+                break;
+            }
+            default: break;
+        }
+
+        if(obj){
+            if(obj_parser_push_elem(parser, obj))return NULL;
+        }
+
+        if(parser->token_type != OBJ_TOKEN_TYPE_TYPECAST){
+            typecast = OBJ_TYPE_NIL;
+        }
+    }
+
+    while(
+        parser->stack &&
+        parser->stack->token_type == OBJ_TOKEN_TYPE_COLON
+    ){
+        if(obj_parser_stack_pop(parser))return NULL;
+    }
+
+    if(parser->stack){
+        obj_parser_errmsg(parser, __func__);
+        fprintf(stderr, "Too many opening parentheses\n");
+        while(parser->stack){
+            fprintf(stderr, "  [row=%zu col=%zu type=%s]\n",
+                parser->stack->token_row+1,
+                parser->stack->line_col+1,
+                obj_token_type_msg(parser->stack->token_type));
+            parser->stack = parser->stack->next;
+        }
+        return NULL;
+    }
+
+    return obj_parser_pop_list(parser, 0);
+}
+
+obj_t *obj_parse(obj_pool_t *pool, const char *filename,
+    const char *data, size_t data_len
+){
+    obj_parser_t _parser, *parser = &_parser;
+    obj_parser_init(parser, pool, filename, data, data_len);
+    obj_t *obj = obj_parser_parse(parser);
+    obj_parser_cleanup(parser);
+    return obj;
+}
+
+
+
+/*************
+* obj_binary *
+*************/
+
+/* Binary format for obj trees, which can be loaded much faster than
+the text format, since there is nothing to lex or unescape, and each
+distinct sym is interned only once.
+
+    image := "COBJ" version n_syms n_objs sym* node
+    sym := len byte*
+    node := type byte, followed by:
+        NULL, NIL: nothing
+        BOOL: 1 byte (0 or 1)
+        INT: zigzag-encoded varint
+        SYM: sym index
+        STR, STRBUF: len byte*
+        CELL: n node*n node (n heads, followed by the tail of the
+            n-th cell, which is usually NIL)
+        QUEUE: node (the queue's list)
+        ARRAY: len node*len
+        DICT: n (sym index, node)*n
+        STRUCT: n (sym index)*n node*n
+        FUN: (sym index) (sym index) node (module name, def name, args)
+        BOX: node
+        VEC: len node*len
+        INTARR: kind len elem*len (for u8, bytes; for i32, zigzag
+            varints)
+        MAP: n (node node)*n (keys, which must be INT, SYM or STR, and
+            values)
+        OMAP: n (node node)*n (keys, as for MAP but all of one type and
+            in increasing order, and values)
+        PQUEUE: n (node node)*n (priorities, which must be INT, and
+            values; in heap order, but the loader doesn't rely on it)
+
+All counts, lengths and indices are unsigned LEB128 varints.
+n_objs is the number of pool objs the loader will need, so it can
+reserve them up front.
+Values inside arrays, dicts, structs, (o)maps and pqueues must be single
+objs (see README), so e.g. a CELL node directly inside an ARRAY is an
+error.
+Shared subtrees are written once per reference, and cycles (via
+boxes) aren't supported. */
+
+#define OBJ_BINARY_MAGIC "COBJ"
+#define OBJ_BINARY_MAGIC_LEN 4
+#define OBJ_BINARY_VERSION 1
+
+struct obj_binary_frame {
+    int type;
+    obj_t *obj;
+    size_t i;
+    size_t n;
+        /* type: type of container whose children we're working
+        through */
+        /* obj: the container (for CELL, the next cell) */
+        /* i, n: index of next child, and number of children */
+};
+
+static int obj_binary_write_varint(obj_writer_t *writer, size_t u){
+    char *s = obj_writer_reserve(writer, 10);
+    if(!s)return 1;
+    size_t len = 0;
+    while(u >= 0x80){
+        s[len++] = (char)(u & 0x7f | 0x80);
+        u >>= 7;
+    }
+    s[len++] = (char)u;
+    writer->buffer_len += len;
+    return 0;
+}
+
+static size_t obj_binary_zigzag(int i){
+    uint32_t u = (uint32_t)i << 1;
+    return i < 0? ~u: u;
+}
+
+static int obj_binary_unzigzag(size_t u){
+    uint32_t u32 = (uint32_t)u;
+    return (int)(u32 & 1? ~(u32 >> 1): u32 >> 1);
+}
+
+static obj_binary_frame_t *obj_binary_push_frame(
+    obj_binary_frame_t **stack_ptr, size_t *stack_len_ptr,
+    size_t *stack_tos_ptr
+){
+    if(*stack_tos_ptr >= *stack_len_ptr){
+        size_t stack_len = *stack_len_ptr? *stack_len_ptr * 2:
+            OBJ_WRITER_DEFAULT_STACK_LEN;
+        obj_binary_frame_t *stack = realloc(*stack_ptr,
+            stack_len * sizeof(*stack));
+        if(!stack){
+            fprintf(stderr, "%s: Couldn't grow stack to %zu frames. ",
+                __func__, stack_len);
+            perror("realloc");
+            return NULL;
+        }
+        *stack_ptr = stack;
+        *stack_len_ptr = stack_len;
+    }
+    obj_binary_frame_t *frame = &(*stack_ptr)[(*stack_tos_ptr)++];
+    memset(frame, 0, sizeof(*frame));
+    return frame;
+}
+
+
+/* Writing */
+
+typedef struct obj_binary_saver {
+    obj_writer_t body;
+    obj_dict_t sym_indices;
+    obj_sym_t **syms;
+    size_t syms_len;
+    size_t n_syms;
+    size_t n_objs;
+    obj_binary_frame_t *stack;
+    size_t stack_len;
+    size_t stack_tos;
+        /* body: the node stream, which is written after the header
+        and syms, once we know how many of each there are */
+        /* sym_indices: maps each sym to its index in syms */
+} obj_binary_saver_t;
+
+static int obj_binary_write_sym(obj_binary_saver_t *saver, obj_sym_t *sym){
+    obj_t *index = obj_dict_get(&saver->sym_indices, sym);
+    if(index)return obj_binary_write_varint(&saver->body, OBJ_INT(index));
+
+    if(saver->n_syms >= saver->syms_len){
+        size_t syms_len = saver->syms_len? saver->syms_len * 2: 64;
+        obj_sym_t **syms = realloc(saver->syms, syms_len * sizeof(*syms));
+        if(!syms){
+            fprintf(stderr, "%s: Couldn't grow syms to %zu. ",
+                __func__, syms_len);
+            perror("realloc");
+            return 1;
+        }
+        saver->syms = syms;
+        saver->syms_len = syms_len;
+    }
+    obj_t new_index;
+    obj_init_int(&new_index, saver->n_syms);
+    if(!obj_dict_set(&saver->sym_indices, sym, &new_index))return 1;
+    saver->syms[saver->n_syms] = sym;
+    return obj_binary_write_varint(&saver->body, saver->n_syms++);
+}
+
+static int obj_binary_write_node(obj_binary_saver_t *saver,
+    obj_t *obj, bool is_inline
+){
+    /* Writes the start of obj's node, pushing a frame if obj has
+    children.
+    If is_inline, obj is inside an array, dict or struct, and will be
+    loaded into the container's own obj; otherwise the loader needs to
+    allocate an obj for it. */
+    obj_writer_t *body = &saver->body;
+    int type = OBJ_TYPE(obj);
+    size_t n_objs = is_inline? 0: 1;
+    size_t n = 0;
+
+    if(is_inline && (type == OBJ_TYPE_CELL || type == OBJ_TYPE_QUEUE ||
+        type == OBJ_TYPE_ARRAY || type == OBJ_TYPE_STRUCT ||
+        type == OBJ_TYPE_FUN || type == OBJ_TYPE_VEC ||
+        type == OBJ_TYPE_INTARR || type == OBJ_TYPE_MAP ||
+        type == OBJ_TYPE_OMAP || type == OBJ_TYPE_PQUEUE)
+    ){
+        fprintf(stderr, "%s: Can't write %s inside array, dict or struct\n",
+            __func__, obj_type_msg(type));
+        return 1;
+    }
+
+    if(obj_writer_putc(body, type))return 1;
+    switch(type){
+        case OBJ_TYPE_NULL:
+        case OBJ_TYPE_NIL:
+            /* Loader uses the pool's own null & nil */
+            return 0;
+        case OBJ_TYPE_BOOL:
+            return obj_writer_putc(body, OBJ_BOOL(obj));
+        case OBJ_TYPE_INT:
+            saver->n_objs += n_objs;
+            return obj_binary_write_varint(body,
+                obj_binary_zigzag(OBJ_INT(obj)));
+        case OBJ_TYPE_SYM:
+            saver->n_objs += n_objs;
+            return obj_binary_write_sym(saver, OBJ_SYM(obj));
+        case OBJ_TYPE_STR:
+        case OBJ_TYPE_STRBUF: {
+            obj_string_t view;
+            obj_string_t *s = obj_str_get(obj, &view);
+            saver->n_objs += n_objs;
+            if(obj_binary_write_varint(body, s->len))return 1;
+            return obj_writer_write(body, s->data, s->len);
+        }
+        case OBJ_TYPE_CELL: {
+            for(obj_t *cell = obj; OBJ_TYPE(cell) == OBJ_TYPE_CELL;
+                cell = OBJ_TAIL(cell)
+            )n++;
+            n_objs = n * 2;
+            if(obj_binary_write_varint(body, n))return 1;
+            n++; /* the tail */
+            break;
+        }
+        case OBJ_TYPE_QUEUE:
+            n_objs = 2;
+            n = 1;
+            break;
+        case OBJ_TYPE_ARRAY:
+            n = OBJ_ARRAY_LEN(obj);
+            n_objs = 1 + n;
+            if(obj_binary_write_varint(body, n))return 1;
+            break;
+        case OBJ_TYPE_DICT:
+            n = OBJ_DICT(obj)->entries_len;
+            if(obj_binary_write_varint(body,
+                OBJ_DICT(obj)->n_entries))return 1;
+            break;
+        case OBJ_TYPE_STRUCT: {
+            n = OBJ_STRUCT_LEN(obj);
+            n_objs = 1 + n;
+            if(obj_binary_write_varint(body, n))return 1;
+            for(size_t i = 0; i < n; i++){
+                obj_sym_t *key = OBJ_SYM(OBJ_STRUCT_IGET_KEY(obj, i));
+                if(obj_binary_write_sym(saver, key))return 1;
+            }
+            break;
+        }
+        case OBJ_TYPE_FUN:
+            n_objs = 3;
+            n = 1;
+            if(obj_binary_write_sym(saver, OBJ_FUN_MODULE_NAME(obj)))return 1;
+            if(obj_binary_write_sym(saver, OBJ_FUN_DEF_NAME(obj)))return 1;
+            break;
+        case OBJ_TYPE_BOX:
+            n = 1;
+            break;
+        case OBJ_TYPE_VEC:
+            /* Roughly: the vec, plus its leaves */
+            n = OBJ_VEC_LEN(obj);
+            n_objs = 2 + n + n / OBJ_VEC_WIDTH;
+            if(obj_binary_write_varint(body, n))return 1;
+            break;
+        case OBJ_TYPE_INTARR: {
+            int kind = OBJ_INTARR_KIND(obj);
+            int len = OBJ_INTARR_LEN(obj);
+            saver->n_objs += obj_intarr_n_objs(kind, len);
+            if(obj_writer_putc(body, kind))return 1;
+            if(obj_binary_write_varint(body, len))return 1;
+            if(kind == OBJ_INTARR_U8){
+                return obj_writer_write(body,
+                    (char*)OBJ_INTARR_U8(obj), len);
+            }
+            for(int i = 0; i < len; i++){
+                if(obj_binary_write_varint(body,
+                    obj_binary_zigzag(OBJ_INTARR_I32(obj)[i])))return 1;
+            }
+            return 0;
+        }
+        case OBJ_TYPE_MAP:
+            /* The map, plus (roughly) the table it'll be loaded into */
+            n = OBJ_MAP_CAP(obj);
+            n_objs = 3 + n * 2;
+            if(obj_binary_write_varint(body, OBJ_MAP_N_KEYS(obj)))return 1;
+            break;
+        case OBJ_TYPE_OMAP:
+            /* The omap, the array its entries are loaded into, and
+            (roughly) its tree */
+            n = OBJ_OMAP_LEN(obj) * 2;
+            n_objs = 4 + n * 2;
+            if(obj_binary_write_varint(body, OBJ_OMAP_LEN(obj)))return 1;
+            break;
+        case OBJ_TYPE_PQUEUE:
+            /* The pqueue, plus its heap */
+            n = OBJ_PQUEUE_LEN(obj) * 2;
+            n_objs = 3 + n;
+            if(obj_binary_write_varint(body, OBJ_PQUEUE_LEN(obj)))return 1;
+            break;
+        default:
+            fprintf(stderr, "%s: Can't write obj of type: %s\n",
+                __func__, obj_type_msg(type));
+            return 1;
+    }
+
+    saver->n_objs += n_objs;
+    obj_binary_frame_t *frame = obj_binary_push_frame(
+        &saver->stack, &saver->stack_len, &saver->stack_tos);
+    if(!frame)return 1;
+    frame->type = type;
+    frame->obj = obj;
+    frame->n = n;
+    return 0;
+}
+
+static int obj_binary_write_nodes(obj_binary_saver_t *saver, obj_t *obj){
+    /* Writes obj's node and all its descendants' nodes, without
+    recursing in C */
+    if(obj_binary_write_node(saver, obj, false))return 1;
+    while(saver->stack_tos){
+        obj_binary_frame_t *frame = &saver->stack[saver->stack_tos - 1];
+        if(frame->i >= frame->n){
+            saver->stack_tos--;
+            continue;
+        }
+        size_t i = frame->i++;
+        obj_t *child;
+        bool is_inline = false;
+        switch(frame->type){
+            case OBJ_TYPE_CELL:
+                if(i < frame->n - 1){
+                    child = OBJ_HEAD(frame->obj);
+                    frame->obj = OBJ_TAIL(frame->obj);
+                }else{
+                    child = frame->obj;
+                }
+                break;
+            case OBJ_TYPE_QUEUE:
+                child = OBJ_QUEUE_LIST(frame->obj);
+                break;
+            case OBJ_TYPE_ARRAY:
+                child = OBJ_ARRAY_IGET(frame->obj, i);
+                is_inline = true;
+                break;
+            case OBJ_TYPE_DICT: {
+                obj_dict_entry_t *entry = &OBJ_DICT(frame->obj)->entries[i];
+                if(!entry->sym)continue;
+                if(obj_binary_write_sym(saver, entry->sym))return 1;
+                child = &entry->value;
+                is_inline = true;
+                break;
+            }
+            case OBJ_TYPE_STRUCT:
+                child = OBJ_STRUCT_IGET_VAL(frame->obj, i);
+                is_inline = true;
+                break;
+            case OBJ_TYPE_FUN:
+                child = OBJ_FUN_ARGS(frame->obj);
+                break;
+            case OBJ_TYPE_VEC:
+                child = OBJ_VEC_IGET(frame->obj, i);
+                is_inline = true;
+                break;
+            case OBJ_TYPE_MAP: {
+                obj_t *key = OBJ_MAP_IGET_KEY(frame->obj, i);
+                if(OBJ_TYPE(key) == OBJ_TYPE_NULL)continue;
+                if(obj_binary_write_node(saver, key, true))return 1;
+                child = OBJ_MAP_IGET_VAL(frame->obj, i);
+                is_inline = true;
+                break;
+            }
+            case OBJ_TYPE_OMAP:
+                child = OBJ_OMAP_IGET(frame->obj, i / 2) + i % 2;
+                is_inline = true;
+                break;
+            case OBJ_TYPE_PQUEUE:
+                child = OBJ_ARRAY_IGET(OBJ_PQUEUE_HEAP(frame->obj), i);
+                is_inline = true;
+                break;
+            default: /* OBJ_TYPE_BOX */
+                child = OBJ_CONTENTS(frame->obj);
+                break;
+        }
+        if(obj_binary_write_node(saver, child, is_inline))return 1;
+    }
+    return 0;
+}
+
+int obj_binary_write(obj_writer_t *writer, obj_t *obj){
+    /* Writes obj in the binary format (see above) */
+    obj_binary_saver_t _saver, *saver=&_saver;
+    memset(saver, 0, sizeof(*saver));
+    obj_writer_init(&saver->body, NULL);
+    obj_dict_init(&saver->sym_indices);
+
+    int err = 1;
+    if(obj_binary_write_nodes(saver, obj))goto done;
+
+    if(obj_writer_write(writer, OBJ_BINARY_MAGIC, OBJ_BINARY_MAGIC_LEN))goto done;
+    if(obj_writer_putc(writer, OBJ_BINARY_VERSION))goto done;
+    if(obj_binary_write_varint(writer, saver->n_syms))goto done;
+    if(obj_binary_write_varint(writer, saver->n_objs))goto done;
+    for(size_t i = 0; i < saver->n_syms; i++){
+        obj_string_t *s = &saver->syms[i]->string;
+        if(obj_binary_write_varint(writer, s->len))goto done;
+        if(obj_writer_write(writer, s->data, s->len))goto done;
+    }
+    if(obj_writer_write(writer,
+        saver->body.buffer, saver->body.buffer_len))goto done;
+    err = 0;
+
+done:
+    obj_writer_cleanup(&saver->body);
+    obj_dict_cleanup(&saver->sym_indices);
+    free(saver->syms);
+    free(saver->stack);
+    return err;
+}
+
+int obj_binary_fwrite(obj_t *obj, FILE *file){
+    obj_writer_t _writer, *writer=&_writer;
+    obj_writer_init(writer, file);
+    int err = obj_binary_write(writer, obj) || obj_writer_flush(writer);
+    obj_writer_cleanup(writer);
+    return err;
+}
+
+
+/* Loading */
+
+typedef struct obj_binary_loader {
+    obj_pool_t *pool;
+    const char *filename;
+    const char *data;
+    size_t data_len;
+    size_t pos;
+    obj_sym_t **syms;
+    size_t n_syms;
+    obj_binary_frame_t *stack;
+    size_t stack_len;
+    size_t stack_tos;
+} obj_binary_loader_t;
+
+static void obj_binary_errmsg(obj_binary_loader_t *loader,
+    const char *funcname
+){
+    fprintf(stderr, "%s: %s: at byte %zu/%zu: ", funcname,
+        loader->filename, loader->pos, loader->data_len);
+}
+
+static int obj_binary_read_byte(obj_binary_loader_t *loader, int *c_ptr){
+    if(loader->pos >= loader->data_len){
+        obj_binary_errmsg(loader, __func__);
+        fprintf(stderr, "Unexpected end of data\n");
+        return 1;
+    }
+    *c_ptr = (unsigned char)loader->data[loader->pos++];
+    return 0;
+}
+
+static int obj_binary_read_varint(obj_binary_loader_t *loader,
+    size_t *u_ptr
+){
+    size_t u = 0;
+    for(int shift = 0; shift < 64; shift += 7){
+        int c;
+        if(obj_binary_read_byte(loader, &c))return 1;
+        u |= (size_t)(c & 0x7f) << shift;
+        if(!(c & 0x80)){
+            *u_ptr = u;
+            return 0;
+        }
+    }
+    obj_binary_errmsg(loader, __func__);
+    fprintf(stderr, "Varint too long\n");
+    return 1;
+}
+
+static int obj_binary_read_len(obj_binary_loader_t *loader,
+    size_t *len_ptr, size_t max
+){
+    /* Reads a varint which is a count or length, and checks it against
+    max, so that corrupt data can't make us allocate huge amounts */
+    if(obj_binary_read_varint(loader, len_ptr))return 1;
+    if(*len_ptr > max){
+        obj_binary_errmsg(loader, __func__);
+        fprintf(stderr, "Length %zu too large (max %zu)\n", *len_ptr, max);
+        return 1;
+    }
+    return 0;
+}
+
+static int obj_binary_read_data_len(obj_binary_loader_t *loader,
+    size_t *len_ptr
+){
+    /* Reads the length of some raw bytes (a str or sym's text) which
+    follow it, and checks they're all there.
+    NOTE: the bound is taken after the length itself has been read, so
+    it can't be off by the length's own bytes */
+    if(obj_binary_read_varint(loader, len_ptr))return 1;
+    if(*len_ptr > loader->data_len - loader->pos){
+        obj_binary_errmsg(loader, __func__);
+        fprintf(stderr, "Length %zu runs past end of data\n", *len_ptr);
+        return 1;
+    }
+    return 0;
+}
+
+static obj_sym_t *obj_binary_read_sym(obj_binary_loader_t *loader){
+    size_t i;
+    if(obj_binary_read_varint(loader, &i))return NULL;
+    if(i >= loader->n_syms){
+        obj_binary_errmsg(loader, __func__);
+        fprintf(stderr, "Sym index %zu out of range (%zu syms)\n",
+            i, loader->n_syms);
+        return NULL;
+    }
+    return loader->syms[i];
+}
+
+static int obj_binary_read_node(obj_binary_loader_t *loader,
+    obj_t **obj_ptr, obj_t *slot
+){
+    /* Reads the start of a node, pushing a frame if it has children.
+    If slot is given, the node is loaded into it (it's an element of an
+    array, dict or struct); otherwise, we allocate an obj for the node
+    and set *obj_ptr to point at it.
+    Note that *obj_ptr or *slot is always written before we read any
+    of the node's children, since slot may point into a dict's entries,
+    which may move when further entries are added. */
+    obj_pool_t *pool = loader->pool;
+    size_t max_len = loader->data_len - loader->pos;
+    int type;
+    if(obj_binary_read_byte(loader, &type))return 1;
+
+    obj_t *obj = NULL;
+    size_t n = 0;
+    switch(type){
+        case OBJ_TYPE_NULL:
+        case OBJ_TYPE_NIL:
+        case OBJ_TYPE_BOOL: {
+            int b = 0;
+            if(type == OBJ_TYPE_BOOL && obj_binary_read_byte(loader, &b))return 1;
+            obj_t *unique_obj = type == OBJ_TYPE_NULL? &pool->null:
+                type == OBJ_TYPE_NIL? &pool->nil: b? &pool->T: &pool->F;
+            if(slot)*slot = *unique_obj;
+            else *obj_ptr = unique_obj;
+            return 0;
+        }
+        case OBJ_TYPE_INT:
+        case OBJ_TYPE_SYM:
+        case OBJ_TYPE_STR:
+        case OBJ_TYPE_STRBUF:
+        case OBJ_TYPE_DICT:
+        case OBJ_TYPE_BOX: {
+            if(!slot){
+                if(!(slot = obj_pool_objs_alloc(pool, 1)))return 1;
+                *obj_ptr = slot;
+            }
+            if(type == OBJ_TYPE_INT){
+                size_t u;
+                if(obj_binary_read_varint(loader, &u))return 1;
+                obj_init_int(slot, obj_binary_unzigzag(u));
+                return 0;
+            }else if(type == OBJ_TYPE_SYM){
+                obj_sym_t *sym = obj_binary_read_sym(loader);
+                if(!sym)return 1;
+                obj_init_sym(slot, sym);
+                return 0;
+            }else if(type == OBJ_TYPE_STR || type == OBJ_TYPE_STRBUF){
+                size_t len;
+                if(obj_binary_read_data_len(loader, &len))return 1;
+                const char *data = loader->data + loader->pos;
+                loader->pos += len;
+                if(type == OBJ_TYPE_STR){
+                    return !obj_init_str_raw(pool, slot, data, len);
+                }
+                obj_string_t *s = obj_pool_strbuf_string_add_raw(
+                    pool, data, len);
+                if(!s)return 1;
+                obj_init_strbuf(slot, s);
+                return 0;
+            }else if(type == OBJ_TYPE_DICT){
+                if(obj_binary_read_len(loader, &n, max_len))return 1;
+                obj_dict_t *dict = obj_pool_dict_alloc(pool);
+                if(!dict)return 1;
+                obj_init_dict(slot, dict);
+            }else{
+                n = 1;
+                obj_init_box(slot, NULL);
+            }
+            obj = slot;
+            break;
+        }
+        case OBJ_TYPE_CELL:
+        case OBJ_TYPE_QUEUE:
+        case OBJ_TYPE_ARRAY:
+        case OBJ_TYPE_STRUCT:
+        case OBJ_TYPE_FUN:
+        case OBJ_TYPE_VEC:
+        case OBJ_TYPE_INTARR:
+        case OBJ_TYPE_MAP:
+        case OBJ_TYPE_OMAP:
+        case OBJ_TYPE_PQUEUE: {
+            if(slot){
+                obj_binary_errmsg(loader, __func__);
+                fprintf(stderr,
+                    "Can't load %s inside array, dict or struct\n",
+                    obj_type_msg(type));
+                return 1;
+            }
+            if(type == OBJ_TYPE_CELL){
+                if(obj_binary_read_len(loader, &n, max_len))return 1;
+                if(!n){
+                    obj_binary_errmsg(loader, __func__);
+                    fprintf(stderr, "List with no cells\n");
+                    return 1;
+                }
+                /* All of the list's cells are allocated together */
+                obj = obj_pool_objs_alloc(pool, n * 2);
+                if(!obj)return 1;
+                for(size_t i = 0; i < n; i++){
+                    obj[i * 2].tag = OBJ_TYPE_CELL;
+                    OBJ_CELL_RUN(obj + i * 2) =
+                        n - i > INT_MAX? INT_MAX: n - i;
+                    OBJ_HEAD(obj + i * 2) = NULL;
+                    OBJ_TAIL(obj + i * 2) = i < n - 1? obj + i * 2 + 2: NULL;
+                }
+                n++; /* the tail */
+            }else if(type == OBJ_TYPE_QUEUE){
+                obj = obj_pool_add_queue(pool, &pool->nil);
+                if(!obj)return 1;
+                n = 1;
+            }else if(type == OBJ_TYPE_ARRAY){
+                if(obj_binary_read_len(loader, &n, max_len))return 1;
+                obj = obj_pool_add_array(pool, n);
+                if(!obj)return 1;
+            }else if(type == OBJ_TYPE_VEC){
+                if(obj_binary_read_len(loader, &n, max_len))return 1;
+                obj = obj_pool_add_vec(pool, n);
+                if(!obj)return 1;
+            }else if(type == OBJ_TYPE_MAP){
+                /* The table is grown as entries are loaded */
+                if(obj_binary_read_len(loader, &n, max_len))return 1;
+                obj = obj_pool_add_map(pool);
+                if(!obj)return 1;
+            }else if(type == OBJ_TYPE_OMAP){
+                /* Entries are loaded into an array, from which the tree
+                is built once they're all there (see
+                obj_binary_read_nodes) */
+                if(obj_binary_read_len(loader, &n, max_len))return 1;
+                n *= 2;
+                obj_t *entries = obj_pool_add_array(pool, n);
+                if(!entries)return 1;
+                obj = obj_pool_add_omap_raw(pool, 0, 0, entries);
+                if(!obj)return 1;
+            }else if(type == OBJ_TYPE_PQUEUE){
+                /* Entries are loaded straight into the heap, which is
+                heapified once they're all there */
+                if(obj_binary_read_len(loader, &n, max_len))return 1;
+                obj_t *heap = obj_pool_add_array(pool, n * 2);
+                if(!heap)return 1;
+                obj = obj_pool_add_pqueue(pool);
+                if(!obj)return 1;
+                OBJ_PQUEUE_LEN(obj) = n;
+                OBJ_PQUEUE_HEAP(obj) = heap;
+                n *= 2;
+            }else if(type == OBJ_TYPE_INTARR){
+                int kind;
+                if(obj_binary_read_byte(loader, &kind))return 1;
+                if(kind >= OBJ_INTARR_KINDS){
+                    obj_binary_errmsg(loader, __func__);
+                    fprintf(stderr, "Unrecognized intarr kind: %i\n", kind);
+                    return 1;
+                }
+                if(obj_binary_read_len(loader, &n, max_len))return 1;
+                obj = obj_pool_add_intarr(pool, kind, n);
+                if(!obj)return 1;
+                *obj_ptr = obj;
+                if(kind == OBJ_INTARR_U8){
+                    if(n > loader->data_len - loader->pos){
+                        obj_binary_errmsg(loader, __func__);
+                        fprintf(stderr, "Unexpected end of data\n");
+                        return 1;
+                    }
+                    memcpy(OBJ_INTARR_U8(obj), loader->data + loader->pos, n);
+                    loader->pos += n;
+                }else{
+                    for(size_t i = 0; i < n; i++){
+                        size_t u;
+                        if(obj_binary_read_varint(loader, &u))return 1;
+                        OBJ_INTARR_I32(obj)[i] = obj_binary_unzigzag(u);
+                    }
+                }
+                /* Elements aren't nodes, so no frame */
+                return 0;
+            }else if(type == OBJ_TYPE_STRUCT){
+                if(obj_binary_read_len(loader, &n, max_len))return 1;
+                obj_sym_t *small_syms[16];
+                obj_sym_t **syms = n > 16?
+                    malloc(n * sizeof(*syms)): small_syms;
+                if(!syms){
+                    perror("malloc");
+                    return 1;
+                }
+                obj_shape_t *shape = NULL;
+                size_t i;
+                for(i = 0; i < n; i++){
+                    if(!(syms[i] = obj_binary_read_sym(loader)))break;
+                }
+                if(i == n)shape = obj_pool_get_shape_raw(pool, syms, n);
+                if(syms != small_syms)free(syms);
+                if(!shape)return 1;
+                obj = obj_pool_add_struct(pool, shape);
+                if(!obj)return 1;
+            }else{
+                obj_sym_t *module_name = obj_binary_read_sym(loader);
+                if(!module_name)return 1;
+                obj_sym_t *def_name = obj_binary_read_sym(loader);
+                if(!def_name)return 1;
+                obj = obj_pool_add_fun(pool, module_name, def_name,
+                    &pool->nil);
+                if(!obj)return 1;
+                n = 1;
+            }
+            *obj_ptr = obj;
+            break;
+        }
+        default:
+            loader->pos--;
+            obj_binary_errmsg(loader, __func__);
+            fprintf(stderr, "Unrecognized type: %i\n", type);
+            return 1;
+    }
+
+    obj_binary_frame_t *frame = obj_binary_push_frame(
+        &loader->stack, &loader->stack_len, &loader->stack_tos);
+    if(!frame)return 1;
+    frame->type = type;
+    frame->obj = obj;
+    frame->n = n;
+    return 0;
+}
+
+static obj_t *obj_binary_read_nodes(obj_binary_loader_t *loader){
+    /* Reads a node and all its descendants, without recursing in C */
+    obj_t *root = NULL;
+    if(obj_binary_read_node(loader, &root, NULL))return NULL;
+    while(loader->stack_tos){
+        obj_binary_frame_t *frame = &loader->stack[loader->stack_tos - 1];
+        obj_t *obj = frame->obj;
+        if(frame->i >= frame->n){
+            if(frame->type == OBJ_TYPE_QUEUE){
+                OBJ_QUEUE_END(obj) = obj_list_get_end(
+                    &OBJ_QUEUE_LIST(obj));
+            }else if(frame->type == OBJ_TYPE_OMAP){
+                obj_t *entries = OBJ_OMAP_ROOT(obj);
+                obj_t *omap = obj_pool_add_omap_from_entries(loader->pool,
+                    OBJ_ARRAY_IGET(entries, 0), OBJ_ARRAY_LEN(entries) / 2);
+                if(!omap){
+                    obj_binary_errmsg(loader, __func__);
+                    fprintf(stderr, "Bad omap\n");
+                    return NULL;
+                }
+                obj[0] = omap[0];
+                obj[1] = omap[1];
+            }else if(frame->type == OBJ_TYPE_PQUEUE){
+                if(obj_pqueue_heapify(obj)){
+                    obj_binary_errmsg(loader, __func__);
+                    fprintf(stderr, "Bad pqueue\n");
+                    return NULL;
+                }
+            }
+            loader->stack_tos--;
+            continue;
+        }
+        size_t i = frame->i++;
+        obj_t **obj_ptr = NULL;
+        obj_t *slot = NULL;
+        switch(frame->type){
+            case OBJ_TYPE_CELL:
+                obj_ptr = i < frame->n - 1?
+                    &OBJ_HEAD(obj + i * 2): &OBJ_TAIL(obj + (i - 1) * 2);
+                break;
+            case OBJ_TYPE_QUEUE:
+                obj_ptr = &OBJ_QUEUE_LIST(obj);
+                break;
+            case OBJ_TYPE_ARRAY:
+                slot = OBJ_ARRAY_IGET(obj, i);
+                break;
+            case OBJ_TYPE_DICT: {
+                obj_sym_t *sym = obj_binary_read_sym(loader);
+                if(!sym)return NULL;
+                obj_dict_entry_t *entry = obj_dict_set(OBJ_DICT(obj), sym,
+                    &loader->pool->null);
+                if(!entry)return NULL;
+                slot = &entry->value;
+                break;
+            }
+            case OBJ_TYPE_STRUCT:
+                slot = OBJ_STRUCT_IGET_VAL(obj, i);
+                break;
+            case OBJ_TYPE_FUN:
+                obj_ptr = &OBJ_FUN_ARGS(obj);
+                break;
+            case OBJ_TYPE_VEC:
+                slot = OBJ_VEC_IGET(obj, i);
+                break;
+            case OBJ_TYPE_MAP: {
+                /* Keys have no children, so can be loaded into a
+                temporary obj (but we check, since a DICT or BOX key
+                would push a frame pointing at it) */
+                int key_type = loader->pos < loader->data_len?
+                    (unsigned char)loader->data[loader->pos]: -1;
+                if(key_type != OBJ_TYPE_INT && key_type != OBJ_TYPE_SYM &&
+                    key_type != OBJ_TYPE_STR
+                ){
+                    obj_binary_errmsg(loader, __func__);
+                    fprintf(stderr, "Bad map key type: %i\n", key_type);
+                    return NULL;
+                }
+                obj_t key;
+                if(obj_binary_read_node(loader, NULL, &key))return NULL;
+                slot = obj_map_set(loader->pool, obj, &key,
+                    &loader->pool->null);
+                if(!slot)return NULL;
+                break;
+            }
+            case OBJ_TYPE_OMAP:
+                slot = OBJ_ARRAY_IGET(OBJ_OMAP_ROOT(obj), i);
+                break;
+            case OBJ_TYPE_PQUEUE:
+                slot = OBJ_ARRAY_IGET(OBJ_PQUEUE_HEAP(obj), i);
+                break;
+            default: /* OBJ_TYPE_BOX */
+                obj_ptr = &OBJ_CONTENTS(obj);
+                break;
+        }
+        if(obj_binary_read_node(loader, obj_ptr, slot))return NULL;
+    }
+    return root;
+}
+
+obj_t *obj_binary_parse(obj_pool_t *pool, const char *filename,
+    const char *data, size_t data_len
+){
+    /* Loads an obj written by obj_binary_write into pool */
+    obj_binary_loader_t _loader, *loader=&_loader;
+    memset(loader, 0, sizeof(*loader));
+    loader->pool = pool;
+    loader->filename = filename;
+    loader->data = data;
+    loader->data_len = data_len;
+
+    obj_t *obj = NULL;
+    if(data_len < OBJ_BINARY_MAGIC_LEN + 1 ||
+        memcmp(data, OBJ_BINARY_MAGIC, OBJ_BINARY_MAGIC_LEN)
+    ){
+        obj_binary_errmsg(loader, __func__);
+        fprintf(stderr, "Not a binary obj file\n");
+        return NULL;
+    }
+    loader->pos = OBJ_BINARY_MAGIC_LEN;
+    int version;
+    if(obj_binary_read_byte(loader, &version))return NULL;
+    if(version != OBJ_BINARY_VERSION){
+        obj_binary_errmsg(loader, __func__);
+        fprintf(stderr, "Unsupported version: %i (expected %i)\n",
+            version, OBJ_BINARY_VERSION);
+        return NULL;
+    }
+
+    size_t n_objs;
+    if(obj_binary_read_len(loader, &loader->n_syms, data_len))return NULL;
+    if(obj_binary_read_varint(loader, &n_objs))return NULL;
+
+    loader->syms = malloc(loader->n_syms * sizeof(*loader->syms) + 1);
+    if(!loader->syms){
+        obj_binary_errmsg(loader, __func__);
+        perror("malloc");
+        return NULL;
+    }
+    for(size_t i = 0; i < loader->n_syms; i++){
+        size_t len;
+        if(obj_binary_read_data_len(loader, &len))goto done;
+        loader->syms[i] = obj_symtable_get_sym_raw(pool->symtable,
+            data + loader->pos, len);
+        if(!loader->syms[i])goto done;
+        loader->pos += len;
+    }
+
+    /* n_objs is only a hint, so don't trust it too far */
+    if(n_objs <= (data_len - loader->pos) * 2){
+        if(!obj_pool_reserve(pool, n_objs))goto done;
+    }
+    obj = obj_binary_read_nodes(loader);
+
+done:
+    free(loader->syms);
+    free(loader->stack);
+    return obj;
+}
+
+
+/************
+* obj_image *
+************/
+
+/* Images are snapshots of an entire pool (and its symtable), laid out
+in a single block of memory with every pointer replaced by an offset
+from the start of the image.
+So an image can be written to a file, and later mmapped (or loaded)
+into any process at any address, and either:
+    * Navigated in place, read-only, with the obj_image_* accessors
+    (e.g. OBJ_IMAGE_HEAD instead of OBJ_HEAD), which translate offsets
+    as they go. So multiple processes mmapping the same file share its
+    pages.
+    * Relocated in place with obj_image_relocate, if the memory is
+    writable (e.g. a private mapping), after which it's a regular
+    graph of objs which can be used with the usual macros and
+    functions, but mustn't be modified in ways which allocate.
+
+Layout:
+    header
+    syms: array of obj_sym_t
+    strings: array of obj_string_t
+    dicts: array of obj_dict_t
+    entries: entries of dicts which aren't small
+    shapes: obj_shape_t blocks (each followed by its keys & index)
+    objs: array of obj_t (the pool's null, nil, T, F, then its chunks)
+    text: contents of syms and strings, each followed by a NUL byte
+
+Offset 0 (the header) stands for NULL.
+Images aren't portable between platforms with different sizes of
+pointers, ints, or endianness; obj_image_init checks for this. */
+
+#define OBJ_IMAGE_MAGIC "COBJIMG"
+#define OBJ_IMAGE_VERSION 1
+#define OBJ_IMAGE_ALIGN 16
+#define OBJ_IMAGE_ALIGNED(size) \
+    (((size) + OBJ_IMAGE_ALIGN - 1) & ~(size_t)(OBJ_IMAGE_ALIGN - 1))
+
+/* Sections of an image which its offsets point into (see
+obj_image_offset_ok) */
+#define OBJ_IMAGE_SYMS 0
+#define OBJ_IMAGE_STRINGS 1
+#define OBJ_IMAGE_DICTS 2
+#define OBJ_IMAGE_ENTRIES 3
+#define OBJ_IMAGE_SHAPES 4
+#define OBJ_IMAGE_OBJS 5
+#define OBJ_IMAGE_OBJ_FIELDS 6
+    /* (The u field of an obj, e.g. a queue's end) */
+#define OBJ_IMAGE_TEXT 7
+
+static const char *obj_image_section_names[] = {
+    "syms", "strings", "dicts", "entries", "shapes", "objs", "objs",
+    "text"
+};
+
+/* Accessors for images which haven't been relocated.
+Each offset is checked to point at an element of the section its type
+belongs in, and they return NULL if it doesn't. */
+#define OBJ_IMAGE_PTR(image, ptr, section) \
+    obj_image_ptr(image, ptr, section)
+#define OBJ_IMAGE_HEAD(image, obj) \
+    ((obj_t*)OBJ_IMAGE_PTR(image, OBJ_HEAD(obj), OBJ_IMAGE_OBJS))
+#define OBJ_IMAGE_TAIL(image, obj) obj_image_tail(image, obj)
+#define OBJ_IMAGE_CONTENTS(image, obj) \
+    ((obj_t*)OBJ_IMAGE_PTR(image, OBJ_CONTENTS(obj), OBJ_IMAGE_OBJS))
+#define OBJ_IMAGE_SYM(image, obj) \
+    ((obj_sym_t*)OBJ_IMAGE_PTR(image, OBJ_SYM(obj), OBJ_IMAGE_SYMS))
+/* (Not for inline strs, see OBJ_STR_IS_INLINE) */
+#define OBJ_IMAGE_STRING(image, obj) \
+    ((obj_string_t*)OBJ_IMAGE_PTR(image, OBJ_STRING(obj), \
+        OBJ_IMAGE_STRINGS))
+#define OBJ_IMAGE_STRING_DATA(image, string) \
+    obj_image_string_data(image, string)
+#define OBJ_IMAGE_DICT(image, obj) \
+    ((obj_dict_t*)OBJ_IMAGE_PTR(image, OBJ_DICT(obj), OBJ_IMAGE_DICTS))
+#define OBJ_IMAGE_STRUCT_SHAPE(image, obj) \
+    ((obj_shape_t*)OBJ_IMAGE_PTR(image, OBJ_STRUCT_SHAPE(obj), \
+        OBJ_IMAGE_SHAPES))
+
+struct obj_image_header {
+    char magic[8];
+    uint32_t version;
+    uint16_t ptr_size;
+    uint16_t obj_size;
+    uint32_t endian;
+    uint32_t n_syms;
+
+    uint64_t size;
+    uint64_t root;
+        /* size: size of whole image in bytes */
+        /* root: offset of the obj which was passed to
+        obj_image_write */
+
+    uint64_t syms_offset;
+    uint64_t strings_offset;
+    uint64_t n_strings;
+    uint64_t dicts_offset;
+    uint64_t n_dicts;
+    uint64_t entries_offset;
+    uint64_t shapes_offset;
+    uint64_t shapes_size;
+    uint64_t objs_offset;
+    uint64_t n_objs;
+    uint64_t text_offset;
+};
+
+struct obj_image {
+    char *data;
+    size_t size;
+    obj_image_header_t *header;
+    bool relocated;
+};
+
+static bool obj_image_offset_ok(const obj_image_header_t *header,
+    uintptr_t offset, int section
+){
+    /* Checks that offset points exactly at an element of given section
+    of image (which must have passed obj_image_init).
+    Shapes vary in size, so for them we can only check that offset is
+    suitably aligned; see obj_image_shape_fits. */
+    uint64_t start, n;
+    size_t stride;
+    switch(section){
+        case OBJ_IMAGE_SYMS:
+            start = header->syms_offset;
+            n = header->n_syms;
+            stride = sizeof(obj_sym_t);
+            break;
+        case OBJ_IMAGE_STRINGS:
+            start = header->strings_offset;
+            n = header->n_strings;
+            stride = sizeof(obj_string_t);
+            break;
+        case OBJ_IMAGE_DICTS:
+            start = header->dicts_offset;
+            n = header->n_dicts;
+            stride = sizeof(obj_dict_t);
+            break;
+        case OBJ_IMAGE_ENTRIES:
+            start = header->entries_offset;
+            stride = sizeof(obj_dict_entry_t);
+            n = (header->shapes_offset - start) / stride;
+            break;
+        case OBJ_IMAGE_SHAPES:
+            start = header->shapes_offset;
+            stride = OBJ_IMAGE_ALIGN;
+            n = header->shapes_size / stride;
+            break;
+        case OBJ_IMAGE_OBJS:
+        case OBJ_IMAGE_OBJ_FIELDS:
+            start = header->objs_offset;
+            if(section == OBJ_IMAGE_OBJ_FIELDS)start += offsetof(obj_t, u);
+            n = header->n_objs;
+            stride = sizeof(obj_t);
+            break;
+        default:
+            start = header->text_offset;
+            n = header->size - start;
+            stride = 1;
+            break;
+    }
+    return offset >= start && (offset - start) % stride == 0 &&
+        (offset - start) / stride < n;
+}
+
+typedef struct obj_image_range {
+    const char *start;
+    size_t size;
+    size_t offset;
+} obj_image_range_t;
+
+typedef struct obj_image_fixer {
+    char *base;
+    const obj_image_header_t *header;
+    bool *shape_starts;
+    bool *obj_starts;
+    obj_image_range_t *ranges;
+    size_t n_ranges;
+    size_t ranges_len;
+    obj_sym_t **sym_map;
+    obj_sym_t *syms;
+    size_t n_syms;
+    bool err;
+        /* When relocating, base is the image, and we turn offsets into
+        pointers, checking that each one points at an element of the
+        section (see obj_image_offset_ok) its type belongs in.
+        shape_starts marks which of header's shapes section's
+        OBJ_IMAGE_ALIGN-byte blocks a shape starts at, and obj_starts
+        which of its objs start a value (rather than being a later obj
+        of a multi-obj type, or an intarr's data).
+        When writing, ranges maps each region of the pool's memory to
+        its offset in the image, and we turn pointers into offsets.
+        When interning, sym_map maps each of image's n_syms syms
+        (an array starting at syms) to a sym from some symtable, and
+        we replace sym pointers, leaving all others alone. */
+} obj_image_fixer_t;
+
+static int obj_image_add_range(obj_image_fixer_t *fixer,
+    const void *start, size_t size, size_t offset
+){
+    if(fixer->n_ranges >= fixer->ranges_len){
+        size_t ranges_len = fixer->ranges_len? fixer->ranges_len * 2: 64;
+        obj_image_range_t *ranges = realloc(fixer->ranges,
+            ranges_len * sizeof(*ranges));
+        if(!ranges){
+            fprintf(stderr, "%s: Couldn't grow ranges to %zu. ",
+                __func__, ranges_len);
+            perror("realloc");
+            return 1;
+        }
+        fixer->ranges = ranges;
+        fixer->ranges_len = ranges_len;
+    }
+    obj_image_range_t *range = &fixer->ranges[fixer->n_ranges++];
+    range->start = start;
+    range->size = size;
+    range->offset = offset;
+    return 0;
+}
+
+static int obj_image_range_cmp(const void *a, const void *b){
+    const char *start_a = ((const obj_image_range_t*)a)->start;
+    const char *start_b = ((const obj_image_range_t*)b)->start;
+    return start_a < start_b? -1: start_a > start_b? 1: 0;
+}
+
+static void *obj_image_fix(obj_image_fixer_t *fixer, const void *ptr,
+    int section
+){
+    /* section: which section of the image ptr should point into (only
+    checked when relocating) */
+    if(!ptr)return NULL;
+    if(fixer->sym_map)return (void*)ptr;
+    if(fixer->base){
+        const obj_image_header_t *header = fixer->header;
+        uintptr_t offset = (uintptr_t)ptr;
+        bool ok = obj_image_offset_ok(header, offset, section);
+        if(ok && section == OBJ_IMAGE_SHAPES){
+            ok = fixer->shape_starts[
+                (offset - header->shapes_offset) / OBJ_IMAGE_ALIGN];
+        }else if(ok && section == OBJ_IMAGE_OBJS){
+            ok = fixer->obj_starts[
+                (offset - header->objs_offset) / sizeof(obj_t)];
+        }else if(ok && section == OBJ_IMAGE_OBJ_FIELDS){
+            /* A queue's end points at its own list field if it's
+            empty, otherwise at the tail field of its last cell */
+            size_t i = (offset - header->objs_offset) / sizeof(obj_t);
+            obj_t *objs = (obj_t*)(fixer->base + header->objs_offset);
+            ok = (fixer->obj_starts[i] &&
+                    OBJ_TYPE(&objs[i]) == OBJ_TYPE_QUEUE) ||
+                (i && fixer->obj_starts[i - 1] &&
+                    OBJ_TYPE(&objs[i - 1]) == OBJ_TYPE_CELL);
+        }
+        if(!ok){
+            if(!fixer->err){
+                fprintf(stderr, "%s: Offset %zu doesn't point at an "
+                    "element of image's %s\n", __func__, (size_t)offset,
+                    obj_image_section_names[section]);
+            }
+            fixer->err = true;
+            return NULL;
+        }
+        return fixer->base + offset;
+    }
+
+    /* Binary search for last range starting at or before ptr */
+    const char *p = ptr;
+    size_t lo = 0, hi = fixer->n_ranges;
+    while(hi - lo > 1){
+        size_t mid = lo + (hi - lo) / 2;
+        if(fixer->ranges[mid].start <= p)lo = mid;
+        else hi = mid;
+    }
+    obj_image_range_t *range = fixer->n_ranges? &fixer->ranges[lo]: NULL;
+    if(!range || p < range->start || p >= range->start + range->size){
+        if(!fixer->err){
+            fprintf(stderr, "%s: Pointer %p doesn't point into pool\n",
+                __func__, ptr);
+        }
+        fixer->err = true;
+        return NULL;
+    }
+    return (void*)(uintptr_t)(range->offset + (p - range->start));
+}
+
+static obj_sym_t *obj_image_fix_sym(obj_image_fixer_t *fixer,
+    obj_sym_t *sym
+){
+    if(!sym || !fixer->sym_map){
+        return obj_image_fix(fixer, sym, OBJ_IMAGE_SYMS);
+    }
+    size_t i = sym - fixer->syms;
+    if(sym < fixer->syms || i >= fixer->n_syms){
+        if(!fixer->err){
+            fprintf(stderr, "%s: Sym %p doesn't point into image\n",
+                __func__, sym);
+        }
+        fixer->err = true;
+        return NULL;
+    }
+    return fixer->sym_map[i];
+}
+
+#define OBJ_IMAGE_FIX(fixer, field, section) \
+    ((field) = obj_image_fix(fixer, field, section))
+#define OBJ_IMAGE_FIX_SYM(fixer, field) \
+    ((field) = obj_image_fix_sym(fixer, field))
+
+static size_t obj_image_obj_len(obj_t *obj){
+    /* Number of objs taken up by obj's type (an array's or struct's
+    values are regular objs, so aren't counted) */
+    switch(OBJ_TYPE(obj)){
+        case OBJ_TYPE_CELL:
+        case OBJ_TYPE_QUEUE:
+        case OBJ_TYPE_VEC:
+        case OBJ_TYPE_MAP:
+        case OBJ_TYPE_OMAP:
+        case OBJ_TYPE_PQUEUE: return 2;
+        case OBJ_TYPE_FUN: return 3;
+        case OBJ_TYPE_INTARR: return OBJ_INTARR_N_OBJS(obj);
+        default: return 1;
+    }
+}
+
+static bool obj_image_objs_fit(obj_image_fixer_t *fixer,
+    size_t i, size_t n, size_t n_objs
+){
+    /* Checks that a multi-obj type taking up n objs, starting at index i
+    of a run of n_objs, doesn't run past the end of the run */
+    if(n && n <= n_objs - i)return true;
+    if(!fixer->err){
+        fprintf(stderr, "%s: Obj %zu of a run of %zu has %zu objs\n",
+            __func__, i, n_objs, n);
+    }
+    fixer->err = true;
+    return false;
+}
+
+static void obj_image_fix_objs(obj_image_fixer_t *fixer,
+    obj_t *objs, size_t n_objs
+){
+    /* Fixes the pointers in a run of objs, such as a pool chunk.
+    Multi-obj types (cells, queues, funs, vecs, intarrs) are
+    recognized by their first obj's tag, and skipped over as a whole;
+    the elements of arrays and structs are regular objs, fixed one at a
+    time. */
+    size_t i = 0;
+    while(i < n_objs){
+        obj_t *obj = &objs[i];
+        size_t len = obj_image_obj_len(obj);
+        if(!obj_image_objs_fit(fixer, i, len, n_objs))return;
+        switch(OBJ_TYPE(obj)){
+            case OBJ_TYPE_SYM: OBJ_IMAGE_FIX_SYM(fixer, OBJ_SYM(obj)); break;
+            case OBJ_TYPE_STR:
+                if(!OBJ_STR_IS_INLINE(obj)){
+                    OBJ_IMAGE_FIX(fixer, OBJ_STRING(obj), OBJ_IMAGE_STRINGS);
+                }else if(fixer->base &&
+                    OBJ_STR_INLINE_LEN(obj) > OBJ_STR_INLINE_MAX
+                ){
+                    fprintf(stderr, "%s: Inline str is too long\n",
+                        __func__);
+                    fixer->err = true;
+                }
+                break;
+            case OBJ_TYPE_STRBUF:
+                /* An image's strings can't grow, so strbufs are saved
+                as strs */
+                OBJ_IMAGE_FIX(fixer, OBJ_STRING(obj), OBJ_IMAGE_STRINGS);
+                if(!fixer->base && !fixer->sym_map){
+                    obj->tag = obj->tag & ~OBJ_TYPE_MASK | OBJ_TYPE_STR;
+                }
+                break;
+            case OBJ_TYPE_DICT:
+                OBJ_IMAGE_FIX(fixer, OBJ_DICT(obj), OBJ_IMAGE_DICTS);
+                break;
+            case OBJ_TYPE_BOX:
+                OBJ_IMAGE_FIX(fixer, OBJ_CONTENTS(obj), OBJ_IMAGE_OBJS);
+                break;
+            case OBJ_TYPE_STRUCT:
+                /* (When relocating, shapes have already been fixed, so
+                we can check the struct's values are all there) */
+                OBJ_IMAGE_FIX(fixer, OBJ_STRUCT_SHAPE(obj), OBJ_IMAGE_SHAPES);
+                if(fixer->base && OBJ_STRUCT_SHAPE(obj)){
+                    obj_image_objs_fit(fixer, i,
+                        1 + (size_t)OBJ_STRUCT_SHAPE(obj)->n_keys, n_objs);
+                }
+                break;
+            case OBJ_TYPE_ARRAY:
+                if(fixer->base){
+                    obj_image_objs_fit(fixer, i,
+                        OBJ_ARRAY_LEN(obj) < 0? 0:
+                            1 + (size_t)OBJ_ARRAY_LEN(obj),
+                        n_objs);
+                }
+                break;
+            case OBJ_TYPE_CELL:
+                OBJ_IMAGE_FIX(fixer, OBJ_HEAD(obj), OBJ_IMAGE_OBJS);
+                OBJ_IMAGE_FIX(fixer, OBJ_TAIL(obj), OBJ_IMAGE_OBJS);
+                break;
+            case OBJ_TYPE_QUEUE:
+                OBJ_IMAGE_FIX(fixer, OBJ_QUEUE_LIST(obj), OBJ_IMAGE_OBJS);
+                OBJ_IMAGE_FIX(fixer, OBJ_QUEUE_END(obj),
+                    OBJ_IMAGE_OBJ_FIELDS);
+                break;
+            case OBJ_TYPE_FUN:
+                OBJ_IMAGE_FIX_SYM(fixer, OBJ_FUN_MODULE_NAME(obj));
+                OBJ_IMAGE_FIX_SYM(fixer, OBJ_FUN_DEF_NAME(obj));
+                OBJ_IMAGE_FIX(fixer, OBJ_FUN_ARGS(obj), OBJ_IMAGE_OBJS);
+                break;
+            case OBJ_TYPE_VEC:
+                OBJ_IMAGE_FIX(fixer, OBJ_VEC_ROOT(obj), OBJ_IMAGE_OBJS);
+                break;
+            case OBJ_TYPE_MAP:
+                OBJ_IMAGE_FIX(fixer, OBJ_MAP_TABLE(obj), OBJ_IMAGE_OBJS);
+                break;
+            case OBJ_TYPE_OMAP:
+                OBJ_IMAGE_FIX(fixer, OBJ_OMAP_ROOT(obj), OBJ_IMAGE_OBJS);
+                break;
+            case OBJ_TYPE_PQUEUE:
+                OBJ_IMAGE_FIX(fixer, OBJ_PQUEUE_HEAP(obj), OBJ_IMAGE_OBJS);
+                break;
+            default: break;
+        }
+        i += len;
+    }
+}
+
+static void obj_image_mark_objs(obj_image_fixer_t *fixer,
+    obj_t *objs, size_t n_objs
+){
+    /* Marks which of a run of objs start a value in fixer->obj_starts,
+    skipping over multi-obj types the way obj_image_fix_objs does */
+    size_t i = 0;
+    while(i < n_objs){
+        size_t len = obj_image_obj_len(&objs[i]);
+        if(!obj_image_objs_fit(fixer, i, len, n_objs))return;
+        fixer->obj_starts[i] = true;
+        i += len;
+    }
+}
+
+static void obj_image_fix_entries(obj_image_fixer_t *fixer,
+    obj_dict_entry_t *entries, size_t entries_len
+){
+    for(size_t i = 0; i < entries_len; i++){
+        obj_dict_entry_t *entry = &entries[i];
+        if(!entry->sym)continue;
+        OBJ_IMAGE_FIX_SYM(fixer, entry->sym);
+        obj_image_fix_objs(fixer, &entry->value, 1);
+    }
+}
+
+static void obj_image_fix_shape(obj_image_fixer_t *fixer,
+    obj_shape_t *shape
+){
+    /* Shape's keys and index follow it directly (see obj_shape_create),
+    so we can find them without following its pointers */
+    obj_t *keys = (obj_t*)(shape + 1);
+    int *index = (int*)(keys + shape->n_keys);
+    shape->next = NULL;
+    if(fixer->base){
+        /* ...so when relocating, rather than trusting the stored
+        offsets, we check them against where they should point */
+        if((uintptr_t)shape->keys != (uintptr_t)((char*)keys - fixer->base) ||
+            (uintptr_t)shape->index != (uintptr_t)((char*)index - fixer->base)
+        ){
+            fprintf(stderr, "%s: Shape's keys or index is misplaced\n",
+                __func__);
+            fixer->err = true;
+            return;
+        }
+        for(int i = 0; i < shape->n_keys; i++){
+            if(OBJ_TYPE(&keys[i]) == OBJ_TYPE_SYM)continue;
+            fprintf(stderr, "%s: Shape's key isn't a sym\n", __func__);
+            fixer->err = true;
+            return;
+        }
+        shape->keys = keys;
+        shape->index = index;
+    }else{
+        OBJ_IMAGE_FIX(fixer, shape->keys, OBJ_IMAGE_SHAPES);
+        OBJ_IMAGE_FIX(fixer, shape->index, OBJ_IMAGE_SHAPES);
+    }
+    obj_image_fix_objs(fixer, keys, shape->n_keys);
+}
+
+static bool obj_image_shape_fits(obj_shape_t *shape, size_t avail){
+    /* Checks that shape, with its keys and index, fits in avail bytes,
+    and that its index is the size its index_bits say */
+    if(avail < sizeof(*shape) || shape->n_keys < 0 ||
+        shape->index_bits < 0 || shape->index_bits >= 32 ||
+        shape->index_len != (size_t)1 << shape->index_bits
+    )return false;
+    avail -= sizeof(*shape);
+    if((size_t)shape->n_keys > avail / sizeof(*shape->keys))return false;
+    avail -= shape->n_keys * sizeof(*shape->keys);
+    return shape->index_len <= avail / sizeof(*shape->index);
+}
+
+static size_t obj_image_shape_size(obj_shape_t *shape){
+    return OBJ_IMAGE_ALIGNED(sizeof(*shape)
+        + shape->n_keys * sizeof(*shape->keys)
+        + shape->index_len * sizeof(*shape->index));
+}
+
+int obj_image_write(obj_writer_t *writer, obj_pool_t *pool, obj_t *root){
+    /* Writes an image of pool and its symtable (see above).
+    root should be an obj in pool; it's what obj_image_root will
+    return. */
+    obj_symtable_t *table = pool->symtable;
+    obj_symtable_slots_t *slots = table->slots;
+    size_t syms_len = slots? slots->len: 0;
+
+    /* Measure everything */
+    size_t n_syms = 0, n_strings = 0, n_dicts = 0, n_objs = 4;
+    size_t entries_size = 0, shapes_size = 0, text_size = 0;
+    for(size_t i = 0; i < syms_len; i++){
+        obj_sym_t *sym = slots->syms[i];
+        if(!sym)continue;
+        n_syms++;
+        text_size += sym->string.len + 1;
+    }
+    for(obj_string_list_t *node = pool->string_list; node;
+        node = node->next
+    ){
+        n_strings++;
+        text_size += node->string.len + 1;
+    }
+    for(obj_dict_chunk_t *chunk = pool->dict_chunk_list; chunk;
+        chunk = chunk->next
+    ){
+        for(size_t i = 0; i < chunk->len; i++){
+            obj_dict_t *dict = &chunk->dicts[i];
+            n_dicts++;
+            if(!OBJ_DICT_IS_SMALL(dict)){
+                entries_size += dict->entries_len * sizeof(*dict->entries);
+            }
+        }
+    }
+    for(int i = 0; i < OBJ_POOL_SHAPE_BUCKETS; i++){
+        for(obj_shape_t *shape = pool->shapes[i]; shape;
+            shape = shape->next
+        )shapes_size += obj_image_shape_size(shape);
+    }
+    for(obj_pool_chunk_t *chunk = pool->chunk_list; chunk;
+        chunk = chunk->next
+    )n_objs += chunk->len;
+
+    if(n_syms > UINT32_MAX){
+        fprintf(stderr, "%s: Too many syms: %zu\n", __func__, n_syms);
+        return 1;
+    }
+
+    /* Lay out the image */
+    obj_image_header_t header;
+    memset(&header, 0, sizeof(header));
+    size_t size = OBJ_IMAGE_ALIGNED(sizeof(header));
+    header.syms_offset = size;
+    size += OBJ_IMAGE_ALIGNED(n_syms * sizeof(obj_sym_t));
+    header.strings_offset = size;
+    size += OBJ_IMAGE_ALIGNED(n_strings * sizeof(obj_string_t));
+    header.dicts_offset = size;
+    size += OBJ_IMAGE_ALIGNED(n_dicts * sizeof(obj_dict_t));
+    header.entries_offset = size;
+    size += OBJ_IMAGE_ALIGNED(entries_size);
+    header.shapes_offset = size;
+    size += shapes_size;
+    header.objs_offset = size;
+    size += n_objs * sizeof(obj_t);
+    header.text_offset = size;
+    size += OBJ_IMAGE_ALIGNED(text_size);
+
+    strncpy(header.magic, OBJ_IMAGE_MAGIC, sizeof(header.magic));
+    header.version = OBJ_IMAGE_VERSION;
+    header.ptr_size = sizeof(void*);
+    header.obj_size = sizeof(obj_t);
+    header.endian = 1;
+    header.n_syms = n_syms;
+    header.size = size;
+    header.n_strings = n_strings;
+    header.n_dicts = n_dicts;
+    header.shapes_size = shapes_size;
+    header.n_objs = n_objs;
+
+    char *image = obj_writer_reserve(writer, size);
+    if(!image)return 1;
+    memset(image, 0, size);
+
+    /* Copy everything into the image, remembering where it came
+    from */
+    obj_image_fixer_t _fixer, *fixer=&_fixer;
+    memset(fixer, 0, sizeof(*fixer));
+    int err = 1;
+    size_t text_pos = header.text_offset;
+
+    obj_sym_t *image_syms = (obj_sym_t*)(image + header.syms_offset);
+    for(size_t i = 0, j = 0; i < syms_len; i++){
+        obj_sym_t *sym = slots->syms[i];
+        if(!sym)continue;
+        image_syms[j] = *sym;
+        if(obj_image_add_range(fixer, sym, sizeof(*sym),
+            header.syms_offset + j * sizeof(*sym)))goto done;
+        if(obj_image_add_range(fixer, sym->string.data,
+            sym->string.len + 1, text_pos))goto done;
+        memcpy(image + text_pos, sym->string.data, sym->string.len);
+        text_pos += sym->string.len + 1;
+        j++;
+    }
+
+    obj_string_t *image_strings =
+        (obj_string_t*)(image + header.strings_offset);
+    size_t n = 0;
+    for(obj_string_list_t *node = pool->string_list; node;
+        node = node->next
+    ){
+        obj_string_t *string = &node->string;
+        image_strings[n] = *string;
+        if(obj_image_add_range(fixer, string, sizeof(*string),
+            header.strings_offset + n * sizeof(*string)))goto done;
+        if(obj_image_add_range(fixer, string->data, string->len + 1,
+            text_pos))goto done;
+        memcpy(image + text_pos, string->data, string->len);
+        text_pos += string->len + 1;
+        n++;
+    }
+
+    obj_dict_t *image_dicts = (obj_dict_t*)(image + header.dicts_offset);
+    size_t entries_pos = header.entries_offset;
+    n = 0;
+    for(obj_dict_chunk_t *chunk = pool->dict_chunk_list; chunk;
+        chunk = chunk->next
+    ){
+        for(size_t i = 0; i < chunk->len; i++){
+            obj_dict_t *dict = &chunk->dicts[i];
+            obj_dict_t *image_dict = &image_dicts[n];
+            *image_dict = *dict;
+            if(obj_image_add_range(fixer, dict, sizeof(*dict),
+                header.dicts_offset + n * sizeof(*dict)))goto done;
+            if(OBJ_DICT_IS_SMALL(dict)){
+                /* Entries past n_entries may be stale */
+                memset(image_dict->small_entries + dict->n_entries, 0,
+                    (OBJ_DICT_SMALL_LEN - dict->n_entries)
+                    * sizeof(*dict->entries));
+            }else{
+                size_t entries_size =
+                    dict->entries_len * sizeof(*dict->entries);
+                memset(image_dict->small_entries, 0,
+                    sizeof(image_dict->small_entries));
+                memcpy(image + entries_pos, dict->entries, entries_size);
+                if(obj_image_add_range(fixer, dict->entries,
+                    entries_size, entries_pos))goto done;
+                entries_pos += entries_size;
+            }
+            n++;
+        }
+    }
+
+    size_t shapes_pos = header.shapes_offset;
+    for(int i = 0; i < OBJ_POOL_SHAPE_BUCKETS; i++){
+        for(obj_shape_t *shape = pool->shapes[i]; shape;
+            shape = shape->next
+        ){
+            size_t shape_size = obj_image_shape_size(shape);
+            size_t used_size = sizeof(*shape)
+                + shape->n_keys * sizeof(*shape->keys)
+                + shape->index_len * sizeof(*shape->index);
+            memcpy(image + shapes_pos, shape, used_size);
+            if(obj_image_add_range(fixer, shape, used_size,
+                shapes_pos))goto done;
+            shapes_pos += shape_size;
+        }
+    }
+
+    obj_t *image_objs = (obj_t*)(image + header.objs_offset);
+    memcpy(image_objs, &pool->null, sizeof(obj_t));
+    memcpy(image_objs + 1, &pool->nil, sizeof(obj_t));
+    memcpy(image_objs + 2, &pool->T, sizeof(obj_t));
+    memcpy(image_objs + 3, &pool->F, sizeof(obj_t));
+    if(obj_image_add_range(fixer, &pool->null, sizeof(obj_t),
+        header.objs_offset))goto done;
+    if(obj_image_add_range(fixer, &pool->nil, sizeof(obj_t),
+        header.objs_offset + sizeof(obj_t)))goto done;
+    if(obj_image_add_range(fixer, &pool->T, sizeof(obj_t),
+        header.objs_offset + 2 * sizeof(obj_t)))goto done;
+    if(obj_image_add_range(fixer, &pool->F, sizeof(obj_t),
+        header.objs_offset + 3 * sizeof(obj_t)))goto done;
+    n = 4;
+    for(obj_pool_chunk_t *chunk = pool->chunk_list; chunk;
+        chunk = chunk->next
+    ){
+        size_t chunk_size = chunk->len * sizeof(obj_t);
+        memcpy(image_objs + n, chunk->objs, chunk_size);
+        if(obj_image_add_range(fixer, chunk->objs, chunk_size,
+            header.objs_offset + n * sizeof(obj_t)))goto done;
+        n += chunk->len;
+    }
+
+    /* Turn pointers into offsets */
+    qsort(fixer->ranges, fixer->n_ranges, sizeof(*fixer->ranges),
+        obj_image_range_cmp);
+
+    for(size_t i = 0; i < n_syms; i++){
+        OBJ_IMAGE_FIX(fixer, image_syms[i].string.data, OBJ_IMAGE_TEXT);
+    }
+    for(size_t i = 0; i < n_strings; i++){
+        OBJ_IMAGE_FIX(fixer, image_strings[i].data, OBJ_IMAGE_TEXT);
+    }
+    for(size_t i = 0; i < n_dicts; i++){
+        /* A small dict's entries now hold the offset of its own
+        small_entries */
+        obj_dict_t *image_dict = &image_dicts[i];
+        OBJ_IMAGE_FIX(fixer, image_dict->entries, OBJ_IMAGE_ENTRIES);
+        if((uintptr_t)image_dict->entries ==
+            (uintptr_t)((char*)image_dict->small_entries - image)
+        ){
+            obj_image_fix_entries(fixer, image_dict->small_entries,
+                image_dict->n_entries);
+        }
+    }
+    obj_image_fix_entries(fixer,
+        (obj_dict_entry_t*)(image + header.entries_offset),
+        entries_size / sizeof(obj_dict_entry_t));
+    for(size_t pos = header.shapes_offset; pos < shapes_pos;){
+        obj_shape_t *shape = (obj_shape_t*)(image + pos);
+        pos += obj_image_shape_size(shape);
+        obj_image_fix_shape(fixer, shape);
+    }
+    obj_image_fix_objs(fixer, image_objs, n_objs);
+    header.root = (uintptr_t)obj_image_fix(fixer, root, OBJ_IMAGE_OBJS);
+    if(fixer->err)goto done;
+
+    memcpy(image, &header, sizeof(header));
+    writer->buffer_len += size;
+    err = 0;
+
+done:
+    free(fixer->ranges);
+    return err;
+}
+
+int obj_image_fwrite(obj_pool_t *pool, obj_t *root, FILE *file){
+    obj_writer_t _writer, *writer=&_writer;
+    obj_writer_init(writer, file);
+    int err = obj_image_write(writer, pool, root)
+        || obj_writer_flush(writer);
+    obj_writer_cleanup(writer);
+    return err;
+}
+
+static bool obj_image_section_fits(const obj_image_header_t *header,
+    uint64_t *pos_ptr, uint64_t offset, uint64_t n, size_t elem_size
+){
+    /* Checks that a section of n elems starts at an aligned offset, no
+    earlier than *pos_ptr (the end of the previous section), and lies
+    within the image; and moves *pos_ptr to its end */
+    if(offset < *pos_ptr || offset > header->size ||
+        offset % OBJ_IMAGE_ALIGN ||
+        n > (header->size - offset) / elem_size
+    )return false;
+    *pos_ptr = offset + n * elem_size;
+    return true;
+}
+
+int obj_image_init(obj_image_t *image, char *data, size_t size){
+    /* Checks that data is an image which can be used on this platform,
+    and that its sections lie within it, in order.
+    The offsets stored in it aren't checked until it's relocated
+    (see obj_image_relocate); until then, the obj_image_* accessors
+    check each one as they go.
+    data must be suitably aligned (e.g. as returned by malloc or mmap),
+    and must remain valid for as long as image is used. */
+    memset(image, 0, sizeof(*image));
+    obj_image_header_t *header = (obj_image_header_t*)data;
+    if(size < sizeof(*header) ||
+        strncmp(header->magic, OBJ_IMAGE_MAGIC, sizeof(header->magic))
+    ){
+        fprintf(stderr, "%s: Not an image\n", __func__);
+        return 1;
+    }
+    if(header->version != OBJ_IMAGE_VERSION){
+        fprintf(stderr, "%s: Unsupported version: %i (expected %i)\n",
+            __func__, (int)header->version, OBJ_IMAGE_VERSION);
+        return 1;
+    }
+    if(header->ptr_size != sizeof(void*) ||
+        header->obj_size != sizeof(obj_t) || header->endian != 1
+    ){
+        fprintf(stderr, "%s: Image was written on an incompatible "
+            "platform\n", __func__);
+        return 1;
+    }
+    if(header->size > size || !header->root ||
+        header->root >= header->size
+    ){
+        fprintf(stderr, "%s: Image is truncated or corrupt\n", __func__);
+        return 1;
+    }
+    uint64_t pos = sizeof(*header);
+    if(
+        !obj_image_section_fits(header, &pos, header->syms_offset,
+            header->n_syms, sizeof(obj_sym_t)) ||
+        !obj_image_section_fits(header, &pos, header->strings_offset,
+            header->n_strings, sizeof(obj_string_t)) ||
+        !obj_image_section_fits(header, &pos, header->dicts_offset,
+            header->n_dicts, sizeof(obj_dict_t)) ||
+        !obj_image_section_fits(header, &pos, header->entries_offset,
+            0, 1) ||
+        !obj_image_section_fits(header, &pos, header->shapes_offset,
+            header->shapes_size, 1) ||
+        !obj_image_section_fits(header, &pos, header->objs_offset,
+            header->n_objs, sizeof(obj_t)) ||
+        header->text_offset < pos || header->text_offset > header->size ||
+        !obj_image_offset_ok(header, header->root, OBJ_IMAGE_OBJS)
+    ){
+        fprintf(stderr, "%s: Image's header is corrupt\n", __func__);
+        return 1;
+    }
+    image->data = data;
+    image->size = size;
+    image->header = header;
+    return 0;
+}
+
+void *obj_image_ptr(obj_image_t *image, const void *ptr, int section){
+    /* Returns pointer to given offset into image, or NULL if offset is
+    0 or doesn't point at an element of given section (for shapes, at
+    one which fits in what's left of the section).
+    Once image has been relocated, offsets have already been turned
+    into pointers, so ptr is returned unchanged. */
+    if(image->relocated)return (void*)ptr;
+    obj_image_header_t *header = image->header;
+    uintptr_t offset = (uintptr_t)ptr;
+    if(!offset || !obj_image_offset_ok(header, offset, section)){
+        return NULL;
+    }
+    if(section == OBJ_IMAGE_SHAPES && !obj_image_shape_fits(
+        (obj_shape_t*)(image->data + offset),
+        header->shapes_offset + header->shapes_size - offset)
+    )return NULL;
+    return image->data + offset;
+}
+
+static bool obj_image_objs_ok(obj_image_t *image, obj_t *obj, size_t n){
+    /* Checks that the n objs starting at obj (e.g. a multi-obj type,
+    or an array and its elements) are all in image's objs */
+    if(image->relocated)return true;
+    obj_image_header_t *header = image->header;
+    obj_t *objs = (obj_t*)(image->data + header->objs_offset);
+    return obj >= objs && obj < objs + header->n_objs &&
+        n <= (size_t)(objs + header->n_objs - obj);
+}
+
+obj_t *obj_image_tail(obj_image_t *image, obj_t *obj){
+    /* A cell's tail is in its second obj, which mustn't run past the
+    end of image's objs */
+    if(!obj_image_objs_ok(image, obj, 2))return NULL;
+    return obj_image_ptr(image, OBJ_TAIL(obj), OBJ_IMAGE_OBJS);
+}
+
+const char *obj_image_string_data(obj_image_t *image,
+    obj_string_t *string
+){
+    /* Returns string's text, or NULL if it (and the NUL after it)
+    isn't all within image's text */
+    const char *data = obj_image_ptr(image, string->data, OBJ_IMAGE_TEXT);
+    if(image->relocated || !data)return data;
+    size_t avail = image->header->size - (data - image->data);
+    return string->len < avail? data: NULL;
+}
+
+obj_t *obj_image_root(obj_image_t *image){
+    return (obj_t*)(image->data + image->header->root);
+}
+
+static void obj_image_fix_string(obj_image_fixer_t *fixer,
+    obj_string_t *string
+){
+    /* Fixes string's data, checking that its text (and the NUL after
+    it) lies within the image's text */
+    OBJ_IMAGE_FIX(fixer, string->data, OBJ_IMAGE_TEXT);
+    if(!fixer->base || !string->data)return;
+    size_t avail = fixer->base + fixer->header->size - string->data;
+    if(string->len >= avail){
+        if(!fixer->err){
+            fprintf(stderr, "%s: String of length %zu runs past end "
+                "of image\n", __func__, string->len);
+        }
+        fixer->err = true;
+    }
+}
+
+static size_t obj_image_fix_dict(obj_image_fixer_t *fixer,
+    obj_dict_t *dict
+){
+    /* Fixes dict's entries pointer, and returns the number of its
+    entries to be fixed.
+    When relocating, a small dict's entries must be its own
+    small_entries, packed as obj_dict_del leaves them (since walking a
+    dict visits every entry with a sym, not just the first n_entries),
+    and anyone else's must be a whole hash table in the image's entries
+    section. */
+    if(!fixer->base){
+        return OBJ_DICT_IS_SMALL(dict)? dict->n_entries: dict->entries_len;
+    }
+    const obj_image_header_t *header = fixer->header;
+    uintptr_t small_offset = (char*)dict->small_entries - fixer->base;
+    bool ok;
+    if((uintptr_t)dict->entries == small_offset){
+        dict->entries = dict->small_entries;
+        ok = dict->entries_len == OBJ_DICT_SMALL_LEN &&
+            dict->n_entries <= OBJ_DICT_SMALL_LEN;
+        for(size_t i = 0; ok && i < OBJ_DICT_SMALL_LEN; i++){
+            ok = !dict->small_entries[i].sym == (i >= dict->n_entries);
+        }
+    }else{
+        OBJ_IMAGE_FIX(fixer, dict->entries, OBJ_IMAGE_ENTRIES);
+        size_t len = dict->entries_len;
+        ok = dict->entries && len && !(len & (len - 1)) &&
+            dict->n_entries <= len &&
+            len <= (size_t)(fixer->base + header->shapes_offset -
+                (char*)dict->entries) / sizeof(*dict->entries);
+    }
+    if(!ok){
+        if(!fixer->err){
+            fprintf(stderr, "%s: Dict's entries are corrupt\n", __func__);
+        }
+        fixer->err = true;
+        return 0;
+    }
+    return OBJ_DICT_IS_SMALL(dict)? dict->n_entries: dict->entries_len;
+}
+
+static void obj_image_fix_contents(obj_image_fixer_t *fixer,
+    obj_image_t *image
+){
+    /* Fixes image's shapes, dicts, and objs.
+    Shapes go first, so that when relocating, pointers to them can be
+    checked against fixer->shape_starts, and structs' numbers of values
+    against their shapes; and objs are marked in fixer->obj_starts
+    before anything pointing at them is fixed. */
+    obj_image_header_t *header = image->header;
+    char *data = image->data;
+    size_t shapes_end = header->shapes_offset + header->shapes_size;
+    for(size_t pos = header->shapes_offset; pos < shapes_end;){
+        obj_shape_t *shape = (obj_shape_t*)(data + pos);
+        if(!obj_image_shape_fits(shape, shapes_end - pos)){
+            fprintf(stderr, "%s: Shape at %zu is corrupt\n",
+                __func__, pos);
+            fixer->err = true;
+            return;
+        }
+        if(fixer->shape_starts){
+            fixer->shape_starts[
+                (pos - header->shapes_offset) / OBJ_IMAGE_ALIGN] = true;
+        }
+        pos += obj_image_shape_size(shape);
+        obj_image_fix_shape(fixer, shape);
+    }
+    obj_t *objs = (obj_t*)(data + header->objs_offset);
+    if(fixer->obj_starts)obj_image_mark_objs(fixer, objs, header->n_objs);
+    obj_dict_t *dicts = (obj_dict_t*)(data + header->dicts_offset);
+    for(size_t i = 0; i < header->n_dicts && !fixer->err; i++){
+        obj_dict_t *dict = &dicts[i];
+        size_t len = obj_image_fix_dict(fixer, dict);
+        obj_image_fix_entries(fixer, dict->entries, len);
+    }
+    if(!fixer->err)obj_image_fix_objs(fixer, objs, header->n_objs);
+}
+
+obj_t *obj_image_relocate(obj_image_t *image){
+    /* Turns image's offsets into pointers, so that it can be used like
+    objs in a pool, and returns its root.
+    Each offset must point at an element of the section its type
+    belongs in (e.g. a sym's at one of the syms, an obj's at the start
+    of one of the objs, not partway through a cell), and each obj's
+    multi-obj type, array or struct must fit in the objs; if not,
+    returns NULL, and image mustn't be used any further.
+    (Beyond this, the internal consistency of vecs, maps, etc isn't
+    checked, so images should still come from a trusted source.)
+    Image's memory must be writable, e.g. loaded with malloc & fread or
+    mmapped with MAP_PRIVATE (in which case each page written to is
+    copied, so the relocated image isn't shared with other
+    processes). */
+    if(image->relocated)return obj_image_root(image);
+    obj_image_header_t *header = image->header;
+    char *data = image->data;
+    obj_image_fixer_t _fixer, *fixer=&_fixer;
+    memset(fixer, 0, sizeof(*fixer));
+    fixer->base = data;
+    fixer->header = header;
+    size_t n_blocks = header->shapes_size / OBJ_IMAGE_ALIGN;
+    fixer->shape_starts = calloc(n_blocks? n_blocks: 1,
+        sizeof(*fixer->shape_starts));
+    if(!fixer->shape_starts){
+        fprintf(stderr, "%s: Couldn't allocate map of %zu shape blocks. ",
+            __func__, n_blocks);
+        perror("calloc");
+        return NULL;
+    }
+    fixer->obj_starts = calloc(header->n_objs? header->n_objs: 1,
+        sizeof(*fixer->obj_starts));
+    if(!fixer->obj_starts){
+        fprintf(stderr, "%s: Couldn't allocate map of %zu objs. ",
+            __func__, header->n_objs);
+        perror("calloc");
+        free(fixer->shape_starts);
+        return NULL;
+    }
+
+    obj_sym_t *syms = (obj_sym_t*)(data + header->syms_offset);
+    for(size_t i = 0; i < header->n_syms; i++){
+        obj_image_fix_string(fixer, &syms[i].string);
+    }
+    obj_string_t *strings = (obj_string_t*)(data + header->strings_offset);
+    for(size_t i = 0; i < header->n_strings; i++){
+        obj_image_fix_string(fixer, &strings[i]);
+    }
+    if(!fixer->err)obj_image_fix_contents(fixer, image);
+    free(fixer->shape_starts);
+    free(fixer->obj_starts);
+    if(fixer->err){
+        fprintf(stderr, "%s: Image is corrupt\n", __func__);
+        return NULL;
+    }
+
+    image->relocated = true;
+    return obj_image_root(image);
+}
+
+int obj_image_intern(obj_image_t *image, obj_symtable_t *table){
+    /* Replaces every sym in a relocated image with the sym of the same
+    text from table, so that image's objs can be compared, looked up
+    in dicts, etc, alongside objs from pools using table.
+    Image's dicts and shapes remain valid, since syms' hashes depend
+    only on their text. */
+    if(!image->relocated){
+        fprintf(stderr, "%s: Image must be relocated first\n", __func__);
+        return 1;
+    }
+    obj_image_header_t *header = image->header;
+    obj_image_fixer_t _fixer, *fixer=&_fixer;
+    memset(fixer, 0, sizeof(*fixer));
+    fixer->syms = (obj_sym_t*)(image->data + header->syms_offset);
+    fixer->n_syms = header->n_syms;
+    fixer->sym_map = malloc(
+        (fixer->n_syms? fixer->n_syms: 1) * sizeof(*fixer->sym_map));
+    if(!fixer->sym_map){
+        fprintf(stderr, "%s: Couldn't allocate map for %zu syms. ",
+            __func__, fixer->n_syms);
+        perror("malloc");
+        return 1;
+    }
+    for(size_t i = 0; i < fixer->n_syms; i++){
+        obj_string_t *string = &fixer->syms[i].string;
+        obj_sym_t *sym = obj_symtable_get_sym_raw(
+            table, string->data, string->len);
+        if(!sym){
+            free(fixer->sym_map);
+            return 1;
+        }
+        fixer->sym_map[i] = sym;
+    }
+
+    obj_image_fix_contents(fixer, image);
+
+    free(fixer->sym_map);
+    return fixer->err? 1: 0;
+}
+
+bool obj_image_sym_eq(obj_image_t *image, obj_sym_t *image_sym,
+    obj_sym_t *sym
+){
+    /* Compares a sym in image against a regular sym */
+    if(!image_sym || image_sym->hash != sym->hash)return false;
+    const char *data = OBJ_IMAGE_STRING_DATA(image, &image_sym->string);
+    return image_sym->string.len == sym->string.len &&
+        (!sym->string.len ||
+            (data && !memcmp(data, sym->string.data, sym->string.len)));
+}
+
+static obj_dict_entry_t *obj_image_dict_entries(obj_image_t *image,
+    obj_dict_t *dict, size_t *len_ptr
+){
+    /* Returns dict's entries, and how many there are to search, or
+    NULL if they aren't either dict's own small_entries or a whole
+    hash table in image's entries section (see obj_image_fix_dict) */
+    if(image->relocated){
+        *len_ptr = OBJ_DICT_IS_SMALL(dict)?
+            dict->n_entries: dict->entries_len;
+        return dict->entries;
+    }
+    obj_image_header_t *header = image->header;
+    if((uintptr_t)dict->entries ==
+        (uintptr_t)((char*)dict->small_entries - image->data)
+    ){
+        if(dict->n_entries > OBJ_DICT_SMALL_LEN)return NULL;
+        *len_ptr = dict->n_entries;
+        return dict->small_entries;
+    }
+    obj_dict_entry_t *entries = OBJ_IMAGE_PTR(image, dict->entries,
+        OBJ_IMAGE_ENTRIES);
+    size_t len = dict->entries_len;
+    if(!entries || !len || len & (len - 1) ||
+        len > (size_t)(image->data + header->shapes_offset -
+            (char*)entries) / sizeof(*entries)
+    )return NULL;
+    *len_ptr = len;
+    return entries;
+}
+
+static obj_t *obj_image_array_iget(obj_image_t *image, obj_t *obj, int i){
+    /* Like OBJ_ARRAY_IGET, but checks obj is an array, i is in range,
+    and the element is in image's objs */
+    if(!obj || OBJ_TYPE(obj) != OBJ_TYPE_ARRAY ||
+        i < 0 || i >= OBJ_ARRAY_LEN(obj) ||
+        !obj_image_objs_ok(image, obj, 2 + (size_t)i)
+    )return NULL;
+    return OBJ_ARRAY_IGET(obj, i);
+}
+
+obj_t *obj_image_get(obj_image_t *image, obj_t *obj, obj_sym_t *sym){
+    /* Like obj_get, for objs in an image which hasn't been relocated.
+    Since image's syms aren't in any symtable, keys are compared by
+    text rather than by pointer. */
+    if(!obj)return NULL;
+    int type = OBJ_TYPE(obj);
+    if(type == OBJ_TYPE_CELL){
+        while(obj && OBJ_TYPE(obj) == OBJ_TYPE_CELL){
+            obj_t *head = OBJ_IMAGE_HEAD(image, obj);
+            obj_t *tail = OBJ_IMAGE_TAIL(image, obj);
+            if(!tail || OBJ_TYPE(tail) != OBJ_TYPE_CELL)return NULL;
+            if(head && OBJ_TYPE(head) == OBJ_TYPE_SYM &&
+                obj_image_sym_eq(image, OBJ_IMAGE_SYM(image, head), sym)
+            )return OBJ_IMAGE_HEAD(image, tail);
+            obj = OBJ_IMAGE_TAIL(image, tail);
+        }
+    }else if(type == OBJ_TYPE_DICT){
+        obj_dict_t *dict = OBJ_IMAGE_DICT(image, obj);
+        size_t len;
+        obj_dict_entry_t *entries = dict?
+            obj_image_dict_entries(image, dict, &len): NULL;
+        if(!entries)return NULL;
+        bool is_small = entries == dict->small_entries;
+        size_t mask = len - 1;
+        size_t i = is_small? 0: sym->hash & mask;
+        for(size_t n = 0; n < len; n++){
+            obj_dict_entry_t *entry = &entries[i];
+            if(!entry->sym){
+                if(!is_small)break;
+            }else if(obj_image_sym_eq(image,
+                OBJ_IMAGE_PTR(image, entry->sym, OBJ_IMAGE_SYMS), sym)
+            )return &entry->value;
+            i = is_small? i + 1: (i + 1) & mask;
+        }
+    }else if(type == OBJ_TYPE_STRUCT){
+        /* Shape's keys and index follow it directly (see
+        obj_shape_create), and OBJ_IMAGE_STRUCT_SHAPE checks they fit */
+        obj_shape_t *shape = OBJ_IMAGE_STRUCT_SHAPE(image, obj);
+        if(!shape || !obj_image_objs_ok(image, obj, 1 + shape->n_keys)){
+            return NULL;
+        }
+        obj_t *keys = (obj_t*)(shape + 1);
+        int *index = (int*)(keys + shape->n_keys);
+        size_t mask = shape->index_len - 1;
+        size_t slot = obj_shape_index_slot(
+            shape->index_bits, shape->index_mult, sym->hash);
+        for(size_t n = 0; n < shape->index_len; n++){
+            int i = index[slot];
+            if(i < 0 || i >= shape->n_keys)break;
+            if(obj_image_sym_eq(image,
+                OBJ_IMAGE_SYM(image, &keys[i]), sym)
+            )return OBJ_STRUCT_IGET_VAL(obj, i);
+            slot = (slot + 1) & mask;
+        }
+    }
+    return NULL;
+}
+
+obj_t *obj_image_iget(obj_image_t *image, obj_t *obj, int i){
+    /* Like obj_iget, for objs in an image which hasn't been
+    relocated */
+    if(!obj)return NULL;
+    int type = OBJ_TYPE(obj);
+    if(type == OBJ_TYPE_CELL){
+        while(obj && OBJ_TYPE(obj) == OBJ_TYPE_CELL){
+            if(i <= 0)return OBJ_IMAGE_HEAD(image, obj);
+            obj = OBJ_IMAGE_TAIL(image, obj);
+            i--;
+        }
+    }else if(type == OBJ_TYPE_ARRAY){
+        return obj_image_array_iget(image, obj, i);
+    }else if(type == OBJ_TYPE_VEC){
+        if(!obj_image_objs_ok(image, obj, 2))return NULL;
+        if(i < 0 || i >= OBJ_VEC_LEN(obj))return NULL;
+        obj_t *node = OBJ_IMAGE_PTR(image, OBJ_VEC_ROOT(obj),
+            OBJ_IMAGE_OBJS);
+        for(int shift = OBJ_VEC_SHIFT(obj); node && shift > 0;
+            shift -= OBJ_VEC_BITS
+        ){
+            obj_t *child = obj_image_array_iget(image, node,
+                (i >> shift) & OBJ_VEC_MASK);
+            node = child && OBJ_TYPE(child) == OBJ_TYPE_BOX?
+                OBJ_IMAGE_CONTENTS(image, child): NULL;
+        }
+        return obj_image_array_iget(image, node, i & OBJ_VEC_MASK);
+    }
+    return NULL;
+}
+
+
+/***********
+* obj_json *
+***********/
+
+/* JSON export & import.
+Lists, arrays, and queues are written as JSON arrays; dicts, structs,
+maps and omaps as JSON objects (with int keys written as strings);
+boxes as their contents; null, bools and ints as themselves.
+JSON is read back as lists, dicts, etc. JSON numbers must be ints, and
+JSON strings are read as strs (or syms, see obj_json_options).
+Funs can't be written as JSON. */
+
+struct obj_json_options {
+    int indent;
+    char sym_prefix;
+        /* indent: if 0, output is compact (all on one line); otherwise,
+        number of spaces by which to indent each level of nesting */
+        /* sym_prefix: if 0, syms are written as plain JSON strings (so
+        they're read back as strs).
+        Otherwise, syms are written as JSON strings starting with
+        sym_prefix, and strs starting with sym_prefix have it doubled.
+        E.g. with sym_prefix '$', sym x is written as "$x", str "x" as
+        "x", and str "$x" as "$$x", and reading reverses this.
+        Keys of JSON objects are always syms, and never prefixed. */
+};
+
+static const obj_json_options_t obj_json_default_options = {0, 0};
+
+/* Bytes which JSON strings can't contain as they are: control
+characters, backslash and double quote */
+static const bool obj_json_escape_table[256] = {
+    [0x00] = true, [0x01] = true, [0x02] = true, [0x03] = true,
+    [0x04] = true, [0x05] = true, [0x06] = true, [0x07] = true,
+    [0x08] = true, [0x09] = true, [0x0a] = true, [0x0b] = true,
+    [0x0c] = true, [0x0d] = true, [0x0e] = true, [0x0f] = true,
+    [0x10] = true, [0x11] = true, [0x12] = true, [0x13] = true,
+    [0x14] = true, [0x15] = true, [0x16] = true, [0x17] = true,
+    [0x18] = true, [0x19] = true, [0x1a] = true, [0x1b] = true,
+    [0x1c] = true, [0x1d] = true, [0x1e] = true, [0x1f] = true,
+    ['\\'] = true, ['"'] = true
+};
+
+
+/* Writing */
+
+int obj_json_write_string_raw(obj_writer_t *writer,
+    const char *data, size_t len, char prefix
+){
+    /* Writes data as a JSON string, preceded by prefix if not 0.
+    Each byte becomes at most 6 ("\u001f"), so we reserve space once and
+    copy unescaped runs in bulk. */
+    char *s = obj_writer_reserve(writer, len * 6 + 3);
+    if(!s)return 1;
+    char *s0 = s;
+    *s++ = '"';
+    if(prefix)*s++ = prefix;
+    size_t i = 0;
+    while(i < len){
+        size_t run = obj_escape_run(data + i, len - i,
+            obj_json_escape_table);
+        memcpy(s, data + i, run);
+        s += run;
+        i += run;
+        if(i >= len)break;
+        unsigned char c = data[i++];
+        *s++ = '\\';
+        switch(c){
+            case '"': case '\\': *s++ = c; break;
+            case '\n': *s++ = 'n'; break;
+            case '\t': *s++ = 't'; break;
+            case '\r': *s++ = 'r'; break;
+            case '\b': *s++ = 'b'; break;
+            case '\f': *s++ = 'f'; break;
+            default:
+                s += sprintf(s, "u%04x", c);
+                break;
+        }
+    }
+    *s++ = '"';
+    writer->buffer_len += s - s0;
+    return 0;
+}
+
+static int obj_json_write_element_sep(obj_writer_t *writer,
+    obj_writer_frame_t *frame, int indent
+){
+    /* Writes what comes before each element of a container */
+    if(frame->n++ && obj_writer_putc(writer, ','))return 1;
+    if(indent && obj_writer_newline(writer, frame->depth + indent)){
+        return 1;
+    }
+    return 0;
+}
+
+static int obj_json_write_key_raw(obj_writer_t *writer,
+    const char *data, size_t len, int indent
+){
+    if(obj_json_write_string_raw(writer, data, len, 0))return 1;
+    return indent? obj_writer_write(writer, ": ", 2):
+        obj_writer_putc(writer, ':');
+}
+
+static int obj_json_write_key(obj_writer_t *writer,
+    obj_sym_t *key, int indent
+){
+    return obj_json_write_key_raw(writer,
+        key->string.data, key->string.len, indent);
+}
+
+static int obj_json_write_map_key(obj_writer_t *writer,
+    obj_t *key, int indent
+){
+    int type = OBJ_TYPE(key);
+    if(type == OBJ_TYPE_INT){
+        char buf[16];
+        int len = snprintf(buf, sizeof(buf), "%i", OBJ_INT(key));
+        return obj_json_write_key_raw(writer, buf, len, indent);
+    }else if(type == OBJ_TYPE_SYM){
+        return obj_json_write_key(writer, OBJ_SYM(key), indent);
+    }
+    obj_string_t view;
+    obj_string_t *s = obj_str_get(key, &view);
+    return obj_json_write_key_raw(writer, s->data, s->len, indent);
+}
+
+int obj_json_write(obj_writer_t *writer, obj_t *obj,
+    const obj_json_options_t *opts
+){
+    /* Writes obj as JSON, using writer->stack (like
+    obj_writer_write_obj) so that deep nesting doesn't use up the C
+    stack. opts may be NULL, for the defaults. */
+    if(!opts)opts = &obj_json_default_options;
+    int indent = opts->indent;
+    char prefix = opts->sym_prefix;
+    int depth = 0;
+    size_t base = writer->stack_tos;
+    for(;;){
+        while(obj){
+            obj = OBJ_RESOLVE(obj);
+            int type = OBJ_TYPE(obj);
+            switch(type){
+                case OBJ_TYPE_NULL:
+                    if(obj_writer_write(writer, "null", 4))return 1;
+                    break;
+                case OBJ_TYPE_BOOL:
+                    if(OBJ_BOOL(obj)){
+                        if(obj_writer_write(writer, "true", 4))return 1;
+                    }else{
+                        if(obj_writer_write(writer, "false", 5))return 1;
+                    }
+                    break;
+                case OBJ_TYPE_INT:
+                    if(obj_writer_write_int(writer, OBJ_INT(obj)))return 1;
+                    break;
+                case OBJ_TYPE_STR:
+                case OBJ_TYPE_STRBUF: {
+                    obj_string_t view;
+                    obj_string_t *s = obj_str_get(obj, &view);
+                    bool doubled = prefix && s->len && s->data[0] == prefix;
+                    if(obj_json_write_string_raw(writer, s->data, s->len,
+                        doubled? prefix: 0))return 1;
+                    break;
+                }
+                case OBJ_TYPE_SYM: {
+                    obj_string_t *s = &OBJ_SYM(obj)->string;
+                    if(obj_json_write_string_raw(writer, s->data, s->len,
+                        prefix))return 1;
+                    break;
+                }
+                case OBJ_TYPE_QUEUE:
+                    obj = OBJ_QUEUE_LIST(obj);
+                    /* fall through */
+                case OBJ_TYPE_NIL:
+                case OBJ_TYPE_CELL:
+                case OBJ_TYPE_ARRAY:
+                case OBJ_TYPE_VEC:
+                case OBJ_TYPE_INTARR:
+                    if(obj_writer_putc(writer, '['))return 1;
+                    if(obj_writer_push(writer,
+                        type == OBJ_TYPE_ARRAY || type == OBJ_TYPE_VEC ||
+                        type == OBJ_TYPE_INTARR?
+                            type: OBJ_TYPE_CELL,
+                        depth, obj, NULL))return 1;
+                    break;
+                case OBJ_TYPE_DICT:
+                    if(obj_writer_putc(writer, '{'))return 1;
+                    if(obj_writer_push(writer, type,
+                        depth, NULL, OBJ_DICT(obj)))return 1;
+                    break;
+                case OBJ_TYPE_STRUCT:
+                case OBJ_TYPE_MAP:
+                case OBJ_TYPE_OMAP:
+                    if(obj_writer_putc(writer, '{'))return 1;
+                    if(obj_writer_push(writer, type,
+                        depth, obj, NULL))return 1;
+                    break;
+                default:
+                    fprintf(stderr, "%s: Can't write %s as JSON\n",
+                        __func__, obj_type_msg(type));
+                    writer->stack_tos = base;
+                    return 1;
+            }
+            obj = NULL;
+        }
+
+        if(writer->stack_tos == base)break;
+
+        /* Find the next element of the innermost container */
+        obj_writer_frame_t *frame = &writer->stack[writer->stack_tos - 1];
+        depth = frame->depth + indent;
+        char close = '}';
+        switch(frame->type){
+            case OBJ_TYPE_CELL: {
+                obj_t *cell = frame->u.o;
+                close = ']';
+                if(OBJ_TYPE(cell) != OBJ_TYPE_CELL)break;
+                if(obj_json_write_element_sep(writer, frame, indent)){
+                    return 1;
+                }
+                obj = OBJ_HEAD(cell);
+                frame->u.o = OBJ_TAIL(cell);
+                continue;
+            }
+            case OBJ_TYPE_ARRAY: {
+                close = ']';
+                if(frame->i >= OBJ_ARRAY_LEN(frame->u.o))break;
+                obj = OBJ_ARRAY_IGET(frame->u.o, frame->i++);
+                if(obj_json_write_element_sep(writer, frame, indent)){
+                    return 1;
+                }
+                continue;
+            }
+            case OBJ_TYPE_VEC: {
+                close = ']';
+                if(frame->i >= OBJ_VEC_LEN(frame->u.o))break;
+                obj = OBJ_VEC_IGET(frame->u.o, frame->i++);
+                if(obj_json_write_element_sep(writer, frame, indent)){
+                    return 1;
+                }
+                continue;
+            }
+            case OBJ_TYPE_INTARR: {
+                close = ']';
+                if(frame->i >= OBJ_INTARR_LEN(frame->u.o))break;
+                if(obj_json_write_element_sep(writer, frame, indent)){
+                    return 1;
+                }
+                if(obj_writer_write_int(writer,
+                    obj_intarr_get(frame->u.o, frame->i++)))return 1;
+                continue;
+            }
+            case OBJ_TYPE_DICT: {
+                obj_dict_t *dict = frame->u.d;
+                while(frame->i < dict->entries_len &&
+                    !dict->entries[frame->i].sym)frame->i++;
+                if(frame->i >= dict->entries_len)break;
+                obj_dict_entry_t *entry = &dict->entries[frame->i++];
+                if(obj_json_write_element_sep(writer, frame, indent)){
+                    return 1;
+                }
+                if(obj_json_write_key(writer, entry->sym, indent))return 1;
+                obj = &entry->value;
+                continue;
+            }
+            case OBJ_TYPE_STRUCT: {
+                obj_t *s_obj = frame->u.o;
+                if(frame->i >= OBJ_STRUCT_LEN(s_obj))break;
+                obj_sym_t *key = OBJ_SYM(
+                    OBJ_STRUCT_IGET_KEY(s_obj, frame->i));
+                obj = OBJ_STRUCT_IGET_VAL(s_obj, frame->i++);
+                if(obj_json_write_element_sep(writer, frame, indent)){
+                    return 1;
+                }
+                if(obj_json_write_key(writer, key, indent))return 1;
+                continue;
+            }
+            case OBJ_TYPE_MAP:
+            case OBJ_TYPE_OMAP: {
+                obj_t *m_obj = frame->u.o;
+                obj_t *key;
+                if(frame->type == OBJ_TYPE_OMAP){
+                    key = OBJ_OMAP_IGET(m_obj, frame->i++);
+                    if(!key)break;
+                }else{
+                    while(frame->i < OBJ_MAP_CAP(m_obj) && OBJ_TYPE(
+                        OBJ_MAP_IGET_KEY(m_obj, frame->i)) == OBJ_TYPE_NULL
+                    )frame->i++;
+                    if(frame->i >= OBJ_MAP_CAP(m_obj))break;
+                    key = OBJ_MAP_IGET_KEY(m_obj, frame->i++);
+                }
+                obj = key + 1;
+                if(obj_json_write_element_sep(writer, frame, indent)){
+                    return 1;
+                }
+                if(obj_json_write_map_key(writer, key, indent))return 1;
+                continue;
+            }
+            default: break;
+        }
+
+        /* Container has no more elements */
+        if(frame->n && indent &&
+            obj_writer_newline(writer, frame->depth))return 1;
+        if(obj_writer_putc(writer, close))return 1;
+        writer->stack_tos--;
+    }
+    return 0;
+}
+
+int obj_json_fwrite(obj_t *obj, FILE *file, const obj_json_options_t *opts){
+    obj_writer_t _writer, *writer=&_writer;
+    obj_writer_init(writer, file);
+    int err = obj_json_write(writer, obj, opts) ||
+        obj_writer_putc(writer, '\n') || obj_writer_flush(writer);
+    obj_writer_cleanup(writer);
+    return err;
+}
+
+
+/* Reading */
+
+typedef struct obj_json_frame {
+    obj_dict_t *dict;
+    obj_sym_t *key;
+    obj_t *list;
+    obj_t *last;
+        /* For objects, dict is the dict being filled, and key is the
+        key of the value being parsed.
+        For arrays, dict is NULL, list is the list so far (nil if
+        empty), and last is its last cell. */
+} obj_json_frame_t;
+
+typedef struct obj_json_loader {
+    obj_pool_t *pool;
+    const char *filename;
+    const char *data;
+    size_t data_len;
+    size_t pos;
+    const obj_json_options_t *opts;
+
+    char *buffer;
+    size_t buffer_len;
+    size_t buffer_size;
+        /* buffer: for strings containing escapes, which we have to
+        decode before interning or copying them */
+
+    obj_json_frame_t *stack;
+    size_t stack_len;
+    size_t stack_tos;
+} obj_json_loader_t;
+
+static void obj_json_errmsg(obj_json_loader_t *loader,
+    const char *funcname
+){
+    int row = 0, col = 0;
+    for(size_t i = 0; i < loader->pos && i < loader->data_len; i++){
+        if(loader->data[i] == '\n'){
+            row++;
+            col = 0;
+        }else col++;
+    }
+    fprintf(stderr, "%s: %s: row %i: col %i: ", funcname,
+        loader->filename, row, col);
+}
+
+static void obj_json_skip_space(obj_json_loader_t *loader){
+    const char *data = loader->data;
+    size_t pos = loader->pos;
+    size_t len = loader->data_len;
+    while(pos < len && (data[pos] == ' ' || data[pos] == '\n' ||
+        data[pos] == '\t' || data[pos] == '\r'))pos++;
+    loader->pos = pos;
+}
+
+static int obj_json_expect(obj_json_loader_t *loader, char c){
+    obj_json_skip_space(loader);
+    if(loader->pos >= loader->data_len || loader->data[loader->pos] != c){
+        obj_json_errmsg(loader, __func__);
+        fprintf(stderr, "Expected '%c'\n", c);
+        return 1;
+    }
+    loader->pos++;
+    return 0;
+}
+
+static size_t obj_json_string_run(const char *data, size_t len){
+    /* Returns length of the longest prefix of data without any '"',
+    '\\' or control characters, i.e. which can be used as-is.
+    Strings are mostly plain text, so we check 8 bytes at a time, using
+    the standard bit tricks for finding a zero byte in a word (applied
+    to the word xored with '"' and with '\\') and a byte less than
+    0x20; once a word contains one of these, we find it bytewise. */
+    const uint64_t ones = 0x0101010101010101ull;
+    const uint64_t highs = 0x8080808080808080ull;
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8){
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        uint64_t q = w ^ (ones * '"');
+        uint64_t b = w ^ (ones * '\\');
+        uint64_t found = ((q - ones) & ~q) | ((b - ones) & ~b) |
+            ((w - ones * 0x20) & ~w);
+        if(found & highs)break;
+    }
+    for(; i < len; i++){
+        unsigned char c = data[i];
+        if(c == '"' || c == '\\' || c < 0x20)break;
+    }
+    return i;
+}
+
+static int obj_json_buffer_write(obj_json_loader_t *loader,
+    const char *data, size_t len
+){
+    if(!len)return 0;
+    if(loader->buffer_len + len > loader->buffer_size){
+        size_t size = loader->buffer_size? loader->buffer_size: 256;
+        while(loader->buffer_len + len > size)size *= 2;
+        char *buffer = realloc(loader->buffer, size);
+        if(!buffer){
+            fprintf(stderr, "%s: Couldn't grow buffer to %zu bytes. ",
+                __func__, size);
+            perror("realloc");
+            return 1;
+        }
+        loader->buffer = buffer;
+        loader->buffer_size = size;
+    }
+    memcpy(loader->buffer + loader->buffer_len, data, len);
+    loader->buffer_len += len;
+    return 0;
+}
+
+static int obj_json_parse_hex4(obj_json_loader_t *loader,
+    unsigned long *u_ptr
+){
+    if(loader->data_len - loader->pos < 4)goto err;
+    unsigned long u = 0;
+    for(int i = 0; i < 4; i++){
+        char c = loader->data[loader->pos++];
+        int digit =
+            c >= '0' && c <= '9'? c - '0':
+            c >= 'a' && c <= 'f'? c - 'a' + 10:
+            c >= 'A' && c <= 'F'? c - 'A' + 10: -1;
+        if(digit < 0)goto err;
+        u = u * 16 + digit;
+    }
+    *u_ptr = u;
+    return 0;
+err:
+    obj_json_errmsg(loader, __func__);
+    fprintf(stderr, "Expected 4 hex digits after \\u\n");
+    return 1;
+}
+
+static int obj_json_parse_escape(obj_json_loader_t *loader){
+    /* Decodes the escape sequence after a backslash into
+    loader->buffer; \u escapes are encoded as UTF-8 */
+    if(loader->pos >= loader->data_len)goto err;
+    char c = loader->data[loader->pos++];
+    switch(c){
+        case '"': case '\\': case '/': break;
+        case 'n': c = '\n'; break;
+        case 't': c = '\t'; break;
+        case 'r': c = '\r'; break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'u': {
+            unsigned long u;
+            if(obj_json_parse_hex4(loader, &u))return 1;
+            if(u >= 0xD800 && u < 0xDC00){
+                /* High surrogate, must be followed by a low one */
+                unsigned long u2;
+                if(loader->data_len - loader->pos < 2 ||
+                    loader->data[loader->pos] != '\\' ||
+                    loader->data[loader->pos + 1] != 'u'
+                )goto err;
+                loader->pos += 2;
+                if(obj_json_parse_hex4(loader, &u2))return 1;
+                if(u2 < 0xDC00 || u2 >= 0xE000)goto err;
+                u = 0x10000 + ((u - 0xD800) << 10) + (u2 - 0xDC00);
+            }else if(u >= 0xDC00 && u < 0xE000)goto err;
+            char utf8[4];
+            size_t n;
+            if(u < 0x80){
+                utf8[0] = u;
+                n = 1;
+            }else if(u < 0x800){
+                utf8[0] = 0xC0 | (u >> 6);
+                utf8[1] = 0x80 | (u & 0x3F);
+                n = 2;
+            }else if(u < 0x10000){
+                utf8[0] = 0xE0 | (u >> 12);
+                utf8[1] = 0x80 | ((u >> 6) & 0x3F);
+                utf8[2] = 0x80 | (u & 0x3F);
+                n = 3;
+            }else{
+                utf8[0] = 0xF0 | (u >> 18);
+                utf8[1] = 0x80 | ((u >> 12) & 0x3F);
+                utf8[2] = 0x80 | ((u >> 6) & 0x3F);
+                utf8[3] = 0x80 | (u & 0x3F);
+                n = 4;
+            }
+            return obj_json_buffer_write(loader, utf8, n);
+        }
+        default: goto err;
+    }
+    return obj_json_buffer_write(loader, &c, 1);
+err:
+    obj_json_errmsg(loader, __func__);
+    fprintf(stderr, "Invalid escape sequence\n");
+    return 1;
+}
+
+static int obj_json_parse_string(obj_json_loader_t *loader,
+    const char **text_ptr, size_t *text_len_ptr
+){
+    /* Parses a JSON string, starting at its opening quote.
+    If it contains no escapes, *text_ptr points into loader->data,
+    otherwise into loader->buffer (valid until the next string is
+    parsed). */
+    if(obj_json_expect(loader, '"'))return 1;
+    const char *data = loader->data;
+    bool buffered = false;
+    loader->buffer_len = 0;
+    for(;;){
+        size_t start = loader->pos;
+        size_t run = obj_json_string_run(data + start,
+            loader->data_len - start);
+        loader->pos += run;
+        if(loader->pos >= loader->data_len){
+            obj_json_errmsg(loader, __func__);
+            fprintf(stderr, "Unterminated string\n");
+            return 1;
+        }
+        char c = data[loader->pos++];
+        if(c == '"' && !buffered){
+            *text_ptr = data + start;
+            *text_len_ptr = run;
+            return 0;
+        }
+        if(obj_json_buffer_write(loader, data + start, run))return 1;
+        buffered = true;
+        if(c == '"')break;
+        if(c != '\\'){
+            loader->pos--;
+            obj_json_errmsg(loader, __func__);
+            fprintf(stderr, "Unescaped control character in string\n");
+            return 1;
+        }
+        if(obj_json_parse_escape(loader))return 1;
+    }
+    *text_ptr = loader->buffer;
+    *text_len_ptr = loader->buffer_len;
+    return 0;
+}
+
+static obj_sym_t *obj_json_parse_key(obj_json_loader_t *loader){
+    const char *text;
+    size_t text_len;
+    if(obj_json_parse_string(loader, &text, &text_len))return NULL;
+    if(obj_json_expect(loader, ':'))return NULL;
+    return obj_symtable_get_sym_raw(loader->pool->symtable, text, text_len);
+}
+
+static int obj_json_parse_scalar(obj_json_loader_t *loader, obj_t *value){
+    /* Parses a string, number, true, false or null into value */
+    const char *data = loader->data + loader->pos;
+    size_t len = loader->data_len - loader->pos;
+    char c = data[0];
+    if(c == '"'){
+        const char *text;
+        size_t text_len;
+        if(obj_json_parse_string(loader, &text, &text_len))return 1;
+        char prefix = loader->opts->sym_prefix;
+        if(prefix && text_len && text[0] == prefix){
+            text++;
+            text_len--;
+            if(!text_len || text[0] != prefix){
+                obj_sym_t *sym = obj_symtable_get_sym_raw(
+                    loader->pool->symtable, text, text_len);
+                if(!sym)return 1;
+                obj_init_sym(value, sym);
+                return 0;
+            }
+        }
+        return !obj_init_str_raw(loader->pool, value, text, text_len);
+    }else if(c == '-' || (c >= '0' && c <= '9')){
+        size_t i = c == '-'? 1: 0;
+        long long n = 0;
+        if(i >= len || data[i] < '0' || data[i] > '9')goto err_number;
+        if(data[i] == '0' && i + 1 < len &&
+            data[i + 1] >= '0' && data[i + 1] <= '9'
+        ){
+            obj_json_errmsg(loader, __func__);
+            fprintf(stderr, "Numbers can't have leading zeros\n");
+            return 1;
+        }
+        for(; i < len && data[i] >= '0' && data[i] <= '9'; i++){
+            n = n * 10 + (data[i] - '0');
+            if(n > (long long)INT_MAX + 1){
+                obj_json_errmsg(loader, __func__);
+                fprintf(stderr, "Number too large for an int\n");
+                return 1;
+            }
+        }
+        if(i < len && (data[i] == '.' || data[i] == 'e' || data[i] == 'E')){
+            obj_json_errmsg(loader, __func__);
+            fprintf(stderr, "Only integers are supported\n");
+            return 1;
+        }
+        if(c == '-')n = -n;
+        if(n > INT_MAX){
+            obj_json_errmsg(loader, __func__);
+            fprintf(stderr, "Number too large for an int\n");
+            return 1;
+        }
+        obj_init_int(value, n);
+        loader->pos += i;
+        return 0;
+    }else if(len >= 4 && !strncmp(data, "true", 4)){
+        obj_init_bool(value, true);
+        loader->pos += 4;
+        return 0;
+    }else if(len >= 5 && !strncmp(data, "false", 5)){
+        obj_init_bool(value, false);
+        loader->pos += 5;
+        return 0;
+    }else if(len >= 4 && !strncmp(data, "null", 4)){
+        obj_init_null(value);
+        loader->pos += 4;
+        return 0;
+    }
+    obj_json_errmsg(loader, __func__);
+    fprintf(stderr, "Expected a JSON value\n");
+    return 1;
+err_number:
+    obj_json_errmsg(loader, __func__);
+    fprintf(stderr, "Invalid number\n");
+    return 1;
+}
+
+static obj_json_frame_t *obj_json_push(obj_json_loader_t *loader){
+    if(loader->stack_tos >= loader->stack_len){
+        size_t stack_len = loader->stack_len? loader->stack_len * 2: 16;
+        obj_json_frame_t *stack = realloc(loader->stack,
+            stack_len * sizeof(*stack));
+        if(!stack){
+            fprintf(stderr, "%s: Couldn't grow stack to %zu frames. ",
+                __func__, stack_len);
+            perror("realloc");
+            return NULL;
+        }
+        loader->stack = stack;
+        loader->stack_len = stack_len;
+    }
+    obj_json_frame_t *frame = &loader->stack[loader->stack_tos++];
+    memset(frame, 0, sizeof(*frame));
+    return frame;
+}
+
+static obj_t *obj_json_value_ptr(obj_json_loader_t *loader, obj_t *value){
+    /* Values are built as a single obj_t (see obj_json_run), with lists
+    boxed, so they can be stored directly in dicts.
+    This returns the equivalent obj_t* for storing in a list. */
+    obj_pool_t *pool = loader->pool;
+    switch(OBJ_TYPE(value)){
+        case OBJ_TYPE_BOX: return OBJ_CONTENTS(value);
+        case OBJ_TYPE_NULL: return obj_pool_add_null(pool);
+        case OBJ_TYPE_BOOL: return obj_pool_add_bool(pool, OBJ_BOOL(value));
+        default: {
+            obj_t *obj = obj_pool_objs_alloc(pool, 1);
+            if(obj)*obj = *value;
+            return obj;
+        }
+    }
+}
+
+static obj_t *obj_json_run(obj_json_loader_t *loader){
+    /* Parses a JSON value, using loader->stack rather than recursion
+    for nested arrays & objects */
+    obj_pool_t *pool = loader->pool;
+    obj_t value;
+    for(;;){
+        /* Parse a value, or the start of an array or object */
+        obj_json_skip_space(loader);
+        if(loader->pos >= loader->data_len){
+            obj_json_errmsg(loader, __func__);
+            fprintf(stderr, "Unexpected end of data\n");
+            return NULL;
+        }
+        char c = loader->data[loader->pos];
+        if(c == '[' || c == '{'){
+            loader->pos++;
+            obj_json_frame_t *frame = obj_json_push(loader);
+            if(!frame)return NULL;
+            obj_json_skip_space(loader);
+            bool empty = loader->pos < loader->data_len &&
+                loader->data[loader->pos] == (c == '['? ']': '}');
+            if(c == '['){
+                frame->list = obj_pool_add_nil(pool);
+            }else{
+                if(!(frame->dict = obj_pool_dict_alloc(pool)))return NULL;
+                if(!empty && !(frame->key = obj_json_parse_key(loader))){
+                    return NULL;
+                }
+            }
+            if(!empty)continue;
+            loader->pos++;
+            loader->stack_tos--;
+            if(c == '[')obj_init_box(&value, frame->list);
+            else obj_init_dict(&value, frame->dict);
+        }else{
+            if(obj_json_parse_scalar(loader, &value))return NULL;
+        }
+
+        /* Add value to enclosing containers, closing them as we go,
+        until one of them has another value to be parsed */
+        for(;;){
+            if(!loader->stack_tos)return obj_json_value_ptr(loader, &value);
+            obj_json_frame_t *frame = &loader->stack[loader->stack_tos - 1];
+            if(frame->dict){
+                if(!obj_dict_set(frame->dict, frame->key, &value)){
+                    return NULL;
+                }
+            }else{
+                obj_t *head = obj_json_value_ptr(loader, &value);
+                obj_t *cell = head?
+                    obj_pool_add_cell(pool, head, obj_pool_add_nil(pool)):
+                    NULL;
+                if(!cell)return NULL;
+                if(frame->last)OBJ_TAIL(frame->last) = cell;
+                else frame->list = cell;
+                frame->last = cell;
+            }
+
+            obj_json_skip_space(loader);
+            char close = frame->dict? '}': ']';
+            c = loader->pos < loader->data_len?
+                loader->data[loader->pos]: 0;
+            if(c == ','){
+                loader->pos++;
+                if(frame->dict &&
+                    !(frame->key = obj_json_parse_key(loader))
+                )return NULL;
+                break;
+            }else if(c == close){
+                loader->pos++;
+                loader->stack_tos--;
+                if(frame->dict)obj_init_dict(&value, frame->dict);
+                else obj_init_box(&value, frame->list);
+            }else{
+                obj_json_errmsg(loader, __func__);
+                fprintf(stderr, "Expected ',' or '%c'\n", close);
+                return NULL;
+            }
+        }
+    }
+}
+
+obj_t *obj_json_parse(obj_pool_t *pool, const char *filename,
+    const char *data, size_t data_len, const obj_json_options_t *opts
+){
+    /* Parses a single JSON value (with optional surrounding
+    whitespace). opts may be NULL, for the defaults. */
+    obj_json_loader_t _loader, *loader=&_loader;
+    memset(loader, 0, sizeof(*loader));
+    loader->pool = pool;
+    loader->filename = filename;
+    loader->data = data;
+    loader->data_len = data_len;
+    loader->opts = opts? opts: &obj_json_default_options;
+
+    obj_t *obj = obj_json_run(loader);
+    if(obj){
+        obj_json_skip_space(loader);
+        if(loader->pos < loader->data_len){
+            obj_json_errmsg(loader, __func__);
+            fprintf(stderr, "Unexpected data after JSON value\n");
+            obj = NULL;
+        }
+    }
+    free(loader->buffer);
+    free(loader->stack);
+    return obj;
+}
+
+
+/******
+* obj *
+******/
+
+static void obj_fprint(obj_t *obj, FILE *file, int depth){
+    obj_writer_t _writer, *writer=&_writer;
+    obj_writer_init(writer, file);
+    if(!obj_writer_write_obj(writer, obj, depth)){
+        obj_writer_flush(writer);
+    }
+    obj_writer_cleanup(writer);
+}
+
+void obj_dump(obj_t *obj, FILE *file, int depth){
+    _print_tabs(file, depth);
+    obj_fprint(obj, file, depth);
+    putc('\n', file);
+}
+
+obj_t *obj_resolve(obj_t *obj){
+    while(OBJ_TYPE(obj) == OBJ_TYPE_BOX)obj = OBJ_CONTENTS(obj);
+    return obj;
+}
+
+obj_t *obj_list_get(obj_t *obj, obj_sym_t *sym){
+    while(obj && OBJ_TYPE(obj) == OBJ_TYPE_CELL){
+        obj_t *head = OBJ_HEAD(obj);
+        obj_t *tail = OBJ_TAIL(obj);
+        if(!tail || OBJ_TYPE(tail) != OBJ_TYPE_CELL)return NULL;
+        if(head && OBJ_TYPE(head) == OBJ_TYPE_SYM && OBJ_SYM(head) == sym){
+            return OBJ_HEAD(tail);
+        }
+        obj = OBJ_TAIL(tail);
+    }
+    return NULL;
+}
+
+obj_t *obj_list_iget(obj_t *obj, int i){
+    while(obj && OBJ_TYPE(obj) == OBJ_TYPE_CELL){
+        int run = OBJ_CELL_RUN(obj);
+        if(run > 1 && i > 0){
+            /* Jump straight to the i-th cell, or the run's last one */
+            int skip = i < run - 1? i: run - 1;
+            obj += skip * 2;
+            i -= skip;
+        }
+        if(i <= 0)return OBJ_HEAD(obj);
+        obj = OBJ_TAIL(obj);
+        i--;
+    }
+    return NULL;
+}
+
+int obj_list_len(obj_t *obj){
+    int len = 0;
+    while(obj && OBJ_TYPE(obj) == OBJ_TYPE_CELL){
+        int run = OBJ_CELL_RUN(obj);
+        if(run > 1){
+            obj += (run - 1) * 2;
+            len += run - 1;
+        }
+        obj = OBJ_TAIL(obj);
+        len++;
+    }
+    return len;
+}
+
+obj_t **obj_list_get_end(obj_t **obj){
+    while(*obj && OBJ_TYPE(*obj) == OBJ_TYPE_CELL){
+        obj = &OBJ_TAIL(*obj);
+    }
+    return obj;
+}
+
+obj_t *obj_struct_get(obj_t *obj, obj_sym_t *sym){
+    int i = obj_shape_get_index(OBJ_STRUCT_SHAPE(obj), sym);
+    if(i < 0)return NULL;
+    return OBJ_STRUCT_IGET_VAL(obj, i);
+}
+
+int obj_len(obj_t *obj){
+    if(!obj)return 0;
+    int type = OBJ_TYPE(obj);
+    if(type == OBJ_TYPE_NIL){
+        return 0;
+    }else if(type == OBJ_TYPE_CELL){
+        return obj_list_len(obj);
+    }else if(type == OBJ_TYPE_ARRAY){
+        return OBJ_ARRAY_LEN(obj);
+    }else if(type == OBJ_TYPE_VEC){
+        return OBJ_VEC_LEN(obj);
+    }else if(type == OBJ_TYPE_INTARR){
+        return OBJ_INTARR_LEN(obj);
+    }else if(type == OBJ_TYPE_DICT){
+        return OBJ_DICT_N_KEYS(obj);
+    }else if(type == OBJ_TYPE_STRUCT){
+        return OBJ_STRUCT_LEN(obj);
+    }else if(type == OBJ_TYPE_MAP){
+        return OBJ_MAP_N_KEYS(obj);
+    }else if(type == OBJ_TYPE_OMAP){
+        return OBJ_OMAP_LEN(obj);
+    }else if(type == OBJ_TYPE_PQUEUE){
+        return OBJ_PQUEUE_LEN(obj);
+    }else{
+        return 0;
+    }
+}
+
+obj_t *obj_get(obj_t *obj, obj_sym_t *sym){
+    if(!obj)return NULL;
+    int type = OBJ_TYPE(obj);
+    if(type == OBJ_TYPE_NIL){
+        return NULL;
+    }else if(type == OBJ_TYPE_CELL){
+        return obj_list_get(obj, sym);
+    }else if(type == OBJ_TYPE_DICT){
+        return obj_dict_get(OBJ_DICT(obj), sym);
+    }else if(type == OBJ_TYPE_STRUCT){
+        return obj_struct_get(obj, sym);
+    }else if(type == OBJ_TYPE_MAP){
+        obj_t key;
+        obj_init_sym(&key, sym);
+        return obj_map_get(obj, &key);
+    }else if(type == OBJ_TYPE_OMAP){
+        obj_t key;
+        obj_init_sym(&key, sym);
+        return obj_omap_get(obj, &key);
     }else{
-        /* Invalid character: treat it like EOF, return empty token */
-        parser->token_type = OBJ_TOKEN_TYPE_INVALID;
-        obj_parser_errmsg(parser, __func__);
-        fprintf(stderr, "Invalid character: %c (#%i)\n",
-            isprint(c)? (char)c: ' ', c);
-        return 1;
+        return NULL;
     }
+}
 
-    parser->token_len = &parser->data[parser->pos] - parser->token;
+obj_t *obj_iget(obj_t *obj, int i){
+    if(!obj)return NULL;
+    int type = OBJ_TYPE(obj);
+    if(type == OBJ_TYPE_NIL){
+        return NULL;
+    }else if(type == OBJ_TYPE_CELL){
+        return obj_list_iget(obj, i);
+    }else if(type == OBJ_TYPE_ARRAY){
+        return OBJ_ARRAY_IGET(obj, i);
+    }else if(type == OBJ_TYPE_VEC){
+        return OBJ_VEC_IGET(obj, i);
+    }else{
+        return NULL;
+    }
+}
 
-    if(
-        !parser->line_col_is_set &&
-        parser->token_type != OBJ_TOKEN_TYPE_WHITESPACE &&
-        parser->token_type != OBJ_TOKEN_TYPE_NEWLINE
-    ){
-        parser->line_col = parser->token_col;
-        parser->line_col_is_set = true;
+
+/***********
+* obj_sort *
+***********/
+
+/* Sorting & searching of objs.
+They work on arrays of obj_t* (e.g. a list's heads, or pointers into
+an array's values), and compare with an obj_lt_t, so callers can
+supply their own comparison (e.g. lang.h's vm calls a fun).
+obj_lt is the native comparison: ints by value, strs and syms by
+their bytes. */
+
+#define OBJ_SORT_SMALL 16
+
+int obj_cmp(obj_t *x, obj_t *y, int *cmp_ptr){
+    /* Sets *cmp_ptr to <0, 0 or >0 as x is less than, equal to or
+    greater than y. They must both be ints, both strs or both syms. */
+    x = obj_resolve(x);
+    y = obj_resolve(y);
+    int type = OBJ_TYPE(x);
+    if(type != OBJ_TYPE(y))goto err;
+    if(type == OBJ_TYPE_INT){
+        int i = OBJ_INT(x), j = OBJ_INT(y);
+        *cmp_ptr = i < j? -1: i > j? 1: 0;
+        return 0;
     }
 
-#   ifdef OBJ_DEBUG_TOKENS
-    fprintf(stderr, "TOKEN: \"%.*s\"\n",
-        size_to_int(parser->token_len, 256), parser->token);
-#   endif
+    obj_string_t *s, *t, view_s, view_t;
+    if(type == OBJ_TYPE_STR){
+        s = obj_str_get(x, &view_s);
+        t = obj_str_get(y, &view_t);
+    }else if(type == OBJ_TYPE_SYM){
+        if(OBJ_SYM(x) == OBJ_SYM(y)){
+            *cmp_ptr = 0;
+            return 0;
+        }
+        s = &OBJ_SYM(x)->string;
+        t = &OBJ_SYM(y)->string;
+    }else goto err;
+    size_t len = s->len < t->len? s->len: t->len;
+    int cmp = len? memcmp(s->data, t->data, len): 0;
+    *cmp_ptr = cmp? cmp: s->len < t->len? -1: s->len > t->len? 1: 0;
+    return 0;
+
+err:
+    fprintf(stderr, "%s: Can't compare %s with %s\n", __func__,
+        obj_type_msg(OBJ_TYPE(x)), obj_type_msg(OBJ_TYPE(y)));
+    return 1;
+}
 
+int obj_lt(obj_t *x, obj_t *y, void *data, bool *lt_ptr){
+    int cmp;
+    if(obj_cmp(x, y, &cmp))return 1;
+    *lt_ptr = cmp < 0;
     return 0;
 }
 
-char *obj_parser_get_unescaped_token(
-    obj_parser_t *parser, const char *token, size_t token_len,
-    size_t *unescaped_token_len_ptr
+static int obj_insertion_sort(obj_t **objs, size_t n,
+    obj_lt_t *lt, void *data
 ){
-    char *unescaped_token = obj_parser_get_token_buffer(
-        parser, parser->token_len);
-    if(!unescaped_token)return NULL;
-    size_t unescaped_token_len = 0;
-    for(size_t i = 0; i < token_len; i++){
-        char c = token[i];
-        if(c == '\\'){
-            if(i >= token_len - 1){
-                fprintf(stderr, "%s: '\\' at end of token: \"%.*s\"\n",
-                    __func__, size_to_int(token_len, -1), token);
-                return NULL;
+    /* Stable. Finds where each obj goes by binary search (after any
+    equal objs), so makes few calls to lt; the moves are cheap. */
+    for(size_t i = 1; i < n; i++){
+        obj_t *obj = objs[i];
+        size_t lo = 0, hi = i;
+        while(lo < hi){
+            size_t mid = lo + (hi - lo) / 2;
+            bool b;
+            if(lt(obj, objs[mid], data, &b))return 1;
+            if(b)hi = mid;
+            else lo = mid + 1;
+        }
+        memmove(&objs[lo + 1], &objs[lo], (i - lo) * sizeof(*objs));
+        objs[lo] = obj;
+    }
+    return 0;
+}
+
+int obj_msort(obj_t **objs, size_t n, obj_lt_t *lt, void *data){
+    /* Stable merge sort: sorts small runs by insertion, then merges
+    them bottom-up, making about n*log2(n) calls to lt */
+    for(size_t i = 0; i < n; i += OBJ_SORT_SMALL){
+        size_t run = n - i < OBJ_SORT_SMALL? n - i: OBJ_SORT_SMALL;
+        if(obj_insertion_sort(objs + i, run, lt, data))return 1;
+    }
+    if(n <= OBJ_SORT_SMALL)return 0;
+
+    obj_t **buf = malloc(n * sizeof(*buf));
+    if(!buf){
+        fprintf(stderr, "%s: Couldn't allocate sort buffer. ", __func__);
+        perror("malloc");
+        return 1;
+    }
+    obj_t **src = objs, **dst = buf;
+    for(size_t width = OBJ_SORT_SMALL; width < n; width *= 2){
+        for(size_t lo = 0; lo < n; lo += width * 2){
+            size_t mid = lo + width < n? lo + width: n;
+            size_t hi = mid + width < n? mid + width: n;
+            size_t i = lo, j = mid, k = lo;
+            while(i < mid && j < hi){
+                /* Only take from the right if it's strictly less, so
+                equal objs keep their order */
+                bool b;
+                if(lt(src[j], src[i], data, &b))goto err;
+                dst[k++] = b? src[j++]: src[i++];
             }
-            c = token[++i];
-            if(c == 'n')c = '\n';
+            while(i < mid)dst[k++] = src[i++];
+            while(j < hi)dst[k++] = src[j++];
         }
-        unescaped_token[unescaped_token_len++] = c;
+        obj_t **tmp = src; src = dst; dst = tmp;
     }
-    *unescaped_token_len_ptr = unescaped_token_len;
-    return unescaped_token;
+    if(src != objs)memcpy(objs, src, n * sizeof(*objs));
+    free(buf);
+    return 0;
+err:
+    free(buf);
+    return 1;
 }
 
-obj_string_t *obj_parser_get_string(obj_parser_t *parser){
-    if(!obj_parser_token_is_string(parser)){
-        obj_parser_errmsg(parser, __func__);
-        fprintf(stderr, "Expected string\n");
-        return NULL;
+static int obj_sift_down(obj_t **objs, size_t i, size_t n,
+    obj_lt_t *lt, void *data
+){
+    for(;;){
+        size_t child = i * 2 + 1;
+        if(child >= n)return 0;
+        bool b;
+        if(child + 1 < n){
+            if(lt(objs[child], objs[child + 1], data, &b))return 1;
+            if(b)child++;
+        }
+        if(lt(objs[i], objs[child], data, &b))return 1;
+        if(!b)return 0;
+        obj_t *tmp = objs[i]; objs[i] = objs[child]; objs[child] = tmp;
+        i = child;
     }
-    if(parser->token_type == OBJ_TOKEN_TYPE_LINESTRING){
-        return obj_pool_string_add_raw(
-            parser->pool, parser->token + 1, parser->token_len - 1);
+}
+
+static int obj_heapsort(obj_t **objs, size_t n, obj_lt_t *lt, void *data){
+    for(size_t i = n / 2; i-- > 0;){
+        if(obj_sift_down(objs, i, n, lt, data))return 1;
     }
-    size_t token_len;
-    char *token = obj_parser_get_unescaped_token(parser,
-        parser->token + 1, parser->token_len - 2, &token_len);
-    if(!token)return NULL;
-    return obj_pool_string_add_raw(
-        parser->pool, token, token_len);
+    for(size_t end = n; end-- > 1;){
+        obj_t *tmp = objs[0]; objs[0] = objs[end]; objs[end] = tmp;
+        if(obj_sift_down(objs, 0, end, lt, data))return 1;
+    }
+    return 0;
 }
 
-obj_sym_t *obj_parser_get_sym(obj_parser_t *parser){
-    if(!obj_parser_token_is_sym(parser)){
-        obj_parser_errmsg(parser, __func__);
-        fprintf(stderr, "Expected sym\n");
-        return NULL;
+static int obj_introsort_rec(obj_t **objs, size_t n, int depth,
+    obj_lt_t *lt, void *data
+){
+    while(n > OBJ_SORT_SMALL){
+        if(!depth--){
+            /* Quicksort is going quadratic, so fall back to heapsort */
+            return obj_heapsort(objs, n, lt, data);
+        }
+
+        /* Median of three as pivot, moved to objs[0]. Afterwards
+        objs[1] isn't greater than it and objs[n - 1] isn't less, so
+        they stop the partition loops running off either end. */
+        obj_t **a = &objs[1], **m = &objs[n / 2], **z = &objs[n - 1];
+        obj_t *tmp;
+        bool b;
+        if(lt(*m, *a, data, &b))return 1;
+        if(b){ tmp = *m; *m = *a; *a = tmp; }
+        if(lt(*z, *m, data, &b))return 1;
+        if(b){
+            tmp = *z; *z = *m; *m = tmp;
+            if(lt(*m, *a, data, &b))return 1;
+            if(b){ tmp = *m; *m = *a; *a = tmp; }
+        }
+        obj_t *pivot = *m; *m = objs[0]; objs[0] = pivot;
+
+        /* Hoare partition of objs[1..n) around pivot */
+        size_t i = 0, j = n;
+        for(;;){
+            /* (The bounds checks are only needed if lt isn't
+            consistent) */
+            do{
+                if(lt(objs[++i], pivot, data, &b))return 1;
+            }while(b && i < n - 1);
+            do{
+                if(lt(pivot, objs[--j], data, &b))return 1;
+            }while(b && j > 1);
+            if(i >= j)break;
+            tmp = objs[i]; objs[i] = objs[j]; objs[j] = tmp;
+        }
+        objs[0] = objs[j]; objs[j] = pivot;
+
+        /* Recurse into the smaller side and loop on the larger, so the
+        C stack stays shallow */
+        size_t n_left = j, n_right = n - j - 1;
+        if(n_left < n_right){
+            if(obj_introsort_rec(objs, n_left, depth, lt, data))return 1;
+            objs += j + 1;
+            n = n_right;
+        }else{
+            if(obj_introsort_rec(objs + j + 1, n_right, depth,
+                lt, data))return 1;
+            n = n_left;
+        }
     }
-    if(parser->token_type != OBJ_TOKEN_TYPE_LONGSYM){
-        return obj_symtable_get_sym_raw(
-            parser->pool->symtable, parser->token,
-            parser->token_len);
+    return obj_insertion_sort(objs, n, lt, data);
+}
+
+int obj_introsort(obj_t **objs, size_t n, obj_lt_t *lt, void *data){
+    /* Unstable, but needs no buffer: quicksort, falling back to
+    heapsort if it recurses more than 2*log2(n) deep, and to insertion
+    sort for small ranges */
+    int depth = 0;
+    for(size_t m = n; m > 1; m /= 2)depth += 2;
+    return obj_introsort_rec(objs, n, depth, lt, data);
+}
+
+int obj_array_sort(obj_t *array, bool stable, obj_lt_t *lt, void *data){
+    /* Sorts array's values in place, by sorting pointers to them and
+    then moving the values into place */
+    int len = OBJ_ARRAY_LEN(array);
+    if(len < 2)return 0;
+    obj_t **ptrs = malloc(len * sizeof(*ptrs));
+    obj_t *vals = ptrs? malloc(len * sizeof(*vals)): NULL;
+    if(!vals){
+        fprintf(stderr, "%s: Couldn't allocate sort buffer. ", __func__);
+        perror("malloc");
+        free(ptrs);
+        return 1;
     }
-    size_t token_len;
-    char *token = obj_parser_get_unescaped_token(parser,
-        parser->token + 1, parser->token_len - 2, &token_len);
-    if(!token)return NULL;
-    return obj_symtable_get_sym_raw(
-        parser->pool->symtable, token, token_len);
+    for(int i = 0; i < len; i++)ptrs[i] = OBJ_ARRAY_IGET(array, i);
+    int err = stable?
+        obj_msort(ptrs, len, lt, data):
+        obj_introsort(ptrs, len, lt, data);
+    if(!err){
+        for(int i = 0; i < len; i++)vals[i] = *ptrs[i];
+        memcpy(OBJ_ARRAY_IGET(array, 0), vals, len * sizeof(*vals));
+    }
+    free(vals);
+    free(ptrs);
+    return err;
 }
 
-obj_t *obj_parser_parse(obj_parser_t *parser){
-    obj_t *lst = NULL;
-    obj_t **tail = &lst;
-    int typecast = OBJ_TYPE_UNDEFINED;
+int obj_array_bsearch(obj_t *array, obj_t *obj, int *i_ptr){
+    /* Sets *i_ptr to the index of the first of array's values which
+    isn't less than obj (or array's len, if there are none), assuming
+    array is sorted */
+    int lo = 0, hi = OBJ_ARRAY_LEN(array);
+    while(lo < hi){
+        int mid = lo + (hi - lo) / 2;
+        int cmp;
+        if(obj_cmp(OBJ_ARRAY_IGET(array, mid), obj, &cmp))return 1;
+        if(cmp < 0)lo = mid + 1;
+        else hi = mid;
+    }
+    *i_ptr = lo;
+    return 0;
+}
 
-    if(parser->use_extended_types){
-        fprintf(stderr, "%s: Extended types not supported yet!\n",
-            __func__);
+void obj_array_reverse(obj_t *array){
+    int len = OBJ_ARRAY_LEN(array);
+    for(int i = 0, j = len - 1; i < j; i++, j--){
+        obj_t tmp = *OBJ_ARRAY_IGET(array, i);
+        *OBJ_ARRAY_IGET(array, i) = *OBJ_ARRAY_IGET(array, j);
+        *OBJ_ARRAY_IGET(array, j) = tmp;
+    }
+}
+
+
+/*********
+* obj_eq *
+*********/
+
+/* Structural equality & hashing of obj trees.
+Two objs are equal if they have the same type (boxes being looked
+through, and queues only being equal to queues) and equal contents:
+dicts compare as sets of entries, regardless of order; structs compare
+keys (in order) and values; funs compare module, name and args.
+obj_hash_deep is consistent with obj_eq: equal objs have equal hashes.
+Both work iteratively, so deep trees don't exhaust the C stack. */
+
+#define OBJ_HASH_MEMO_DEFAULT_LEN 64
+#define OBJ_EQ_DEFAULT_STACK_LEN 32
+
+struct obj_hash_memo_entry {
+    obj_t *obj;
+    size_t hash;
+};
+
+struct obj_hash_memo {
+    obj_hash_memo_entry_t *entries;
+    size_t entries_len;
+    size_t n_entries;
+        /* Maps containers (the obj_t* of a list's first cell, an array,
+        etc) to their hashes, so that hashing a shared subtree again is
+        O(1).
+        Entries aren't invalidated when objs are modified, so callers
+        must obj_hash_memo_clear a memo after modifying anything in
+        it. */
+};
+
+void obj_hash_memo_init(obj_hash_memo_t *memo){
+    memset(memo, 0, sizeof(*memo));
+}
+
+void obj_hash_memo_cleanup(obj_hash_memo_t *memo){
+    free(memo->entries);
+}
+
+void obj_hash_memo_clear(obj_hash_memo_t *memo){
+    /* Clearing costs as much as the table is big, so a table left much
+    bigger than its contents (by some earlier, larger hash) is freed
+    instead, and regrown as needed. So clearing after each hash costs
+    no more than the hash itself. */
+    if(!memo->n_entries)return;
+    if(memo->entries_len > OBJ_HASH_MEMO_DEFAULT_LEN &&
+        memo->n_entries * 8 < memo->entries_len
+    ){
+        free(memo->entries);
+        memo->entries = NULL;
+        memo->entries_len = 0;
+    }else{
+        memset(memo->entries, 0,
+            memo->entries_len * sizeof(*memo->entries));
+    }
+    memo->n_entries = 0;
+}
+
+static size_t obj_hash_memo_slot(obj_hash_memo_t *memo, obj_t *obj){
+    /* Index of obj's entry, or of the empty slot where it would go */
+    size_t mask = memo->entries_len - 1;
+    size_t i = ((uintptr_t)obj >> 4) * (size_t)0x9e3779b9 & mask;
+    while(memo->entries[i].obj && memo->entries[i].obj != obj){
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+bool obj_hash_memo_get(obj_hash_memo_t *memo, obj_t *obj,
+    size_t *hash_ptr
+){
+    if(!memo || !memo->n_entries)return false;
+    obj_hash_memo_entry_t *entry =
+        &memo->entries[obj_hash_memo_slot(memo, obj)];
+    if(!entry->obj)return false;
+    *hash_ptr = entry->hash;
+    return true;
+}
+
+int obj_hash_memo_set(obj_hash_memo_t *memo, obj_t *obj, size_t hash){
+    /* We grow once we're half full */
+    if((memo->n_entries + 1) * 2 > memo->entries_len){
+        obj_hash_memo_entry_t *old_entries = memo->entries;
+        size_t old_entries_len = memo->entries_len;
+        size_t entries_len = old_entries_len? old_entries_len * 2:
+            OBJ_HASH_MEMO_DEFAULT_LEN;
+        obj_hash_memo_entry_t *entries = calloc(entries_len,
+            sizeof(*entries));
+        if(!entries){
+            fprintf(stderr, "%s: Couldn't grow memo to %zu entries. ",
+                __func__, entries_len);
+            perror("calloc");
+            return 1;
+        }
+        memo->entries = entries;
+        memo->entries_len = entries_len;
+        for(size_t i = 0; i < old_entries_len; i++){
+            obj_hash_memo_entry_t *old_entry = &old_entries[i];
+            if(!old_entry->obj)continue;
+            memo->entries[obj_hash_memo_slot(memo, old_entry->obj)] =
+                *old_entry;
+        }
+        free(old_entries);
+    }
+    obj_hash_memo_entry_t *entry =
+        &memo->entries[obj_hash_memo_slot(memo, obj)];
+    if(!entry->obj)memo->n_entries++;
+    entry->obj = obj;
+    entry->hash = hash;
+    return 0;
+}
+
+static void *obj_eq_grow_stack(void *stack, void *local_stack,
+    size_t *stack_len_ptr, size_t elem_size
+){
+    /* Doubles a stack which starts out as a local array, moving it to
+    the heap */
+    size_t stack_len = *stack_len_ptr * 2;
+    void *new_stack = realloc(stack == local_stack? NULL: stack,
+        stack_len * elem_size);
+    if(!new_stack){
+        fprintf(stderr, "%s: Couldn't grow stack to %zu elements. ",
+            __func__, stack_len);
+        perror("realloc");
         return NULL;
     }
+    if(stack == local_stack){
+        memcpy(new_stack, stack, *stack_len_ptr * elem_size);
+    }
+    *stack_len_ptr = stack_len;
+    return new_stack;
+}
 
+typedef struct obj_hash_frame {
+    obj_t *obj;
+    obj_t *cell;
+    size_t i;
+    size_t hash;
+    size_t key_hash;
+        /* obj: the container being hashed */
+        /* cell: for lists, the next cell */
+        /* i: index of next element (arrays, dicts, structs, funs) */
+        /* hash: hash of elements so far; for dicts and maps, the sum
+        of the hashes of entries, so that order doesn't matter */
+        /* key_hash: for dicts and maps, hash of the key of the entry
+        whose value is being hashed */
+} obj_hash_frame_t;
+
+int obj_hash_deep(obj_t *obj, obj_hash_memo_t *memo, size_t *hash_ptr){
+    /* Computes a hash of obj and everything in it.
+    If memo isn't NULL, it's used to look up (and then remember) hashes
+    of containers. */
+    obj_hash_frame_t local_stack[OBJ_EQ_DEFAULT_STACK_LEN];
+    obj_hash_frame_t *stack = local_stack;
+    size_t stack_len = OBJ_EQ_DEFAULT_STACK_LEN;
+    size_t stack_tos = 0;
+    size_t hash = 0;
+    int err = 1;
     for(;;){
-        if(obj_parser_get_token(parser))return NULL;
-        if(parser->token_type == OBJ_TOKEN_TYPE_EOF)break;
-        if(parser->line_col_is_set){
-            while(
-                parser->stack &&
-                parser->stack->token_type == OBJ_TOKEN_TYPE_COLON &&
-                parser->token_row > parser->stack->token_row &&
-                parser->line_col <= parser->stack->line_col
-            ){
-                if(!(tail = obj_parser_stack_pop(parser, tail)))return NULL;
+        /* Hash obj, unless it's a container which we have to descend
+        into, in which case we push a frame for it */
+        if(obj){
+            obj = OBJ_RESOLVE(obj);
+            int type = OBJ_TYPE(obj);
+            hash = obj_hash_mix(0, type);
+            switch(type){
+                case OBJ_TYPE_BOOL:
+                case OBJ_TYPE_INT:
+                    hash = obj_hash_mix(hash, (unsigned)OBJ_INT(obj));
+                    break;
+                case OBJ_TYPE_SYM:
+                    hash = obj_hash_mix(hash, OBJ_SYM(obj)->hash);
+                    break;
+                case OBJ_TYPE_STR:
+                case OBJ_TYPE_STRBUF: {
+                    obj_string_t view;
+                    obj_string_t *s = obj_str_get(obj, &view);
+                    hash = obj_hash_mix(hash,
+                        (unsigned)obj_hash(s->data, s->len));
+                    break;
+                }
+                case OBJ_TYPE_INTARR: {
+                    int len = OBJ_INTARR_LEN(obj);
+                    hash = obj_hash_mix(hash, OBJ_INTARR_KIND(obj));
+                    hash = obj_hash_mix(hash, (unsigned)obj_hash(
+                        OBJ_INTARR_DATA(obj),
+                        len * obj_intarr_elem_size(OBJ_INTARR_KIND(obj))));
+                    break;
+                }
+                case OBJ_TYPE_CELL:
+                case OBJ_TYPE_QUEUE:
+                case OBJ_TYPE_ARRAY:
+                case OBJ_TYPE_DICT:
+                case OBJ_TYPE_STRUCT:
+                case OBJ_TYPE_FUN:
+                case OBJ_TYPE_VEC:
+                case OBJ_TYPE_MAP:
+                case OBJ_TYPE_OMAP:
+                case OBJ_TYPE_PQUEUE: {
+                    if(obj_hash_memo_get(memo, obj, &hash))break;
+                    if(stack_tos >= stack_len){
+                        obj_hash_frame_t *new_stack = obj_eq_grow_stack(
+                            stack, local_stack, &stack_len,
+                            sizeof(*stack));
+                        if(!new_stack)goto done;
+                        stack = new_stack;
+                    }
+                    obj_hash_frame_t *frame = &stack[stack_tos++];
+                    frame->obj = obj;
+                    frame->cell = type == OBJ_TYPE_CELL? obj:
+                        type == OBJ_TYPE_QUEUE? OBJ_QUEUE_LIST(obj): NULL;
+                    frame->i = 0;
+                    frame->hash = hash;
+                    frame->key_hash = 0;
+                    obj = NULL;
+                    break;
+                }
+                default: break;
+            }
+            if(obj){
+                /* obj was hashed without pushing a frame */
+                obj = NULL;
+                goto combine;
             }
         }
 
-        obj_t *obj = NULL;
-        switch(parser->token_type){
-            case OBJ_TOKEN_TYPE_INT: {
-                bool is_neg = parser->token[0] == '-';
-                int n = 0;
-                for(int i = is_neg? 1: 0; i < parser->token_len; i++){
-                    int digit = parser->token[i] - '0';
-                    n *= 10;
-                    n += digit;
+        /* Find the next element of the innermost container */
+        {
+            obj_hash_frame_t *frame = &stack[stack_tos - 1];
+            obj_t *container = frame->obj;
+            switch(OBJ_TYPE(container)){
+                case OBJ_TYPE_CELL:
+                case OBJ_TYPE_QUEUE:
+                    if(OBJ_TYPE(frame->cell) != OBJ_TYPE_CELL)break;
+                    obj = OBJ_HEAD(frame->cell);
+                    frame->cell = OBJ_TAIL(frame->cell);
+                    continue;
+                case OBJ_TYPE_ARRAY:
+                    if(frame->i >= OBJ_ARRAY_LEN(container))break;
+                    obj = OBJ_ARRAY_IGET(container, frame->i++);
+                    continue;
+                case OBJ_TYPE_DICT: {
+                    obj_dict_t *dict = OBJ_DICT(container);
+                    while(frame->i < dict->entries_len &&
+                        !dict->entries[frame->i].sym)frame->i++;
+                    if(frame->i >= dict->entries_len)break;
+                    obj_dict_entry_t *entry = &dict->entries[frame->i++];
+                    frame->key_hash = entry->sym->hash;
+                    obj = &entry->value;
+                    continue;
                 }
-                if(is_neg)n = -n;
-                obj = obj_pool_add_int(parser->pool, n);
-                if(!obj)return NULL;
+                case OBJ_TYPE_STRUCT:
+                    if(frame->i >= OBJ_STRUCT_LEN(container))break;
+                    frame->hash = obj_hash_mix(frame->hash, OBJ_SYM(
+                        OBJ_STRUCT_IGET_KEY(container, frame->i))->hash);
+                    obj = OBJ_STRUCT_IGET_VAL(container, frame->i++);
+                    continue;
+                case OBJ_TYPE_FUN:
+                    if(frame->i++)break;
+                    frame->hash = obj_hash_mix(frame->hash,
+                        OBJ_FUN_MODULE_NAME(container)->hash);
+                    frame->hash = obj_hash_mix(frame->hash,
+                        OBJ_FUN_DEF_NAME(container)->hash);
+                    obj = OBJ_FUN_ARGS(container);
+                    continue;
+                case OBJ_TYPE_VEC:
+                    /* Vecs of the same length have trees of the same
+                    shape, so we can just hash the tree */
+                    if(frame->i++ || !OBJ_VEC_ROOT(container))break;
+                    obj = OBJ_VEC_ROOT(container);
+                    continue;
+                case OBJ_TYPE_MAP: {
+                    obj_t *key;
+                    while(frame->i < (size_t)OBJ_MAP_CAP(container) &&
+                        OBJ_TYPE(key = OBJ_MAP_IGET_KEY(container,
+                            frame->i)) == OBJ_TYPE_NULL
+                    )frame->i++;
+                    if(frame->i >= (size_t)OBJ_MAP_CAP(container))break;
+                    frame->key_hash = obj_pool_hashcons_hash(key);
+                    obj = OBJ_MAP_IGET_VAL(container, frame->i++);
+                    continue;
+                }
+                case OBJ_TYPE_OMAP: {
+                    /* Omaps with the same entries may have differently
+                    shaped trees, so we hash the entries, in order */
+                    obj_t *entry = OBJ_OMAP_IGET(container, frame->i++);
+                    if(!entry)break;
+                    frame->hash = obj_hash_mix(frame->hash,
+                        obj_pool_hashcons_hash(entry));
+                    obj = entry + 1;
+                    continue;
+                }
+                case OBJ_TYPE_PQUEUE:
+                    /* Priorities and values, in heap order */
+                    if(frame->i >= (size_t)OBJ_PQUEUE_LEN(container) * 2){
+                        break;
+                    }
+                    obj = OBJ_ARRAY_IGET(OBJ_PQUEUE_HEAP(container),
+                        frame->i++);
+                    continue;
+                default: break;
+            }
+
+            /* Container has no more elements */
+            hash = frame->hash;
+            stack_tos--;
+            if(memo && obj_hash_memo_set(memo, container, hash))goto done;
+        }
+
+    combine:
+        /* Combine hash into that of the innermost container */
+        if(!stack_tos)break;
+        {
+            obj_hash_frame_t *frame = &stack[stack_tos - 1];
+            int type = OBJ_TYPE(frame->obj);
+            if(type == OBJ_TYPE_DICT || type == OBJ_TYPE_MAP){
+                frame->hash += obj_hash_mix(frame->key_hash, hash);
+            }else{
+                frame->hash = obj_hash_mix(frame->hash, hash);
+            }
+        }
+    }
+    *hash_ptr = hash;
+    err = 0;
+done:
+    if(stack != local_stack)free(stack);
+    return err;
+}
+
+typedef struct obj_eq_pair {
+    obj_t *x;
+    obj_t *y;
+} obj_eq_pair_t;
+
+int obj_eq(obj_t *x, obj_t *y, obj_hash_memo_t *memo, bool *eq_ptr){
+    /* Sets *eq_ptr to whether x and y are structurally equal.
+    Pairs of identical objs are equal without looking inside them, so
+    comparing trees which share subtrees is cheap.
+    If memo isn't NULL, containers with different hashes in it are
+    known to be unequal without looking inside them. */
+    obj_eq_pair_t local_stack[OBJ_EQ_DEFAULT_STACK_LEN];
+    obj_eq_pair_t *stack = local_stack;
+    size_t stack_len = OBJ_EQ_DEFAULT_STACK_LEN;
+    size_t stack_tos = 0;
+    bool eq = false;
+    int err = 1;
+
+#   define OBJ_EQ_PUSH(X, Y) { \
+        if(stack_tos >= stack_len){ \
+            obj_eq_pair_t *new_stack = obj_eq_grow_stack( \
+                stack, local_stack, &stack_len, sizeof(*stack)); \
+            if(!new_stack)goto done; \
+            stack = new_stack; \
+        } \
+        stack[stack_tos].x = (X); \
+        stack[stack_tos].y = (Y); \
+        stack_tos++; \
+    }
+
+    OBJ_EQ_PUSH(x, y)
+    while(stack_tos){
+        stack_tos--;
+        x = OBJ_RESOLVE(stack[stack_tos].x);
+        y = OBJ_RESOLVE(stack[stack_tos].y);
+        if(x == y)continue;
+        int type = OBJ_TYPE(x);
+        if(OBJ_TYPE(y) != type)goto done_eq;
+
+        size_t x_hash, y_hash;
+        bool is_container = type == OBJ_TYPE_CELL ||
+            type == OBJ_TYPE_QUEUE || type == OBJ_TYPE_ARRAY ||
+            type == OBJ_TYPE_DICT || type == OBJ_TYPE_STRUCT ||
+            type == OBJ_TYPE_FUN || type == OBJ_TYPE_VEC ||
+            type == OBJ_TYPE_MAP || type == OBJ_TYPE_OMAP ||
+            type == OBJ_TYPE_PQUEUE;
+        if(is_container &&
+            obj_hash_memo_get(memo, x, &x_hash) &&
+            obj_hash_memo_get(memo, y, &y_hash) &&
+            x_hash != y_hash
+        )goto done_eq;
+
+        switch(type){
+            case OBJ_TYPE_NULL:
+            case OBJ_TYPE_NIL:
+                break;
+            case OBJ_TYPE_BOOL:
+                if(OBJ_BOOL(x) != OBJ_BOOL(y))goto done_eq;
+                break;
+            case OBJ_TYPE_INT:
+                if(OBJ_INT(x) != OBJ_INT(y))goto done_eq;
+                break;
+            case OBJ_TYPE_SYM:
+                if(OBJ_SYM(x) != OBJ_SYM(y))goto done_eq;
+                break;
+            case OBJ_TYPE_STR:
+            case OBJ_TYPE_STRBUF: {
+                obj_string_t view_x, view_y;
+                if(!obj_string_eq(obj_str_get(x, &view_x),
+                    obj_str_get(y, &view_y)))goto done_eq;
                 break;
             }
-            case OBJ_TOKEN_TYPE_NAME:
-            case OBJ_TOKEN_TYPE_OPER:
-            case OBJ_TOKEN_TYPE_LONGSYM: {
-                obj_sym_t *sym = obj_parser_get_sym(parser);
-                if(!sym)return NULL;
-                obj = obj_pool_add_sym(parser->pool, sym);
-                if(!obj)return NULL;
+            case OBJ_TYPE_CELL:
+                /* Tails are compared after heads */
+                OBJ_EQ_PUSH(OBJ_TAIL(x), OBJ_TAIL(y))
+                OBJ_EQ_PUSH(OBJ_HEAD(x), OBJ_HEAD(y))
+                break;
+            case OBJ_TYPE_QUEUE:
+                OBJ_EQ_PUSH(OBJ_QUEUE_LIST(x), OBJ_QUEUE_LIST(y))
+                break;
+            case OBJ_TYPE_ARRAY: {
+                int len = OBJ_ARRAY_LEN(x);
+                if(OBJ_ARRAY_LEN(y) != len)goto done_eq;
+                for(int i = len - 1; i >= 0; i--){
+                    OBJ_EQ_PUSH(OBJ_ARRAY_IGET(x, i), OBJ_ARRAY_IGET(y, i))
+                }
                 break;
             }
-            case OBJ_TOKEN_TYPE_STRING:
-            case OBJ_TOKEN_TYPE_LINESTRING: {
-                obj_string_t *string = obj_parser_get_string(parser);
-                if(!string)return NULL;
-                obj = obj_pool_add_str(parser->pool, string);
-                if(!obj)return NULL;
+            case OBJ_TYPE_DICT: {
+                obj_dict_t *x_dict = OBJ_DICT(x);
+                obj_dict_t *y_dict = OBJ_DICT(y);
+                if(x_dict->n_entries != y_dict->n_entries)goto done_eq;
+                for(size_t i = 0; i < x_dict->entries_len; i++){
+                    obj_dict_entry_t *entry = &x_dict->entries[i];
+                    if(!entry->sym)continue;
+                    obj_t *y_value = obj_dict_get(y_dict, entry->sym);
+                    if(!y_value)goto done_eq;
+                    OBJ_EQ_PUSH(&entry->value, y_value)
+                }
                 break;
             }
-            case OBJ_TOKEN_TYPE_COLON:
-            case OBJ_TOKEN_TYPE_LPAREN: {
-                *tail = obj_pool_add_cell(parser->pool, NULL, NULL);
-                if(!*tail)return NULL;
-                obj_t **next_tail = &OBJ_TAIL(*tail);
-
-                if(!obj_parser_stack_push(parser, next_tail))return NULL;
-                tail = &OBJ_HEAD(*tail);
+            case OBJ_TYPE_MAP: {
+                if(OBJ_MAP_N_KEYS(x) != OBJ_MAP_N_KEYS(y))goto done_eq;
+                for(int i = 0; i < OBJ_MAP_CAP(x); i++){
+                    obj_t *key = OBJ_MAP_IGET_KEY(x, i);
+                    if(OBJ_TYPE(key) == OBJ_TYPE_NULL)continue;
+                    obj_t *y_value = obj_map_get(y, key);
+                    if(!y_value)goto done_eq;
+                    OBJ_EQ_PUSH(OBJ_MAP_IGET_VAL(x, i), y_value)
+                }
                 break;
             }
-            case OBJ_TOKEN_TYPE_RPAREN: {
-                while(
-                    parser->stack &&
-                    parser->stack->token_type != OBJ_TOKEN_TYPE_LPAREN
-                ){
-                    if(!(tail = obj_parser_stack_pop(parser, tail))){
-                        return NULL;
+            case OBJ_TYPE_OMAP: {
+                /* Versions of an omap share subtrees, but otherwise the
+                same entries may be in differently shaped trees, so we
+                compare entries */
+                int len = OBJ_OMAP_LEN(x);
+                if(OBJ_OMAP_LEN(y) != len)goto done_eq;
+                if(OBJ_OMAP_ROOT(x) == OBJ_OMAP_ROOT(y))break;
+                for(int i = len - 1; i >= 0; i--){
+                    obj_t *x_entry = OBJ_OMAP_IGET(x, i);
+                    obj_t *y_entry = OBJ_OMAP_IGET(y, i);
+                    if(!obj_pool_hashcons_eq(x_entry, y_entry))goto done_eq;
+                    OBJ_EQ_PUSH(x_entry + 1, y_entry + 1)
+                }
+                break;
+            }
+            case OBJ_TYPE_PQUEUE: {
+                /* Compared in heap order, so pqueues with the same
+                entries, pushed in different orders, may differ */
+                int len = OBJ_PQUEUE_LEN(x);
+                if(OBJ_PQUEUE_LEN(y) != len)goto done_eq;
+                for(int i = len - 1; i >= 0; i--){
+                    if(OBJ_INT(OBJ_PQUEUE_IGET_PRIO(x, i)) !=
+                        OBJ_INT(OBJ_PQUEUE_IGET_PRIO(y, i)))goto done_eq;
+                    OBJ_EQ_PUSH(OBJ_PQUEUE_IGET_VAL(x, i),
+                        OBJ_PQUEUE_IGET_VAL(y, i))
+                }
+                break;
+            }
+            case OBJ_TYPE_STRUCT: {
+                int len = OBJ_STRUCT_LEN(x);
+                if(OBJ_STRUCT_SHAPE(x) != OBJ_STRUCT_SHAPE(y)){
+                    if(OBJ_STRUCT_LEN(y) != len)goto done_eq;
+                    for(int i = 0; i < len; i++){
+                        if(OBJ_SYM(OBJ_STRUCT_IGET_KEY(x, i)) !=
+                            OBJ_SYM(OBJ_STRUCT_IGET_KEY(y, i))
+                        )goto done_eq;
                     }
                 }
-                if(!parser->stack){
-                    obj_parser_errmsg(parser, __func__);
-                    fprintf(stderr, "Too many closing parentheses\n");
-                    return NULL;
+                for(int i = len - 1; i >= 0; i--){
+                    OBJ_EQ_PUSH(
+                        OBJ_STRUCT_IGET_VAL(x, i), OBJ_STRUCT_IGET_VAL(y, i))
                 }
-                if(!(tail = obj_parser_stack_pop(parser, tail)))return NULL;
                 break;
             }
-            case OBJ_TOKEN_TYPE_TYPECAST: {
-                if(!parser->use_extended_types){
-                    /* It's cool, just carry on like you never saw a
-                    typecast token */
-                }else if(obj_parser_token_eq(parser, "{arr}")){
-                    typecast = OBJ_TYPE_ARRAY;
-                }else if(obj_parser_token_eq(parser, "{dict}")){
-                    typecast = OBJ_TYPE_DICT;
-                }else if(obj_parser_token_eq(parser, "{obj}")){
-                    typecast = OBJ_TYPE_STRUCT;
-                }else if(obj_parser_token_eq(parser, "{fun}")){
-                    typecast = OBJ_TYPE_FUN;
-                }else{
-                    obj_parser_errmsg(parser, __func__);
-                    fprintf(stderr, "Unrecognized typecast\n");
-                    return NULL;
+            case OBJ_TYPE_FUN:
+                if(OBJ_FUN_MODULE_NAME(x) != OBJ_FUN_MODULE_NAME(y) ||
+                    OBJ_FUN_DEF_NAME(x) != OBJ_FUN_DEF_NAME(y)
+                )goto done_eq;
+                OBJ_EQ_PUSH(OBJ_FUN_ARGS(x), OBJ_FUN_ARGS(y))
+                break;
+            case OBJ_TYPE_VEC:
+                /* Trees of vecs of the same length have the same shape,
+                and subtrees they share are skipped */
+                if(OBJ_VEC_LEN(x) != OBJ_VEC_LEN(y))goto done_eq;
+                if(OBJ_VEC_ROOT(x)){
+                    OBJ_EQ_PUSH(OBJ_VEC_ROOT(x), OBJ_VEC_ROOT(y))
                 }
                 break;
+            case OBJ_TYPE_INTARR: {
+                int len = OBJ_INTARR_LEN(x);
+                int kind = OBJ_INTARR_KIND(x);
+                if(OBJ_INTARR_LEN(y) != len ||
+                    OBJ_INTARR_KIND(y) != kind ||
+                    memcmp(OBJ_INTARR_DATA(x), OBJ_INTARR_DATA(y),
+                        len * obj_intarr_elem_size(kind))
+                )goto done_eq;
+                break;
             }
-            default: break;
+            default:
+                fprintf(stderr, "%s: Can't compare %s\n",
+                    __func__, obj_type_msg(type));
+                goto done;
         }
+    }
+    eq = true;
+
+done_eq:
+    *eq_ptr = eq;
+    err = 0;
+done:
+    if(stack != local_stack)free(stack);
+    return err;
+#   undef OBJ_EQ_PUSH
+}
 
-        if(obj){
-            *tail = obj_pool_add_cell(parser->pool, obj, NULL);
-            if(!*tail)return NULL;
-            tail = &OBJ_TAIL(*tail);
-        }
 
-        if(parser->token_type != OBJ_TOKEN_TYPE_TYPECAST){
-            typecast = OBJ_TYPE_NIL;
-        }
-    }
 
-    while(
-        parser->stack &&
-        parser->stack->token_type == OBJ_TOKEN_TYPE_COLON
-    ){
-        if(!(tail = obj_parser_stack_pop(parser, tail)))return NULL;
-    }
+/***********
+* obj_copy *
+***********/
 
-    if(parser->stack){
-        obj_parser_errmsg(parser, __func__);
-        fprintf(stderr, "Too many opening parentheses\n");
-        while(parser->stack){
-            fprintf(stderr, "  [row=%zu col=%zu type=%s]\n",
-                parser->stack->token_row+1,
-                parser->stack->line_col+1,
-                obj_token_type_msg(parser->stack->token_type));
-            parser->stack = parser->stack->next;
-        }
-        return NULL;
-    }
+/* Copying obj trees into another pool, e.g. so that data parsed into a
+short-lived pool can outlive it.
+A copier remembers everything it has copied (its forwarding table), so
+substructure shared in the original is copied once and stays shared in
+the copy, and cycles (through boxes) are fine.
+Objs are copied breadth-first from a worklist, rather than by
+recursion, and a list's cells are all allocated as soon as the list is
+reached, so the copy of each list is contiguous.
+Strings, dicts and struct shapes are copied into the destination pool
+too, and syms are re-interned in its symtable (if that's the symtable
+they came from, they're unchanged).
+Pointers must point at whole objs: e.g. a box whose contents is an
+element of an array gets a copy of just that element. */
+
+#define OBJ_COPIER_DEFAULT_TABLE_LEN 256
+#define OBJ_COPIER_DEFAULT_WORKLIST_LEN 64
+
+struct obj_copier_entry {
+    const void *src;
+    void *dst;
+};
 
-    *tail = obj_pool_add_nil(parser->pool);
-    if(!*tail)return NULL;
-    return lst;
-}
+struct obj_copier_item {
+    int type;
+    void *src;
+    void *dst;
+        /* type: OBJ_TYPE_DICT if src & dst are obj_dict_t*, otherwise
+        they're obj_t* */
+};
 
-obj_t *obj_parse(obj_pool_t *pool, const char *filename,
-    const char *data, size_t data_len
-){
-    obj_parser_t _parser, *parser = &_parser;
-    obj_parser_init(parser, pool, filename, data, data_len);
-    obj_t *obj = obj_parser_parse(parser);
-    obj_parser_cleanup(parser);
-    return obj;
-}
+struct obj_copier {
+    obj_pool_t *pool;
+    size_t n_objs;
+        /* pool: the destination pool */
+        /* n_objs: number of objs allocated in pool so far */
 
+    obj_copier_entry_t *table;
+    size_t table_len;
+    size_t n_entries;
+        /* table: open addressing table mapping everything copied so
+        far (objs, strings, dicts, shapes and syms) to its copy */
+
+    obj_copier_item_t *worklist;
+    size_t worklist_len;
+    size_t worklist_start;
+    size_t worklist_end;
+        /* worklist: queue of objs & dicts which have been allocated,
+        but whose contents haven't been copied yet */
+};
 
+void obj_copier_init(obj_copier_t *copier, obj_pool_t *pool){
+    memset(copier, 0, sizeof(*copier));
+    copier->pool = pool;
+}
 
-/******
-* obj *
-******/
+void obj_copier_cleanup(obj_copier_t *copier){
+    free(copier->table);
+    free(copier->worklist);
+}
 
-static void obj_fprint(obj_t *obj, FILE *file, int depth){
-    int type = OBJ_TYPE(obj);
-    while(type == OBJ_TYPE_BOX){
-        obj = OBJ_CONTENTS(obj);
-        type = OBJ_TYPE(obj);
+static size_t obj_copier_slot(obj_copier_t *copier, const void *src){
+    /* Index of src's entry, or of the empty slot where it would go */
+    size_t mask = copier->table_len - 1;
+    size_t i = ((uintptr_t)src >> 4) * (size_t)0x9e3779b9 & mask;
+    while(copier->table[i].src && copier->table[i].src != src){
+        i = (i + 1) & mask;
     }
-    switch(type){
-        case OBJ_TYPE_BOOL:
-            fprintf(file, "{bool}%c", OBJ_BOOL(obj)? 'T': 'F');
-            break;
-        case OBJ_TYPE_INT:
-            fprintf(file, "%i", OBJ_INT(obj));
-            break;
-        case OBJ_TYPE_STR: {
-            obj_string_t *s = OBJ_STRING(obj);
-            obj_string_fprint(s, file);
-            break;
-        }
-        case OBJ_TYPE_SYM: {
-            obj_sym_t *y = OBJ_SYM(obj);
-            obj_sym_fprint(y, file);
-            break;
-        }
-        case OBJ_TYPE_NIL:
-        case OBJ_TYPE_CELL:
-        case OBJ_TYPE_QUEUE: {
-            if(type == OBJ_TYPE_QUEUE){
-                fprintf(file, "{queue}");
-                obj = OBJ_QUEUE_LIST(obj);
-            }
-            fprintf(file, ":");
-            while(OBJ_TYPE(obj) == OBJ_TYPE_CELL){
-                putc('\n', file);
-                _print_tabs(file, depth+2);
-                obj_fprint(OBJ_HEAD(obj), file, depth+2);
-                obj = OBJ_TAIL(obj);
-            }
-            break;
-        }
-        case OBJ_TYPE_ARRAY: {
-            fprintf(file, "{arr}:");
-            int len = OBJ_ARRAY_LEN(obj);
-            for(int i = 0; i < len; i++){
-                putc('\n', file);
-                _print_tabs(file, depth+2);
-                obj_fprint(OBJ_ARRAY_IGET(obj, i), file, depth+2);
-            }
-            break;
-        }
-        case OBJ_TYPE_DICT: {
-            fprintf(file, "{dict}:");
-            obj_dict_t *dict = OBJ_DICT(obj);
-            obj_dict_fprint(dict, file, depth + 2);
-            break;
-        }
-        case OBJ_TYPE_STRUCT: {
-            fprintf(file, "{obj}:");
-            int n_keys = OBJ_STRUCT_LEN(obj);
-            for(int i = 0; i < n_keys; i++){
-                obj_sym_t *key = OBJ_SYM(OBJ_STRUCT_IGET_KEY(obj, i));
-                obj_t *val = OBJ_STRUCT_IGET_VAL(obj, i);
+    return i;
+}
 
-                putc('\n', file);
-                _print_tabs(file, depth+2);
+void *obj_copier_get(obj_copier_t *copier, const void *src){
+    /* Returns the copy of src, or NULL if it hasn't been copied */
+    if(!copier->n_entries)return NULL;
+    return copier->table[obj_copier_slot(copier, src)].dst;
+}
 
-                obj_sym_fprint(key, file);
+static int obj_copier_set(obj_copier_t *copier,
+    const void *src, void *dst
+){
+    /* We grow once we're half full */
+    if((copier->n_entries + 1) * 2 > copier->table_len){
+        obj_copier_entry_t *old_table = copier->table;
+        size_t old_table_len = copier->table_len;
+        size_t table_len = old_table_len? old_table_len * 2:
+            OBJ_COPIER_DEFAULT_TABLE_LEN;
+        obj_copier_entry_t *table = calloc(table_len, sizeof(*table));
+        if(!table){
+            fprintf(stderr, "%s: Couldn't grow table to %zu entries. ",
+                __func__, table_len);
+            perror("calloc");
+            return 1;
+        }
+        copier->table = table;
+        copier->table_len = table_len;
+        for(size_t i = 0; i < old_table_len; i++){
+            obj_copier_entry_t *old_entry = &old_table[i];
+            if(!old_entry->src)continue;
+            copier->table[obj_copier_slot(copier, old_entry->src)] =
+                *old_entry;
+        }
+        free(old_table);
+    }
+    obj_copier_entry_t *entry =
+        &copier->table[obj_copier_slot(copier, src)];
+    if(!entry->src)copier->n_entries++;
+    entry->src = src;
+    entry->dst = dst;
+    return 0;
+}
 
-                putc(' ', file);
-                obj_fprint((obj_t*)val, file, depth+2);
+static int obj_copier_push(obj_copier_t *copier,
+    int type, void *src, void *dst
+){
+    if(copier->worklist_end >= copier->worklist_len){
+        /* Make room at the end, by growing worklist unless at least
+        half of it is free at the start, then moving the queue back to
+        the start */
+        size_t n = copier->worklist_end - copier->worklist_start;
+        if(copier->worklist_start < n || !copier->worklist_len){
+            size_t worklist_len = copier->worklist_len?
+                copier->worklist_len * 2: OBJ_COPIER_DEFAULT_WORKLIST_LEN;
+            obj_copier_item_t *worklist = realloc(copier->worklist,
+                worklist_len * sizeof(*worklist));
+            if(!worklist){
+                fprintf(stderr, "%s: Couldn't grow worklist to %zu items. ",
+                    __func__, worklist_len);
+                perror("realloc");
+                return 1;
             }
-            break;
-        }
-        case OBJ_TYPE_FUN: {
-            fprintf(file, "{fun}:");
-            putc('\n', file);
-            _print_tabs(file, depth+2);
-            obj_sym_fprint(OBJ_FUN_MODULE_NAME(obj), file);
-            putc('\n', file);
-            _print_tabs(file, depth+2);
-            obj_sym_fprint(OBJ_FUN_DEF_NAME(obj), file);
-            putc('\n', file);
-            _print_tabs(file, depth+2);
-            obj_fprint(OBJ_FUN_ARGS(obj), file, depth+2);
-            break;
+            copier->worklist = worklist;
+            copier->worklist_len = worklist_len;
         }
-        case OBJ_TYPE_NULL:
-            fprintf(file, "{null}null");
-            break;
-        default:
-            fprintf(file, "{unknown}unknown");
-            break;
+        memmove(copier->worklist, copier->worklist + copier->worklist_start,
+            n * sizeof(*copier->worklist));
+        copier->worklist_start = 0;
+        copier->worklist_end = n;
     }
+    obj_copier_item_t *item = &copier->worklist[copier->worklist_end++];
+    item->type = type;
+    item->src = src;
+    item->dst = dst;
+    return 0;
 }
 
-void obj_dump(obj_t *obj, FILE *file, int depth){
-    _print_tabs(file, depth);
-    obj_fprint(obj, file, depth);
-    putc('\n', file);
+obj_sym_t *obj_copier_sym(obj_copier_t *copier, obj_sym_t *sym){
+    obj_sym_t *dst = obj_copier_get(copier, sym);
+    if(dst)return dst;
+    dst = obj_symtable_get_sym_raw(copier->pool->symtable,
+        sym->string.data, sym->string.len);
+    if(!dst || obj_copier_set(copier, sym, dst))return NULL;
+    return dst;
 }
 
-obj_t *obj_resolve(obj_t *obj){
-    while(OBJ_TYPE(obj) == OBJ_TYPE_BOX)obj = OBJ_CONTENTS(obj);
-    return obj;
+obj_string_t *obj_copier_string(obj_copier_t *copier, obj_string_t *s){
+    obj_string_t *dst = obj_copier_get(copier, s);
+    if(dst)return dst;
+    dst = obj_pool_string_add_raw(copier->pool, s->data, s->len);
+    if(!dst || obj_copier_set(copier, s, dst))return NULL;
+    return dst;
 }
 
-obj_t *obj_list_get(obj_t *obj, obj_sym_t *sym){
-    while(obj && OBJ_TYPE(obj) == OBJ_TYPE_CELL){
-        obj_t *head = OBJ_HEAD(obj);
-        obj_t *tail = OBJ_TAIL(obj);
-        if(!tail || OBJ_TYPE(tail) != OBJ_TYPE_CELL)return NULL;
-        if(head && OBJ_TYPE(head) == OBJ_TYPE_SYM && OBJ_SYM(head) == sym){
-            return OBJ_HEAD(tail);
+obj_string_t *obj_copier_strbuf_string(obj_copier_t *copier,
+    obj_string_t *s
+){
+    /* Like obj_copier_string, but the copy has a strbuf's spare room */
+    obj_string_t *dst = obj_copier_get(copier, s);
+    if(dst)return dst;
+    dst = obj_pool_strbuf_string_add_raw(copier->pool, s->data, s->len);
+    if(!dst || obj_copier_set(copier, s, dst))return NULL;
+    return dst;
+}
+
+obj_shape_t *obj_copier_shape(obj_copier_t *copier, obj_shape_t *shape){
+    obj_shape_t *dst = obj_copier_get(copier, shape);
+    if(dst)return dst;
+
+    obj_sym_t *small_syms[16];
+    obj_sym_t **syms = small_syms;
+    if(shape->n_keys > 16){
+        syms = malloc(shape->n_keys * sizeof(*syms));
+        if(!syms){
+            fprintf(stderr, "%s: ", __func__);
+            perror("malloc");
+            return NULL;
         }
-        obj = OBJ_TAIL(tail);
     }
-    return NULL;
+    for(int i = 0; i < shape->n_keys; i++){
+        syms[i] = obj_copier_sym(copier, OBJ_SYM(&shape->keys[i]));
+        if(!syms[i])goto done;
+    }
+    dst = obj_pool_get_shape_raw(copier->pool, syms, shape->n_keys);
+    if(dst && obj_copier_set(copier, shape, dst))dst = NULL;
+
+done:
+    if(syms != small_syms)free(syms);
+    return dst;
 }
 
-obj_t *obj_list_iget(obj_t *obj, int i){
-    while(obj && OBJ_TYPE(obj) == OBJ_TYPE_CELL){
-        if(i <= 0)return OBJ_HEAD(obj);
-        obj = OBJ_TAIL(obj);
-        i--;
-    }
-    return NULL;
+obj_dict_t *obj_copier_dict(obj_copier_t *copier, obj_dict_t *dict){
+    /* Returns dict's copy, which (if this is the first time dict has
+    been seen) is empty until the worklist gets to it */
+    obj_dict_t *dst = obj_copier_get(copier, dict);
+    if(dst)return dst;
+    dst = obj_pool_dict_alloc(copier->pool);
+    if(!dst || obj_copier_set(copier, dict, dst))return NULL;
+    if(obj_copier_push(copier, OBJ_TYPE_DICT, dict, dst))return NULL;
+    return dst;
 }
 
-int obj_list_len(obj_t *obj){
-    int len = 0;
-    while(obj && OBJ_TYPE(obj) == OBJ_TYPE_CELL){
-        obj = OBJ_TAIL(obj);
-        len++;
+obj_t *obj_copier_ref(obj_copier_t *copier, obj_t *obj){
+    /* Returns the copy of the obj which obj points to, which (if this is
+    the first time obj has been seen) is only allocated, its contents
+    being copied when the worklist gets to it */
+    obj_pool_t *pool = copier->pool;
+    int type = OBJ_TYPE(obj);
+
+    /* The pool's unique objs */
+    if(type == OBJ_TYPE_NULL)return obj_pool_add_null(pool);
+    if(type == OBJ_TYPE_NIL)return obj_pool_add_nil(pool);
+    if(type == OBJ_TYPE_BOOL)return obj_pool_add_bool(pool, OBJ_BOOL(obj));
+
+    obj_t *dst = obj_copier_get(copier, obj);
+    if(dst)return dst;
+
+    if(type == OBJ_TYPE_CELL){
+        /* Allocate the rest of the list's cells (up to any which were
+        already copied) now too, all at once, so that the copy has a
+        run (see OBJ_CELL_RUN) */
+        size_t n = 0;
+        obj_t *cell = obj;
+        do{
+            n++;
+            cell = OBJ_TAIL(cell);
+        }while(cell && OBJ_TYPE(cell) == OBJ_TYPE_CELL &&
+            !obj_copier_get(copier, cell));
+
+        dst = obj_pool_alloc_list(pool, n);
+        if(!dst)return NULL;
+        copier->n_objs += n * 2;
+        cell = obj;
+        for(size_t i = 0; i < n; i++){
+            obj_t *dst_cell = dst + i * 2;
+            if(obj_copier_set(copier, cell, dst_cell))return NULL;
+            if(obj_copier_push(copier, OBJ_TYPE_CELL,
+                cell, dst_cell))return NULL;
+            cell = OBJ_TAIL(cell);
+        }
+        return dst;
     }
-    return len;
+
+    int n_objs =
+        type == OBJ_TYPE_QUEUE || type == OBJ_TYPE_VEC ||
+            type == OBJ_TYPE_MAP || type == OBJ_TYPE_OMAP ||
+            type == OBJ_TYPE_PQUEUE? 2:
+        type == OBJ_TYPE_FUN? 3:
+        type == OBJ_TYPE_ARRAY? 1 + OBJ_ARRAY_LEN(obj):
+        type == OBJ_TYPE_STRUCT? 1 + OBJ_STRUCT_LEN(obj):
+        type == OBJ_TYPE_INTARR? OBJ_INTARR_N_OBJS(obj):
+        1;
+    dst = obj_pool_objs_alloc(pool, n_objs);
+    if(!dst)return NULL;
+    copier->n_objs += n_objs;
+    if(obj_copier_set(copier, obj, dst))return NULL;
+    if(obj_copier_push(copier, type, obj, dst))return NULL;
+    return dst;
 }
 
-obj_t **obj_list_get_end(obj_t **obj){
-    while(*obj && OBJ_TYPE(*obj) == OBJ_TYPE_CELL){
-        obj = &OBJ_TAIL(*obj);
+int obj_copier_value(obj_copier_t *copier, obj_t *dst, obj_t *src){
+    /* Copies src, a single obj_t value (e.g. an array element, or a
+    value on the vm's stack), into dst */
+    *dst = *src;
+    int type = OBJ_TYPE(src);
+    switch(type){
+        case OBJ_TYPE_NULL:
+        case OBJ_TYPE_BOOL:
+        case OBJ_TYPE_INT:
+        case OBJ_TYPE_NIL:
+            break;
+        case OBJ_TYPE_SYM:
+            if(!(OBJ_SYM(dst) = obj_copier_sym(copier,
+                OBJ_SYM(src))))return 1;
+            break;
+        case OBJ_TYPE_STR:
+            if(OBJ_STR_IS_INLINE(src))break;
+            if(!(OBJ_STRING(dst) = obj_copier_string(copier,
+                OBJ_STRING(src))))return 1;
+            break;
+        case OBJ_TYPE_STRBUF:
+            if(!(OBJ_STRING(dst) = obj_copier_strbuf_string(copier,
+                OBJ_STRING(src))))return 1;
+            break;
+        case OBJ_TYPE_DICT:
+            if(!(OBJ_DICT(dst) = obj_copier_dict(copier,
+                OBJ_DICT(src))))return 1;
+            break;
+        case OBJ_TYPE_BOX:
+            if(!(OBJ_CONTENTS(dst) = obj_copier_ref(copier,
+                OBJ_CONTENTS(src))))return 1;
+            break;
+        default:
+            fprintf(stderr, "%s: Can't copy %s as a single value\n",
+                __func__, obj_type_msg(type));
+            return 1;
     }
-    return obj;
+    return 0;
 }
 
-obj_t *obj_struct_get(obj_t *obj, obj_sym_t *sym){
-    int n_keys = OBJ_STRUCT_LEN(obj);
-    for(int i = 0; i < n_keys; i++){
-        obj_sym_t *key = OBJ_SYM(OBJ_STRUCT_IGET_KEY(obj, i));
-        if(key != sym)continue;
-        return OBJ_STRUCT_IGET_VAL(obj, i);
+static int obj_copier_copy_dict(obj_copier_t *copier,
+    obj_dict_t *src, obj_dict_t *dst
+){
+    for(size_t i = 0; i < src->entries_len; i++){
+        obj_dict_entry_t *entry = &src->entries[i];
+        if(!entry->sym)continue;
+        obj_sym_t *sym = obj_copier_sym(copier, entry->sym);
+        if(!sym)return 1;
+        obj_t value;
+        if(obj_copier_value(copier, &value, &entry->value))return 1;
+        if(!obj_dict_set(dst, sym, &value))return 1;
     }
-    return NULL;
+    return 0;
 }
 
-int obj_len(obj_t *obj){
-    if(!obj)return 0;
-    int type = OBJ_TYPE(obj);
-    if(type == OBJ_TYPE_NIL){
-        return 0;
-    }else if(type == OBJ_TYPE_CELL){
-        return obj_list_len(obj);
-    }else if(type == OBJ_TYPE_ARRAY){
-        return OBJ_ARRAY_LEN(obj);
-    }else if(type == OBJ_TYPE_DICT){
-        return OBJ_DICT_N_KEYS(obj);
-    }else if(type == OBJ_TYPE_STRUCT){
-        return OBJ_STRUCT_LEN(obj);
-    }else{
-        return 0;
+static int obj_copier_copy_obj(obj_copier_t *copier,
+    obj_t *src, obj_t *dst
+){
+    int type = OBJ_TYPE(src);
+    switch(type){
+        case OBJ_TYPE_CELL: {
+            /* dst's run was set by obj_copier_ref */
+            dst[0] = src[0];
+            OBJ_TAIL(dst) = OBJ_TAIL(src);
+            obj_t *head = OBJ_HEAD(src);
+            obj_t *tail = OBJ_TAIL(src);
+            if(head && !(OBJ_HEAD(dst) = obj_copier_ref(copier, head)))
+                return 1;
+            if(tail && !(OBJ_TAIL(dst) = obj_copier_ref(copier, tail)))
+                return 1;
+            break;
+        }
+        case OBJ_TYPE_QUEUE: {
+            dst[0] = src[0];
+            dst[1] = src[1];
+            if(!(OBJ_QUEUE_LIST(dst) = obj_copier_ref(copier,
+                OBJ_QUEUE_LIST(src))))return 1;
+
+            /* The end is either the queue's own list ptr (if the queue
+            is empty), or the tail ptr of its list's last cell */
+            obj_t **end = OBJ_QUEUE_END(src);
+            if(end == &OBJ_QUEUE_LIST(src)){
+                OBJ_QUEUE_END(dst) = &OBJ_QUEUE_LIST(dst);
+            }else{
+                obj_t *end_cell =
+                    (obj_t*)((char*)end - offsetof(obj_t, u.o)) - 1;
+                obj_t *dst_end_cell = obj_copier_ref(copier, end_cell);
+                if(!dst_end_cell)return 1;
+                OBJ_QUEUE_END(dst) = &OBJ_TAIL(dst_end_cell);
+            }
+            break;
+        }
+        case OBJ_TYPE_FUN:
+            memcpy(dst, src, 3 * sizeof(*dst));
+            if(!(OBJ_FUN_MODULE_NAME(dst) = obj_copier_sym(copier,
+                OBJ_FUN_MODULE_NAME(src))))return 1;
+            if(!(OBJ_FUN_DEF_NAME(dst) = obj_copier_sym(copier,
+                OBJ_FUN_DEF_NAME(src))))return 1;
+            if(!(OBJ_FUN_ARGS(dst) = obj_copier_ref(copier,
+                OBJ_FUN_ARGS(src))))return 1;
+            break;
+        case OBJ_TYPE_ARRAY:
+            dst[0] = src[0];
+            for(int i = 0; i < OBJ_ARRAY_LEN(src); i++){
+                if(obj_copier_value(copier, OBJ_ARRAY_IGET(dst, i),
+                    OBJ_ARRAY_IGET(src, i)))return 1;
+            }
+            break;
+        case OBJ_TYPE_STRUCT:
+            dst[0] = src[0];
+            if(!(OBJ_STRUCT_SHAPE(dst) = obj_copier_shape(copier,
+                OBJ_STRUCT_SHAPE(src))))return 1;
+            for(int i = 0; i < OBJ_STRUCT_LEN(src); i++){
+                if(obj_copier_value(copier, OBJ_STRUCT_IGET_VAL(dst, i),
+                    OBJ_STRUCT_IGET_VAL(src, i)))return 1;
+            }
+            break;
+        case OBJ_TYPE_VEC:
+            dst[0] = src[0];
+            dst[1] = src[1];
+            if(OBJ_VEC_ROOT(src) && !(OBJ_VEC_ROOT(dst) = obj_copier_ref(
+                copier, OBJ_VEC_ROOT(src))))return 1;
+            break;
+        case OBJ_TYPE_MAP:
+            /* Keys hash the same in any pool (syms by their text), so
+            the table can be copied as it is */
+            dst[0] = src[0];
+            dst[1] = src[1];
+            if(OBJ_MAP_TABLE(src) && !(OBJ_MAP_TABLE(dst) = obj_copier_ref(
+                copier, OBJ_MAP_TABLE(src))))return 1;
+            break;
+        case OBJ_TYPE_OMAP:
+            /* Like a vec's, an omap's nodes are arrays of boxes, so the
+            tree (and what it shares with other versions) is copied as
+            it is */
+            dst[0] = src[0];
+            dst[1] = src[1];
+            if(OBJ_OMAP_ROOT(src) && !(OBJ_OMAP_ROOT(dst) = obj_copier_ref(
+                copier, OBJ_OMAP_ROOT(src))))return 1;
+            break;
+        case OBJ_TYPE_PQUEUE:
+            dst[0] = src[0];
+            dst[1] = src[1];
+            if(OBJ_PQUEUE_HEAP(src) && !(OBJ_PQUEUE_HEAP(dst) = obj_copier_ref(
+                copier, OBJ_PQUEUE_HEAP(src))))return 1;
+            break;
+        case OBJ_TYPE_INTARR:
+            memcpy(dst, src, OBJ_INTARR_N_OBJS(src) * sizeof(*dst));
+            break;
+        default:
+            return obj_copier_value(copier, dst, src);
     }
+    return 0;
 }
 
-obj_t *obj_get(obj_t *obj, obj_sym_t *sym){
-    if(!obj)return NULL;
-    int type = OBJ_TYPE(obj);
-    if(type == OBJ_TYPE_NIL){
-        return NULL;
-    }else if(type == OBJ_TYPE_CELL){
-        return obj_list_get(obj, sym);
-    }else if(type == OBJ_TYPE_DICT){
-        return obj_dict_get(OBJ_DICT(obj), sym);
-    }else if(type == OBJ_TYPE_STRUCT){
-        return obj_struct_get(obj, sym);
-    }else{
-        return NULL;
+int obj_copier_run(obj_copier_t *copier){
+    /* Copies the contents of everything on the worklist, until it's
+    empty */
+    while(copier->worklist_start < copier->worklist_end){
+        obj_copier_item_t item = copier->worklist[copier->worklist_start++];
+        if(item.type == OBJ_TYPE_DICT){
+            if(obj_copier_copy_dict(copier, item.src, item.dst))return 1;
+        }else{
+            if(obj_copier_copy_obj(copier, item.src, item.dst))return 1;
+        }
     }
+    copier->worklist_start = copier->worklist_end = 0;
+    return 0;
 }
 
-obj_t *obj_iget(obj_t *obj, int i){
-    if(!obj)return NULL;
-    int type = OBJ_TYPE(obj);
-    if(type == OBJ_TYPE_NIL){
-        return NULL;
-    }else if(type == OBJ_TYPE_CELL){
-        return obj_list_iget(obj, i);
-    }else if(type == OBJ_TYPE_ARRAY){
-        return OBJ_ARRAY_IGET(obj, i);
-    }else{
-        return NULL;
-    }
+obj_t *obj_copy_to_pool(obj_pool_t *pool, obj_t *obj){
+    /* Returns a deep copy of obj, allocated from pool.
+    To copy several objs which share substructure, use an obj_copier_t
+    directly (obj_copier_ref each of them, then obj_copier_run). */
+    obj_copier_t _copier, *copier=&_copier;
+    obj_copier_init(copier, pool);
+    obj_t *copy = obj_copier_ref(copier, obj);
+    if(copy && obj_copier_run(copier))copy = NULL;
+    obj_copier_cleanup(copier);
+    return copy;
 }
 
 
-#endif
\ No newline at end of file
+#endif
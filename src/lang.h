@@ -8,6 +8,9 @@
 #define OBJ_FRAME_DEFAULT_VARS_LEN 8
 #define OBJ_FRAME_DEFAULT_STACK_LEN 8
 
+/* Must be a power of 2 */
+#define OBJ_VM_SITE_CACHE_LEN 256
+
 /* TOS: Top Of Stack, NOS: Next On Stack, 3OS: Third On Stack */
 #define OBJ_FRAME_GET(frame, i) &frame->stack[frame->stack_tos - (i) - 1]
 #define OBJ_FRAME_TOS(frame) OBJ_FRAME_GET(frame, 0)
@@ -35,6 +38,7 @@
 typedef struct obj_vm obj_vm_t;
 typedef struct obj_frame obj_frame_t;
 typedef struct obj_block obj_block_t;
+typedef struct obj_vm_site obj_vm_site_t;
 
 enum {
     OBJ_BLOCK_BASIC,
@@ -99,6 +103,18 @@ struct obj_frame {
         /* block_list: see vm->free_block_list */
 };
 
+struct obj_vm_site {
+    obj_t *site;
+    obj_shape_t *shape;
+    int i;
+        /* site: the code cell of an instruction's operand, e.g. the
+        cell holding "x" in ". x" or "=. x" or the keys list in
+        "obj: x y" */
+        /* shape: for "obj", the shape which the keys list resolved to;
+        for "." and "=.", the shape of the struct last seen there */
+        /* i: for "." and "=.", index of the key in shape */
+};
+
 struct obj_vm {
     obj_pool_t *pool;
     obj_dict_t modules;
@@ -116,6 +132,11 @@ struct obj_vm {
         vm->free_frame_list if available, only otherwise do we
         malloc. */
 
+    obj_frame_t *stop_frame;
+        /* stop_frame: if set, obj_vm_step stops running when this
+        frame runs out of blocks, rather than popping it (see
+        obj_vm_call_fun) */
+
     obj_block_t *free_block_list;
         /* free_block_list is a linked list of preallocated
         blocks, for use by the frames in vm->frame_list.
@@ -125,6 +146,26 @@ struct obj_vm {
         vm->free_block_list if available, only otherwise do we
         malloc. */
 
+    obj_vm_site_t site_cache[OBJ_VM_SITE_CACHE_LEN];
+        /* site_cache: direct-mapped cache, keyed by address of code
+        cell, used by struct instructions to skip key lookups at sites
+        which keep seeing the same shape (see obj_vm_get_site) */
+
+    obj_hash_memo_t hash_memo;
+        /* hash_memo: used by deep_hash, so that subtrees shared within
+        the obj being hashed are only hashed once.
+        It's cleared after each use, since objs may be modified between
+        instructions, so it saves nothing across calls; deep_eq doesn't
+        use it at all. */
+
+    size_t gc_threshold;
+    size_t gc_next;
+    int n_collections;
+        /* gc_threshold: if nonzero, obj_vm_run calls obj_vm_collect
+        whenever the pool has more than gc_next objs allocated */
+        /* gc_next: number of objs which survived the last collection,
+        plus gc_threshold */
+
     #define _OBJ_VM_MKSYM(NAME, STRING) obj_sym_t *sym_##NAME;
     #include "vm_mksym.inc"
     #undef _OBJ_VM_MKSYM
@@ -263,6 +304,16 @@ obj_t *obj_frame_push(obj_frame_t *frame, obj_t *obj){
     return return_obj;
 }
 
+obj_t *obj_frame_push_shared(obj_frame_t *frame, obj_t *obj){
+    /* Pushes a second reference to obj's value, e.g. for "dup" or
+    "'x", so neither it nor obj is unique any more (see obj_vm_own).
+    NOTE: obj may be on frame's stack, which obj_frame_push may
+    realloc, so we push a local copy */
+    OBJ_UNSET_UNIQUE(obj);
+    obj_t copy = *obj;
+    return obj_frame_push(frame, &copy);
+}
+
 obj_t *obj_frame_get_var(obj_frame_t *frame, obj_sym_t *sym){
     for(size_t i = 0; i < frame->n_vars; i++){
         if(OBJ_SYM(&frame->vars[i * 2]) == sym){
@@ -343,6 +394,121 @@ void obj_vm_init(obj_vm_t *vm, obj_pool_t *pool){
     memset(vm, 0, sizeof(*vm));
     vm->pool = pool;
     obj_dict_init(&vm->modules);
+    obj_hash_memo_init(&vm->hash_memo);
+}
+
+obj_vm_site_t *obj_vm_get_site(obj_vm_t *vm, obj_t *site){
+    /* Returns the site cache entry for given code cell.
+    Caller should check entry->site == site; if not, the entry is
+    either empty or belongs to another site, and caller may overwrite
+    it. */
+    size_t i = (uintptr_t)site / sizeof(obj_t);
+    return &vm->site_cache[i & (OBJ_VM_SITE_CACHE_LEN - 1)];
+}
+
+void obj_vm_clear_site_cache(obj_vm_t *vm){
+    /* Must be called if code cells are moved or freed */
+    memset(vm->site_cache, 0, sizeof(vm->site_cache));
+}
+
+obj_shape_t *obj_vm_get_site_shape(obj_vm_t *vm, obj_t *site, obj_t *keys){
+    /* Returns shape for the keys list at given site, e.g. for
+    "obj: x y" */
+    obj_vm_site_t *entry = obj_vm_get_site(vm, site);
+    if(entry->site == site)return entry->shape;
+    obj_shape_t *shape = obj_pool_get_shape(vm->pool, keys);
+    if(!shape)return NULL;
+    entry->site = site;
+    entry->shape = shape;
+    entry->i = -1;
+    return shape;
+}
+
+obj_t *obj_vm_struct_get(obj_vm_t *vm, obj_t *site,
+    obj_t *obj, obj_sym_t *sym
+){
+    /* Like obj_struct_get, but caches the key's index for given site,
+    e.g. for ". x" */
+    obj_shape_t *shape = OBJ_STRUCT_SHAPE(obj);
+    obj_vm_site_t *entry = obj_vm_get_site(vm, site);
+    if(entry->site == site && entry->shape == shape){
+        return OBJ_STRUCT_IGET_VAL(obj, entry->i);
+    }
+    int i = obj_shape_get_index(shape, sym);
+    if(i < 0)return NULL;
+    entry->site = site;
+    entry->shape = shape;
+    entry->i = i;
+    return OBJ_STRUCT_IGET_VAL(obj, i);
+}
+
+obj_t *obj_vm_own(obj_vm_t *vm, obj_t *obj){
+    /* Copy-on-write for values on the stack which are about to be
+    mutated in place: a str or strbuf, or a box of an array, struct,
+    fun, intarr, map or pqueue.
+    Unless obj is unique (OBJ_UNIQUE), i.e. is the only reference to
+    its value, we first copy the value, and change obj to refer to
+    the copy, so the mutation can't be seen through other references.
+    Returns obj, resolved.
+    Values are unique when newly created, and stop being unique when
+    a second reference is made, e.g. by "dup", "'x" or reading them
+    out of a container. */
+    if(OBJ_TYPE(obj) == OBJ_TYPE_STR || OBJ_TYPE(obj) == OBJ_TYPE_STRBUF){
+        /* Inline strs are stored in obj itself, so are never shared */
+        if(OBJ_UNIQUE(obj) || OBJ_STR_IS_INLINE(obj))return obj;
+        obj_string_t *s = OBJ_STRING(obj);
+        if(OBJ_TYPE(obj) == OBJ_TYPE_STR){
+            obj_string_t *s_clone = obj_pool_string_add_raw(
+                vm->pool, s->data, s->len);
+            if(!s_clone)return NULL;
+            obj_init_str(obj, s_clone);
+        }else{
+            obj_string_t *s_clone = obj_pool_strbuf_string_add_raw(
+                vm->pool, s->data, s->len);
+            if(!s_clone)return NULL;
+            obj_init_strbuf(obj, s_clone);
+        }
+        OBJ_SET_UNIQUE(obj);
+        return obj;
+    }
+
+    obj_t *contents = OBJ_RESOLVE(obj);
+    if(OBJ_UNIQUE(obj))return contents;
+    int type = OBJ_TYPE(contents);
+    if((type == OBJ_TYPE_MAP || type == OBJ_TYPE_PQUEUE) &&
+        OBJ_TYPE(obj) == OBJ_TYPE_BOX
+    ){
+        /* A map's entries are in its table (and a pqueue's in its
+        heap), which is copied too */
+        obj_t *copy = type == OBJ_TYPE_MAP?
+            obj_pool_add_map_clone(vm->pool, contents):
+            obj_pool_add_pqueue_clone(vm->pool, contents);
+        if(!copy)return NULL;
+        obj_init_box(obj, copy);
+        OBJ_SET_UNIQUE(obj);
+        return copy;
+    }
+    int n_objs =
+        type == OBJ_TYPE_ARRAY? 1 + OBJ_ARRAY_LEN(contents):
+        type == OBJ_TYPE_STRUCT? 1 + OBJ_STRUCT_LEN(contents):
+        type == OBJ_TYPE_FUN? 3:
+        type == OBJ_TYPE_INTARR? OBJ_INTARR_N_OBJS(contents): 0;
+    if(!n_objs || OBJ_TYPE(obj) != OBJ_TYPE_BOX)return contents;
+
+    obj_t *copy = obj_pool_objs_alloc(vm->pool, n_objs);
+    if(!copy)return NULL;
+    memcpy(copy, contents, n_objs * sizeof(*copy));
+
+    /* The copy is shallow, so the values inside are now shared
+    (intarrs hold raw ints, not values) */
+    if(type != OBJ_TYPE_INTARR)for(int i = 1; i < n_objs; i++){
+        OBJ_UNSET_UNIQUE(&contents[i]);
+        OBJ_UNSET_UNIQUE(&copy[i]);
+    }
+
+    obj_init_box(obj, copy);
+    OBJ_SET_UNIQUE(obj);
+    return copy;
 }
 
 void obj_vm_cleanup(obj_vm_t *vm){
@@ -350,6 +516,7 @@ void obj_vm_cleanup(obj_vm_t *vm){
     obj_frame_cleanup(vm->frame_list);
     obj_frame_cleanup(vm->free_frame_list);
     obj_block_cleanup(vm->free_block_list);
+    obj_hash_memo_cleanup(&vm->hash_memo);
 }
 
 void obj_vm_dump_modules(obj_vm_t *vm, FILE *file, int depth){
@@ -374,6 +541,10 @@ void obj_vm_dump_frames(
 
 void obj_vm_dump(obj_vm_t *vm, FILE *file){
     fprintf(file, "VM %p:\n", vm);
+    if(vm->gc_threshold){
+        fprintf(file, "  COLLECTIONS: %i (next after %zu objs)\n",
+            vm->n_collections, vm->gc_next);
+    }
     obj_vm_dump_modules(vm, file, 2);
     obj_vm_dump_frames(vm, file, 2, true);
 }
@@ -396,8 +567,24 @@ int obj_vm_get_syms(obj_vm_t *vm){
     return 0;
 }
 
+obj_t *obj_dict_get_boxed(obj_dict_t *dict, obj_sym_t *sym){
+    /* Dicts store single obj_t values, so modules, defs, and refs
+    (which are arrays) are stored as boxes. */
+    obj_t *box = obj_dict_get(dict, sym);
+    if(!box)return NULL;
+    return OBJ_CONTENTS(box);
+}
+
+obj_dict_entry_t *obj_dict_set_boxed(
+    obj_dict_t *dict, obj_sym_t *sym, obj_t *obj
+){
+    obj_t box;
+    obj_init_box(&box, obj);
+    return obj_dict_set(dict, sym, &box);
+}
+
 obj_t *obj_vm_get_module(obj_vm_t *vm, obj_sym_t *name){
-    return obj_dict_get(&vm->modules, name);
+    return obj_dict_get_boxed(&vm->modules, name);
 }
 
 obj_t *obj_vm_get_or_add_module(obj_vm_t *vm, obj_sym_t *name){
@@ -411,19 +598,19 @@ obj_t *obj_vm_get_or_add_module(obj_vm_t *vm, obj_sym_t *name){
     if(!module)return NULL;
     obj_init_sym(OBJ_ARRAY_IGET(module, 0), name);
     obj_init_dict(OBJ_ARRAY_IGET(module, 1), defs);
-    if(!obj_dict_set(&vm->modules, name, module))return NULL;
+    if(!obj_dict_set_boxed(&vm->modules, name, module))return NULL;
     return module;
 }
 
 obj_t *obj_module_get_def(obj_t *module, obj_sym_t *sym){
     obj_dict_t *defs = OBJ_MODULE_DEFS(module);
-    return obj_dict_get(defs, sym);
+    return obj_dict_get_boxed(defs, sym);
 }
 
 obj_t *obj_get_def(
     obj_vm_t *vm, obj_t *module, obj_dict_t *scope, obj_sym_t *sym
 ){
-    obj_t *ref = obj_dict_get(scope, sym);
+    obj_t *ref = obj_dict_get_boxed(scope, sym);
     if(ref){
         obj_sym_t *module_name = OBJ_REF_MODULE_NAME(ref);
         obj_sym_t *def_name = OBJ_REF_DEF_NAME(ref);
@@ -601,7 +788,7 @@ int obj_vm_parse_from(
         if(!ref)return 1;
         obj_init_sym(OBJ_ARRAY_IGET(ref, 0), module_name);
         obj_init_sym(OBJ_ARRAY_IGET(ref, 1), def_name);
-        if(!obj_dict_set(scope, ref_name, ref))return 1;
+        if(!obj_dict_set_boxed(scope, ref_name, ref))return 1;
 
         body = OBJ_TAIL(body);
     }
@@ -732,7 +919,7 @@ int obj_vm_parse_raw(obj_vm_t *vm,
             obj_t *def = obj_vm_add_def(
                 vm, module_name, def_name, scope, args, rets, body);
             if(!def)goto err;
-            if(!obj_dict_set(defs, def_name, def))goto err;
+            if(!obj_dict_set_boxed(defs, def_name, def))goto err;
         }else{
             ERRMSG()
             fprintf(stderr, "Expected one of: module, from, def.\n");
@@ -750,17 +937,208 @@ err:
 }
 
 
+/*******************
+* obj_vm -- images *
+*******************/
+
+/* Images (see obj_image in cobj.h) let us skip parsing: once files have
+been parsed into modules, we can write an image of vm's pool, and later
+load its modules, defs, scopes and code straight into another vm. */
+
+int obj_vm_write_image(obj_vm_t *vm, obj_writer_t *writer){
+    /* Writes an image of vm's pool, rooted at a copy of vm->modules.
+    (The copy is added to vm's pool, since an image's root has to be
+    in the pool being written.) */
+    obj_t *root = obj_pool_add_dict(vm->pool);
+    if(!root)return 1;
+    obj_dict_t *modules = &vm->modules;
+    for(size_t i = 0; i < modules->entries_len; i++){
+        obj_dict_entry_t *entry = &modules->entries[i];
+        if(!entry->sym)continue;
+        if(!obj_dict_set(OBJ_DICT(root), entry->sym, &entry->value)){
+            return 1;
+        }
+    }
+    return obj_image_write(writer, vm->pool, root);
+}
+
+int obj_vm_load_image(obj_vm_t *vm, obj_image_t *image){
+    /* Relocates image, interns its syms into vm's symtable, and adds
+    its defs to vm's modules.
+    Image's memory must outlive vm.
+    The defs dicts of image's modules aren't used directly (since
+    adding defs to them might try to grow them, and so free part of
+    the image), but instead copied into vm's modules. */
+    obj_t *root = obj_image_relocate(image);
+    if(!root || obj_image_intern(image, vm->pool->symtable))return 1;
+    if(obj_vm_get_syms(vm))return 1;
+    if(OBJ_TYPE(root) != OBJ_TYPE_DICT){
+        fprintf(stderr, "%s: Expected image's root to be a dict of "
+            "modules\n", __func__);
+        return 1;
+    }
+
+    obj_dict_t *image_modules = OBJ_DICT(root);
+    for(size_t i = 0; i < image_modules->entries_len; i++){
+        obj_dict_entry_t *entry = &image_modules->entries[i];
+        if(!entry->sym)continue;
+        obj_t *image_module = OBJ_TYPE(&entry->value) == OBJ_TYPE_BOX?
+            OBJ_CONTENTS(&entry->value): NULL;
+        if(!image_module || OBJ_TYPE(image_module) != OBJ_TYPE_ARRAY ||
+            OBJ_ARRAY_LEN(image_module) < 2 ||
+            OBJ_TYPE(OBJ_ARRAY_IGET(image_module, 1)) != OBJ_TYPE_DICT
+        ){
+            fprintf(stderr, "%s: Expected image's module ", __func__);
+            obj_sym_fprint(entry->sym, stderr);
+            fprintf(stderr, " to be a box of a module\n");
+            return 1;
+        }
+        obj_t *module = obj_vm_get_or_add_module(vm, entry->sym);
+        if(!module)return 1;
+
+        obj_dict_t *image_defs = OBJ_MODULE_DEFS(image_module);
+        obj_dict_t *defs = OBJ_MODULE_DEFS(module);
+        for(size_t j = 0; j < image_defs->entries_len; j++){
+            obj_dict_entry_t *def_entry = &image_defs->entries[j];
+            if(!def_entry->sym)continue;
+
+            /* Check for def name conflict in module */
+            if(obj_dict_get(defs, def_entry->sym)){
+                fprintf(stderr, "%s: Conflict: def ", __func__);
+                obj_sym_fprint(def_entry->sym, stderr);
+                fprintf(stderr, " already in module!\n");
+                return 1;
+            }
+            if(!obj_dict_set(defs, def_entry->sym, &def_entry->value)){
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+
+
+/*******************************
+* obj_vm -- garbage collection *
+*******************************/
+
+/* A copying collector: everything reachable from the vm's roots (its
+modules, and the stacks, vars and blocks of its frames) is copied into
+fresh storage, and everything else is freed along with the old storage.
+Since the copy is made breadth-first with an obj_copier_t, lists end up
+contiguous, which also makes walking them afterwards cheaper.
+The vm's pool must not be shared with anything outside the vm (e.g. a
+parser holding onto objs), since only the vm's roots are updated.
+If the pool has hashcons set, objs which survive a collection are no
+longer in its hashcons table, so they won't be shared with objs added
+afterwards. */
+
+static int obj_vm_collect_frame(obj_copier_t *copier, obj_frame_t *frame){
+    if(!(frame->module = obj_copier_ref(copier, frame->module)))return 1;
+    if(!(frame->def = obj_copier_ref(copier, frame->def)))return 1;
+    for(size_t i = 0; i < frame->stack_tos; i++){
+        obj_t *obj = &frame->stack[i];
+        if(obj_copier_value(copier, obj, obj))return 1;
+    }
+    for(size_t i = 0; i < frame->n_vars * 2; i++){
+        obj_t *obj = &frame->vars[i];
+        if(obj_copier_value(copier, obj, obj))return 1;
+    }
+    for(obj_block_t *block = frame->block_list; block; block = block->next){
+        if(block->code_start && !(block->code_start =
+            obj_copier_ref(copier, block->code_start)))return 1;
+        if(block->code && !(block->code =
+            obj_copier_ref(copier, block->code)))return 1;
+        if(
+            (block->type == OBJ_BLOCK_FOR ||
+                block->type == OBJ_BLOCK_LIST_FOR) &&
+            block->u.o && !(block->u.o = obj_copier_ref(copier, block->u.o))
+        )return 1;
+    }
+    return 0;
+}
+
+int obj_vm_collect(obj_vm_t *vm){
+    obj_pool_t *pool = vm->pool;
+    obj_pool_t _old_pool, *old_pool=&_old_pool;
+    obj_pool_init(old_pool, pool->symtable);
+    obj_pool_move(pool, old_pool);
+
+    int err = 0;
+    obj_copier_t _copier, *copier=&_copier;
+    obj_copier_init(copier, pool);
+
+    obj_dict_t *modules = &vm->modules;
+    for(size_t i = 0; i < modules->entries_len; i++){
+        if(!modules->entries[i].sym)continue;
+        obj_t *obj = &modules->entries[i].value;
+        if(obj_copier_value(copier, obj, obj)){err = 1; goto end;}
+    }
+    for(obj_frame_t *frame = vm->frame_list; frame; frame = frame->next){
+        if(obj_vm_collect_frame(copier, frame)){err = 1; goto end;}
+    }
+    if(obj_copier_run(copier)){err = 1; goto end;}
+
+    obj_vm_clear_site_cache(vm);
+    obj_hash_memo_clear(&vm->hash_memo);
+
+    vm->n_collections++;
+    vm->gc_next = pool->n_objs + vm->gc_threshold;
+
+end:
+    obj_copier_cleanup(copier);
+    if(err){
+        /* We've already started overwriting the roots, there's no going
+        back */
+        fprintf(stderr, "%s: Failed to collect garbage\n", __func__);
+    }else{
+        obj_pool_cleanup(old_pool);
+    }
+    return err;
+}
+
+
+
 /********************
 * obj_vm -- running *
 ********************/
 
 int obj_vm_step(obj_vm_t *vm, bool *running_ptr);
+int obj_vm_call_fun(obj_vm_t *vm, obj_t *fun,
+    obj_t **args, int n_args, obj_t *ret);
+
+typedef struct obj_vm_fun_lt_data {
+    obj_vm_t *vm;
+    obj_t *fun;
+} obj_vm_fun_lt_data_t;
+
+static int obj_vm_fun_lt(obj_t *x, obj_t *y, void *data, bool *lt_ptr){
+    /* An obj_lt_t which calls a fun (x y -- bool), for e.g.
+    arr_sort_by */
+    obj_vm_fun_lt_data_t *fun_lt_data = data;
+    obj_t *args[2] = {x, y};
+    obj_t ret;
+    if(obj_vm_call_fun(fun_lt_data->vm, fun_lt_data->fun,
+        args, 2, &ret))return 1;
+    if(OBJ_TYPE(&ret) != OBJ_TYPE_BOOL){
+        fprintf(stderr, "%s: Expected bool, got: %s\n",
+            __func__, obj_type_msg(OBJ_TYPE(&ret)));
+        return 1;
+    }
+    *lt_ptr = OBJ_BOOL(&ret);
+    return 0;
+}
+
 #include "lang_step.h" /* definition of obj_vm_step */
 
 int obj_vm_run(obj_vm_t *vm){
     bool running = true;
     while(running){
         if(obj_vm_step(vm, &running))goto err;
+        if(vm->gc_threshold && vm->pool->n_objs > vm->gc_next){
+            if(obj_vm_collect(vm))goto err;
+        }
     }
     return 0;
 err:
@@ -772,5 +1150,72 @@ err:
     return 1;
 }
 
+int obj_vm_call_fun(obj_vm_t *vm, obj_t *fun,
+    obj_t **args, int n_args, obj_t *ret
+){
+    /* Calls fun from C, e.g. from an instruction like list_map:
+    pushes fun's args followed by the n_args objs in args onto the
+    current frame, runs fun's def until it returns, and pops its
+    return value into *ret.
+    The vm doesn't collect garbage until the call returns, since the
+    caller may be holding on to objs in C variables.
+    NOTE: the current frame's stack may be realloc'd, so caller
+    shouldn't hold on to pointers into it either. */
+    obj_frame_t *frame = vm->frame_list;
+    obj_sym_t *module_name = OBJ_FUN_MODULE_NAME(fun);
+    obj_sym_t *sym = OBJ_FUN_DEF_NAME(fun);
+    obj_t *module = obj_vm_get_module(vm, module_name);
+    obj_t *def = module? obj_module_get_def(module, sym): NULL;
+    if(!def){
+        fprintf(stderr, "%s: Couldn't find def: ", __func__);
+        obj_sym_fprint(module_name, stderr);
+        putc(' ', stderr);
+        obj_sym_fprint(sym, stderr);
+        putc('\n', stderr);
+        return 1;
+    }
+    int n_fun_args = OBJ_LIST_LEN(OBJ_FUN_ARGS(fun));
+    if(
+        OBJ_DEF_N_ARGS(def) != n_fun_args + n_args ||
+        OBJ_DEF_N_RETS(def) != 1
+    ){
+        fprintf(stderr, "%s: Expected def taking %i args and returning "
+            "1 value, but it takes %i and returns %i: ", __func__,
+            n_fun_args + n_args, OBJ_DEF_N_ARGS(def), OBJ_DEF_N_RETS(def));
+        obj_sym_fprint(module_name, stderr);
+        putc(' ', stderr);
+        obj_sym_fprint(sym, stderr);
+        putc('\n', stderr);
+        return 1;
+    }
+
+    for(obj_t *lst = OBJ_FUN_ARGS(fun);
+        OBJ_TYPE(lst) == OBJ_TYPE_CELL; lst = OBJ_TAIL(lst)
+    ){
+        if(!obj_frame_push_shared(frame, OBJ_HEAD(lst)))return 1;
+    }
+    for(int i = 0; i < n_args; i++){
+        if(!obj_frame_push_shared(frame, args[i]))return 1;
+    }
+    obj_frame_t *fun_frame = obj_vm_push_frame(vm, module, def);
+    if(!fun_frame)return 1;
+
+    obj_frame_t *stop_frame = vm->stop_frame;
+    vm->stop_frame = fun_frame;
+    bool running = true;
+    while(running){
+        if(obj_vm_step(vm, &running)){
+            vm->stop_frame = stop_frame;
+            return 1;
+        }
+    }
+    vm->stop_frame = stop_frame;
+
+    if(!obj_vm_pop_frame(vm))return 1;
+    *ret = *OBJ_FRAME_TOS(frame);
+    frame->stack_tos--;
+    return 0;
+}
+
 
 #endif
\ No newline at end of file
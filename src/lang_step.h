@@ -42,6 +42,30 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
         return 1; \
     }
 
+#   define OBJ_TYPECHECK_MAP_KEY(o) \
+    if(OBJ_TYPE(o) != OBJ_TYPE_INT && OBJ_TYPE(o) != OBJ_TYPE_STR && \
+        OBJ_TYPE(o) != OBJ_TYPE_SYM \
+    ){ \
+        fprintf(stderr, "%s: Failed type check (map key) for: ", \
+            __func__); \
+        obj_sym_fprint(inst, stderr); \
+        putc('\n', stderr); \
+        fprintf(stderr, "Value was:\n"); \
+        obj_dump((o), stderr, 2); \
+        return 1; \
+    }
+
+#   define OBJ_TYPECHECK_OMAP_KEY(m, o) \
+    if(!obj_omap_key_ok((m), (o))){ \
+        fprintf(stderr, "%s: Failed type check (omap key) for: ", \
+            __func__); \
+        obj_sym_fprint(inst, stderr); \
+        putc('\n', stderr); \
+        fprintf(stderr, "Value was:\n"); \
+        obj_dump((o), stderr, 2); \
+        return 1; \
+    }
+
 #   define OBJ_FRAME_NEXT(VAR) \
         obj_t *VAR; \
         { \
@@ -79,6 +103,11 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
         }
         block = frame->block_list;
         if(!block){
+            if(frame == vm->stop_frame){
+                /* Leave it to obj_vm_call_fun to pop */
+                *running_ptr = false;
+                return 0;
+            }
             if(!obj_vm_pop_frame(vm))return 1;
             continue;
         }
@@ -124,7 +153,7 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
                     if(!obj_frame_pop_block(vm, frame))return 1;
                     continue;
                 }
-                if(!obj_frame_push(frame,
+                if(!obj_frame_push_shared(frame,
                     OBJ_HEAD(block->u.o)))return 1;
             }
         }
@@ -183,11 +212,12 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
             obj_t *obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
             OBJ_TYPECHECK_LIST(obj)
             obj_init_box(OBJ_FRAME_TOS(frame), OBJ_TAIL(obj));
-            if(!obj_frame_push(frame, OBJ_HEAD(obj)))return 1;
+            if(!obj_frame_push_shared(frame, OBJ_HEAD(obj)))return 1;
         }else if(inst == vm->sym_head){
             OBJ_STACKCHECK(1)
             obj_t *obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
             OBJ_TYPECHECK_LIST(obj)
+            OBJ_UNSET_UNIQUE(OBJ_HEAD(obj));
             *OBJ_FRAME_TOS(frame) = *OBJ_HEAD(obj);
         }else if(inst == vm->sym_tail){
             OBJ_STACKCHECK(1)
@@ -218,6 +248,7 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
             obj_t *a_obj = obj_pool_add_array_from_list(vm->pool, obj);
             if(!a_obj)return 1;
             obj_init_box(OBJ_FRAME_TOS(frame), a_obj);
+            OBJ_SET_UNIQUE(OBJ_FRAME_TOS(frame));
         }else if(inst == vm->sym_rev_flat){
             OBJ_STACKCHECK(1)
             obj_t *obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
@@ -225,6 +256,7 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
             obj_t *a_obj = obj_pool_add_array_from_rev_list(vm->pool, obj);
             if(!a_obj)return 1;
             obj_init_box(OBJ_FRAME_TOS(frame), a_obj);
+            OBJ_SET_UNIQUE(OBJ_FRAME_TOS(frame));
         }else if(inst == vm->sym_queue){
             obj_t *obj = obj_pool_add_queue(vm->pool, &vm->pool->nil);
             obj_t box;
@@ -319,6 +351,35 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
             obj_init_bool(OBJ_FRAME_TOS(frame),
                 OBJ_TYPE(OBJ_RESOLVE(OBJ_FRAME_TOS(frame)))
                 == OBJ_TYPE_FUN);
+        }else if(inst == vm->sym_is_vec){
+            OBJ_STACKCHECK(1)
+            obj_init_bool(OBJ_FRAME_TOS(frame),
+                OBJ_TYPE(OBJ_RESOLVE(OBJ_FRAME_TOS(frame)))
+                == OBJ_TYPE_VEC);
+        }else if(inst == vm->sym_is_iarr){
+            OBJ_STACKCHECK(1)
+            obj_init_bool(OBJ_FRAME_TOS(frame),
+                OBJ_TYPE(OBJ_RESOLVE(OBJ_FRAME_TOS(frame)))
+                == OBJ_TYPE_INTARR);
+        }else if(inst == vm->sym_is_strbuf){
+            OBJ_STACKCHECK(1)
+            obj_init_bool(OBJ_FRAME_TOS(frame),
+                OBJ_TYPE(OBJ_FRAME_TOS(frame)) == OBJ_TYPE_STRBUF);
+        }else if(inst == vm->sym_is_map){
+            OBJ_STACKCHECK(1)
+            obj_init_bool(OBJ_FRAME_TOS(frame),
+                OBJ_TYPE(OBJ_RESOLVE(OBJ_FRAME_TOS(frame)))
+                == OBJ_TYPE_MAP);
+        }else if(inst == vm->sym_is_omap){
+            OBJ_STACKCHECK(1)
+            obj_init_bool(OBJ_FRAME_TOS(frame),
+                OBJ_TYPE(OBJ_RESOLVE(OBJ_FRAME_TOS(frame)))
+                == OBJ_TYPE_OMAP);
+        }else if(inst == vm->sym_is_pqueue){
+            OBJ_STACKCHECK(1)
+            obj_init_bool(OBJ_FRAME_TOS(frame),
+                OBJ_TYPE(OBJ_RESOLVE(OBJ_FRAME_TOS(frame)))
+                == OBJ_TYPE_PQUEUE);
         }else if(inst == vm->sym_not){
             OBJ_STACKCHECK(1)
             OBJ_TYPECHECK(OBJ_FRAME_TOS(frame), OBJ_TYPE_BOOL)
@@ -328,7 +389,7 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
             obj_init_bool(z, OBJ_BOOL(x) == OBJ_BOOL(y));
         }else if(inst == vm->sym_dup){
             OBJ_STACKCHECK(1)
-            if(!obj_frame_push(frame, OBJ_FRAME_TOS(frame)))return 1;
+            if(!obj_frame_push_shared(frame, OBJ_FRAME_TOS(frame)))return 1;
         }else if(inst == vm->sym_drop){
             OBJ_STACKCHECK(1)
             frame->stack_tos--;
@@ -343,13 +404,14 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
             frame->stack_tos--;
         }else if(inst == vm->sym_tuck){
             OBJ_STACKCHECK(2)
+            OBJ_UNSET_UNIQUE(OBJ_FRAME_TOS(frame));
             obj_t tos_obj = *OBJ_FRAME_TOS(frame);
             *OBJ_FRAME_TOS(frame) = *OBJ_FRAME_NOS(frame);
             *OBJ_FRAME_NOS(frame) = tos_obj;
             if(!obj_frame_push(frame, &tos_obj))return 1;
         }else if(inst == vm->sym_over){
             OBJ_STACKCHECK(2)
-            if(!obj_frame_push(frame, OBJ_FRAME_NOS(frame)))return 1;
+            if(!obj_frame_push_shared(frame, OBJ_FRAME_NOS(frame)))return 1;
         }else if(inst == vm->sym_var_get){
             OBJ_FRAME_NEXTSYM(sym)
             obj_t *var = obj_frame_get_var(frame, sym);
@@ -359,7 +421,7 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
                 putc('\n', stderr);
                 return 1;
             }
-            if(!obj_frame_push(frame, var))return 1;
+            if(!obj_frame_push_shared(frame, var))return 1;
         }else if(inst == vm->sym_var_set){
             OBJ_STACKCHECK(1)
             OBJ_FRAME_NEXTSYM(sym)
@@ -367,7 +429,8 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
             frame->stack_tos--;
         }else if(inst == vm->sym_typeof){
             OBJ_STACKCHECK(1)
-            int type = OBJ_TYPE(OBJ_RESOLVE(OBJ_FRAME_TOS(frame)));
+            obj_t *obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            int type = OBJ_TYPE(obj);
             obj_sym_t *sym =
                 type == OBJ_TYPE_NULL? vm->sym_null
                 : type == OBJ_TYPE_BOOL? vm->sym_bool
@@ -381,6 +444,14 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
                 : type == OBJ_TYPE_DICT? vm->sym_dict
                 : type == OBJ_TYPE_STRUCT? vm->sym_obj
                 : type == OBJ_TYPE_FUN? vm->sym_fun
+                : type == OBJ_TYPE_VEC? vm->sym_vec
+                : type == OBJ_TYPE_INTARR?
+                    OBJ_INTARR_KIND(obj) == OBJ_INTARR_U8?
+                        vm->sym_u8arr: vm->sym_i32arr
+                : type == OBJ_TYPE_STRBUF? vm->sym_strbuf
+                : type == OBJ_TYPE_MAP? vm->sym_map
+                : type == OBJ_TYPE_OMAP? vm->sym_omap
+                : type == OBJ_TYPE_PQUEUE? vm->sym_pqueue
                 : NULL;
             if(sym == NULL){
                 fprintf(stderr, "%s: Unrecognized type: %i (%s)\n",
@@ -391,6 +462,21 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
         }else if(inst == vm->sym_sym_eq){
             OBJ_FRAME_BINOP(SYM)
             obj_init_bool(z, OBJ_SYM(x) == OBJ_SYM(y));
+        }else if(inst == vm->sym_deep_eq){
+            OBJ_STACKCHECK(2)
+            bool eq;
+            if(obj_eq(OBJ_FRAME_NOS(frame), OBJ_FRAME_TOS(frame),
+                NULL, &eq))return 1;
+            frame->stack_tos--;
+            obj_init_bool(OBJ_FRAME_TOS(frame), eq);
+        }else if(inst == vm->sym_deep_hash){
+            OBJ_STACKCHECK(1)
+            size_t hash;
+            int err = obj_hash_deep(OBJ_FRAME_TOS(frame),
+                &vm->hash_memo, &hash);
+            obj_hash_memo_clear(&vm->hash_memo);
+            if(err)return 1;
+            obj_init_int(OBJ_FRAME_TOS(frame), (int)hash);
         }else if(inst == vm->sym_sym_tostr){
             OBJ_STACKCHECK(1)
             OBJ_TYPECHECK(OBJ_FRAME_TOS(frame), OBJ_TYPE_SYM)
@@ -398,15 +484,14 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
 
             /* Don't let people mess with the actual string for the sym!..
             Then they could change the sym! */
-            obj_string_t *s_clone = obj_pool_string_add_raw(
-                vm->pool, sym->string.data, sym->string.len);
-            if(!s_clone)return 1;
-
-            obj_init_str(OBJ_FRAME_TOS(frame), s_clone);
+            if(!obj_init_str_raw(vm->pool, OBJ_FRAME_TOS(frame),
+                sym->string.data, sym->string.len))return 1;
+            OBJ_SET_UNIQUE(OBJ_FRAME_TOS(frame));
         }else if(inst == vm->sym_str_tosym){
             OBJ_STACKCHECK(1)
             OBJ_TYPECHECK(OBJ_FRAME_TOS(frame), OBJ_TYPE_STR)
-            obj_string_t *s = OBJ_STRING(OBJ_FRAME_TOS(frame));
+            obj_string_t view;
+            obj_string_t *s = obj_str_get(OBJ_FRAME_TOS(frame), &view);
             obj_sym_t *sym = obj_symtable_get_sym_raw(
                 vm->pool->symtable, s->data, s->len);
             if(!sym)return 1;
@@ -414,11 +499,11 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
         }else if(inst == vm->sym_str_clone){
             OBJ_STACKCHECK(1)
             OBJ_TYPECHECK(OBJ_FRAME_TOS(frame), OBJ_TYPE_STR)
-            obj_string_t *s = OBJ_STRING(OBJ_FRAME_TOS(frame));
-            obj_string_t *s_clone = obj_pool_string_add_raw(
-                vm->pool, s->data, s->len);
-            if(!s_clone)return 1;
-            obj_init_str(OBJ_FRAME_TOS(frame), s_clone);
+            obj_string_t view;
+            obj_string_t *s = obj_str_get(OBJ_FRAME_TOS(frame), &view);
+            if(!obj_init_str_raw(vm->pool, OBJ_FRAME_TOS(frame),
+                s->data, s->len))return 1;
+            OBJ_SET_UNIQUE(OBJ_FRAME_TOS(frame));
         }else if(inst == vm->sym_add){
             OBJ_FRAME_BINOP(INT)
             OBJ_INT(z) = OBJ_INT(x) + OBJ_INT(y);
@@ -457,36 +542,31 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
             OBJ_TYPECHECK(OBJ_FRAME_TOS(frame), OBJ_TYPE_INT)
             int i = OBJ_INT(OBJ_FRAME_TOS(frame));
             size_t len = strlen_of_int(i);
-            obj_string_t *s = obj_pool_string_alloc(vm->pool, len);
-            if(!s)return 1;
-            strncpy_of_int(s->data, i, len);
-            obj_init_str(OBJ_FRAME_TOS(frame), s);
+            char data[16];
+            strncpy_of_int(data, i, len);
+            if(!obj_init_str_raw(vm->pool, OBJ_FRAME_TOS(frame),
+                data, len))return 1;
+            OBJ_SET_UNIQUE(OBJ_FRAME_TOS(frame));
         }else if(inst == vm->sym_obj){
+            obj_t *site = code;
             OBJ_FRAME_NEXT(keys)
             OBJ_TYPECHECK_LIST(keys)
-            obj_t *obj = obj_pool_add_struct(vm->pool,
-                OBJ_LIST_LEN(keys));
+            obj_shape_t *shape = obj_vm_get_site_shape(vm, site, keys);
+            if(!shape)return 1;
+            obj_t *obj = obj_pool_add_struct(vm->pool, shape);
             if(!obj)return 1;
-            size_t i = 0;
-            while(OBJ_TYPE(keys) == OBJ_TYPE_CELL){
-                obj_t *key_obj = OBJ_HEAD(keys);
-                OBJ_TYPECHECK(key_obj, OBJ_TYPE_SYM)
-                obj_sym_t *key = OBJ_SYM(key_obj);
-                obj_init_sym(OBJ_STRUCT_IGET_KEY(obj, i), key);
-                obj_init_null(OBJ_STRUCT_IGET_VAL(obj, i));
-                keys = OBJ_TAIL(keys);
-                i++;
-            }
             obj_t box;
             obj_init_box(&box, obj);
+            OBJ_SET_UNIQUE(&box);
             if(!obj_frame_push(frame, &box))return 1;
         }else if(inst == vm->sym_obj_get){
+            obj_t *site = code;
             OBJ_FRAME_NEXTSYM(key)
             OBJ_STACKCHECK(1)
             obj_t *s_obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
             OBJ_TYPECHECK(s_obj, OBJ_TYPE_STRUCT)
 
-            obj_t *val = OBJ_STRUCT_GET(s_obj, key);
+            obj_t *val = obj_vm_struct_get(vm, site, s_obj, key);
             if(!val){
                 fprintf(stderr, "%s: Couldn't find struct key: ", __func__);
                 obj_sym_fprint(key, stderr);
@@ -494,15 +574,19 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
                 return 1;
             }
 
+            OBJ_UNSET_UNIQUE(val);
             *OBJ_FRAME_TOS(frame) = *val;
         }else if(inst == vm->sym_obj_set){
+            obj_t *site = code;
             OBJ_FRAME_NEXTSYM(key)
             OBJ_STACKCHECK(2)
             obj_t *new_val = OBJ_FRAME_TOS(frame);
             obj_t *s_obj = OBJ_RESOLVE(OBJ_FRAME_NOS(frame));
             OBJ_TYPECHECK(s_obj, OBJ_TYPE_STRUCT)
+            s_obj = obj_vm_own(vm, OBJ_FRAME_NOS(frame));
+            if(!s_obj)return 1;
 
-            obj_t *val = OBJ_STRUCT_GET(s_obj, key);
+            obj_t *val = obj_vm_struct_get(vm, site, s_obj, key);
             if(!val){
                 fprintf(stderr, "%s: Couldn't find struct key: ", __func__);
                 obj_sym_fprint(key, stderr);
@@ -552,6 +636,7 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
             }
 
             frame->stack_tos--;
+            OBJ_UNSET_UNIQUE(OBJ_STRUCT_IGET_VAL(obj, i));
             *OBJ_FRAME_TOS(frame) = *OBJ_STRUCT_IGET_VAL(obj, i);
         }else if(inst == vm->sym_dict){
             obj_t *obj = obj_pool_add_dict(vm->pool);
@@ -589,6 +674,7 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
             }
 
             frame->stack_tos--;
+            OBJ_UNSET_UNIQUE(val);
             *OBJ_FRAME_TOS(frame) = *val;
         }else if(inst == vm->sym_set){
             OBJ_STACKCHECK(3)
@@ -601,18 +687,8 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
             obj_sym_t *key = OBJ_SYM(key_obj);
             obj_dict_t *d = OBJ_DICT(d_obj);
 
-            obj_t *val = obj_dict_get(d, key);
-            if(!val){
-                /* NOTE: dicts store obj_t*, they have no space of
-                their own for actual obj_t.
-                So the first time you dict_set a key, we allocate 1 obj_t. */
-                val = obj_pool_objs_alloc(vm->pool, 1);
-                if(!val)return 1;
-            }
-            *val = *new_val;
-
+            if(!obj_dict_set(d, key, new_val))return 1;
             frame->stack_tos -= 2;
-            if(!obj_dict_set(d, key, val))return 1;
         }else if(inst == vm->sym_del){
             OBJ_STACKCHECK(2)
 
@@ -623,8 +699,7 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
             obj_sym_t *key = OBJ_SYM(key_obj);
             obj_dict_t *d = OBJ_DICT(d_obj);
 
-            obj_t *val = obj_dict_del(d, key);
-            if(!val){
+            if(!obj_dict_del(d, key, NULL)){
                 fprintf(stderr, "%s: Couldn't find dict key: ", __func__);
                 obj_sym_fprint(key, stderr);
                 putc('\n', stderr);
@@ -671,8 +746,394 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
             }else if(inst == vm->sym_dict_iget_key){
                 obj_init_sym(OBJ_FRAME_TOS(frame), d->entries[i].sym);
             }else{
-                *OBJ_FRAME_TOS(frame) = *(obj_t*)d->entries[i].value;
+                OBJ_UNSET_UNIQUE(&d->entries[i].value);
+                *OBJ_FRAME_TOS(frame) = d->entries[i].value;
+            }
+        }else if(inst == vm->sym_map){
+            obj_t *obj = obj_pool_add_map(vm->pool);
+            if(!obj)return 1;
+            obj_t box;
+            obj_init_box(&box, obj);
+            OBJ_SET_UNIQUE(&box);
+            if(!obj_frame_push(frame, &box))return 1;
+        }else if(
+            inst == vm->sym_map_has ||
+            inst == vm->sym_map_get
+        ){
+            OBJ_STACKCHECK(2)
+
+            obj_t *key = OBJ_FRAME_TOS(frame);
+            obj_t *m_obj = OBJ_RESOLVE(OBJ_FRAME_NOS(frame));
+            OBJ_TYPECHECK_MAP_KEY(key)
+            OBJ_TYPECHECK(m_obj, OBJ_TYPE_MAP)
+
+            obj_t *val = obj_map_get(m_obj, key);
+            if(inst == vm->sym_map_has){
+                frame->stack_tos--;
+                obj_init_bool(OBJ_FRAME_TOS(frame), val != NULL);
+            }else{
+                if(!val){
+                    fprintf(stderr, "%s: Couldn't find map key:\n",
+                        __func__);
+                    obj_dump(key, stderr, 2);
+                    return 1;
+                }
+                frame->stack_tos--;
+                OBJ_UNSET_UNIQUE(val);
+                *OBJ_FRAME_TOS(frame) = *val;
+            }
+        }else if(inst == vm->sym_map_set){
+            OBJ_STACKCHECK(3)
+
+            obj_t *key = OBJ_FRAME_TOS(frame);
+            obj_t *val = OBJ_FRAME_NOS(frame);
+            obj_t *m_obj = OBJ_RESOLVE(OBJ_FRAME_3OS(frame));
+            OBJ_TYPECHECK_MAP_KEY(key)
+            OBJ_TYPECHECK(m_obj, OBJ_TYPE_MAP)
+            m_obj = obj_vm_own(vm, OBJ_FRAME_3OS(frame));
+            if(!m_obj)return 1;
+            if(!obj_map_set(vm->pool, m_obj, key, val))return 1;
+
+            frame->stack_tos -= 2;
+        }else if(inst == vm->sym_map_del){
+            OBJ_STACKCHECK(2)
+
+            obj_t *key = OBJ_FRAME_TOS(frame);
+            obj_t *m_obj = OBJ_RESOLVE(OBJ_FRAME_NOS(frame));
+            OBJ_TYPECHECK_MAP_KEY(key)
+            OBJ_TYPECHECK(m_obj, OBJ_TYPE_MAP)
+            if(!obj_map_get(m_obj, key)){
+                fprintf(stderr, "%s: Couldn't find map key:\n", __func__);
+                obj_dump(key, stderr, 2);
+                return 1;
+            }
+            m_obj = obj_vm_own(vm, OBJ_FRAME_NOS(frame));
+            if(!m_obj)return 1;
+            obj_map_del(m_obj, key, NULL);
+
+            frame->stack_tos--;
+        }else if(inst == vm->sym_map_len){
+            OBJ_STACKCHECK(1)
+            obj_t *m_obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK(m_obj, OBJ_TYPE_MAP)
+            obj_init_int(OBJ_FRAME_TOS(frame), OBJ_MAP_CAP(m_obj));
+        }else if(inst == vm->sym_map_n_keys){
+            OBJ_STACKCHECK(1)
+            obj_t *m_obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK(m_obj, OBJ_TYPE_MAP)
+            obj_init_int(OBJ_FRAME_TOS(frame), OBJ_MAP_N_KEYS(m_obj));
+        }else if(
+            inst == vm->sym_map_ihas ||
+            inst == vm->sym_map_iget_key ||
+            inst == vm->sym_map_iget_val
+        ){
+            OBJ_STACKCHECK(2)
+
+            obj_t *i_obj = OBJ_FRAME_TOS(frame);
+            obj_t *m_obj = OBJ_RESOLVE(OBJ_FRAME_NOS(frame));
+            OBJ_TYPECHECK(i_obj, OBJ_TYPE_INT)
+            OBJ_TYPECHECK(m_obj, OBJ_TYPE_MAP)
+            int i = OBJ_INT(i_obj);
+            int len = OBJ_MAP_CAP(m_obj);
+
+            if(i < 0 || i >= len){
+                fprintf(stderr,
+                    "%s: Map index %i out of range for len: %i\n",
+                    __func__, i, len);
+                return 1;
+            }
+
+            obj_t *key = OBJ_MAP_IGET_KEY(m_obj, i);
+            obj_t *val = OBJ_MAP_IGET_VAL(m_obj, i);
+            frame->stack_tos--;
+            if(inst == vm->sym_map_ihas){
+                obj_init_bool(OBJ_FRAME_TOS(frame),
+                    OBJ_TYPE(key) != OBJ_TYPE_NULL);
+            }else{
+                obj_t *obj = inst == vm->sym_map_iget_key? key: val;
+                OBJ_UNSET_UNIQUE(obj);
+                *OBJ_FRAME_TOS(frame) = *obj;
+            }
+        }else if(inst == vm->sym_map_keys){
+            OBJ_STACKCHECK(1)
+            obj_t *m_obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK(m_obj, OBJ_TYPE_MAP)
+            obj_t *lst = obj_pool_add_map_keys(vm->pool, m_obj);
+            if(!lst)return 1;
+            obj_init_box(OBJ_FRAME_TOS(frame), lst);
+        }else if(inst == vm->sym_omap){
+            obj_t *obj = obj_pool_add_omap(vm->pool);
+            if(!obj)return 1;
+            obj_t box;
+            obj_init_box(&box, obj);
+            if(!obj_frame_push(frame, &box))return 1;
+        }else if(inst == vm->sym_omap_len){
+            OBJ_STACKCHECK(1)
+            obj_t *m_obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK(m_obj, OBJ_TYPE_OMAP)
+            obj_init_int(OBJ_FRAME_TOS(frame), OBJ_OMAP_LEN(m_obj));
+        }else if(
+            inst == vm->sym_omap_has ||
+            inst == vm->sym_omap_get
+        ){
+            OBJ_STACKCHECK(2)
+
+            obj_t *key = OBJ_FRAME_TOS(frame);
+            obj_t *m_obj = OBJ_RESOLVE(OBJ_FRAME_NOS(frame));
+            OBJ_TYPECHECK_MAP_KEY(key)
+            OBJ_TYPECHECK(m_obj, OBJ_TYPE_OMAP)
+
+            obj_t *val = obj_omap_get(m_obj, key);
+            if(inst == vm->sym_omap_has){
+                frame->stack_tos--;
+                obj_init_bool(OBJ_FRAME_TOS(frame), val != NULL);
+            }else{
+                if(!val){
+                    fprintf(stderr, "%s: Couldn't find omap key:\n",
+                        __func__);
+                    obj_dump(key, stderr, 2);
+                    return 1;
+                }
+                frame->stack_tos--;
+                *OBJ_FRAME_TOS(frame) = *val;
+            }
+        }else if(inst == vm->sym_omap_set){
+            /* Omaps are persistent, like vecs */
+            OBJ_STACKCHECK(3)
+
+            obj_t *key = OBJ_FRAME_TOS(frame);
+            obj_t *val = OBJ_FRAME_NOS(frame);
+            obj_t *m_obj = OBJ_RESOLVE(OBJ_FRAME_3OS(frame));
+            OBJ_TYPECHECK(m_obj, OBJ_TYPE_OMAP)
+            OBJ_TYPECHECK_OMAP_KEY(m_obj, key)
+            OBJ_UNSET_UNIQUE(val);
+            obj_t *new_m_obj = obj_pool_omap_set(vm->pool, m_obj, key, val);
+            if(!new_m_obj)return 1;
+
+            frame->stack_tos -= 2;
+            obj_init_box(OBJ_FRAME_TOS(frame), new_m_obj);
+        }else if(inst == vm->sym_omap_del){
+            OBJ_STACKCHECK(2)
+
+            obj_t *key = OBJ_FRAME_TOS(frame);
+            obj_t *m_obj = OBJ_RESOLVE(OBJ_FRAME_NOS(frame));
+            OBJ_TYPECHECK_MAP_KEY(key)
+            OBJ_TYPECHECK(m_obj, OBJ_TYPE_OMAP)
+            obj_t *new_m_obj = obj_pool_omap_del(vm->pool, m_obj, key, NULL);
+            if(!new_m_obj)return 1;
+            if(new_m_obj == m_obj){
+                fprintf(stderr, "%s: Couldn't find omap key:\n", __func__);
+                obj_dump(key, stderr, 2);
+                return 1;
+            }
+
+            frame->stack_tos--;
+            obj_init_box(OBJ_FRAME_TOS(frame), new_m_obj);
+        }else if(
+            inst == vm->sym_omap_iget_key ||
+            inst == vm->sym_omap_iget_val
+        ){
+            OBJ_STACKCHECK(2)
+
+            obj_t *i_obj = OBJ_FRAME_TOS(frame);
+            obj_t *m_obj = OBJ_RESOLVE(OBJ_FRAME_NOS(frame));
+            OBJ_TYPECHECK(i_obj, OBJ_TYPE_INT)
+            OBJ_TYPECHECK(m_obj, OBJ_TYPE_OMAP)
+            obj_t *entry = OBJ_OMAP_IGET(m_obj, OBJ_INT(i_obj));
+            if(!entry){
+                fprintf(stderr,
+                    "%s: Omap index %i out of range for len: %i\n",
+                    __func__, OBJ_INT(i_obj), OBJ_OMAP_LEN(m_obj));
+                return 1;
             }
+
+            frame->stack_tos--;
+            *OBJ_FRAME_TOS(frame) =
+                entry[inst == vm->sym_omap_iget_val];
+        }else if(
+            inst == vm->sym_omap_rank ||
+            inst == vm->sym_omap_floor ||
+            inst == vm->sym_omap_ceil
+        ){
+            /* Rank is the number of keys less than the given one;
+            floor and ceil are the greatest key not greater than it, and
+            the least key not less than it (or null) */
+            OBJ_STACKCHECK(2)
+
+            obj_t *key = OBJ_FRAME_TOS(frame);
+            obj_t *m_obj = OBJ_RESOLVE(OBJ_FRAME_NOS(frame));
+            OBJ_TYPECHECK(m_obj, OBJ_TYPE_OMAP)
+            OBJ_TYPECHECK_OMAP_KEY(m_obj, key)
+            bool eq;
+            int i = obj_omap_rank(m_obj, key, &eq);
+
+            frame->stack_tos--;
+            if(inst == vm->sym_omap_rank){
+                obj_init_int(OBJ_FRAME_TOS(frame), i);
+            }else{
+                if(inst == vm->sym_omap_floor && !eq)i--;
+                obj_t *entry = OBJ_OMAP_IGET(m_obj, i);
+                if(entry)*OBJ_FRAME_TOS(frame) = *entry;
+                else obj_init_null(OBJ_FRAME_TOS(frame));
+            }
+        }else if(inst == vm->sym_omap_slice){
+            /* Entries whose keys are from lo up to (but not including)
+            hi */
+            OBJ_STACKCHECK(3)
+
+            obj_t *hi = OBJ_FRAME_TOS(frame);
+            obj_t *lo = OBJ_FRAME_NOS(frame);
+            obj_t *m_obj = OBJ_RESOLVE(OBJ_FRAME_3OS(frame));
+            OBJ_TYPECHECK(m_obj, OBJ_TYPE_OMAP)
+            OBJ_TYPECHECK_OMAP_KEY(m_obj, lo)
+            OBJ_TYPECHECK_OMAP_KEY(m_obj, hi)
+            bool eq;
+            int i = obj_omap_rank(m_obj, lo, &eq);
+            int j = obj_omap_rank(m_obj, hi, &eq);
+            obj_t *new_m_obj = obj_pool_omap_slice(vm->pool, m_obj, i, j);
+            if(!new_m_obj)return 1;
+
+            frame->stack_tos -= 2;
+            obj_init_box(OBJ_FRAME_TOS(frame), new_m_obj);
+        }else if(
+            inst == vm->sym_omap_keys ||
+            inst == vm->sym_omap_vals
+        ){
+            OBJ_STACKCHECK(1)
+            obj_t *m_obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK(m_obj, OBJ_TYPE_OMAP)
+            obj_t *lst = obj_pool_add_list_from_omap(vm->pool, m_obj,
+                inst == vm->sym_omap_vals);
+            if(!lst)return 1;
+            obj_init_box(OBJ_FRAME_TOS(frame), lst);
+        }else if(inst == vm->sym_pqueue){
+            obj_t *obj = obj_pool_add_pqueue(vm->pool);
+            if(!obj)return 1;
+            obj_t box;
+            obj_init_box(&box, obj);
+            OBJ_SET_UNIQUE(&box);
+            if(!obj_frame_push(frame, &box))return 1;
+        }else if(inst == vm->sym_pqueue_len){
+            OBJ_STACKCHECK(1)
+            obj_t *q_obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK(q_obj, OBJ_TYPE_PQUEUE)
+            obj_init_int(OBJ_FRAME_TOS(frame), OBJ_PQUEUE_LEN(q_obj));
+        }else if(inst == vm->sym_pqueue_push){
+            OBJ_STACKCHECK(3)
+
+            obj_t *prio = OBJ_FRAME_TOS(frame);
+            obj_t *val = OBJ_FRAME_NOS(frame);
+            OBJ_TYPECHECK(prio, OBJ_TYPE_INT)
+            OBJ_TYPECHECK(OBJ_RESOLVE(OBJ_FRAME_3OS(frame)),
+                OBJ_TYPE_PQUEUE)
+            obj_t *q_obj = obj_vm_own(vm, OBJ_FRAME_3OS(frame));
+            if(!q_obj)return 1;
+            if(obj_pqueue_push(vm->pool, q_obj, OBJ_INT(prio), val))return 1;
+
+            frame->stack_tos -= 2;
+        }else if(inst == vm->sym_pqueue_push_by){
+            /* The fun (val -- prio) is called once, when val is pushed,
+            so the heap itself never calls back into the vm.
+            NOTE: obj_vm_call_fun may realloc frame's stack, so we
+            don't hold on to pointers into it across the call */
+            OBJ_STACKCHECK(3)
+
+            obj_t *fun = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK(fun, OBJ_TYPE_FUN)
+            OBJ_TYPECHECK(OBJ_RESOLVE(OBJ_FRAME_3OS(frame)),
+                OBJ_TYPE_PQUEUE)
+            obj_t val = *OBJ_FRAME_NOS(frame);
+            frame->stack_tos -= 2;
+            obj_t *args[] = {&val};
+            obj_t prio;
+            if(obj_vm_call_fun(vm, fun, args, 1, &prio))return 1;
+            OBJ_TYPECHECK(&prio, OBJ_TYPE_INT)
+            obj_t *q_obj = obj_vm_own(vm, OBJ_FRAME_TOS(frame));
+            if(!q_obj)return 1;
+            if(obj_pqueue_push(vm->pool, q_obj, OBJ_INT(&prio), &val)){
+                return 1;
+            }
+        }else if(inst == vm->sym_pqueue_pop){
+            OBJ_STACKCHECK(1)
+            obj_t *q_obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK(q_obj, OBJ_TYPE_PQUEUE)
+            if(!OBJ_PQUEUE_LEN(q_obj)){
+                fprintf(stderr, "%s: Can't pop from empty pqueue\n",
+                    __func__);
+                return 1;
+            }
+            q_obj = obj_vm_own(vm, OBJ_FRAME_TOS(frame));
+            if(!q_obj)return 1;
+            obj_t val;
+            obj_pqueue_pop(q_obj, NULL, &val);
+            if(!obj_frame_push(frame, &val))return 1;
+        }else if(
+            inst == vm->sym_pqueue_peek ||
+            inst == vm->sym_pqueue_peek_prio
+        ){
+            OBJ_STACKCHECK(1)
+            obj_t *q_obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK(q_obj, OBJ_TYPE_PQUEUE)
+            obj_t *top = obj_pqueue_peek(q_obj);
+            if(!top){
+                fprintf(stderr, "%s: Can't peek at empty pqueue\n",
+                    __func__);
+                return 1;
+            }
+            if(inst == vm->sym_pqueue_peek){
+                OBJ_UNSET_UNIQUE(&top[1]);
+                *OBJ_FRAME_TOS(frame) = top[1];
+            }else{
+                *OBJ_FRAME_TOS(frame) = top[0];
+            }
+        }else if(
+            inst == vm->sym_list_topqueue ||
+            inst == vm->sym_list_topqueue_by
+        ){
+            /* Heapifies the whole list at once, in O(n).
+            Without a fun, the list's elements are ints, which are their
+            own priorities. */
+            bool by = inst == vm->sym_list_topqueue_by;
+            OBJ_STACKCHECK(by? 2: 1)
+            obj_t *fun = NULL;
+            if(by){
+                fun = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+                OBJ_TYPECHECK(fun, OBJ_TYPE_FUN)
+                frame->stack_tos--;
+            }
+            obj_t *lst = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK_LIST(lst)
+            int len = OBJ_LIST_LEN(lst);
+            obj_t *entries = malloc(len * 2 * sizeof(*entries) + 1);
+            if(!entries){
+                perror("malloc");
+                return 1;
+            }
+            for(int i = 0; i < len; i++, lst = OBJ_TAIL(lst)){
+                obj_t *elem = OBJ_HEAD(lst);
+                OBJ_UNSET_UNIQUE(elem);
+                entries[i * 2 + 1] = *elem;
+                if(!by){
+                    entries[i * 2] = *elem;
+                }else if(obj_vm_call_fun(vm, fun, &elem, 1,
+                    &entries[i * 2])
+                ){
+                    free(entries);
+                    return 1;
+                }
+                if(OBJ_TYPE(&entries[i * 2]) != OBJ_TYPE_INT){
+                    fprintf(stderr, "%s: Expected int priority, got: %s\n",
+                        __func__, obj_type_msg(OBJ_TYPE(&entries[i * 2])));
+                    free(entries);
+                    return 1;
+                }
+            }
+            obj_t *q_obj = obj_pool_add_pqueue_from_entries(vm->pool,
+                entries, len);
+            free(entries);
+            if(!q_obj)return 1;
+            obj_init_box(OBJ_FRAME_TOS(frame), q_obj);
+            OBJ_SET_UNIQUE(OBJ_FRAME_TOS(frame));
         }else if(inst == vm->sym_arr){
             OBJ_STACKCHECK(2)
             obj_t *len_obj = OBJ_FRAME_TOS(frame);
@@ -686,17 +1147,20 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
             }
             obj_t *obj = obj_pool_add_array(vm->pool, len);
             if(!obj)return 1;
+            OBJ_UNSET_UNIQUE(val);
             for(size_t i = 0; i < len; i++){
                 *OBJ_ARRAY_IGET(obj, i) = *val;
             }
 
             frame->stack_tos--;
             obj_init_box(OBJ_FRAME_TOS(frame), obj);
+            OBJ_SET_UNIQUE(OBJ_FRAME_TOS(frame));
         }else if(inst == vm->sym_str_len){
             OBJ_STACKCHECK(1)
             obj_t *obj = OBJ_FRAME_TOS(frame);
             OBJ_TYPECHECK(obj, OBJ_TYPE_STR)
-            obj_string_t *s = OBJ_STRING(obj);
+            obj_string_t view;
+            obj_string_t *s = obj_str_get(obj, &view);
             if((int)s->len < 0){
                 /* TODO: Is this safe enough?.. shouldn't we do this
                 somewhere else so we never end up with a string this
@@ -713,7 +1177,8 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
             OBJ_TYPECHECK(i_obj, OBJ_TYPE_INT)
             OBJ_TYPECHECK(obj, OBJ_TYPE_STR)
             int i = OBJ_INT(i_obj);
-            obj_string_t *s = OBJ_STRING(obj);
+            obj_string_t view;
+            obj_string_t *s = obj_str_get(obj, &view);
 
             if(i < 0 || i >= s->len){
                 fprintf(stderr,
@@ -734,7 +1199,8 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
             OBJ_TYPECHECK(obj, OBJ_TYPE_STR)
             int i = OBJ_INT(i_obj);
             int byte = OBJ_INT(byte_obj);
-            obj_string_t *s = OBJ_STRING(obj);
+            obj_string_t view;
+            obj_string_t *s = obj_str_get(obj, &view);
 
             if(byte < 0 || byte >= 256){
                 fprintf(stderr,
@@ -748,7 +1214,9 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
                 return 1;
             }
 
-            s->data[i] = byte;
+            obj = obj_vm_own(vm, obj);
+            if(!obj)return 1;
+            obj_str_get(obj, &view)->data[i] = byte;
             frame->stack_tos -= 2;
         }else if(inst == vm->sym_str_eq){
             OBJ_STACKCHECK(2)
@@ -756,8 +1224,9 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
             obj_t *s2_obj = OBJ_FRAME_TOS(frame);
             OBJ_TYPECHECK(s1_obj, OBJ_TYPE_STR)
             OBJ_TYPECHECK(s2_obj, OBJ_TYPE_STR)
-            obj_string_t *s1 = OBJ_STRING(s1_obj);
-            obj_string_t *s2 = OBJ_STRING(s2_obj);
+            obj_string_t view1, view2;
+            obj_string_t *s1 = obj_str_get(s1_obj, &view1);
+            obj_string_t *s2 = obj_str_get(s2_obj, &view2);
             frame->stack_tos--;
             obj_init_bool(OBJ_FRAME_TOS(frame), obj_string_eq(s1, s2));
         }else if(inst == vm->sym_str_join){
@@ -766,17 +1235,165 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
             obj_t *s2_obj = OBJ_FRAME_TOS(frame);
             OBJ_TYPECHECK(s1_obj, OBJ_TYPE_STR)
             OBJ_TYPECHECK(s2_obj, OBJ_TYPE_STR)
-            obj_string_t *s1 = OBJ_STRING(s1_obj);
-            obj_string_t *s2 = OBJ_STRING(s2_obj);
+            obj_string_t view1, view2;
+            obj_string_t *s1 = obj_str_get(s1_obj, &view1);
+            obj_string_t *s2 = obj_str_get(s2_obj, &view2);
+            size_t len = s1->len + s2->len;
+
+            if(len <= OBJ_STR_INLINE_MAX){
+                char data[OBJ_STR_INLINE_MAX];
+                memcpy(data, s1->data, s1->len);
+                memcpy(data + s1->len, s2->data, s2->len);
+                obj_init_str_inline(s1_obj, data, len);
+            }else{
+                obj_string_t *s3 = obj_pool_string_alloc(vm->pool, len);
+                if(!s3)return 1;
+                memcpy(s3->data, s1->data, s1->len);
+                memcpy(s3->data + s1->len, s2->data, s2->len);
+                obj_init_str(s1_obj, s3);
+            }
 
-            obj_string_t *s3 = obj_pool_string_alloc(vm->pool,
-                s1->len + s2->len);
-            if(!s3)return 1;
-            memcpy(s3->data, s1->data, s1->len);
-            memcpy(s3->data + s1->len, s2->data, s2->len);
+            frame->stack_tos--;
+            OBJ_SET_UNIQUE(OBJ_FRAME_TOS(frame));
+        }else if(inst == vm->sym_str_slice){
+            OBJ_STACKCHECK(3)
+            obj_t *i_obj = OBJ_FRAME_NOS(frame);
+            obj_t *j_obj = OBJ_FRAME_TOS(frame);
+            obj_t *obj = OBJ_FRAME_3OS(frame);
+            OBJ_TYPECHECK(i_obj, OBJ_TYPE_INT)
+            OBJ_TYPECHECK(j_obj, OBJ_TYPE_INT)
+            OBJ_TYPECHECK(obj, OBJ_TYPE_STR)
+            int i = OBJ_INT(i_obj);
+            int j = OBJ_INT(j_obj);
+            obj_string_t view;
+            obj_string_t *s = obj_str_get(obj, &view);
+            if(i < 0 || j < i || j > s->len){
+                fprintf(stderr,
+                    "%s: Slice %i..%i out of range for len: %zu\n",
+                    __func__, i, j, s->len);
+                return 1;
+            }
 
+            /* The slice shares the str's data (unless it's short enough
+            to be copied inline), so neither may change it in place */
+            bool is_unique = OBJ_UNIQUE(obj);
+            if(!obj_init_str_slice(vm->pool, obj, obj, i, j - i))return 1;
+            if(is_unique && OBJ_STR_IS_INLINE(obj))OBJ_SET_UNIQUE(obj);
+            frame->stack_tos -= 2;
+        }else if(
+            inst == vm->sym_str_find ||
+            inst == vm->sym_str_startswith
+        ){
+            OBJ_STACKCHECK(2)
+            obj_t *s1_obj = OBJ_FRAME_NOS(frame);
+            obj_t *s2_obj = OBJ_FRAME_TOS(frame);
+            OBJ_TYPECHECK(s1_obj, OBJ_TYPE_STR)
+            OBJ_TYPECHECK(s2_obj, OBJ_TYPE_STR)
+            obj_string_t view1, view2;
+            obj_string_t *s1 = obj_str_get(s1_obj, &view1);
+            obj_string_t *s2 = obj_str_get(s2_obj, &view2);
             frame->stack_tos--;
-            obj_init_str(OBJ_FRAME_TOS(frame), s3);
+            if(inst == vm->sym_str_find){
+                obj_init_int(OBJ_FRAME_TOS(frame), obj_string_find(s1, s2));
+            }else{
+                obj_init_bool(OBJ_FRAME_TOS(frame),
+                    obj_string_startswith(s1, s2));
+            }
+        }else if(
+            inst == vm->sym_str_find_byte ||
+            inst == vm->sym_str_split
+        ){
+            OBJ_STACKCHECK(2)
+            obj_t *byte_obj = OBJ_FRAME_TOS(frame);
+            obj_t *obj = OBJ_FRAME_NOS(frame);
+            OBJ_TYPECHECK(byte_obj, OBJ_TYPE_INT)
+            OBJ_TYPECHECK(obj, OBJ_TYPE_STR)
+            int byte = OBJ_INT(byte_obj);
+            if(byte < 0 || byte >= 256){
+                fprintf(stderr,
+                    "%s: Not a byte: %i\n", __func__, byte);
+                return 1;
+            }
+            if(inst == vm->sym_str_find_byte){
+                obj_string_t view;
+                int i = obj_string_find_byte(obj_str_get(obj, &view), byte);
+                frame->stack_tos--;
+                obj_init_int(OBJ_FRAME_TOS(frame), i);
+            }else{
+                obj_t *lst = obj_pool_add_str_split(vm->pool, obj, byte);
+                if(!lst)return 1;
+                frame->stack_tos--;
+                obj_init_box(OBJ_FRAME_TOS(frame), lst);
+            }
+        }else if(inst == vm->sym_str_toint){
+            /* Pushes null if the str isn't an int */
+            OBJ_STACKCHECK(1)
+            obj_t *obj = OBJ_FRAME_TOS(frame);
+            OBJ_TYPECHECK(obj, OBJ_TYPE_STR)
+            obj_string_t view;
+            int i;
+            if(obj_string_toint(obj_str_get(obj, &view), &i)){
+                obj_init_int(obj, i);
+            }else{
+                obj_init_null(obj);
+            }
+        }else if(inst == vm->sym_strbuf){
+            obj_string_t *s = obj_pool_strbuf_string_add_raw(vm->pool,
+                "", 0);
+            if(!s)return 1;
+            obj_t obj;
+            obj_init_strbuf(&obj, s);
+            OBJ_SET_UNIQUE(&obj);
+            if(!obj_frame_push(frame, &obj))return 1;
+        }else if(inst == vm->sym_strbuf_len){
+            OBJ_STACKCHECK(1)
+            obj_t *obj = OBJ_FRAME_TOS(frame);
+            OBJ_TYPECHECK(obj, OBJ_TYPE_STRBUF)
+            obj_string_t *s = OBJ_STRING(obj);
+            if((int)s->len < 0){
+                fprintf(stderr, "%s: String length overflow! %zu -> %i\n",
+                    __func__, s->len, (int)s->len);
+                return 1;
+            }
+            obj_init_int(OBJ_FRAME_TOS(frame), (int)s->len);
+        }else if(
+            inst == vm->sym_strbuf_add ||
+            inst == vm->sym_strbuf_addbyte
+        ){
+            OBJ_STACKCHECK(2)
+            obj_t *x = OBJ_FRAME_TOS(frame);
+            obj_t *obj = OBJ_FRAME_NOS(frame);
+            OBJ_TYPECHECK(obj, OBJ_TYPE_STRBUF)
+            if(inst == vm->sym_strbuf_addbyte){
+                OBJ_TYPECHECK(x, OBJ_TYPE_INT)
+                if(OBJ_INT(x) < 0 || OBJ_INT(x) >= 256){
+                    fprintf(stderr,
+                        "%s: Not a byte: %i\n", __func__, OBJ_INT(x));
+                    return 1;
+                }
+            }
+            obj = obj_vm_own(vm, obj);
+            if(!obj)return 1;
+            if(inst == vm->sym_strbuf_addbyte){
+                char c = OBJ_INT(x);
+                if(obj_strbuf_add_raw(obj, &c, 1))return 1;
+            }else{
+                if(obj_strbuf_add(obj, x))return 1;
+            }
+            frame->stack_tos--;
+        }else if(inst == vm->sym_strbuf_tostr){
+            /* If nothing else refers to the strbuf's string, it
+            becomes the str, without being copied */
+            OBJ_STACKCHECK(1)
+            obj_t *obj = OBJ_FRAME_TOS(frame);
+            OBJ_TYPECHECK(obj, OBJ_TYPE_STRBUF)
+            obj_string_t *s = OBJ_STRING(obj);
+            if(!OBJ_UNIQUE(obj)){
+                s = obj_pool_string_add_raw(vm->pool, s->data, s->len);
+                if(!s)return 1;
+            }
+            obj_init_str(obj, s);
+            OBJ_SET_UNIQUE(obj);
         }else if(inst == vm->sym_arr_len){
             OBJ_STACKCHECK(1)
             obj_t *a_obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
@@ -801,6 +1418,7 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
             obj_t *val = OBJ_ARRAY_IGET(a_obj, i);
 
             frame->stack_tos--;
+            OBJ_UNSET_UNIQUE(val);
             *OBJ_FRAME_TOS(frame) = *val;
         }else if(inst == vm->sym_arr_iset){
             OBJ_STACKCHECK(3)
@@ -819,9 +1437,409 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
                     __func__, i, len);
                 return 1;
             }
+            a_obj = obj_vm_own(vm, OBJ_FRAME_3OS(frame));
+            if(!a_obj)return 1;
             *OBJ_ARRAY_IGET(a_obj, i) = *val;
 
             frame->stack_tos -= 2;
+        }else if(inst == vm->sym_vec){
+            obj_t *obj = obj_pool_add_vec(vm->pool, 0);
+            if(!obj)return 1;
+            obj_t box;
+            obj_init_box(&box, obj);
+            if(!obj_frame_push(frame, &box))return 1;
+        }else if(inst == vm->sym_vec_len){
+            OBJ_STACKCHECK(1)
+            obj_t *v_obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK(v_obj, OBJ_TYPE_VEC)
+            obj_init_int(OBJ_FRAME_TOS(frame), OBJ_VEC_LEN(v_obj));
+        }else if(inst == vm->sym_vec_iget){
+            OBJ_STACKCHECK(2)
+            obj_t *i_obj = OBJ_FRAME_TOS(frame);
+            obj_t *v_obj = OBJ_RESOLVE(OBJ_FRAME_NOS(frame));
+            OBJ_TYPECHECK(i_obj, OBJ_TYPE_INT)
+            OBJ_TYPECHECK(v_obj, OBJ_TYPE_VEC)
+            obj_t *val = OBJ_VEC_IGET(v_obj, OBJ_INT(i_obj));
+            if(!val){
+                fprintf(stderr,
+                    "%s: Vec index %i out of range for len: %i\n",
+                    __func__, OBJ_INT(i_obj), OBJ_VEC_LEN(v_obj));
+                return 1;
+            }
+
+            frame->stack_tos--;
+            OBJ_UNSET_UNIQUE(val);
+            *OBJ_FRAME_TOS(frame) = *val;
+        }else if(inst == vm->sym_vec_iset){
+            /* Vecs are persistent, so rather than being changed in
+            place, the vec is replaced by a new one */
+            OBJ_STACKCHECK(3)
+            obj_t *i_obj = OBJ_FRAME_TOS(frame);
+            obj_t *val = OBJ_FRAME_NOS(frame);
+            obj_t *v_obj = OBJ_RESOLVE(OBJ_FRAME_3OS(frame));
+            OBJ_TYPECHECK(i_obj, OBJ_TYPE_INT)
+            OBJ_TYPECHECK(v_obj, OBJ_TYPE_VEC)
+            OBJ_UNSET_UNIQUE(val);
+            obj_t *new_v_obj = obj_pool_vec_iset(vm->pool,
+                v_obj, OBJ_INT(i_obj), val);
+            if(!new_v_obj)return 1;
+
+            frame->stack_tos -= 2;
+            obj_init_box(OBJ_FRAME_TOS(frame), new_v_obj);
+        }else if(inst == vm->sym_vec_push){
+            OBJ_STACKCHECK(2)
+            obj_t *val = OBJ_FRAME_TOS(frame);
+            obj_t *v_obj = OBJ_RESOLVE(OBJ_FRAME_NOS(frame));
+            OBJ_TYPECHECK(v_obj, OBJ_TYPE_VEC)
+            OBJ_UNSET_UNIQUE(val);
+            obj_t *new_v_obj = obj_pool_vec_push(vm->pool, v_obj, val);
+            if(!new_v_obj)return 1;
+
+            frame->stack_tos--;
+            obj_init_box(OBJ_FRAME_TOS(frame), new_v_obj);
+        }else if(
+            inst == vm->sym_vec_tolist ||
+            inst == vm->sym_vec_toarr
+        ){
+            OBJ_STACKCHECK(1)
+            obj_t *v_obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK(v_obj, OBJ_TYPE_VEC)
+            bool to_arr = inst == vm->sym_vec_toarr;
+            obj_t *obj = to_arr?
+                obj_pool_add_array_from_vec(vm->pool, v_obj):
+                obj_pool_add_list_from_vec(vm->pool, v_obj);
+            if(!obj)return 1;
+            obj_init_box(OBJ_FRAME_TOS(frame), obj);
+            if(to_arr)OBJ_SET_UNIQUE(OBJ_FRAME_TOS(frame));
+        }else if(inst == vm->sym_list_tovec){
+            OBJ_STACKCHECK(1)
+            obj_t *obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK_LIST(obj)
+            obj_t *v_obj = obj_pool_add_vec_from_list(vm->pool, obj);
+            if(!v_obj)return 1;
+            obj_init_box(OBJ_FRAME_TOS(frame), v_obj);
+        }else if(inst == vm->sym_arr_tovec){
+            OBJ_STACKCHECK(1)
+            obj_t *obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK(obj, OBJ_TYPE_ARRAY)
+            obj_t *v_obj = obj_pool_add_vec_from_array(vm->pool, obj);
+            if(!v_obj)return 1;
+            obj_init_box(OBJ_FRAME_TOS(frame), v_obj);
+        }else if(
+            inst == vm->sym_i32arr ||
+            inst == vm->sym_u8arr
+        ){
+            OBJ_STACKCHECK(2)
+            obj_t *len_obj = OBJ_FRAME_TOS(frame);
+            obj_t *x_obj = OBJ_FRAME_NOS(frame);
+            OBJ_TYPECHECK(len_obj, OBJ_TYPE_INT)
+            OBJ_TYPECHECK(x_obj, OBJ_TYPE_INT)
+            int kind = inst == vm->sym_u8arr? OBJ_INTARR_U8: OBJ_INTARR_I32;
+            int len = OBJ_INT(len_obj);
+            int x = OBJ_INT(x_obj);
+            if(len < 0){
+                fprintf(stderr, "%s: Negative %sarr length: %i\n",
+                    __func__, obj_intarr_kind_msg(kind), len);
+                return 1;
+            }
+            if(!obj_intarr_fits(kind, x)){
+                fprintf(stderr, "%s: Value %i doesn't fit in %sarr\n",
+                    __func__, x, obj_intarr_kind_msg(kind));
+                return 1;
+            }
+            obj_t *obj = obj_pool_add_intarr(vm->pool, kind, len);
+            if(!obj)return 1;
+            if(x)obj_intarr_fill(obj, x);
+
+            frame->stack_tos--;
+            obj_init_box(OBJ_FRAME_TOS(frame), obj);
+            OBJ_SET_UNIQUE(OBJ_FRAME_TOS(frame));
+        }else if(inst == vm->sym_iarr_len){
+            OBJ_STACKCHECK(1)
+            obj_t *a_obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK(a_obj, OBJ_TYPE_INTARR)
+            obj_init_int(OBJ_FRAME_TOS(frame), OBJ_INTARR_LEN(a_obj));
+        }else if(inst == vm->sym_iarr_iget){
+            OBJ_STACKCHECK(2)
+            obj_t *i_obj = OBJ_FRAME_TOS(frame);
+            obj_t *a_obj = OBJ_RESOLVE(OBJ_FRAME_NOS(frame));
+            OBJ_TYPECHECK(i_obj, OBJ_TYPE_INT)
+            OBJ_TYPECHECK(a_obj, OBJ_TYPE_INTARR)
+            int i = OBJ_INT(i_obj);
+            int len = OBJ_INTARR_LEN(a_obj);
+            if(i < 0 || i >= len){
+                fprintf(stderr,
+                    "%s: Intarr index %i out of range for len: %i\n",
+                    __func__, i, len);
+                return 1;
+            }
+
+            frame->stack_tos--;
+            obj_init_int(OBJ_FRAME_TOS(frame), obj_intarr_get(a_obj, i));
+        }else if(inst == vm->sym_iarr_iset){
+            OBJ_STACKCHECK(3)
+            obj_t *i_obj = OBJ_FRAME_TOS(frame);
+            obj_t *x_obj = OBJ_FRAME_NOS(frame);
+            obj_t *a_obj = OBJ_RESOLVE(OBJ_FRAME_3OS(frame));
+            OBJ_TYPECHECK(i_obj, OBJ_TYPE_INT)
+            OBJ_TYPECHECK(x_obj, OBJ_TYPE_INT)
+            OBJ_TYPECHECK(a_obj, OBJ_TYPE_INTARR)
+            int i = OBJ_INT(i_obj);
+            int x = OBJ_INT(x_obj);
+            int kind = OBJ_INTARR_KIND(a_obj);
+            int len = OBJ_INTARR_LEN(a_obj);
+            if(i < 0 || i >= len){
+                fprintf(stderr,
+                    "%s: Intarr index %i out of range for len: %i\n",
+                    __func__, i, len);
+                return 1;
+            }
+            if(!obj_intarr_fits(kind, x)){
+                fprintf(stderr, "%s: Value %i doesn't fit in %sarr\n",
+                    __func__, x, obj_intarr_kind_msg(kind));
+                return 1;
+            }
+            a_obj = obj_vm_own(vm, OBJ_FRAME_3OS(frame));
+            if(!a_obj)return 1;
+            obj_intarr_set(a_obj, i, x);
+
+            frame->stack_tos -= 2;
+        }else if(
+            inst == vm->sym_iarr_add ||
+            inst == vm->sym_iarr_sub ||
+            inst == vm->sym_iarr_mul ||
+            inst == vm->sym_iarr_eq ||
+            inst == vm->sym_iarr_lt
+        ){
+            OBJ_STACKCHECK(2)
+            obj_t *b_obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK(b_obj, OBJ_TYPE_INTARR)
+            OBJ_TYPECHECK(OBJ_RESOLVE(OBJ_FRAME_NOS(frame)), OBJ_TYPE_INTARR)
+            int op =
+                inst == vm->sym_iarr_add? OBJ_INTARR_ADD:
+                inst == vm->sym_iarr_sub? OBJ_INTARR_SUB:
+                inst == vm->sym_iarr_mul? OBJ_INTARR_MUL:
+                inst == vm->sym_iarr_eq? OBJ_INTARR_EQ: OBJ_INTARR_LT;
+            obj_t *a_obj = obj_vm_own(vm, OBJ_FRAME_NOS(frame));
+            if(!a_obj)return 1;
+            if(obj_intarr_binop(a_obj, b_obj, op))return 1;
+            frame->stack_tos--;
+        }else if(inst == vm->sym_iarr_fill){
+            OBJ_STACKCHECK(2)
+            obj_t *x_obj = OBJ_FRAME_TOS(frame);
+            obj_t *a_obj = OBJ_RESOLVE(OBJ_FRAME_NOS(frame));
+            OBJ_TYPECHECK(x_obj, OBJ_TYPE_INT)
+            OBJ_TYPECHECK(a_obj, OBJ_TYPE_INTARR)
+            int kind = OBJ_INTARR_KIND(a_obj);
+            int x = OBJ_INT(x_obj);
+            if(!obj_intarr_fits(kind, x)){
+                fprintf(stderr, "%s: Value %i doesn't fit in %sarr\n",
+                    __func__, x, obj_intarr_kind_msg(kind));
+                return 1;
+            }
+            a_obj = obj_vm_own(vm, OBJ_FRAME_NOS(frame));
+            if(!a_obj)return 1;
+            obj_intarr_fill(a_obj, x);
+            frame->stack_tos--;
+        }else if(
+            inst == vm->sym_iarr_sum ||
+            inst == vm->sym_iarr_min ||
+            inst == vm->sym_iarr_max
+        ){
+            OBJ_STACKCHECK(1)
+            obj_t *a_obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK(a_obj, OBJ_TYPE_INTARR)
+            int op =
+                inst == vm->sym_iarr_sum? OBJ_INTARR_SUM:
+                inst == vm->sym_iarr_min? OBJ_INTARR_MIN: OBJ_INTARR_MAX;
+            int result;
+            if(obj_intarr_reduce(a_obj, op, &result))return 1;
+            obj_init_int(OBJ_FRAME_TOS(frame), result);
+        }else if(inst == vm->sym_iarr_toarr){
+            OBJ_STACKCHECK(1)
+            obj_t *a_obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK(a_obj, OBJ_TYPE_INTARR)
+            obj_t *obj = obj_pool_add_array_from_intarr(vm->pool, a_obj);
+            if(!obj)return 1;
+            obj_init_box(OBJ_FRAME_TOS(frame), obj);
+            OBJ_SET_UNIQUE(OBJ_FRAME_TOS(frame));
+        }else if(
+            inst == vm->sym_arr_toi32arr ||
+            inst == vm->sym_arr_tou8arr
+        ){
+            OBJ_STACKCHECK(1)
+            obj_t *a_obj = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK(a_obj, OBJ_TYPE_ARRAY)
+            int kind = inst == vm->sym_arr_tou8arr?
+                OBJ_INTARR_U8: OBJ_INTARR_I32;
+            obj_t *obj = obj_pool_add_intarr_from_array(vm->pool,
+                kind, a_obj);
+            if(!obj)return 1;
+            obj_init_box(OBJ_FRAME_TOS(frame), obj);
+            OBJ_SET_UNIQUE(OBJ_FRAME_TOS(frame));
+        }else if(inst == vm->sym_arr_sort){
+            OBJ_STACKCHECK(1)
+            OBJ_TYPECHECK(OBJ_RESOLVE(OBJ_FRAME_TOS(frame)), OBJ_TYPE_ARRAY)
+            obj_t *a_obj = obj_vm_own(vm, OBJ_FRAME_TOS(frame));
+            if(!a_obj)return 1;
+            if(obj_array_sort(a_obj, false, obj_lt, NULL))return 1;
+        }else if(inst == vm->sym_arr_sort_by){
+            /* Stable, since with a fun it's the number of calls which
+            matters, and merge sort makes fewest */
+            OBJ_STACKCHECK(2)
+            obj_t *fun = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK(fun, OBJ_TYPE_FUN)
+            OBJ_TYPECHECK(OBJ_RESOLVE(OBJ_FRAME_NOS(frame)), OBJ_TYPE_ARRAY)
+            obj_t *a_obj = obj_vm_own(vm, OBJ_FRAME_NOS(frame));
+            if(!a_obj)return 1;
+            frame->stack_tos--;
+            obj_vm_fun_lt_data_t data = {vm, fun};
+            if(obj_array_sort(a_obj, true, obj_vm_fun_lt, &data))return 1;
+        }else if(inst == vm->sym_arr_bsearch){
+            OBJ_STACKCHECK(2)
+            obj_t *a_obj = OBJ_RESOLVE(OBJ_FRAME_NOS(frame));
+            OBJ_TYPECHECK(a_obj, OBJ_TYPE_ARRAY)
+            int i;
+            if(obj_array_bsearch(a_obj, OBJ_FRAME_TOS(frame), &i))return 1;
+            frame->stack_tos--;
+            obj_init_int(OBJ_FRAME_TOS(frame), i);
+        }else if(inst == vm->sym_arr_reverse){
+            OBJ_STACKCHECK(1)
+            OBJ_TYPECHECK(OBJ_RESOLVE(OBJ_FRAME_TOS(frame)), OBJ_TYPE_ARRAY)
+            obj_t *a_obj = obj_vm_own(vm, OBJ_FRAME_TOS(frame));
+            if(!a_obj)return 1;
+            obj_array_reverse(a_obj);
+        }else if(inst == vm->sym_arr_slice){
+            OBJ_STACKCHECK(3)
+            obj_t *i_obj = OBJ_FRAME_NOS(frame);
+            obj_t *j_obj = OBJ_FRAME_TOS(frame);
+            obj_t *a_obj = OBJ_RESOLVE(OBJ_FRAME_3OS(frame));
+            OBJ_TYPECHECK(i_obj, OBJ_TYPE_INT)
+            OBJ_TYPECHECK(j_obj, OBJ_TYPE_INT)
+            OBJ_TYPECHECK(a_obj, OBJ_TYPE_ARRAY)
+            int i = OBJ_INT(i_obj);
+            int j = OBJ_INT(j_obj);
+            int len = OBJ_ARRAY_LEN(a_obj);
+            if(i < 0 || j < i || j > len){
+                fprintf(stderr,
+                    "%s: Slice %i..%i out of range for len: %i\n",
+                    __func__, i, j, len);
+                return 1;
+            }
+            obj_t *slice = obj_pool_add_array(vm->pool, j - i);
+            if(!slice)return 1;
+            for(int k = i; k < j; k++){
+                /* The values are now shared */
+                OBJ_UNSET_UNIQUE(OBJ_ARRAY_IGET(a_obj, k));
+                *OBJ_ARRAY_IGET(slice, k - i) = *OBJ_ARRAY_IGET(a_obj, k);
+            }
+            frame->stack_tos -= 2;
+            obj_init_box(OBJ_FRAME_TOS(frame), slice);
+            OBJ_SET_UNIQUE(OBJ_FRAME_TOS(frame));
+        }else if(
+            inst == vm->sym_list_sort ||
+            inst == vm->sym_list_sort_by
+        ){
+            bool by = inst == vm->sym_list_sort_by;
+            OBJ_STACKCHECK(by? 2: 1)
+            obj_vm_fun_lt_data_t data = {vm, NULL};
+            if(by){
+                data.fun = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+                OBJ_TYPECHECK(data.fun, OBJ_TYPE_FUN)
+                frame->stack_tos--;
+            }
+            obj_t *lst = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK_LIST(lst)
+            int len = OBJ_LIST_LEN(lst);
+            obj_t **elems = malloc(len * sizeof(*elems) + 1);
+            if(!elems){
+                perror("malloc");
+                return 1;
+            }
+            for(int i = 0; i < len; i++){
+                elems[i] = OBJ_HEAD(lst);
+                lst = OBJ_TAIL(lst);
+            }
+            if(by? obj_msort(elems, len, obj_vm_fun_lt, &data):
+                obj_msort(elems, len, obj_lt, NULL)
+            ){
+                free(elems);
+                return 1;
+            }
+            lst = obj_pool_add_list(vm->pool, elems, len);
+            free(elems);
+            if(!lst)return 1;
+            obj_init_box(OBJ_FRAME_TOS(frame), lst);
+        }else if(inst == vm->sym_list_cat){
+            OBJ_STACKCHECK(2)
+            obj_t *lst = OBJ_RESOLVE(OBJ_FRAME_NOS(frame));
+            obj_t *tail = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            OBJ_TYPECHECK_LIST(lst)
+            OBJ_TYPECHECK_LIST(tail)
+            lst = obj_pool_add_list_cat(vm->pool, lst, tail);
+            if(!lst)return 1;
+            frame->stack_tos--;
+            obj_init_box(OBJ_FRAME_TOS(frame), lst);
+        }else if(
+            inst == vm->sym_list_map ||
+            inst == vm->sym_list_filter
+        ){
+            /* NOTE: obj_vm_call_fun may realloc frame's stack, so we
+            don't hold on to pointers into it across calls */
+            OBJ_STACKCHECK(2)
+            obj_t *fun = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            obj_t *lst = OBJ_RESOLVE(OBJ_FRAME_NOS(frame));
+            OBJ_TYPECHECK(fun, OBJ_TYPE_FUN)
+            OBJ_TYPECHECK_LIST(lst)
+            bool map = inst == vm->sym_list_map;
+            frame->stack_tos--;
+            int len = OBJ_LIST_LEN(lst);
+            obj_t *vals = map && len?
+                obj_pool_objs_alloc(vm->pool, len): NULL;
+            obj_t **elems = malloc(len * sizeof(*elems) + 1);
+            if(map && len && !vals || !elems){
+                perror("malloc");
+                free(elems);
+                return 1;
+            }
+            int n_elems = 0;
+            for(; OBJ_TYPE(lst) == OBJ_TYPE_CELL; lst = OBJ_TAIL(lst)){
+                obj_t *elem = OBJ_HEAD(lst);
+                obj_t ret;
+                if(obj_vm_call_fun(vm, fun, &elem, 1, &ret)){
+                    free(elems);
+                    return 1;
+                }
+                if(map){
+                    vals[n_elems] = ret;
+                    elems[n_elems] = &vals[n_elems];
+                    n_elems++;
+                }else if(OBJ_TYPE(&ret) != OBJ_TYPE_BOOL){
+                    fprintf(stderr, "%s: Expected bool, got: %s\n",
+                        __func__, obj_type_msg(OBJ_TYPE(&ret)));
+                    free(elems);
+                    return 1;
+                }else if(OBJ_BOOL(&ret)){
+                    elems[n_elems++] = elem;
+                }
+            }
+            lst = obj_pool_add_list(vm->pool, elems, n_elems);
+            free(elems);
+            if(!lst)return 1;
+            obj_init_box(OBJ_FRAME_TOS(frame), lst);
+        }else if(inst == vm->sym_list_fold){
+            OBJ_STACKCHECK(3)
+            obj_t *fun = OBJ_RESOLVE(OBJ_FRAME_TOS(frame));
+            obj_t *lst = OBJ_RESOLVE(OBJ_FRAME_3OS(frame));
+            OBJ_TYPECHECK(fun, OBJ_TYPE_FUN)
+            OBJ_TYPECHECK_LIST(lst)
+            obj_t acc = *OBJ_FRAME_NOS(frame);
+            frame->stack_tos -= 2;
+            for(; OBJ_TYPE(lst) == OBJ_TYPE_CELL; lst = OBJ_TAIL(lst)){
+                obj_t *args[2] = {&acc, OBJ_HEAD(lst)};
+                if(obj_vm_call_fun(vm, fun, args, 2, &acc))return 1;
+            }
+            *OBJ_FRAME_TOS(frame) = acc;
         }else if(
             inst == vm->sym_call ||
             inst == vm->sym_ref
@@ -854,6 +1872,7 @@ int obj_vm_step(obj_vm_t *vm, bool *running_ptr){
                 if(!obj)return 1;
                 obj_t box;
                 obj_init_box(&box, obj);
+                OBJ_SET_UNIQUE(&box);
                 if(!obj_frame_push(frame, &box))return 1;
             }
         }else if(
@@ -883,7 +1902,7 @@ fun_call:
                 obj_t *args = OBJ_FUN_ARGS(fun);
                 while(OBJ_TYPE(args) == OBJ_TYPE_CELL){
                     obj_t *arg = OBJ_HEAD(args);
-                    if(!obj_frame_push(frame, arg))return 1;
+                    if(!obj_frame_push_shared(frame, arg))return 1;
                     args = OBJ_TAIL(args);
                 }
             }
@@ -917,11 +1936,14 @@ longcall:
             if(!obj)return 1;
             obj_t box;
             obj_init_box(&box, obj);
+            OBJ_SET_UNIQUE(&box);
             if(!obj_frame_push(frame, &box))return 1;
         }else if(inst == vm->sym_apply){
             OBJ_STACKCHECK(2)
             obj_t *fun = OBJ_RESOLVE(OBJ_FRAME_NOS(frame));
             OBJ_TYPECHECK(fun, OBJ_TYPE_FUN)
+            fun = obj_vm_own(vm, OBJ_FRAME_NOS(frame));
+            if(!fun)return 1;
 
             /* NOTE: we can't just use TOS as the head!
             Because obj_t on the stack are ephemeral.
@@ -978,7 +2000,8 @@ longcall:
         }else if(inst == vm->sym_str_p){
             OBJ_STACKCHECK(1)
             OBJ_TYPECHECK(OBJ_FRAME_TOS(frame), OBJ_TYPE_STR)
-            obj_string_t *s = OBJ_STRING(OBJ_FRAME_TOS(frame));
+            obj_string_t view;
+            obj_string_t *s = obj_str_get(OBJ_FRAME_TOS(frame), &view);
             fprintf(stderr, "%.*s", (int)s->len, s->data);
             frame->stack_tos--;
         }else if(inst == vm->sym_assert){
@@ -1155,6 +2178,8 @@ skip_block_code_update:
 #   undef OBJ_STACKCHECK
 #   undef OBJ_TYPECHECK
 #   undef OBJ_TYPECHECK_LIST
+#   undef OBJ_TYPECHECK_MAP_KEY
+#   undef OBJ_TYPECHECK_OMAP_KEY
 #   undef OBJ_FRAME_NEXT
 #   undef OBJ_FRAME_NEXTSYM
 #   undef OBJ_FRAME_BINOP
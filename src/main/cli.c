@@ -13,27 +13,148 @@ static void print_help(){
         "Arguments:\n"
         "  -f FILE    Loads & parses given file\n"
         "  -c TEXT    Parses given text\n"
+        "  -b FILE    Loads given file in binary format\n"
+        "  -j FILE    Loads given file in JSON format\n"
+        "  -o FILE    Writes last loaded obj to given file in binary format\n"
+        "  -i FILE    Writes image of pool to given file, with last loaded\n"
+        "             obj as its root\n"
+        "  -m FILE    Maps given image file into memory (privately, since\n"
+        "             it's relocated in place, so its pages are copied\n"
+        "             rather than shared), and uses its root as last\n"
+        "             loaded obj\n"
+        "  -J FILE    Writes last loaded obj to given file as JSON, all on\n"
+        "             one line (FILE may be - for stdout)\n"
+        "  -P FILE    Like -J, but pretty-printed\n"
+        "  -y CHAR    Sym prefix for JSON: syms are written as strings\n"
+        "             starting with CHAR, and such strings read as syms\n"
+        "             (default: none, i.e. syms are written as strings)\n"
+        "  -H         Hash-conses text parsed after this point, so that\n"
+        "             equal ints, syms, strings and lists share storage\n"
     );
 }
 
 
-static int parse_buffer(
+enum { FORMAT_TEXT, FORMAT_BINARY, FORMAT_JSON };
+
+static obj_t *parse_buffer(
     obj_pool_t *pool, const char *filename,
-    const char *buffer, size_t buffer_len
+    const char *buffer, size_t buffer_len, int format,
+    obj_json_options_t *json_opts
 ){
     fprintf(stderr, "Parsing file: %s\n", filename);
-    obj_t *obj = obj_parse(pool, filename, buffer, buffer_len);
+    obj_t *obj =
+        format == FORMAT_BINARY?
+            obj_binary_parse(pool, filename, buffer, buffer_len):
+        format == FORMAT_JSON?
+            obj_json_parse(pool, filename, buffer, buffer_len, json_opts):
+            obj_parse(pool, filename, buffer, buffer_len);
     if(!obj){
         fprintf(stderr, "Couldn't parse file: %s\n", filename);
-        return 1;
+        return NULL;
     }
     fprintf(stderr, "Parsed file: %s\n", filename);
 
     fprintf(stderr, "Resulting obj:\n");
     obj_dump(obj, stderr, 2);
+    return obj;
+}
+
+static int write_binary_file(obj_t *obj, const char *filename){
+    fprintf(stderr, "Writing file: %s\n", filename);
+    FILE *file = fopen(filename, "wb");
+    if(!file){
+        fprintf(stderr, "Couldn't open file: %s\n", filename);
+        perror("fopen");
+        return 1;
+    }
+    int err = obj_binary_fwrite(obj, file);
+    if(fclose(file)){
+        perror("fclose");
+        err = 1;
+    }
+    if(err){
+        fprintf(stderr, "Couldn't write file: %s\n", filename);
+        return 1;
+    }
+    fprintf(stderr, "Wrote file: %s\n", filename);
     return 0;
 }
 
+static int write_json_file(obj_t *obj, const char *filename,
+    obj_json_options_t *json_opts
+){
+    bool use_stdout = !strcmp(filename, "-");
+    fprintf(stderr, "Writing file: %s\n", filename);
+    FILE *file = use_stdout? stdout: fopen(filename, "w");
+    if(!file){
+        fprintf(stderr, "Couldn't open file: %s\n", filename);
+        perror("fopen");
+        return 1;
+    }
+    int err = obj_json_fwrite(obj, file, json_opts);
+    if(use_stdout? fflush(file): fclose(file)){
+        perror(use_stdout? "fflush": "fclose");
+        err = 1;
+    }
+    if(err){
+        fprintf(stderr, "Couldn't write file: %s\n", filename);
+        return 1;
+    }
+    fprintf(stderr, "Wrote file: %s\n", filename);
+    return 0;
+}
+
+static int write_image_file(obj_pool_t *pool, obj_t *obj,
+    const char *filename
+){
+    fprintf(stderr, "Writing image: %s\n", filename);
+    FILE *file = fopen(filename, "wb");
+    if(!file){
+        fprintf(stderr, "Couldn't open file: %s\n", filename);
+        perror("fopen");
+        return 1;
+    }
+    int err = obj_image_fwrite(pool, obj, file);
+    if(fclose(file)){
+        perror("fclose");
+        err = 1;
+    }
+    if(err){
+        fprintf(stderr, "Couldn't write image: %s\n", filename);
+        return 1;
+    }
+    fprintf(stderr, "Wrote image: %s\n", filename);
+    return 0;
+}
+
+static obj_t *map_image_file(obj_image_t *image, const char *filename){
+    /* The other options use the usual macros and functions, which need
+    real pointers, so we relocate the image; since map_file's mapping is
+    private, that makes a private copy of every page holding a pointer.
+    (Navigating it read-only with the obj_image_* accessors instead
+    would leave its pages shared.) */
+    fprintf(stderr, "Mapping image: %s\n", filename);
+    size_t size;
+    char *data = map_file(filename, &size);
+    if(!data)return NULL;
+    if(obj_image_init(image, data, size)){
+        fprintf(stderr, "Couldn't use image: %s\n", filename);
+        unmap_file(data, size);
+        return NULL;
+    }
+    obj_t *obj = obj_image_relocate(image);
+    if(!obj){
+        fprintf(stderr, "Couldn't use image: %s\n", filename);
+        unmap_file(data, size);
+        return NULL;
+    }
+    fprintf(stderr, "Mapped image: %s\n", filename);
+
+    fprintf(stderr, "Resulting obj:\n");
+    obj_dump(obj, stderr, 2);
+    return obj;
+}
+
 
 int main(int n_args, char *args[]){
 
@@ -46,10 +167,18 @@ int main(int n_args, char *args[]){
     obj_pool_t _pool, *pool=&_pool;
     obj_symtable_init(table);
     obj_pool_init(pool, table);
+    obj_t *obj = NULL;
+    obj_image_t _image, *image=&_image;
+    memset(image, 0, sizeof(*image));
+    obj_json_options_t json_opts = {0};
 
     for(int i = 1; i < n_args; i++){
         char *arg = args[i];
-        if(!strcmp(arg, "-f")){
+        if(!strcmp(arg, "-f") || !strcmp(arg, "-b") || !strcmp(arg, "-j")){
+            int format =
+                arg[1] == 'b'? FORMAT_BINARY:
+                arg[1] == 'j'? FORMAT_JSON:
+                FORMAT_TEXT;
             if(i >= n_args - 1){
                 fprintf(stderr, "Missing arg after %s\n", arg);
                 return 1;
@@ -62,7 +191,9 @@ int main(int n_args, char *args[]){
             if(!buffer)return 1;
             fprintf(stderr, "Loaded file: %s\n", arg);
 
-            if(parse_buffer(pool, arg, buffer, buffer_len))return 1;
+            obj = parse_buffer(pool, arg, buffer, buffer_len, format,
+                &json_opts);
+            if(!obj)return 1;
             free(buffer);
         }else if(!strcmp(arg, "-c")){
             if(i >= n_args - 1){
@@ -71,7 +202,66 @@ int main(int n_args, char *args[]){
             }
             arg = args[++i];
 
-            if(parse_buffer(pool, "<inline>", arg, strlen(arg)))return 1;
+            obj = parse_buffer(pool, "<inline>", arg, strlen(arg),
+                FORMAT_TEXT, &json_opts);
+            if(!obj)return 1;
+        }else if(!strcmp(arg, "-o")){
+            if(i >= n_args - 1){
+                fprintf(stderr, "Missing arg after %s\n", arg);
+                return 1;
+            }
+            arg = args[++i];
+
+            if(!obj){
+                fprintf(stderr, "No obj loaded!\n");
+                return 1;
+            }
+            if(write_binary_file(obj, arg))return 1;
+        }else if(!strcmp(arg, "-J") || !strcmp(arg, "-P")){
+            if(i >= n_args - 1){
+                fprintf(stderr, "Missing arg after %s\n", arg);
+                return 1;
+            }
+            json_opts.indent = arg[1] == 'P'? 2: 0;
+            arg = args[++i];
+
+            if(!obj){
+                fprintf(stderr, "No obj loaded!\n");
+                return 1;
+            }
+            if(write_json_file(obj, arg, &json_opts))return 1;
+        }else if(!strcmp(arg, "-y")){
+            if(i >= n_args - 1){
+                fprintf(stderr, "Missing arg after %s\n", arg);
+                return 1;
+            }
+            arg = args[++i];
+            if(strlen(arg) != 1){
+                fprintf(stderr, "Expected a single character after -y\n");
+                return 1;
+            }
+            json_opts.sym_prefix = arg[0];
+        }else if(!strcmp(arg, "-H")){
+            pool->hashcons = true;
+        }else if(!strcmp(arg, "-i") || !strcmp(arg, "-m")){
+            bool map = arg[1] == 'm';
+            if(i >= n_args - 1){
+                fprintf(stderr, "Missing arg after %s\n", arg);
+                return 1;
+            }
+            arg = args[++i];
+
+            if(map){
+                unmap_file(image->data, image->size);
+                obj = map_image_file(image, arg);
+                if(!obj)return 1;
+            }else{
+                if(!obj){
+                    fprintf(stderr, "No obj loaded!\n");
+                    return 1;
+                }
+                if(write_image_file(pool, obj, arg))return 1;
+            }
         }else{
             fprintf(stderr, "Unrecognized option: %s\n", arg);
             return 1;
@@ -83,6 +273,7 @@ int main(int n_args, char *args[]){
 
     obj_symtable_cleanup(table);
     obj_pool_cleanup(pool);
+    unmap_file(image->data, image->size);
 
     fprintf(stderr, "OK!\n");
     return 0;
@@ -14,11 +14,14 @@ static void print_help(){
         "Arguments:\n"
         "  -f FILE        Loads & parses given file\n"
         "  -c TEXT        Parses given text\n"
+        "  -i FILE        Writes image of loaded modules to given file\n"
+        "  -I FILE        Loads modules from given image file\n"
         "  -m NAME        Finds given module\n"
         "  -d NAME        Finds given def within module found with -m\n"
         "  -p             Primes def found with -d (loads frame but doesn't run vm)\n"
         "  -e             Executes def found with -d\n"
         "  -D             Dumps symtable, pool, and vm\n"
+        "  -g N           Collects garbage after every N objs allocated\n"
     );
 }
 
@@ -36,6 +39,46 @@ static int parse_buffer(
     return 0;
 }
 
+static int write_image_file(obj_vm_t *vm, const char *filename){
+    fprintf(stderr, "Writing image: %s\n", filename);
+    FILE *file = fopen(filename, "wb");
+    if(!file){
+        fprintf(stderr, "Couldn't open file: %s\n", filename);
+        perror("fopen");
+        return 1;
+    }
+    obj_writer_t _writer, *writer=&_writer;
+    obj_writer_init(writer, file);
+    int err = obj_vm_write_image(vm, writer) || obj_writer_flush(writer);
+    obj_writer_cleanup(writer);
+    if(fclose(file)){
+        perror("fclose");
+        err = 1;
+    }
+    if(err){
+        fprintf(stderr, "Couldn't write image: %s\n", filename);
+        return 1;
+    }
+    fprintf(stderr, "Wrote image: %s\n", filename);
+    return 0;
+}
+
+static int load_image_file(obj_vm_t *vm, obj_image_t *image,
+    const char *filename
+){
+    fprintf(stderr, "Loading image: %s\n", filename);
+    size_t size;
+    char *data = map_file(filename, &size);
+    if(!data)return 1;
+    if(obj_image_init(image, data, size) || obj_vm_load_image(vm, image)){
+        fprintf(stderr, "Couldn't load image: %s\n", filename);
+        unmap_file(data, size);
+        return 1;
+    }
+    fprintf(stderr, "Loaded image: %s\n", filename);
+    return 0;
+}
+
 
 int main(int n_args, char *args[]){
 
@@ -59,6 +102,14 @@ int main(int n_args, char *args[]){
     obj_t *cur_def = NULL;
     bool executed = false;
 
+    /* Images must stay mapped for as long as vm uses them */
+    int n_images = 0;
+    obj_image_t *images = calloc(n_args, sizeof(*images));
+    if(!images){
+        perror("calloc");
+        return 1;
+    }
+
     for(int i = 1; i < n_args; i++){
         char *arg = args[i];
         if(!strcmp(arg, "-f")){
@@ -84,6 +135,20 @@ int main(int n_args, char *args[]){
             arg = args[++i];
 
             if(parse_buffer(vm, "<inline>", arg, strlen(arg)))return 1;
+        }else if(!strcmp(arg, "-i") || !strcmp(arg, "-I")){
+            bool load = arg[1] == 'I';
+            if(i >= n_args - 1){
+                fprintf(stderr, "Missing arg after %s\n", arg);
+                return 1;
+            }
+            arg = args[++i];
+
+            if(load){
+                if(load_image_file(vm, &images[n_images], arg))return 1;
+                n_images++;
+            }else{
+                if(write_image_file(vm, arg))return 1;
+            }
         }else if(!strcmp(arg, "-m")){
             if(i >= n_args - 1){
                 fprintf(stderr, "Missing arg after %s\n", arg);
@@ -136,8 +201,25 @@ int main(int n_args, char *args[]){
 
             if(!obj_vm_push_frame(vm, cur_module, cur_def))return 1;
             if(!strcmp(arg, "-e")){
+                /* Running may collect garbage, moving the module & def,
+                so we find them again afterwards */
+                obj_sym_t *module_name = OBJ_MODULE_NAME(cur_module);
+                obj_sym_t *def_name = OBJ_DEF_NAME(cur_def);
                 if(obj_vm_run(vm))return 1;
+                cur_module = obj_vm_get_module(vm, module_name);
+                cur_def = obj_module_get_def(cur_module, def_name);
             }
+        }else if(!strcmp(arg, "-g")){
+            if(i >= n_args - 1){
+                fprintf(stderr, "Missing arg after %s\n", arg);
+                return 1;
+            }
+            int threshold = atoi(args[++i]);
+            if(threshold <= 0){
+                fprintf(stderr, "Expected positive int after %s\n", arg);
+                return 1;
+            }
+            vm->gc_threshold = vm->gc_next = threshold;
         }else{
             fprintf(stderr, "Unrecognized option: %s\n", arg);
             return 1;
@@ -159,6 +241,10 @@ int main(int n_args, char *args[]){
     obj_symtable_cleanup(table);
     obj_pool_cleanup(pool);
     obj_vm_cleanup(vm);
+    for(int i = 0; i < n_images; i++){
+        unmap_file(images[i].data, images[i].size);
+    }
+    free(images);
 
     fprintf(stderr, "OK!\n");
     return 0;
@@ -0,0 +1,190 @@
+#define _POSIX_C_SOURCE 200809L
+#define OBJ_SYMTABLE_THREADSAFE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../cobj.h"
+
+/* Multithreaded stress test & benchmark for a shared symtable.
+Build with: ./compile symtable_bench -pthread */
+
+
+static void print_help(){
+    fprintf(stderr,
+        "Arguments:\n"
+        "  -t N       Number of threads (default: 4)\n"
+        "  -n N       Number of distinct syms (default: 10000)\n"
+        "  -r N       Number of rounds of lookups (default: 20)\n"
+    );
+}
+
+
+typedef struct bench_thread {
+    pthread_t thread;
+    int i;
+    int n_threads;
+
+    obj_symtable_t *table;
+    char **names;
+    int n_names;
+    int n_rounds;
+
+    obj_sym_t **syms;
+    int n_errors;
+        /* syms: the sym found for each name, to be compared against
+        what the other threads found */
+} bench_thread_t;
+
+
+static void *run_bench_thread(void *arg){
+    bench_thread_t *t = arg;
+    int n_names = t->n_names;
+
+    /* Each thread starts at a different offset, so that in the first
+    round, different threads are creating different syms while other
+    threads are looking them up */
+    int offset = (int)((long)n_names * t->i / t->n_threads);
+
+    for(int round = 0; round < t->n_rounds; round++){
+        for(int j = 0; j < n_names; j++){
+            int k = (offset + j) % n_names;
+            obj_sym_t *sym = obj_symtable_get_sym(t->table, t->names[k]);
+            if(!sym){
+                t->n_errors++;
+            }else if(!round){
+                t->syms[k] = sym;
+            }else if(t->syms[k] != sym){
+                t->n_errors++;
+            }
+        }
+    }
+    return NULL;
+}
+
+
+static double get_time(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+int main(int n_args, char *args[]){
+    int n_threads = 4;
+    int n_names = 10000;
+    int n_rounds = 20;
+
+    for(int i = 1; i < n_args; i++){
+        char *arg = args[i];
+        if(
+            !strcmp(arg, "-t") ||
+            !strcmp(arg, "-n") ||
+            !strcmp(arg, "-r")
+        ){
+            if(i >= n_args - 1){
+                fprintf(stderr, "Missing arg after %s\n", arg);
+                return 1;
+            }
+            int value = atoi(args[++i]);
+            if(value <= 0){
+                fprintf(stderr, "Expected positive int after %s\n", arg);
+                return 1;
+            }
+            if(arg[1] == 't')n_threads = value;
+            else if(arg[1] == 'n')n_names = value;
+            else n_rounds = value;
+        }else if(!strcmp(arg, "-h") || !strcmp(arg, "--help")){
+            print_help();
+            return 0;
+        }else{
+            fprintf(stderr, "Unrecognized option: %s\n", arg);
+            print_help();
+            return 1;
+        }
+    }
+
+    char **names = malloc(n_names * sizeof(*names));
+    bench_thread_t *threads = calloc(n_threads, sizeof(*threads));
+    if(!names || !threads){
+        perror("malloc");
+        return 1;
+    }
+    for(int k = 0; k < n_names; k++){
+        names[k] = malloc(32);
+        if(!names[k]){
+            perror("malloc");
+            return 1;
+        }
+        snprintf(names[k], 32, "sym_%i", k);
+    }
+
+    obj_symtable_t _table, *table=&_table;
+    obj_symtable_init(table);
+
+    fprintf(stderr,
+        "Running symtable bench: %i threads, %i syms, %i rounds...\n",
+        n_threads, n_names, n_rounds);
+    double t0 = get_time();
+
+    for(int i = 0; i < n_threads; i++){
+        bench_thread_t *t = &threads[i];
+        t->i = i;
+        t->n_threads = n_threads;
+        t->table = table;
+        t->names = names;
+        t->n_names = n_names;
+        t->n_rounds = n_rounds;
+        t->syms = calloc(n_names, sizeof(*t->syms));
+        if(!t->syms){
+            perror("calloc");
+            return 1;
+        }
+        if(pthread_create(&t->thread, NULL, run_bench_thread, t)){
+            fprintf(stderr, "Couldn't create thread %i\n", i);
+            return 1;
+        }
+    }
+    for(int i = 0; i < n_threads; i++){
+        pthread_join(threads[i].thread, NULL);
+    }
+
+    double t1 = get_time();
+
+    /* All threads should have seen the same sym for each name */
+    int n_errors = 0;
+    for(int i = 0; i < n_threads; i++){
+        bench_thread_t *t = &threads[i];
+        n_errors += t->n_errors;
+        for(int k = 0; k < n_names; k++){
+            if(t->syms[k] != threads[0].syms[k])n_errors++;
+        }
+    }
+    if(table->n_syms != n_names){
+        fprintf(stderr, "Expected %i syms, but table has %zu\n",
+            n_names, table->n_syms);
+        n_errors++;
+    }
+
+    double n_lookups = (double)n_threads * n_names * n_rounds;
+    fprintf(stderr, "%.0f lookups in %.3fs (%.1f million/s)\n",
+        n_lookups, t1 - t0, n_lookups / (t1 - t0) / 1e6);
+
+    for(int i = 0; i < n_threads; i++)free(threads[i].syms);
+    for(int k = 0; k < n_names; k++)free(names[k]);
+    free(threads);
+    free(names);
+    obj_symtable_cleanup(table);
+
+    if(n_errors){
+        fprintf(stderr, "*** Bench failed with %i errors! ***\n",
+            n_errors);
+        return 1;
+    }
+    fprintf(stderr, "OK!\n");
+    return 0;
+}
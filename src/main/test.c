@@ -5,6 +5,7 @@
 #include <string.h>
 
 #include "../cobj.h"
+#include "../lang.h"
 
 
 static int run_obj_test(){
@@ -239,14 +240,23 @@ static int run_obj_test(){
     obj_dump(obj, stderr, 2);
 
     /* Add a struct obj */
-    obj = obj_pool_add_struct(pool, 2);
+    obj_sym_t *shape_syms[] = {sym_x, sym_y};
+    obj_shape_t *shape = obj_pool_get_shape_raw(pool, shape_syms, 2);
+    if(!shape){
+        fprintf(stderr, "%s: Couldn't get shape\n", __func__);
+        goto err;
+    }
+    if(obj_pool_get_shape_raw(pool, shape_syms, 2) != shape){
+        fprintf(stderr, "%s: Shape with same keys wasn't reused\n",
+            __func__);
+        goto err;
+    }
+    obj = obj_pool_add_struct(pool, shape);
     if(!obj){
         fprintf(stderr, "%s: Couldn't allocate struct obj\n", __func__);
         goto err;
     }
-    obj_init_sym(OBJ_STRUCT_IGET_KEY(obj, 0), sym_x);
     obj_init_int(OBJ_STRUCT_IGET_VAL(obj, 0), 30);
-    obj_init_sym(OBJ_STRUCT_IGET_KEY(obj, 1), sym_y);
     obj_init_int(OBJ_STRUCT_IGET_VAL(obj, 1), 40);
     fprintf(stderr, "%s: Allocated struct of objs:\n", __func__);
     obj_dump(obj, stderr, 2);
@@ -280,6 +290,62 @@ static int run_obj_test(){
         }
     }
 
+    /* Write objs to a buffer */
+    {
+        obj_writer_t _writer, *writer=&_writer;
+        obj_writer_init(writer, NULL);
+
+        obj_string_t *string = obj_pool_string_add(pool, "a\"b\nc");
+        obj_t *str_obj = string? obj_pool_add_str(pool, string): NULL;
+        obj_t *sym_obj = obj_pool_add_sym(pool,
+            obj_symtable_get_sym(table, "x y"));
+        obj_t *nil = obj_pool_add_nil(pool);
+        obj = nil? obj_pool_add_cell(pool, sym_obj, nil): NULL;
+        obj = obj? obj_pool_add_cell(pool, str_obj, obj): NULL;
+        if(!str_obj || !sym_obj || !obj){
+            fprintf(stderr, "%s: Couldn't allocate list to write\n",
+                __func__);
+            obj_writer_cleanup(writer);
+            goto err;
+        }
+
+        const char *expected = ":\n  \"a\\\"b\\nc\"\n  [x y]";
+        if(
+            obj_writer_write_obj(writer, obj, 0) ||
+            writer->buffer_len != strlen(expected) ||
+            strncmp(writer->buffer, expected, writer->buffer_len)
+        ){
+            fprintf(stderr, "%s: Wrote \"%.*s\", expected \"%s\"\n",
+                __func__, (int)writer->buffer_len, writer->buffer,
+                expected);
+            obj_writer_cleanup(writer);
+            goto err;
+        }
+
+        /* Deeply nested lists are written without recursing in C */
+        const int depth = 3000;
+        obj = nil;
+        for(int i = 0; i < depth && obj; i++){
+            obj = obj_pool_add_cell(pool, obj, nil);
+        }
+        if(!obj){
+            fprintf(stderr, "%s: Couldn't allocate nested list\n",
+                __func__);
+            obj_writer_cleanup(writer);
+            goto err;
+        }
+        writer->buffer_len = 0;
+        if(obj_writer_write_obj(writer, obj, 0)){
+            fprintf(stderr, "%s: Couldn't write nested list\n", __func__);
+            obj_writer_cleanup(writer);
+            goto err;
+        }
+        fprintf(stderr, "%s: Wrote nested list of depth %i (%zu bytes)\n",
+            __func__, depth, writer->buffer_len);
+
+        obj_writer_cleanup(writer);
+    }
+
 
     obj_symtable_cleanup(table);
     obj_pool_cleanup(pool);
@@ -304,7 +370,7 @@ static int run_dict_test(){
         obj_dict_entry_t *entry;
         obj_sym_t *sym;
         obj_sym_t *syms[100];
-        int values[50];
+        obj_t values[50];
         char sym_name[] = "symbolXX";
 
         /* Set up dict */
@@ -319,7 +385,7 @@ static int run_dict_test(){
                 entries */
                 continue;
             }
-            values[i] = i;
+            obj_init_int(&values[i], i);
             entry = obj_dict_set(dict, sym, &values[i]);
             if(!entry)goto err;
         }
@@ -333,11 +399,10 @@ static int run_dict_test(){
                     fprintf(stderr, "Entry for sym %i not found!\n", i);
                     goto err;
                 }
-                void *expected_value = &values[i];
-                if(entry->value != expected_value){
+                obj_t *value = &entry->value;
+                if(OBJ_TYPE(value) != OBJ_TYPE_INT || OBJ_INT(value) != i){
                     fprintf(stderr,
-                        "Entry for sym %i has wrong value: %p != %p\n",
-                        i, entry->value, expected_value);
+                        "Entry for sym %i has wrong value\n", i);
                     goto err;
                 }
             }else{
@@ -348,6 +413,88 @@ static int run_dict_test(){
                 }
             }
         }
+
+        /* Delete every third entry, and make sure the remaining
+        entries can still be found */
+        for(int i = 0; i < 50; i += 3){
+            obj_t value;
+            if(!obj_dict_del(dict, syms[i], &value) || OBJ_INT(&value) != i){
+                fprintf(stderr, "Couldn't delete entry for sym %i\n", i);
+                goto err;
+            }
+        }
+        for(int i = 0; i < 50; i++){
+            obj_t *value = obj_dict_get(dict, syms[i]);
+            if(i % 3? !value || OBJ_INT(value) != i: value != NULL){
+                fprintf(stderr, "After del, sym %i has wrong value\n", i);
+                goto err;
+            }
+        }
+        if(dict->n_entries != 33){
+            fprintf(stderr, "After del, wrong n_entries: %zu\n",
+                dict->n_entries);
+            goto err;
+        }
+
+        /* Churn: repeatedly add & remove the other 50 syms, which
+        should leave the dict exactly as it was */
+        for(int j = 0; j < 10; j++){
+            for(int i = 50; i < 100; i++){
+                if(!obj_dict_set(dict, syms[i], &values[i % 50]))goto err;
+            }
+            for(int i = 50; i < 100; i++){
+                if(!obj_dict_del(dict, syms[i], NULL)){
+                    fprintf(stderr,
+                        "Churn: couldn't delete entry for sym %i\n", i);
+                    goto err;
+                }
+            }
+        }
+        for(int i = 0; i < 100; i++){
+            obj_t *value = obj_dict_get(dict, syms[i]);
+            if(i < 50 && i % 3? !value || OBJ_INT(value) != i: value != NULL){
+                fprintf(stderr, "After churn, sym %i has wrong value\n", i);
+                goto err;
+            }
+        }
+
+        /* Small dicts stay small (and packed, in insertion order)
+        until they have more than OBJ_DICT_SMALL_LEN keys */
+        obj_dict_t *small_dict = obj_pool_dict_alloc(pool);
+        if(!small_dict)goto err;
+        for(int i = 0; i < OBJ_DICT_SMALL_LEN; i++){
+            if(!obj_dict_set(small_dict, syms[i], &values[i]))goto err;
+        }
+        if(!OBJ_DICT_IS_SMALL(small_dict)){
+            fprintf(stderr, "Small dict was promoted too early\n");
+            goto err;
+        }
+        if(!obj_dict_del(small_dict, syms[1], NULL))goto err;
+        for(int i = 0; i < OBJ_DICT_SMALL_LEN - 1; i++){
+            obj_dict_entry_t *entry = &small_dict->entries[i];
+            int expected_i = i? i + 1: 0;
+            if(entry->sym != syms[expected_i]
+                || OBJ_INT(&entry->value) != expected_i
+            ){
+                fprintf(stderr, "Small dict entry %i is wrong\n", i);
+                goto err;
+            }
+        }
+        for(int i = OBJ_DICT_SMALL_LEN; i < 20; i++){
+            if(!obj_dict_set(small_dict, syms[i], &values[i]))goto err;
+        }
+        if(OBJ_DICT_IS_SMALL(small_dict)){
+            fprintf(stderr, "Small dict wasn't promoted\n");
+            goto err;
+        }
+        for(int i = 0; i < 20; i++){
+            obj_t *value = obj_dict_get(small_dict, syms[i]);
+            if(i == 1? value != NULL: !value || OBJ_INT(value) != i){
+                fprintf(stderr,
+                    "Promoted dict: sym %i has wrong value\n", i);
+                goto err;
+            }
+        }
     }
 
     obj_symtable_cleanup(table);
@@ -363,17 +510,2081 @@ err:
 }
 
 
-int main(int n_args, char *args[]){
+static int run_shape_test(){
+    obj_symtable_t _table, *table=&_table;
+    obj_pool_t _pool, *pool=&_pool;
+    obj_vm_t _vm, *vm=&_vm;
 
-    fprintf(stderr, "Running obj test...\n");
-    if(run_obj_test()){
-        fprintf(stderr, "*** Test failed! ***\n");
-        return 1;
+    obj_symtable_init(table);
+    obj_pool_init(pool, table);
+    obj_vm_init(vm, pool);
+
+#   define CHECK(COND) { \
+        if(!(COND)){ \
+            fprintf(stderr, "%s: Check failed: %s\n", __func__, #COND); \
+            goto err; \
+        } \
     }
-    fprintf(stderr, "Test ok!\n");
+#   define CHECK_INT(OBJ, I) \
+        CHECK((OBJ) && OBJ_TYPE(OBJ) == OBJ_TYPE_INT && OBJ_INT(OBJ) == (I))
 
-    fprintf(stderr, "Running dict test...\n");
-    if(run_dict_test()){
+    obj_sym_t *sym_x = obj_symtable_get_sym(table, "x");
+    obj_sym_t *sym_y = obj_symtable_get_sym(table, "y");
+    obj_sym_t *sym_z = obj_symtable_get_sym(table, "z");
+    CHECK(sym_x && sym_y && sym_z)
+
+    /* One site (e.g. the "x" of ". x") seeing structs of two shapes,
+    with x at a different position in each: the site's cache entry
+    should be used while the shape stays the same, and refilled when it
+    changes */
+    obj_sym_t *keys_a[] = {sym_x, sym_y};
+    obj_sym_t *keys_b[] = {sym_z, sym_y, sym_x};
+    obj_shape_t *shape_a = obj_pool_get_shape_raw(pool, keys_a, 2);
+    obj_shape_t *shape_b = obj_pool_get_shape_raw(pool, keys_b, 3);
+    CHECK(shape_a && shape_b && shape_a != shape_b)
+    obj_t *a = obj_pool_add_struct(pool, shape_a);
+    obj_t *b = obj_pool_add_struct(pool, shape_b);
+    obj_t *site = obj_pool_add_sym(pool, sym_x);
+    CHECK(a && b && site)
+    for(int i = 0; i < 2; i++)obj_init_int(OBJ_STRUCT_IGET_VAL(a, i), 10 + i);
+    for(int i = 0; i < 3; i++)obj_init_int(OBJ_STRUCT_IGET_VAL(b, i), 20 + i);
+
+    obj_vm_site_t *entry = obj_vm_get_site(vm, site);
+    CHECK(entry->site != site)
+    obj_t *val = obj_vm_struct_get(vm, site, a, sym_x);
+    CHECK_INT(val, 10)
+    CHECK(entry->site == site && entry->shape == shape_a && entry->i == 0)
+
+    /* Tamper with the entry, to show that a hit uses it rather than
+    looking the key up again */
+    entry->i = 1;
+    val = obj_vm_struct_get(vm, site, a, sym_x);
+    CHECK_INT(val, 11)
+    entry->i = 0;
+
+    val = obj_vm_struct_get(vm, site, b, sym_x);
+    CHECK_INT(val, 22)
+    CHECK(entry->site == site && entry->shape == shape_b && entry->i == 2)
+    val = obj_vm_struct_get(vm, site, b, sym_x);
+    CHECK_INT(val, 22)
+    val = obj_vm_struct_get(vm, site, a, sym_x);
+    CHECK_INT(val, 10)
+    CHECK(entry->shape == shape_a && entry->i == 0)
+
+    /* At a site whose key the struct doesn't have, nothing is found,
+    or cached */
+    obj_t *site_z = obj_pool_add_sym(pool, sym_z);
+    CHECK(site_z)
+    CHECK(!obj_vm_struct_get(vm, site_z, a, sym_z))
+    CHECK(obj_vm_get_site(vm, site_z)->site != site_z)
+
+    /* Keys whose hashes collide ("Ab" with "BA", and "Ac" with "BB",
+    under obj_hash), so that no multiplier gives a perfect index, and
+    the shape falls back to linear probing */
+    const char *texts[] = {"Ab", "BA", "Ac", "BB", "x"};
+    enum { N_KEYS = sizeof(texts) / sizeof(*texts) };
+    obj_sym_t *keys_c[N_KEYS];
+    for(int i = 0; i < N_KEYS; i++){
+        keys_c[i] = obj_symtable_get_sym(table, texts[i]);
+        CHECK(keys_c[i])
+    }
+    CHECK(keys_c[0]->hash == keys_c[1]->hash)
+    CHECK(keys_c[2]->hash == keys_c[3]->hash)
+    int bits;
+    uint32_t mult;
+    CHECK(!obj_shape_find_index_mult(keys_c, N_KEYS, &bits, &mult))
+
+    obj_shape_t *shape_c = obj_pool_get_shape_raw(pool, keys_c, N_KEYS);
+    obj_t *c = shape_c? obj_pool_add_struct(pool, shape_c): NULL;
+    CHECK(c)
+    for(int i = 0; i < N_KEYS; i++){
+        obj_init_int(OBJ_STRUCT_IGET_VAL(c, i), 100 + i);
+    }
+    for(int i = 0; i < N_KEYS; i++){
+        CHECK(obj_shape_get_index(shape_c, keys_c[i]) == i)
+        val = OBJ_STRUCT_GET(c, keys_c[i]);
+        CHECK_INT(val, 100 + i)
+    }
+    val = obj_vm_struct_get(vm, site, c, sym_x);
+    CHECK_INT(val, 104)
+
+    /* A missing key, whose hash collides with present ones */
+    obj_sym_t *sym_missing = obj_symtable_get_sym(table, "C ");
+    CHECK(sym_missing && sym_missing->hash == keys_c[0]->hash)
+    CHECK(!OBJ_STRUCT_GET(c, sym_missing))
+    CHECK(obj_shape_get_index(shape_c, sym_missing) < 0)
+
+#   undef CHECK_INT
+#   undef CHECK
+
+    obj_vm_cleanup(vm);
+    obj_symtable_cleanup(table);
+    obj_pool_cleanup(pool);
+    return 0;
+
+err:
+    obj_vm_cleanup(vm);
+    obj_symtable_dump(table, stderr);
+    obj_pool_dump(pool, stderr);
+    return 1;
+}
+
+
+static int run_binary_test(){
+    obj_symtable_t _table, *table=&_table;
+    obj_pool_t _pool, *pool=&_pool;
+    obj_writer_t _writer, *writer=&_writer;
+    obj_writer_t _writer2, *writer2=&_writer2;
+
+    obj_symtable_init(table);
+    obj_pool_init(pool, table);
+    obj_writer_init(writer, NULL);
+    obj_writer_init(writer2, NULL);
+
+    obj_sym_t *sym_x = obj_symtable_get_sym(table, "x");
+    obj_sym_t *sym_y = obj_symtable_get_sym(table, "y");
+    obj_sym_t *sym_long = obj_symtable_get_sym(table, "long sym");
+    if(!sym_x || !sym_y || !sym_long)goto err;
+
+    /* Build an obj containing one of everything */
+    obj_sym_t *shape_syms[] = {sym_x, sym_y};
+    obj_shape_t *shape = obj_pool_get_shape_raw(pool, shape_syms, 2);
+    obj_string_t *string = obj_pool_string_add(pool, "a\"b\nc");
+    obj_t *nil = obj_pool_add_nil(pool);
+    obj_t *array = obj_pool_add_array(pool, 3);
+    obj_t *dict_obj = obj_pool_add_dict(pool);
+    obj_t *fun = obj_pool_add_fun(pool, sym_x, sym_long, nil);
+    obj_t *struct_obj = shape? obj_pool_add_struct(pool, shape): NULL;
+    obj_t *str_obj = string? obj_pool_add_str(pool, string): NULL;
+    if(!array || !dict_obj || !fun || !struct_obj || !str_obj){
+        fprintf(stderr, "%s: Couldn't allocate objs to write\n", __func__);
+        goto err;
+    }
+    obj_init_int(OBJ_ARRAY_IGET(array, 0), -123456);
+    obj_init_sym(OBJ_ARRAY_IGET(array, 1), sym_long);
+    obj_init_box(OBJ_ARRAY_IGET(array, 2), fun);
+    obj_init_int(OBJ_STRUCT_IGET_VAL(struct_obj, 0), 1 << 30);
+    obj_init_bool(OBJ_STRUCT_IGET_VAL(struct_obj, 1), true);
+    obj_t value;
+    obj_init_box(&value, array);
+    if(!obj_dict_set(OBJ_DICT(dict_obj), sym_y, &value))goto err;
+
+    obj_t *obj = obj_pool_add_cell(pool, dict_obj, nil);
+    if(obj)obj = obj_pool_add_cell(pool, struct_obj, obj);
+    if(obj)obj = obj_pool_add_cell(pool, str_obj, obj);
+    if(obj)obj = obj_pool_add_queue(pool, obj);
+    if(obj)obj = obj_pool_add_cell(pool, obj, nil);
+    if(!obj)goto err;
+
+    /* Write it, load it, and write it again */
+    if(obj_binary_write(writer, obj)){
+        fprintf(stderr, "%s: Couldn't write binary\n", __func__);
+        goto err;
+    }
+    fprintf(stderr, "%s: Wrote %zu bytes of binary\n",
+        __func__, writer->buffer_len);
+
+    obj_t *loaded = obj_binary_parse(pool, "<test>",
+        writer->buffer, writer->buffer_len);
+    if(!loaded){
+        fprintf(stderr, "%s: Couldn't load binary\n", __func__);
+        goto err;
+    }
+    fprintf(stderr, "%s: Loaded binary:\n", __func__);
+    obj_dump(loaded, stderr, 2);
+
+    if(
+        obj_binary_write(writer2, loaded) ||
+        writer2->buffer_len != writer->buffer_len ||
+        memcmp(writer2->buffer, writer->buffer, writer->buffer_len)
+    ){
+        fprintf(stderr, "%s: Loaded binary didn't match original\n",
+            __func__);
+        goto err;
+    }
+
+    /* Truncated data should fail cleanly.
+    Each prefix is copied into a buffer of exactly its size, so reading
+    past its end is caught (e.g. by -fsanitize=address) rather than
+    landing in the rest of writer's buffer. */
+    for(size_t len = 0; len < writer->buffer_len; len++){
+        char *truncated = malloc(len? len: 1);
+        if(!truncated){
+            perror("malloc");
+            goto err;
+        }
+        memcpy(truncated, writer->buffer, len);
+        obj_t *truncated_obj = obj_binary_parse(pool, "<truncated>",
+            truncated, len);
+        free(truncated);
+        if(truncated_obj){
+            fprintf(stderr, "%s: Loaded truncated binary (%zu bytes)\n",
+                __func__, len);
+            goto err;
+        }
+    }
+
+    obj_writer_cleanup(writer);
+    obj_writer_cleanup(writer2);
+    obj_symtable_cleanup(table);
+    obj_pool_cleanup(pool);
+    return 0;
+
+err:
+    obj_writer_cleanup(writer);
+    obj_writer_cleanup(writer2);
+    obj_symtable_dump(table, stderr);
+    obj_pool_dump(pool, stderr);
+    return 1;
+}
+
+
+static int run_image_test(){
+    obj_symtable_t _table, *table=&_table;
+    obj_pool_t _pool, *pool=&_pool;
+    obj_writer_t _writer, *writer=&_writer;
+    obj_writer_t _writer2, *writer2=&_writer2;
+    obj_image_t _image, *image=&_image;
+    char *data = NULL;
+    char *bad_data = NULL;
+
+    obj_symtable_init(table);
+    obj_pool_init(pool, table);
+    obj_writer_init(writer, NULL);
+    obj_writer_init(writer2, NULL);
+
+    obj_sym_t *sym_x = obj_symtable_get_sym(table, "x");
+    obj_sym_t *sym_y = obj_symtable_get_sym(table, "y");
+    obj_sym_t *sym_name = obj_symtable_get_sym(table, "name");
+    if(!sym_x || !sym_y || !sym_name)goto err;
+
+    /* Build a list of key-value pairs: a small dict, a big dict, a
+    struct, and a string */
+    obj_sym_t *shape_syms[] = {sym_x, sym_y};
+    obj_shape_t *shape = obj_pool_get_shape_raw(pool, shape_syms, 2);
+    obj_string_t *string = obj_pool_string_add(pool, "Hello!");
+    obj_t *nil = obj_pool_add_nil(pool);
+    obj_t *small_dict = obj_pool_add_dict(pool);
+    obj_t *big_dict = obj_pool_add_dict(pool);
+    obj_t *struct_obj = shape? obj_pool_add_struct(pool, shape): NULL;
+    obj_t *str_obj = string? obj_pool_add_str(pool, string): NULL;
+    if(!small_dict || !big_dict || !struct_obj || !str_obj){
+        fprintf(stderr, "%s: Couldn't allocate objs to write\n", __func__);
+        goto err;
+    }
+    obj_t value;
+    obj_init_int(&value, 1);
+    if(!obj_dict_set(OBJ_DICT(small_dict), sym_x, &value))goto err;
+    for(int i = 0; i < 100; i++){
+        char text[32];
+        snprintf(text, sizeof(text), "key_%i", i);
+        obj_sym_t *sym = obj_symtable_get_sym(table, text);
+        obj_init_int(&value, i);
+        if(!sym || !obj_dict_set(OBJ_DICT(big_dict), sym, &value))goto err;
+    }
+    obj_init_int(OBJ_STRUCT_IGET_VAL(struct_obj, 0), 10);
+    obj_init_int(OBJ_STRUCT_IGET_VAL(struct_obj, 1), 20);
+
+    obj_t *obj = nil;
+    obj_t *items[] = {
+        obj_pool_add_sym(pool, sym_name), str_obj,
+        obj_pool_add_sym(pool, sym_x), small_dict,
+        obj_pool_add_sym(pool, sym_y), big_dict,
+        obj_pool_add_sym(pool, sym_x), struct_obj,
+    };
+    for(int i = sizeof(items) / sizeof(*items) - 1; i >= 0; i--){
+        if(obj && items[i])obj = obj_pool_add_cell(pool, items[i], obj);
+        else obj = NULL;
+    }
+    if(obj)obj = obj_pool_add_queue(pool, obj);
+    if(obj)obj = obj_pool_add_cell(pool, obj, nil);
+    if(!obj)goto err;
+
+    /* Write an image, and copy it somewhere else, as if we'd loaded it
+    from a file */
+    if(obj_image_write(writer, pool, obj)){
+        fprintf(stderr, "%s: Couldn't write image\n", __func__);
+        goto err;
+    }
+    fprintf(stderr, "%s: Wrote %zu bytes of image\n",
+        __func__, writer->buffer_len);
+    data = malloc(writer->buffer_len);
+    if(!data){
+        perror("malloc");
+        goto err;
+    }
+    memcpy(data, writer->buffer, writer->buffer_len);
+
+    if(!obj_image_init(image, data, writer->buffer_len - 1)){
+        fprintf(stderr, "%s: Accepted truncated image\n", __func__);
+        goto err;
+    }
+    if(obj_image_init(image, data, writer->buffer_len))goto err;
+
+    /* Corrupt copies of the image should be rejected, either by
+    obj_image_init (if the header is corrupt) or obj_image_relocate (if
+    an offset stored in an obj is) */
+    bad_data = malloc(writer->buffer_len);
+    if(!bad_data){
+        perror("malloc");
+        goto err;
+    }
+    for(int i = 0; i < 9; i++){
+        memcpy(bad_data, data, writer->buffer_len);
+        obj_image_header_t *header = (obj_image_header_t*)bad_data;
+        obj_t *bad_root = (obj_t*)(bad_data + header->root);
+        obj_t *bad_end = (obj_t*)(bad_data + header->objs_offset) +
+            header->n_objs;
+        bool bad_header = true;
+        switch(i){
+            case 0: header->n_objs = header->size; break;
+            case 1: header->objs_offset += OBJ_IMAGE_ALIGN / 2; break;
+            case 2: header->shapes_size = header->size; break;
+            case 3: header->n_syms = UINT32_MAX; break;
+            case 4:
+                OBJ_HEAD(bad_root) = (obj_t*)(uintptr_t)header->size;
+                bad_header = false;
+                break;
+            case 5:
+                OBJ_HEAD(bad_root) = (obj_t*)(uintptr_t)
+                    (header->objs_offset + 1);
+                bad_header = false;
+                break;
+            case 6:
+                /* A fun (which takes up 3 objs) as the last obj */
+                obj_init_int(&bad_end[-3], 0);
+                obj_init_int(&bad_end[-2], 0);
+                bad_end[-1].tag = OBJ_TYPE_FUN;
+                bad_header = false;
+                break;
+            case 7:
+                /* Root cell's head pointing at its own tail, which is
+                on an obj boundary, but isn't the start of an obj */
+                OBJ_HEAD(bad_root) = (obj_t*)(uintptr_t)
+                    ((char*)&bad_root[1] - bad_data);
+                bad_header = false;
+                break;
+            default: {
+                /* A sym obj pointing into the text, rather than at one
+                of the syms */
+                obj_image_t _bad_image, *bad_image=&_bad_image;
+                if(obj_image_init(bad_image, bad_data, writer->buffer_len)){
+                    goto err;
+                }
+                obj_t *queue = OBJ_IMAGE_HEAD(bad_image, bad_root);
+                obj_t *list = queue? OBJ_IMAGE_HEAD(bad_image, queue): NULL;
+                obj_t *sym_obj = list? OBJ_IMAGE_HEAD(bad_image, list): NULL;
+                if(!sym_obj || OBJ_TYPE(sym_obj) != OBJ_TYPE_SYM)goto err;
+                OBJ_SYM(sym_obj) = (obj_sym_t*)(uintptr_t)
+                    (header->text_offset + 8);
+                if(OBJ_IMAGE_SYM(bad_image, sym_obj)){
+                    fprintf(stderr, "%s: Got sym from text of image\n",
+                        __func__);
+                    goto err;
+                }
+                bad_header = false;
+                break;
+            }
+        }
+        bool ok = !obj_image_init(image, bad_data, writer->buffer_len);
+        if(ok != !bad_header ||
+            ok && obj_image_relocate(image)
+        ){
+            fprintf(stderr, "%s: Accepted corrupt image (case %i)\n",
+                __func__, i);
+            goto err;
+        }
+    }
+    if(obj_image_init(image, data, writer->buffer_len))goto err;
+
+    /* Navigate image in place */
+    obj_t *root = obj_image_root(image);
+    obj_t *queue = OBJ_IMAGE_HEAD(image, root);
+    obj_t *list = queue? OBJ_IMAGE_HEAD(image, queue): NULL;
+    obj_t *found = obj_image_get(image, list, sym_name);
+    obj_string_t *found_string = found && OBJ_TYPE(found) == OBJ_TYPE_STR?
+        OBJ_IMAGE_STRING(image, found): NULL;
+    if(!found_string ||
+        strcmp(OBJ_IMAGE_STRING_DATA(image, found_string), "Hello!")
+    ){
+        fprintf(stderr, "%s: Couldn't get string from image\n", __func__);
+        goto err;
+    }
+    found = obj_image_get(image,
+        obj_image_get(image, list, sym_x), sym_x);
+    if(!found || OBJ_TYPE(found) != OBJ_TYPE_INT || OBJ_INT(found) != 1){
+        fprintf(stderr, "%s: Couldn't get from small dict in image\n",
+            __func__);
+        goto err;
+    }
+    obj_t *found_dict = obj_image_get(image, list, sym_y);
+    for(int i = 0; i < 100; i++){
+        char text[32];
+        snprintf(text, sizeof(text), "key_%i", i);
+        found = obj_image_get(image, found_dict,
+            obj_symtable_get_sym(table, text));
+        if(!found || OBJ_TYPE(found) != OBJ_TYPE_INT || OBJ_INT(found) != i){
+            fprintf(stderr, "%s: Couldn't get %s from big dict in image\n",
+                __func__, text);
+            goto err;
+        }
+    }
+    found = obj_image_get(image, found_dict, sym_name);
+    if(found){
+        fprintf(stderr, "%s: Got missing key from big dict in image\n",
+            __func__);
+        goto err;
+    }
+    found = obj_image_get(image,
+        obj_image_iget(image, list, 7), sym_y);
+    if(!found || OBJ_TYPE(found) != OBJ_TYPE_INT || OBJ_INT(found) != 20){
+        fprintf(stderr, "%s: Couldn't get from struct in image\n",
+            __func__);
+        goto err;
+    }
+
+    /* Relocate image, after which it should be indistinguishable from
+    the original */
+    root = obj_image_relocate(image);
+    fprintf(stderr, "%s: Relocated image:\n", __func__);
+    obj_dump(root, stderr, 2);
+    if(
+        obj_binary_write(writer, obj) ||
+        obj_binary_write(writer2, root) ||
+        memcmp(writer2->buffer,
+            writer->buffer + writer->buffer_len - writer2->buffer_len,
+            writer2->buffer_len)
+    ){
+        fprintf(stderr, "%s: Relocated image didn't match original\n",
+            __func__);
+        goto err;
+    }
+
+    free(data);
+    free(bad_data);
+    obj_writer_cleanup(writer);
+    obj_writer_cleanup(writer2);
+    obj_symtable_cleanup(table);
+    obj_pool_cleanup(pool);
+    return 0;
+
+err:
+    free(data);
+    free(bad_data);
+    obj_writer_cleanup(writer);
+    obj_writer_cleanup(writer2);
+    obj_symtable_dump(table, stderr);
+    obj_pool_dump(pool, stderr);
+    return 1;
+}
+
+
+static int run_json_test(){
+    obj_symtable_t _table, *table=&_table;
+    obj_pool_t _pool, *pool=&_pool;
+    obj_writer_t _writer, *writer=&_writer;
+
+    obj_symtable_init(table);
+    obj_pool_init(pool, table);
+    obj_writer_init(writer, NULL);
+
+    obj_json_options_t opts = {0, '$'};
+
+    /* Read some JSON, and write it back compactly */
+    const char *text =
+        "{\"a\": [1, -2, true, false, null, [], {}],\n"
+        " \"b\": \"x\\\"y\\n\\u00e9\\ud83d\\ude00\",\n"
+        " \"c\": [\"$sym\", \"$$str\", \"\\u0001\"]}";
+    obj_t *obj = obj_json_parse(pool, "<test>", text, strlen(text), &opts);
+    if(!obj){
+        fprintf(stderr, "%s: Couldn't parse JSON\n", __func__);
+        goto err;
+    }
+    obj_dump(obj, stderr, 2);
+    obj_sym_t *sym_c = obj_symtable_get_sym(table, "c");
+    obj_t *c = sym_c? OBJ_GET(obj, sym_c): NULL;
+    obj_t *c_head = c? OBJ_HEAD(OBJ_RESOLVE(c)): NULL;
+    if(!c_head || OBJ_TYPE(c_head) != OBJ_TYPE_SYM ||
+        OBJ_SYM(c_head) != obj_symtable_get_sym(table, "sym")
+    ){
+        fprintf(stderr, "%s: Expected \"$sym\" to be read as a sym\n",
+            __func__);
+        goto err;
+    }
+
+    /* Dict entries come out in hash order, so we check values one key
+    at a time */
+    const char *expected[][2] = {
+        {"a", "[1,-2,true,false,null,[],{}]"},
+        {"b", "\"x\\\"y\\n\xc3\xa9\xf0\x9f\x98\x80\""},
+        {"c", "[\"$sym\",\"$$str\",\"\\u0001\"]"},
+    };
+    for(int i = 0; i < 3; i++){
+        obj_sym_t *key = obj_symtable_get_sym(table, expected[i][0]);
+        obj_t *value = key? OBJ_GET(obj, key): NULL;
+        writer->buffer_len = 0;
+        if(!value || obj_json_write(writer, value, &opts))goto err;
+        if(writer->buffer_len != strlen(expected[i][1]) ||
+            memcmp(writer->buffer, expected[i][1], writer->buffer_len)
+        ){
+            fprintf(stderr, "%s: Expected %s to be written as:\n%s\n"
+                "...but got:\n%.*s\n", __func__, expected[i][0],
+                expected[i][1], (int)writer->buffer_len, writer->buffer);
+            goto err;
+        }
+    }
+
+    /* Pretty printing */
+    const char *pretty_text = "[1, {\"k\": [2, 3]}, []]";
+    const char *pretty_expected =
+        "[\n"
+        "  1,\n"
+        "  {\n"
+        "    \"k\": [\n"
+        "      2,\n"
+        "      3\n"
+        "    ]\n"
+        "  },\n"
+        "  []\n"
+        "]";
+    opts.indent = 2;
+    obj = obj_json_parse(pool, "<test>",
+        pretty_text, strlen(pretty_text), &opts);
+    writer->buffer_len = 0;
+    if(!obj || obj_json_write(writer, obj, &opts))goto err;
+    if(writer->buffer_len != strlen(pretty_expected) ||
+        memcmp(writer->buffer, pretty_expected, writer->buffer_len)
+    ){
+        fprintf(stderr, "%s: Expected pretty JSON:\n%s\n"
+            "...but got:\n%.*s\n", __func__, pretty_expected,
+            (int)writer->buffer_len, writer->buffer);
+        goto err;
+    }
+
+    /* Invalid JSON should fail cleanly */
+    const char *bad_texts[] = {
+        "", "[1,", "[1 2]", "{\"a\" 1}", "{1: 2}", "1.5", "1e3",
+        "99999999999", "\"abc", "\"\\x\"", "\"\\ud83d\"", "[1] 2", "tru",
+        "01", "-01", "[00]",
+    };
+    for(int i = 0; i < sizeof(bad_texts) / sizeof(*bad_texts); i++){
+        const char *bad_text = bad_texts[i];
+        if(obj_json_parse(pool, "<bad>",
+            bad_text, strlen(bad_text), &opts)
+        ){
+            fprintf(stderr, "%s: Parsed invalid JSON: %s\n",
+                __func__, bad_text);
+            goto err;
+        }
+    }
+
+    obj_writer_cleanup(writer);
+    obj_symtable_cleanup(table);
+    obj_pool_cleanup(pool);
+    return 0;
+
+err:
+    obj_writer_cleanup(writer);
+    obj_symtable_dump(table, stderr);
+    obj_pool_dump(pool, stderr);
+    return 1;
+}
+
+
+static int run_eq_test(){
+    obj_symtable_t _table, *table=&_table;
+    obj_pool_t _pool, *pool=&_pool;
+    obj_hash_memo_t _memo, *memo=&_memo;
+
+    obj_symtable_init(table);
+    obj_pool_init(pool, table);
+    obj_hash_memo_init(memo);
+
+#   define CHECK_EQ(X, Y, EXPECTED) { \
+        bool eq; \
+        size_t x_hash, y_hash; \
+        if(obj_eq((X), (Y), NULL, &eq))goto err; \
+        if(eq != (EXPECTED)){ \
+            fprintf(stderr, "%s: Expected %s and %s to be %s\n", \
+                __func__, #X, #Y, (EXPECTED)? "equal": "unequal"); \
+            goto err; \
+        } \
+        if(obj_hash_deep((X), NULL, &x_hash) || \
+            obj_hash_deep((Y), NULL, &y_hash))goto err; \
+        if(eq && x_hash != y_hash){ \
+            fprintf(stderr, "%s: Expected %s and %s to have equal " \
+                "hashes\n", __func__, #X, #Y); \
+            goto err; \
+        } \
+    }
+
+    /* Parsed trees */
+    const char *texts[] = {
+        "x 1 \"s\" : a b : c {null}null {bool}T",
+        "x 1 \"s\" : a b : c {null}null {bool}T",
+        "x 1 \"s\" : a b : d {null}null {bool}T",
+        "x 1 \"s\" : a b",
+    };
+    obj_t *objs[4];
+    for(int i = 0; i < 4; i++){
+        objs[i] = obj_parse(pool, "<test>", texts[i], strlen(texts[i]));
+        if(!objs[i])goto err;
+    }
+    CHECK_EQ(objs[0], objs[1], true)
+    CHECK_EQ(objs[0], objs[2], false)
+    CHECK_EQ(objs[0], objs[3], false)
+
+    /* Dicts are equal regardless of the order of their entries */
+    obj_t *dict1 = obj_pool_add_dict(pool);
+    obj_t *dict2 = obj_pool_add_dict(pool);
+    if(!dict1 || !dict2)goto err;
+    for(int i = 0; i < 20; i++){
+        char text[32];
+        snprintf(text, sizeof(text), "key_%i", i);
+        obj_sym_t *sym1 = obj_symtable_get_sym(table, text);
+        snprintf(text, sizeof(text), "key_%i", 19 - i);
+        obj_sym_t *sym2 = obj_symtable_get_sym(table, text);
+        if(!sym1 || !sym2)goto err;
+        obj_t value;
+        obj_init_int(&value, i);
+        if(!obj_dict_set(OBJ_DICT(dict1), sym1, &value))goto err;
+        obj_init_int(&value, 19 - i);
+        if(!obj_dict_set(OBJ_DICT(dict2), sym2, &value))goto err;
+    }
+    CHECK_EQ(dict1, dict2, true)
+    obj_t value;
+    obj_init_box(&value, objs[0]);
+    if(!obj_dict_set(OBJ_DICT(dict1), obj_symtable_get_sym(table, "key_0"),
+        &value))goto err;
+    CHECK_EQ(dict1, dict2, false)
+
+    /* Deep nesting shouldn't use up the C stack */
+    obj_t *deep[3];
+    for(int i = 0; i < 3; i++){
+        obj_t *obj = i == 2? objs[0]: obj_pool_add_nil(pool);
+        for(int j = 0; j < 100000 && obj; j++){
+            obj = obj_pool_add_cell(pool, obj, obj_pool_add_nil(pool));
+        }
+        if(!obj)goto err;
+        deep[i] = obj;
+    }
+    CHECK_EQ(deep[0], deep[1], true)
+    CHECK_EQ(deep[0], deep[2], false)
+
+    /* With a memo, shared subtrees are hashed once, so a DAG of depth
+    64 (with 2**64 paths) is cheap to hash */
+    obj_t *dags[2];
+    for(int i = 0; i < 2; i++){
+        obj_t *obj = obj_pool_add_int(pool, i);
+        for(int j = 0; j < 64 && obj; j++){
+            obj_t *tail = obj_pool_add_cell(pool, obj,
+                obj_pool_add_nil(pool));
+            obj = tail? obj_pool_add_cell(pool, obj, tail): NULL;
+        }
+        if(!obj)goto err;
+        dags[i] = obj;
+        size_t hash;
+        if(obj_hash_deep(obj, memo, &hash))goto err;
+    }
+    /* Each level is a single list, memoized by its first cell */
+    if(memo->n_entries != 2 * 64){
+        fprintf(stderr, "%s: Expected %i memo entries, got %zu\n",
+            __func__, 2 * 64, memo->n_entries);
+        goto err;
+    }
+
+    /* ...and the memo's hashes tell us they differ without looking
+    inside them */
+    bool eq;
+    if(obj_eq(dags[0], dags[1], memo, &eq))goto err;
+    if(eq){
+        fprintf(stderr, "%s: Expected DAGs to differ\n", __func__);
+        goto err;
+    }
+
+#   undef CHECK_EQ
+
+    obj_hash_memo_cleanup(memo);
+    obj_symtable_cleanup(table);
+    obj_pool_cleanup(pool);
+    return 0;
+
+err:
+    obj_hash_memo_cleanup(memo);
+    obj_symtable_dump(table, stderr);
+    obj_pool_dump(pool, stderr);
+    return 1;
+}
+
+static int run_hashcons_test(){
+    obj_symtable_t _table, *table=&_table;
+    obj_pool_t _pool, *pool=&_pool;
+
+    obj_symtable_init(table);
+    obj_pool_init(pool, table);
+    pool->hashcons = true;
+
+#   define CHECK_SAME(X, Y, EXPECTED) { \
+        if(((X) == (Y)) != (EXPECTED)){ \
+            fprintf(stderr, "%s: Expected %s and %s to be %s\n", \
+                __func__, #X, #Y, (EXPECTED)? "the same obj": \
+                "different objs"); \
+            goto err; \
+        } \
+    }
+
+    /* Equal atoms and lists are the same obj */
+    const char *text = "(a 1 \"s\") (a 1 \"s\") : a 1 \"s\"";
+    obj_t *obj1 = obj_parse(pool, "<test>", text, strlen(text));
+    obj_t *obj2 = obj_parse(pool, "<test>", text, strlen(text));
+    if(!obj1 || !obj2)goto err;
+    CHECK_SAME(obj1, obj2, true)
+    obj_t *lst1 = OBJ_HEAD(obj1);
+    obj_t *lst2 = OBJ_HEAD(OBJ_TAIL(obj1));
+    obj_t *lst3 = OBJ_HEAD(OBJ_TAIL(OBJ_TAIL(obj1)));
+    CHECK_SAME(lst1, lst2, true)
+    CHECK_SAME(lst1, lst3, true)
+    if(OBJ_LIST_LEN(lst1) != 3 || OBJ_TYPE(OBJ_HEAD(lst1)) != OBJ_TYPE_SYM){
+        fprintf(stderr, "%s: Parsed list is wrong\n", __func__);
+        goto err;
+    }
+    CHECK_SAME(obj_pool_add_int(pool, 1), OBJ_HEAD(OBJ_TAIL(lst1)), true)
+    CHECK_SAME(obj_pool_add_int(pool, 1), obj_pool_add_int(pool, 2), false)
+    CHECK_SAME(obj_pool_add_str_raw(pool, "s", 1),
+        OBJ_HEAD(OBJ_TAIL(OBJ_TAIL(lst1))), true)
+    CHECK_SAME(obj_pool_add_str_raw(pool, "s", 1),
+        obj_pool_add_str_raw(pool, "t", 1), false)
+
+    /* Placeholder cells are never shared, since they'll be mutated */
+    CHECK_SAME(obj_pool_add_cell(pool, NULL, NULL),
+        obj_pool_add_cell(pool, NULL, NULL), false)
+
+    /* Lists share their tails, so a list of 4 copies of lst1 only
+    needs one new cell (in front of obj1) */
+    size_t n_objs = pool->hashcons_n_objs;
+    text = "(a 1 \"s\") (a 1 \"s\") (a 1 \"s\") (a 1 \"s\")";
+    obj_t *obj3 = obj_parse(pool, "<test>", text, strlen(text));
+    if(!obj3)goto err;
+    CHECK_SAME(OBJ_TAIL(obj3), obj1, true)
+    if(pool->hashcons_n_objs != n_objs + 1){
+        fprintf(stderr, "%s: Expected %zu hash-consed objs, got %zu\n",
+            __func__, n_objs + 1, pool->hashcons_n_objs);
+        goto err;
+    }
+
+#   undef CHECK_SAME
+
+    obj_symtable_cleanup(table);
+    obj_pool_cleanup(pool);
+    return 0;
+
+err:
+    obj_symtable_dump(table, stderr);
+    obj_pool_dump(pool, stderr);
+    return 1;
+}
+
+static int run_copy_test(){
+    obj_symtable_t _table, *table=&_table;
+    obj_pool_t _pool, *pool=&_pool;
+    obj_symtable_t _table2, *table2=&_table2;
+    obj_pool_t _pool2, *pool2=&_pool2;
+
+    obj_symtable_init(table);
+    obj_pool_init(pool, table);
+    obj_symtable_init(table2);
+    obj_pool_init(pool2, table2);
+
+#   define CHECK(COND) { \
+        if(!(COND)){ \
+            fprintf(stderr, "%s: Check failed: %s\n", __func__, #COND); \
+            goto err; \
+        } \
+    }
+
+    /* An array holding a list twice, plus a dict, struct, queue and
+    box which refer to it, a box which contains itself, and some
+    atoms */
+    const char *text = "x 1 \"s\" : a b : c";
+    obj_t *lst = obj_parse(pool, "<test>", text, strlen(text));
+    if(!lst)goto err;
+
+    obj_t *arr = obj_pool_add_array(pool, 8);
+    if(!arr)goto err;
+    obj_init_box(OBJ_ARRAY_IGET(arr, 0), lst);
+    obj_init_box(OBJ_ARRAY_IGET(arr, 1), lst);
+
+    obj_t *dict = obj_pool_add_dict(pool);
+    if(!dict)goto err;
+    obj_t value;
+    obj_init_box(&value, lst);
+    if(!obj_dict_set(OBJ_DICT(dict), obj_symtable_get_sym(table, "k"),
+        &value))goto err;
+    *OBJ_ARRAY_IGET(arr, 2) = *dict;
+
+    obj_t *keys = obj_parse(pool, "<test>", "x y", 3);
+    obj_shape_t *shape = keys? obj_pool_get_shape(pool, keys): NULL;
+    obj_t *st = shape? obj_pool_add_struct(pool, shape): NULL;
+    if(!st)goto err;
+    obj_init_int(OBJ_STRUCT_IGET_VAL(st, 1), 7);
+    obj_init_box(OBJ_ARRAY_IGET(arr, 3), st);
+
+    obj_t *queue = obj_pool_add_queue(pool, lst);
+    if(!queue)goto err;
+    obj_init_box(OBJ_ARRAY_IGET(arr, 4), queue);
+
+    obj_t *cycle = obj_pool_add_box(pool, NULL);
+    if(!cycle)goto err;
+    OBJ_CONTENTS(cycle) = cycle;
+    obj_init_box(OBJ_ARRAY_IGET(arr, 5), cycle);
+
+    obj_init_sym(OBJ_ARRAY_IGET(arr, 6), obj_symtable_get_sym(table, "x"));
+    obj_init_str(OBJ_ARRAY_IGET(arr, 7), obj_pool_string_add(pool, "s"));
+
+    obj_t *copy = obj_copy_to_pool(pool2, arr);
+    if(!copy)goto err;
+
+    /* The copy mustn't refer to anything in the original */
+    obj_symtable_cleanup(table);
+    obj_pool_cleanup(pool);
+    obj_symtable_init(table);
+    obj_pool_init(pool, table);
+
+    obj_t *expected = obj_parse(pool2, "<test>", text, strlen(text));
+    if(!expected)goto err;
+    obj_t *lst2 = OBJ_CONTENTS(OBJ_ARRAY_IGET(copy, 0));
+    bool eq;
+    if(obj_eq(lst2, expected, NULL, &eq))goto err;
+    CHECK(eq)
+
+    /* Sharing is preserved, and lists are contiguous */
+    CHECK(OBJ_CONTENTS(OBJ_ARRAY_IGET(copy, 1)) == lst2)
+    CHECK(OBJ_TAIL(lst2) == lst2 + 2)
+    obj_t *k_value = obj_dict_get(OBJ_DICT(OBJ_ARRAY_IGET(copy, 2)),
+        obj_symtable_get_sym(table2, "k"));
+    CHECK(k_value && OBJ_CONTENTS(k_value) == lst2)
+    obj_t *st2 = OBJ_CONTENTS(OBJ_ARRAY_IGET(copy, 3));
+    obj_t *y_value = obj_struct_get(st2, obj_symtable_get_sym(table2, "y"));
+    CHECK(y_value && OBJ_INT(y_value) == 7)
+    obj_t *queue2 = OBJ_CONTENTS(OBJ_ARRAY_IGET(copy, 4));
+    CHECK(OBJ_QUEUE_LIST(queue2) == lst2)
+    CHECK(OBJ_QUEUE_END(queue2) ==
+        obj_list_get_end(&OBJ_QUEUE_LIST(queue2)))
+    obj_t *cycle2 = OBJ_CONTENTS(OBJ_ARRAY_IGET(copy, 5));
+    CHECK(OBJ_CONTENTS(cycle2) == cycle2)
+    CHECK(OBJ_SYM(OBJ_ARRAY_IGET(copy, 6)) ==
+        obj_symtable_get_sym(table2, "x"))
+    obj_string_t view, view2;
+    CHECK(obj_string_eq(obj_str_get(OBJ_ARRAY_IGET(copy, 7), &view),
+        obj_str_get(OBJ_HEAD(OBJ_TAIL(OBJ_TAIL(lst2))), &view2)))
+
+#   undef CHECK
+
+    obj_symtable_cleanup(table);
+    obj_pool_cleanup(pool);
+    obj_symtable_cleanup(table2);
+    obj_pool_cleanup(pool2);
+    return 0;
+
+err:
+    obj_symtable_dump(table2, stderr);
+    obj_pool_dump(pool2, stderr);
+    return 1;
+}
+
+static int run_list_test(){
+    obj_symtable_t _table, *table=&_table;
+    obj_pool_t _pool, *pool=&_pool;
+
+    obj_symtable_init(table);
+    obj_pool_init(pool, table);
+
+#   define CHECK(COND) { \
+        if(!(COND)){ \
+            fprintf(stderr, "%s: Check failed: %s\n", __func__, #COND); \
+            goto err; \
+        } \
+    }
+#   define CHECK_IGET(LST, I, NAME) \
+        CHECK(OBJ_SYM(OBJ_LIST_IGET(LST, I)) == \
+            obj_symtable_get_sym(table, NAME))
+
+    /* Parsed lists are allocated in one go, so have runs */
+    obj_t *lst = obj_parse(pool, "<test>", "a b c d e f", 11);
+    if(!lst)goto err;
+    CHECK(OBJ_CELL_RUN(lst) == 6)
+    CHECK(OBJ_CELL_RUN(OBJ_TAIL(lst)) == 5)
+    CHECK(OBJ_LIST_LEN(lst) == 6)
+    CHECK_IGET(lst, -1, "a")
+    CHECK_IGET(lst, 0, "a")
+    CHECK_IGET(lst, 3, "d")
+    CHECK_IGET(lst, 5, "f")
+    CHECK(!OBJ_LIST_IGET(lst, 6))
+
+    /* Appending to the run's last cell is fine */
+    obj_t *lst2 = obj_parse(pool, "<test>", "g h", 3);
+    if(!lst2)goto err;
+    *obj_list_get_end(&lst) = lst2;
+    CHECK(OBJ_LIST_LEN(lst) == 8)
+    CHECK(OBJ_LIST_LEN(OBJ_TAIL(lst)) == 7)
+    CHECK_IGET(lst, 5, "f")
+    CHECK_IGET(lst, 6, "g")
+    CHECK_IGET(lst, 7, "h")
+    CHECK_IGET(OBJ_TAIL(lst), 6, "h")
+    CHECK(!OBJ_LIST_IGET(lst, 8))
+
+    obj_t *rev = obj_pool_add_rev_list(pool, lst);
+    if(!rev)goto err;
+    CHECK(OBJ_CELL_RUN(rev) == 8)
+    CHECK_IGET(rev, 0, "h")
+    CHECK_IGET(rev, 7, "a")
+    CHECK(OBJ_TYPE(OBJ_TAIL(rev + 7 * 2)) == OBJ_TYPE_NIL)
+
+#   undef CHECK_IGET
+#   undef CHECK
+
+    obj_symtable_cleanup(table);
+    obj_pool_cleanup(pool);
+    return 0;
+
+err:
+    obj_symtable_dump(table, stderr);
+    obj_pool_dump(pool, stderr);
+    return 1;
+}
+
+
+static int run_vec_test(){
+    obj_symtable_t _table, *table=&_table;
+    obj_pool_t _pool, *pool=&_pool;
+    obj_pool_t _pool2, *pool2=&_pool2;
+
+    obj_symtable_init(table);
+    obj_pool_init(pool, table);
+    obj_pool_init(pool2, table);
+
+#   define CHECK(COND) { \
+        if(!(COND)){ \
+            fprintf(stderr, "%s: Check failed: %s\n", __func__, #COND); \
+            goto err; \
+        } \
+    }
+#   define CHECK_EQ(X, Y, EQ) { \
+        bool eq; \
+        if(obj_eq((X), (Y), NULL, &eq))goto err; \
+        CHECK(eq == (EQ)) \
+    }
+
+    /* Enough pushes to need a tree of depth 3 */
+    int n = 2000;
+    obj_t val;
+    obj_t *vec = obj_pool_add_vec(pool, 0);
+    if(!vec)goto err;
+    obj_t *vec100 = NULL;
+    for(int i = 0; i < n; i++){
+        obj_init_int(&val, i);
+        vec = obj_pool_vec_push(pool, vec, &val);
+        if(!vec)goto err;
+        if(i == 99)vec100 = vec;
+    }
+    CHECK(OBJ_VEC_LEN(vec) == n)
+    CHECK(OBJ_VEC_SHIFT(vec) == 2 * OBJ_VEC_BITS)
+    CHECK(OBJ_VEC_LEN(vec100) == 100)
+    for(int i = 0; i < n; i++){
+        CHECK(OBJ_INT(OBJ_VEC_IGET(vec, i)) == i)
+    }
+    CHECK(!OBJ_VEC_IGET(vec, n))
+    CHECK(!OBJ_VEC_IGET(vec, -1))
+
+    /* Setting an element leaves the old vec as it was */
+    obj_init_int(&val, -1);
+    obj_t *vec2 = obj_pool_vec_iset(pool, vec, 1234, &val);
+    if(!vec2)goto err;
+    CHECK(OBJ_INT(OBJ_VEC_IGET(vec, 1234)) == 1234)
+    CHECK(OBJ_INT(OBJ_VEC_IGET(vec2, 1234)) == -1)
+    CHECK(OBJ_INT(OBJ_VEC_IGET(vec2, 1233)) == 1233)
+    CHECK_EQ(vec, vec2, false)
+
+    /* A vec built in one go equals one built by pushing */
+    obj_t *vec3 = obj_pool_add_vec(pool, n);
+    if(!vec3)goto err;
+    for(int i = 0; i < n; i++)obj_init_int(OBJ_VEC_IGET(vec3, i), i);
+    CHECK_EQ(vec, vec3, true)
+    size_t hash, hash3;
+    if(obj_hash_deep(vec, NULL, &hash))goto err;
+    if(obj_hash_deep(vec3, NULL, &hash3))goto err;
+    CHECK(hash == hash3)
+
+    /* Round trips through lists and arrays */
+    obj_t *lst = obj_pool_add_list_from_vec(pool, vec100);
+    if(!lst)goto err;
+    CHECK(OBJ_LIST_LEN(lst) == 100)
+    CHECK(OBJ_INT(OBJ_LIST_IGET(lst, 42)) == 42)
+    obj_t *vec4 = obj_pool_add_vec_from_list(pool, lst);
+    if(!vec4)goto err;
+    CHECK_EQ(vec100, vec4, true)
+    obj_t *arr = obj_pool_add_array_from_vec(pool, vec);
+    if(!arr)goto err;
+    CHECK(OBJ_ARRAY_LEN(arr) == n)
+    CHECK(OBJ_INT(OBJ_ARRAY_IGET(arr, 1999)) == 1999)
+    obj_t *vec5 = obj_pool_add_vec_from_array(pool, arr);
+    if(!vec5)goto err;
+    CHECK_EQ(vec, vec5, true)
+
+    /* Copying to another pool keeps the tree */
+    obj_t *copy = obj_copy_to_pool(pool2, vec2);
+    if(!copy)goto err;
+    CHECK(OBJ_TYPE(copy) == OBJ_TYPE_VEC)
+    CHECK_EQ(vec2, copy, true)
+
+#   undef CHECK_EQ
+#   undef CHECK
+
+    obj_symtable_cleanup(table);
+    obj_pool_cleanup(pool);
+    obj_pool_cleanup(pool2);
+    return 0;
+
+err:
+    obj_symtable_dump(table, stderr);
+    obj_pool_dump(pool, stderr);
+    return 1;
+}
+
+
+static int sort_test_lt(obj_t *x, obj_t *y, void *data, bool *lt_ptr){
+    /* Compares ints by their ten-thousands only, counting calls */
+    (*(int*)data)++;
+    *lt_ptr = OBJ_INT(x) / 10000 < OBJ_INT(y) / 10000;
+    return 0;
+}
+
+static int run_sort_test(){
+    obj_symtable_t _table, *table=&_table;
+    obj_pool_t _pool, *pool=&_pool;
+
+    obj_symtable_init(table);
+    obj_pool_init(pool, table);
+
+#   define CHECK(COND) { \
+        if(!(COND)){ \
+            fprintf(stderr, "%s: Check failed: %s\n", __func__, #COND); \
+            goto err; \
+        } \
+    }
+
+    /* Random, sorted, reversed and all-equal inputs */
+    int n = 5000;
+    obj_t *arr = obj_pool_add_array(pool, n);
+    if(!arr)goto err;
+    for(int round = 0; round < 4; round++){
+        unsigned seed = 1;
+        for(int i = 0; i < n; i++){
+            seed = seed * 1103515245 + 12345;
+            int x =
+                round == 0? (int)(seed >> 16) % 1000:
+                round == 1? i:
+                round == 2? n - i: 7;
+            obj_init_int(OBJ_ARRAY_IGET(arr, i), x);
+        }
+        if(obj_array_sort(arr, false, obj_lt, NULL))goto err;
+        for(int i = 1; i < n; i++){
+            CHECK(OBJ_INT(OBJ_ARRAY_IGET(arr, i - 1))
+                <= OBJ_INT(OBJ_ARRAY_IGET(arr, i)))
+        }
+    }
+
+    int i;
+    if(obj_array_bsearch(arr, OBJ_ARRAY_IGET(arr, 0), &i))goto err;
+    CHECK(i == 0)
+
+    /* Merge sort is stable: values with equal keys (their
+    ten-thousands) stay in order of their original index (the rest) */
+    int n_calls = 0;
+    for(int i = 0; i < n; i++){
+        obj_init_int(OBJ_ARRAY_IGET(arr, i), i * 7919 % 100 * 10000 + i);
+    }
+    if(obj_array_sort(arr, true, sort_test_lt, &n_calls))goto err;
+    for(int i = 1; i < n; i++){
+        int x = OBJ_INT(OBJ_ARRAY_IGET(arr, i - 1));
+        int y = OBJ_INT(OBJ_ARRAY_IGET(arr, i));
+        CHECK(x / 10000 < y / 10000 ||
+            x / 10000 == y / 10000 && x % 10000 < y % 10000)
+    }
+    CHECK(n_calls < n * 13)
+
+    /* Strs and syms compare by their bytes */
+    obj_t *lst = obj_parse(pool, "<test>", "b ab a abc", 10);
+    if(!lst)goto err;
+    obj_t *elems[4];
+    for(int i = 0; i < 4; i++){
+        elems[i] = OBJ_LIST_IGET(lst, i);
+    }
+    if(obj_msort(elems, 4, obj_lt, NULL))goto err;
+    CHECK(OBJ_SYM(elems[0]) == obj_symtable_get_sym(table, "a"))
+    CHECK(OBJ_SYM(elems[1]) == obj_symtable_get_sym(table, "ab"))
+    CHECK(OBJ_SYM(elems[2]) == obj_symtable_get_sym(table, "abc"))
+    CHECK(OBJ_SYM(elems[3]) == obj_symtable_get_sym(table, "b"))
+
+#   undef CHECK
+
+    obj_symtable_cleanup(table);
+    obj_pool_cleanup(pool);
+    return 0;
+
+err:
+    obj_symtable_dump(table, stderr);
+    obj_pool_dump(pool, stderr);
+    return 1;
+}
+
+static int run_intarr_test(){
+    obj_symtable_t _table, *table=&_table;
+    obj_pool_t _pool, *pool=&_pool;
+    obj_pool_t _pool2, *pool2=&_pool2;
+    obj_writer_t _writer, *writer=&_writer;
+
+    obj_symtable_init(table);
+    obj_pool_init(pool, table);
+    obj_pool_init(pool2, table);
+    obj_writer_init(writer, NULL);
+
+#   define CHECK(COND) { \
+        if(!(COND)){ \
+            fprintf(stderr, "%s: Check failed: %s\n", __func__, #COND); \
+            goto err; \
+        } \
+    }
+#   define CHECK_EQ(X, Y, EQ) { \
+        bool eq; \
+        if(obj_eq((X), (Y), NULL, &eq))goto err; \
+        CHECK(eq == (EQ)) \
+    }
+
+    /* A length which isn't a multiple of the vector width, so the
+    bulk ops' scalar tails get tested too */
+    int n = 37;
+    obj_t *x = obj_pool_add_intarr(pool, OBJ_INTARR_I32, n);
+    obj_t *y = obj_pool_add_intarr(pool, OBJ_INTARR_I32, n);
+    obj_t *z = obj_pool_add_intarr(pool, OBJ_INTARR_I32, n);
+    if(!x || !y || !z)goto err;
+    for(int i = 0; i < n; i++){
+        obj_intarr_set(x, i, i * 1000 - 20000);
+        obj_intarr_set(y, i, (i * 7919) % 101 - 50);
+    }
+    CHECK(OBJ_INTARR_LEN(x) == n)
+    CHECK(obj_len(x) == n)
+
+    int ops[] = {OBJ_INTARR_ADD, OBJ_INTARR_SUB, OBJ_INTARR_MUL,
+        OBJ_INTARR_EQ, OBJ_INTARR_LT};
+    for(int k = 0; k < 5; k++){
+        memcpy(z, x, OBJ_INTARR_N_OBJS(x) * sizeof(*z));
+        if(obj_intarr_binop(z, y, ops[k]))goto err;
+        for(int i = 0; i < n; i++){
+            int a = obj_intarr_get(x, i), b = obj_intarr_get(y, i);
+            int c =
+                ops[k] == OBJ_INTARR_ADD? a + b:
+                ops[k] == OBJ_INTARR_SUB? a - b:
+                ops[k] == OBJ_INTARR_MUL? a * b:
+                ops[k] == OBJ_INTARR_EQ? a == b: a < b;
+            CHECK(obj_intarr_get(z, i) == c)
+        }
+    }
+
+    int sum = 0, min = obj_intarr_get(y, 0), max = min, result;
+    for(int i = 0; i < n; i++){
+        int b = obj_intarr_get(y, i);
+        sum += b;
+        if(b < min)min = b;
+        if(b > max)max = b;
+    }
+    if(obj_intarr_reduce(y, OBJ_INTARR_SUM, &result))goto err;
+    CHECK(result == sum)
+    if(obj_intarr_reduce(y, OBJ_INTARR_MIN, &result))goto err;
+    CHECK(result == min)
+    if(obj_intarr_reduce(y, OBJ_INTARR_MAX, &result))goto err;
+    CHECK(result == max)
+
+    /* u8 arithmetic wraps around */
+    obj_t *u = obj_pool_add_intarr(pool, OBJ_INTARR_U8, n);
+    obj_t *v = obj_pool_add_intarr(pool, OBJ_INTARR_U8, n);
+    if(!u || !v)goto err;
+    obj_intarr_fill(u, 200);
+    for(int i = 0; i < n; i++)obj_intarr_set(v, i, i * 7);
+    if(obj_intarr_binop(u, v, OBJ_INTARR_ADD))goto err;
+    max = 0;
+    for(int i = 0; i < n; i++){
+        CHECK(obj_intarr_get(u, i) == (200 + i * 7) % 256)
+        if(obj_intarr_get(u, i) > max)max = obj_intarr_get(u, i);
+    }
+    if(obj_intarr_reduce(u, OBJ_INTARR_MAX, &result))goto err;
+    CHECK(result == max)
+    if(obj_intarr_reduce(v, OBJ_INTARR_SUM, &result))goto err;
+    CHECK(result == 7 * n * (n - 1) / 2)
+    CHECK(obj_intarr_binop(u, x, OBJ_INTARR_ADD))
+
+    /* Round trips through arrays */
+    obj_t *arr = obj_pool_add_array_from_intarr(pool, y);
+    if(!arr)goto err;
+    CHECK(OBJ_ARRAY_LEN(arr) == n)
+    CHECK(OBJ_INT(OBJ_ARRAY_IGET(arr, 5)) == obj_intarr_get(y, 5))
+    obj_t *y2 = obj_pool_add_intarr_from_array(pool, OBJ_INTARR_I32, arr);
+    if(!y2)goto err;
+    CHECK_EQ(y, y2, true)
+    CHECK_EQ(y, x, false)
+    size_t hash, hash2;
+    if(obj_hash_deep(y, NULL, &hash))goto err;
+    if(obj_hash_deep(y2, NULL, &hash2))goto err;
+    CHECK(hash == hash2)
+    CHECK(!obj_pool_add_intarr_from_array(pool, OBJ_INTARR_U8, arr))
+
+    /* Binary round trip, and copying to another pool */
+    obj_t *elems[2] = {y, u};
+    obj_t *lst = obj_pool_add_list(pool, elems, 2);
+    if(!lst)goto err;
+    if(obj_binary_write(writer, lst))goto err;
+    obj_t *loaded = obj_binary_parse(pool2, "<test>",
+        writer->buffer, writer->buffer_len);
+    if(!loaded)goto err;
+    CHECK_EQ(lst, loaded, true)
+    obj_t *copy = obj_copy_to_pool(pool2, u);
+    if(!copy)goto err;
+    CHECK(OBJ_TYPE(copy) == OBJ_TYPE_INTARR)
+    CHECK_EQ(u, copy, true)
+
+#   undef CHECK_EQ
+#   undef CHECK
+
+    obj_writer_cleanup(writer);
+    obj_symtable_cleanup(table);
+    obj_pool_cleanup(pool);
+    obj_pool_cleanup(pool2);
+    return 0;
+
+err:
+    obj_symtable_dump(table, stderr);
+    obj_pool_dump(pool, stderr);
+    return 1;
+}
+
+static int run_strbuf_test(){
+    obj_symtable_t _table, *table=&_table;
+    obj_pool_t _pool, *pool=&_pool;
+    obj_pool_t _pool2, *pool2=&_pool2;
+    obj_writer_t _writer, *writer=&_writer;
+
+    obj_symtable_init(table);
+    obj_pool_init(pool, table);
+    obj_pool_init(pool2, table);
+    obj_writer_init(writer, NULL);
+
+#   define CHECK(COND) { \
+        if(!(COND)){ \
+            fprintf(stderr, "%s: Check failed: %s\n", __func__, #COND); \
+            goto err; \
+        } \
+    }
+#   define CHECK_EQ(X, Y, EQ) { \
+        bool eq; \
+        if(obj_eq((X), (Y), NULL, &eq))goto err; \
+        CHECK(eq == (EQ)) \
+    }
+
+    obj_t *buf = obj_pool_add_strbuf(pool, "ab", 2);
+    if(!buf)goto err;
+    obj_t x;
+    obj_init_int(&x, -7);
+    if(obj_strbuf_add(buf, &x))goto err;
+    obj_init_sym(&x, obj_symtable_get_sym(table, "cd"));
+    if(obj_strbuf_add(buf, &x))goto err;
+    if(obj_strbuf_add_raw(buf, "!", 1))goto err;
+    CHECK(obj_string_eq_raw(OBJ_STRING(buf), "ab-7cd!", 7))
+
+    /* Adding a strbuf to itself doubles it */
+    if(obj_strbuf_add(buf, buf))goto err;
+    CHECK(obj_string_eq_raw(OBJ_STRING(buf), "ab-7cd!ab-7cd!", 14))
+
+    /* Lots of small adds, growing the data many times over */
+    obj_t *big = obj_pool_add_strbuf(pool, "", 0);
+    if(!big)goto err;
+    for(int i = 0; i < 10000; i++){
+        if(obj_strbuf_add_raw(big, "0123456789" + i % 10, 1))goto err;
+    }
+    CHECK(OBJ_STRING(big)->len == 10000)
+    for(int i = 0; i < 10000; i++){
+        CHECK(OBJ_STRING(big)->data[i] == '0' + i % 10)
+    }
+
+    /* Binary round trip, and copying to another pool, keep strbufs
+    growable */
+    obj_t *elems[2] = {buf, big};
+    obj_t *lst = obj_pool_add_list(pool, elems, 2);
+    if(!lst)goto err;
+    if(obj_binary_write(writer, lst))goto err;
+    obj_t *loaded = obj_binary_parse(pool2, "<test>",
+        writer->buffer, writer->buffer_len);
+    if(!loaded)goto err;
+    CHECK_EQ(lst, loaded, true)
+    obj_t *copy = obj_copy_to_pool(pool2, buf);
+    if(!copy)goto err;
+    CHECK(OBJ_TYPE(copy) == OBJ_TYPE_STRBUF)
+    CHECK_EQ(buf, copy, true)
+    if(obj_strbuf_add_raw(copy, "?", 1))goto err;
+    CHECK_EQ(buf, copy, false)
+    obj_t *loaded_buf = OBJ_LIST_IGET(loaded, 0);
+    CHECK(OBJ_TYPE(loaded_buf) == OBJ_TYPE_STRBUF)
+    if(obj_strbuf_add_raw(loaded_buf, "?", 1))goto err;
+    CHECK_EQ(loaded_buf, copy, true)
+
+    /* Short strs are stored inline, but can still be added to strbufs */
+    obj_t *short_str = obj_pool_add_str_raw(pool, "ab-7", 4);
+    obj_t *long_str = obj_pool_add_str_raw(pool, "ab-7cd!ab", 9);
+    if(!short_str || !long_str)goto err;
+    CHECK(OBJ_STR_IS_INLINE(short_str))
+    CHECK(!OBJ_STR_IS_INLINE(long_str))
+    obj_t *buf2 = obj_pool_add_strbuf(pool, "", 0);
+    if(!buf2)goto err;
+    if(obj_strbuf_add(buf2, short_str))goto err;
+    if(obj_strbuf_add_raw(buf2, "cd!ab", 5))goto err;
+    obj_string_t view;
+    CHECK(obj_string_eq(OBJ_STRING(buf2), obj_str_get(long_str, &view)))
+    CHECK(obj_string_eq_raw(obj_str_get(short_str, &view), "ab-7", 4))
+    obj_t *short_copy = obj_copy_to_pool(pool2, short_str);
+    if(!short_copy)goto err;
+    CHECK(OBJ_STR_IS_INLINE(short_copy))
+    CHECK_EQ(short_copy, short_str, true)
+
+#   undef CHECK_EQ
+#   undef CHECK
+
+    obj_writer_cleanup(writer);
+    obj_symtable_cleanup(table);
+    obj_pool_cleanup(pool);
+    obj_pool_cleanup(pool2);
+    return 0;
+
+err:
+    obj_symtable_dump(table, stderr);
+    obj_pool_dump(pool, stderr);
+    return 1;
+}
+
+
+static int run_str_test(){
+    obj_symtable_t _table, *table=&_table;
+    obj_pool_t _pool, *pool=&_pool;
+    obj_pool_t _pool2, *pool2=&_pool2;
+    obj_writer_t _writer, *writer=&_writer;
+    obj_image_t _image, *image=&_image;
+    char *data = NULL;
+
+    obj_symtable_init(table);
+    obj_pool_init(pool, table);
+    obj_pool_init(pool2, table);
+    obj_writer_init(writer, NULL);
+
+#   define CHECK(COND) { \
+        if(!(COND)){ \
+            fprintf(stderr, "%s: Check failed: %s\n", __func__, #COND); \
+            goto err; \
+        } \
+    }
+#   define CHECK_EQ(X, Y, EQ) { \
+        bool eq; \
+        if(obj_eq((X), (Y), NULL, &eq))goto err; \
+        CHECK(eq == (EQ)) \
+    }
+
+    obj_t *str = obj_pool_add_str_raw(pool,
+        "Hello, world! Hello, world!", 27);
+    if(!str)goto err;
+    obj_string_t *s = OBJ_STRING(str);
+    obj_string_t view;
+
+    /* Searching */
+    obj_string_t *world = obj_str_get(
+        obj_pool_add_str_raw(pool, "world", 5), &view);
+    CHECK(obj_string_find(s, world) == 7)
+    CHECK(obj_string_find_byte(s, '!') == 12)
+    CHECK(obj_string_find_byte(s, '?') == -1)
+    CHECK(!obj_string_startswith(s, world))
+    int i = 0;
+    CHECK(obj_string_toint(obj_str_get(
+        obj_pool_add_str_raw(pool, "-123", 4), &view), &i) && i == -123)
+    CHECK(!obj_string_toint(obj_str_get(
+        obj_pool_add_str_raw(pool, "1-23", 4), &view), &i) && i == -123)
+
+    /* Long slices share their str's data, short ones are inline */
+    obj_t *slice = obj_pool_objs_alloc(pool, 2);
+    if(!slice)goto err;
+    obj_t *short_slice = slice + 1;
+    if(!obj_init_str_slice(pool, slice, str, 7, 20))goto err;
+    if(!obj_init_str_slice(pool, short_slice, str, 7, 5))goto err;
+    CHECK(OBJ_STRING(slice)->data == s->data + 7)
+    CHECK(obj_string_eq_raw(OBJ_STRING(slice), "world! Hello, world!", 20))
+    CHECK(OBJ_STR_IS_INLINE(short_slice))
+    CHECK(obj_string_eq(obj_str_get(short_slice, &view), world))
+
+    /* Splitting */
+    obj_t *lst = obj_pool_add_str_split(pool, str, ' ');
+    if(!lst)goto err;
+    CHECK(obj_list_len(lst) == 4)
+    obj_t *last = OBJ_LIST_IGET(lst, 3);
+    CHECK(obj_string_eq_raw(obj_str_get(last, &view), "world!", 6))
+    CHECK(obj_list_len(obj_pool_add_str_split(pool, str, '?')) == 1)
+
+    /* Images and copies of slices get their own data */
+    obj_t *elems[] = {str, slice, lst};
+    obj_t *root = obj_pool_add_list(pool, elems, 3);
+    if(!root)goto err;
+    if(obj_image_write(writer, pool, root))goto err;
+    data = malloc(writer->buffer_len);
+    if(!data){
+        perror("malloc");
+        goto err;
+    }
+    memcpy(data, writer->buffer, writer->buffer_len);
+    if(obj_image_init(image, data, writer->buffer_len))goto err;
+    obj_t *image_root = obj_image_relocate(image);
+    if(!image_root)goto err;
+    CHECK_EQ(root, image_root, true)
+    obj_t *copy = obj_copy_to_pool(pool2, root);
+    if(!copy)goto err;
+    obj_pool_cleanup(pool);
+    obj_pool_init(pool, table);
+    CHECK(obj_string_eq_raw(OBJ_STRING(OBJ_LIST_IGET(copy, 1)),
+        "world! Hello, world!", 20))
+    CHECK_EQ(image_root, copy, true)
+
+#   undef CHECK_EQ
+#   undef CHECK
+
+    free(data);
+    obj_writer_cleanup(writer);
+    obj_symtable_cleanup(table);
+    obj_pool_cleanup(pool);
+    obj_pool_cleanup(pool2);
+    return 0;
+
+err:
+    free(data);
+    obj_symtable_dump(table, stderr);
+    obj_pool_dump(pool, stderr);
+    return 1;
+}
+
+
+static int run_map_test(){
+    obj_symtable_t _table, *table=&_table;
+    obj_pool_t _pool, *pool=&_pool;
+    obj_pool_t _pool2, *pool2=&_pool2;
+    obj_writer_t _writer, *writer=&_writer;
+    obj_image_t _image, *image=&_image;
+    char *data = NULL;
+
+    obj_symtable_init(table);
+    obj_pool_init(pool, table);
+    obj_pool_init(pool2, table);
+    obj_writer_init(writer, NULL);
+
+#   define CHECK(COND) { \
+        if(!(COND)){ \
+            fprintf(stderr, "%s: Check failed: %s\n", __func__, #COND); \
+            goto err; \
+        } \
+    }
+#   define CHECK_EQ(X, Y, EQ) { \
+        bool eq; \
+        if(obj_eq((X), (Y), NULL, &eq))goto err; \
+        CHECK(eq == (EQ)) \
+    }
+
+    obj_t *map = obj_pool_add_map(pool);
+    if(!map)goto err;
+    obj_t key, val;
+
+    /* Enough int keys to grow the table a few times */
+    for(int i = 0; i < 1000; i++){
+        obj_init_int(&key, i * 7);
+        obj_init_int(&val, i);
+        if(!obj_map_set(pool, map, &key, &val))goto err;
+    }
+    CHECK(OBJ_MAP_N_KEYS(map) == 1000)
+    CHECK(OBJ_MAP_CAP(map) == 2048)
+    for(int i = 0; i < 1000; i++){
+        obj_init_int(&key, i * 7);
+        obj_t *got = obj_map_get(map, &key);
+        CHECK(got && OBJ_INT(got) == i)
+    }
+    obj_init_int(&key, 1);
+    CHECK(!obj_map_get(map, &key))
+
+    /* Deleting every other key leaves the rest findable */
+    for(int i = 0; i < 1000; i += 2){
+        obj_init_int(&key, i * 7);
+        CHECK(obj_map_del(map, &key, &val) && OBJ_INT(&val) == i)
+        CHECK(!obj_map_del(map, &key, NULL))
+    }
+    CHECK(OBJ_MAP_N_KEYS(map) == 500)
+    for(int i = 0; i < 1000; i++){
+        obj_init_int(&key, i * 7);
+        obj_t *got = obj_map_get(map, &key);
+        CHECK(i % 2? got && OBJ_INT(got) == i: !got)
+    }
+
+    /* Str keys are compared by contents, and aren't syms */
+    obj_t *str_key = obj_pool_add_str_raw(pool, "a long str key", 14);
+    obj_t *str_key2 = obj_pool_add_str_raw(pool, "a long str key", 14);
+    obj_t *short_key = obj_pool_add_str_raw(pool, "x", 1);
+    obj_sym_t *sym_x = obj_symtable_get_sym(table, "x");
+    obj_t *sym_key = sym_x? obj_pool_add_sym(pool, sym_x): NULL;
+    if(!str_key || !str_key2 || !short_key || !sym_key)goto err;
+    if(!obj_map_set(pool, map, str_key, &val))goto err;
+    CHECK(obj_map_get(map, str_key2))
+    obj_init_int(&val, 1);
+    if(!obj_map_set(pool, map, short_key, &val))goto err;
+    obj_init_int(&val, 2);
+    if(!obj_map_set(pool, map, sym_key, &val))goto err;
+    CHECK(OBJ_INT(obj_map_get(map, short_key)) == 1)
+    CHECK(OBJ_INT(obj_get(map, OBJ_SYM(sym_key))) == 2)
+    CHECK(OBJ_MAP_N_KEYS(map) == 503)
+    CHECK(!obj_map_set(pool, map, &pool->nil, &val))
+
+    /* Clones are independent, and equal until one is changed */
+    obj_t *clone = obj_pool_add_map_clone(pool, map);
+    if(!clone)goto err;
+    CHECK(OBJ_MAP_TABLE(clone) != OBJ_MAP_TABLE(map))
+    CHECK_EQ(map, clone, true)
+    size_t hash, clone_hash;
+    if(obj_hash_deep(map, NULL, &hash))goto err;
+    if(obj_hash_deep(clone, NULL, &clone_hash))goto err;
+    CHECK(hash == clone_hash)
+    obj_map_del(clone, short_key, NULL);
+    CHECK_EQ(map, clone, false)
+    CHECK(obj_map_get(map, short_key))
+    CHECK(obj_list_len(obj_pool_add_map_keys(pool, clone)) == 502)
+
+    /* The same keys inserted in another order give an equal map */
+    obj_t *small = obj_pool_add_map(pool);
+    obj_t *small2 = obj_pool_add_map(pool);
+    if(!small || !small2)goto err;
+    for(int i = 0; i < 20; i++){
+        obj_init_int(&key, i);
+        obj_init_int(&val, i * i);
+        if(!obj_map_set(pool, small, &key, &val))goto err;
+        obj_init_int(&key, 19 - i);
+        obj_init_int(&val, (19 - i) * (19 - i));
+        if(!obj_map_set(pool, small2, &key, &val))goto err;
+    }
+    CHECK_EQ(small, small2, true)
+    if(obj_hash_deep(small, NULL, &hash))goto err;
+    if(obj_hash_deep(small2, NULL, &clone_hash))goto err;
+    CHECK(hash == clone_hash)
+
+    /* Binary, images and copies (images have their own syms, so
+    we leave those out) */
+    obj_map_del(clone, sym_key, NULL);
+    obj_t *elems[] = {clone, small};
+    obj_t *root = obj_pool_add_list(pool, elems, 2);
+    if(!root)goto err;
+    if(obj_binary_write(writer, root))goto err;
+    obj_t *loaded = obj_binary_parse(pool2, "<test>",
+        writer->buffer, writer->buffer_len);
+    if(!loaded)goto err;
+    CHECK_EQ(root, loaded, true)
+
+    writer->buffer_len = 0;
+    if(obj_image_write(writer, pool, root))goto err;
+    data = malloc(writer->buffer_len);
+    if(!data){
+        perror("malloc");
+        goto err;
+    }
+    memcpy(data, writer->buffer, writer->buffer_len);
+    if(obj_image_init(image, data, writer->buffer_len))goto err;
+    obj_t *image_root = obj_image_relocate(image);
+    if(!image_root)goto err;
+    CHECK_EQ(root, image_root, true)
+    obj_t *copy = obj_copy_to_pool(pool2, root);
+    if(!copy)goto err;
+    obj_pool_cleanup(pool);
+    obj_pool_init(pool, table);
+    CHECK_EQ(image_root, copy, true)
+    CHECK_EQ(loaded, copy, true)
+
+#   undef CHECK_EQ
+#   undef CHECK
+
+    free(data);
+    obj_writer_cleanup(writer);
+    obj_symtable_cleanup(table);
+    obj_pool_cleanup(pool);
+    obj_pool_cleanup(pool2);
+    return 0;
+
+err:
+    free(data);
+    obj_symtable_dump(table, stderr);
+    obj_pool_dump(pool, stderr);
+    return 1;
+}
+
+
+static int run_omap_test(){
+    obj_symtable_t _table, *table=&_table;
+    obj_pool_t _pool, *pool=&_pool;
+    obj_pool_t _pool2, *pool2=&_pool2;
+    obj_writer_t _writer, *writer=&_writer;
+    obj_image_t _image, *image=&_image;
+    char *data = NULL;
+
+    obj_symtable_init(table);
+    obj_pool_init(pool, table);
+    obj_pool_init(pool2, table);
+    obj_writer_init(writer, NULL);
+
+#   define CHECK(COND) { \
+        if(!(COND)){ \
+            fprintf(stderr, "%s: Check failed: %s\n", __func__, #COND); \
+            goto err; \
+        } \
+    }
+#   define CHECK_EQ(X, Y, EQ) { \
+        bool eq; \
+        if(obj_eq((X), (Y), NULL, &eq))goto err; \
+        CHECK(eq == (EQ)) \
+    }
+
+    obj_t *empty = obj_pool_add_omap(pool);
+    if(!empty)goto err;
+    obj_t key, val;
+    bool found;
+
+    /* Keys inserted out of order come out in order; 379 is coprime
+    with 1000, so this inserts each of 0, 2, ..., 1998 once */
+    obj_t *omap = empty;
+    obj_t *half = NULL;
+    for(int i = 0; i < 1000; i++){
+        int k = i * 379 % 1000;
+        obj_init_int(&key, k * 2);
+        obj_init_int(&val, k);
+        omap = obj_pool_omap_set(pool, omap, &key, &val);
+        if(!omap)goto err;
+        if(i == 499)half = omap;
+    }
+    CHECK(OBJ_OMAP_LEN(omap) == 1000)
+    CHECK(OBJ_OMAP_HEIGHT(omap) > 1)
+    for(int i = 0; i < 1000; i++){
+        obj_t *entry = OBJ_OMAP_IGET(omap, i);
+        CHECK(entry && OBJ_INT(entry) == i * 2 && OBJ_INT(entry + 1) == i)
+        obj_init_int(&key, i * 2);
+        CHECK(obj_omap_rank(omap, &key, &found) == i && found)
+        obj_init_int(&key, i * 2 + 1);
+        CHECK(obj_omap_rank(omap, &key, &found) == i + 1 && !found)
+        CHECK(!obj_omap_get(omap, &key))
+    }
+    CHECK(!OBJ_OMAP_IGET(omap, 1000))
+    CHECK(!OBJ_OMAP_IGET(omap, -1))
+
+    /* Older versions are unchanged */
+    CHECK(OBJ_OMAP_LEN(half) == 500 && OBJ_OMAP_LEN(empty) == 0)
+    obj_init_int(&key, 379 * 2);
+    CHECK(obj_omap_get(half, &key))
+    for(int i = 500; i < 1000; i++){
+        obj_init_int(&key, i * 379 % 1000 * 2);
+        CHECK(!obj_omap_get(half, &key))
+    }
+
+    /* Setting an existing key replaces its value */
+    obj_init_int(&key, 10);
+    obj_init_int(&val, -1);
+    obj_t *changed = obj_pool_omap_set(pool, omap, &key, &val);
+    if(!changed)goto err;
+    CHECK(OBJ_OMAP_LEN(changed) == 1000)
+    CHECK(OBJ_INT(obj_omap_get(changed, &key)) == -1)
+    CHECK(OBJ_INT(obj_omap_get(omap, &key)) == 5)
+    CHECK_EQ(omap, changed, false)
+
+    /* Deleting in another order keeps the rest in order, and all the
+    way down to empty */
+    obj_t *deleted = omap;
+    for(int i = 0; i < 1000; i++){
+        int k = i * 613 % 1000;
+        obj_init_int(&key, k * 2);
+        obj_t *new_deleted = obj_pool_omap_del(pool, deleted, &key, &val);
+        if(!new_deleted)goto err;
+        CHECK(new_deleted != deleted && OBJ_INT(&val) == k)
+        deleted = new_deleted;
+        CHECK(obj_pool_omap_del(pool, deleted, &key, NULL) == deleted)
+        CHECK(OBJ_OMAP_LEN(deleted) == 999 - i)
+        if(i % 100 == 0){
+            int prev = -1;
+            for(int j = 0; j < OBJ_OMAP_LEN(deleted); j++){
+                obj_t *entry = OBJ_OMAP_IGET(deleted, j);
+                CHECK(OBJ_INT(entry) > prev)
+                CHECK(OBJ_INT(entry + 1) * 2 == OBJ_INT(entry))
+                prev = OBJ_INT(entry);
+            }
+        }
+    }
+    CHECK(!OBJ_OMAP_ROOT(deleted))
+    CHECK_EQ(deleted, empty, true)
+    CHECK(OBJ_OMAP_LEN(omap) == 1000)
+
+    /* Keys must all be one type */
+    obj_t *str_key = obj_pool_add_str_raw(pool, "a long str key", 14);
+    if(!str_key)goto err;
+    CHECK(!obj_omap_key_ok(omap, str_key))
+    CHECK(!obj_pool_omap_set(pool, omap, str_key, &val))
+    CHECK(!obj_omap_get(omap, str_key))
+    CHECK(!obj_pool_omap_set(pool, empty, &pool->nil, &val))
+
+    /* Str keys are ordered by contents */
+    const char *words[] = {"pear", "apple", "a long str key", "fig", ""};
+    obj_t *strs = empty;
+    for(int i = 0; i < 5; i++){
+        obj_t *word = obj_pool_add_str_raw(pool, words[i],
+            strlen(words[i]));
+        if(!word)goto err;
+        obj_init_int(&val, i);
+        strs = obj_pool_omap_set(pool, strs, word, &val);
+        if(!strs)goto err;
+    }
+    CHECK(OBJ_INT(obj_omap_get(strs, str_key)) == 2)
+    CHECK(OBJ_INT(OBJ_OMAP_IGET(strs, 0) + 1) == 4)
+    CHECK(OBJ_INT(OBJ_OMAP_IGET(strs, 4) + 1) == 0)
+    obj_t *str_keys = obj_pool_add_list_from_omap(pool, strs, false);
+    if(!str_keys)goto err;
+    CHECK(obj_list_len(str_keys) == 5)
+    obj_string_t view;
+    CHECK(obj_str_get(OBJ_HEAD(str_keys), &view)->len == 0)
+
+    /* Building from entries gives a differently shaped tree, which is
+    still equal (and hashes the same) */
+    obj_t *entries = obj_pool_objs_alloc(pool, 2000);
+    if(!entries)goto err;
+    for(int i = 0; i < 1000; i++){
+        obj_init_int(&entries[i * 2], i * 2);
+        obj_init_int(&entries[i * 2 + 1], i);
+    }
+    obj_t *built = obj_pool_add_omap_from_entries(pool, entries, 1000);
+    if(!built)goto err;
+    CHECK(OBJ_OMAP_ROOT(built) != OBJ_OMAP_ROOT(omap))
+    CHECK_EQ(omap, built, true)
+    size_t hash, built_hash;
+    if(obj_hash_deep(omap, NULL, &hash))goto err;
+    if(obj_hash_deep(built, NULL, &built_hash))goto err;
+    CHECK(hash == built_hash)
+    obj_init_int(&entries[2], 0);
+    CHECK(!obj_pool_add_omap_from_entries(pool, entries, 1000))
+
+    /* Slices */
+    obj_t *slice = obj_pool_omap_slice(pool, omap, 100, 300);
+    if(!slice)goto err;
+    CHECK(OBJ_OMAP_LEN(slice) == 200)
+    CHECK(OBJ_INT(OBJ_OMAP_IGET(slice, 0)) == 200)
+    CHECK(OBJ_INT(OBJ_OMAP_IGET(slice, 199)) == 598)
+    slice = obj_pool_omap_slice(pool, omap, 300, 100);
+    CHECK(slice && OBJ_OMAP_LEN(slice) == 0)
+
+    /* Binary, images and copies */
+    obj_t *elems[] = {omap, strs, empty};
+    obj_t *root = obj_pool_add_list(pool, elems, 3);
+    if(!root)goto err;
+    if(obj_binary_write(writer, root))goto err;
+    obj_t *loaded = obj_binary_parse(pool2, "<test>",
+        writer->buffer, writer->buffer_len);
+    if(!loaded)goto err;
+    CHECK_EQ(root, loaded, true)
+
+    writer->buffer_len = 0;
+    if(obj_image_write(writer, pool, root))goto err;
+    data = malloc(writer->buffer_len);
+    if(!data){
+        perror("malloc");
+        goto err;
+    }
+    memcpy(data, writer->buffer, writer->buffer_len);
+    if(obj_image_init(image, data, writer->buffer_len))goto err;
+    obj_t *image_root = obj_image_relocate(image);
+    if(!image_root)goto err;
+    CHECK_EQ(root, image_root, true)
+    obj_t *copy = obj_copy_to_pool(pool2, root);
+    if(!copy)goto err;
+    obj_pool_cleanup(pool);
+    obj_pool_init(pool, table);
+    CHECK_EQ(image_root, copy, true)
+    CHECK_EQ(loaded, copy, true)
+
+#   undef CHECK_EQ
+#   undef CHECK
+
+    free(data);
+    obj_writer_cleanup(writer);
+    obj_symtable_cleanup(table);
+    obj_pool_cleanup(pool);
+    obj_pool_cleanup(pool2);
+    return 0;
+
+err:
+    free(data);
+    obj_symtable_dump(table, stderr);
+    obj_pool_dump(pool, stderr);
+    return 1;
+}
+
+
+static int run_pqueue_test(){
+    obj_symtable_t _table, *table=&_table;
+    obj_pool_t _pool, *pool=&_pool;
+    obj_pool_t _pool2, *pool2=&_pool2;
+    obj_writer_t _writer, *writer=&_writer;
+    obj_image_t _image, *image=&_image;
+    char *data = NULL;
+
+    obj_symtable_init(table);
+    obj_pool_init(pool, table);
+    obj_pool_init(pool2, table);
+    obj_writer_init(writer, NULL);
+
+#   define CHECK(COND) { \
+        if(!(COND)){ \
+            fprintf(stderr, "%s: Check failed: %s\n", __func__, #COND); \
+            goto err; \
+        } \
+    }
+#   define CHECK_EQ(X, Y, EQ) { \
+        bool eq; \
+        if(obj_eq((X), (Y), NULL, &eq))goto err; \
+        CHECK(eq == (EQ)) \
+    }
+
+    obj_t *pqueue = obj_pool_add_pqueue(pool);
+    if(!pqueue)goto err;
+    obj_t val;
+    int prio;
+    CHECK(!obj_pqueue_peek(pqueue))
+    CHECK(!obj_pqueue_pop(pqueue, &prio, &val))
+
+    /* Enough values to grow the heap a few times, pushed out of order
+    (379 is coprime with 1000), with some priorities repeated; they
+    come out in order of priority */
+    for(int i = 0; i < 1000; i++){
+        int k = i * 379 % 1000;
+        obj_init_int(&val, k);
+        if(obj_pqueue_push(pool, pqueue, k / 2, &val))goto err;
+    }
+    CHECK(OBJ_PQUEUE_LEN(pqueue) == 1000)
+    CHECK(OBJ_INT(obj_pqueue_peek(pqueue)) == 0)
+    obj_t *clone = obj_pool_add_pqueue_clone(pool, pqueue);
+    if(!clone)goto err;
+    CHECK(OBJ_PQUEUE_HEAP(clone) != OBJ_PQUEUE_HEAP(pqueue))
+    CHECK_EQ(pqueue, clone, true)
+    for(int i = 0; i < 1000; i++){
+        CHECK(obj_pqueue_pop(pqueue, &prio, &val))
+        CHECK(prio == i / 2 && OBJ_INT(&val) / 2 == prio)
+    }
+    CHECK(OBJ_PQUEUE_LEN(pqueue) == 0)
+    CHECK(!obj_pqueue_pop(pqueue, &prio, &val))
+    CHECK(OBJ_PQUEUE_LEN(clone) == 1000)
+    CHECK_EQ(pqueue, clone, false)
+
+    /* Interleaved pushes and pops */
+    int n_pushed = 0, last = -1;
+    for(int i = 0; i < 300; i++){
+        for(int j = 0; j < 3; j++){
+            obj_init_null(&val);
+            if(obj_pqueue_push(pool, pqueue,
+                last + 1 + (n_pushed++ * 7919) % 101, &val))goto err;
+        }
+        CHECK(obj_pqueue_pop(pqueue, &prio, &val))
+        CHECK(prio >= last)
+        last = prio;
+    }
+    CHECK(OBJ_PQUEUE_LEN(pqueue) == 600)
+
+    /* Building from entries heapifies them, in O(n) */
+    obj_t *entries = obj_pool_objs_alloc(pool, 200);
+    if(!entries)goto err;
+    for(int i = 0; i < 100; i++){
+        obj_init_int(&entries[i * 2], (i * 37) % 100);
+        obj_init_int(&entries[i * 2 + 1], -i);
+    }
+    obj_t *built = obj_pool_add_pqueue_from_entries(pool, entries, 100);
+    if(!built)goto err;
+    for(int i = 0; i < 50; i++){
+        CHECK(obj_pqueue_pop(built, &prio, &val))
+        CHECK(prio == i && (-OBJ_INT(&val) * 37) % 100 == i)
+    }
+    obj_init_null(&entries[0]);
+    CHECK(!obj_pool_add_pqueue_from_entries(pool, entries, 100))
+
+    /* Binary, images and copies (the loader heapifies again, which
+    leaves a heap as it is) */
+    obj_t *elems[] = {clone, built, pqueue};
+    obj_t *root = obj_pool_add_list(pool, elems, 3);
+    if(!root)goto err;
+    if(obj_binary_write(writer, root))goto err;
+    obj_t *loaded = obj_binary_parse(pool2, "<test>",
+        writer->buffer, writer->buffer_len);
+    if(!loaded)goto err;
+    CHECK_EQ(root, loaded, true)
+
+    writer->buffer_len = 0;
+    if(obj_image_write(writer, pool, root))goto err;
+    data = malloc(writer->buffer_len);
+    if(!data){
+        perror("malloc");
+        goto err;
+    }
+    memcpy(data, writer->buffer, writer->buffer_len);
+    if(obj_image_init(image, data, writer->buffer_len))goto err;
+    obj_t *image_root = obj_image_relocate(image);
+    if(!image_root)goto err;
+    CHECK_EQ(root, image_root, true)
+    obj_t *copy = obj_copy_to_pool(pool2, root);
+    if(!copy)goto err;
+    obj_pool_cleanup(pool);
+    obj_pool_init(pool, table);
+    CHECK_EQ(image_root, copy, true)
+    CHECK_EQ(loaded, copy, true)
+
+#   undef CHECK_EQ
+#   undef CHECK
+
+    free(data);
+    obj_writer_cleanup(writer);
+    obj_symtable_cleanup(table);
+    obj_pool_cleanup(pool);
+    obj_pool_cleanup(pool2);
+    return 0;
+
+err:
+    free(data);
+    obj_symtable_dump(table, stderr);
+    obj_pool_dump(pool, stderr);
+    return 1;
+}
+
+
+int main(int n_args, char *args[]){
+
+    fprintf(stderr, "Running obj test...\n");
+    if(run_obj_test()){
+        fprintf(stderr, "*** Test failed! ***\n");
+        return 1;
+    }
+    fprintf(stderr, "Test ok!\n");
+
+    fprintf(stderr, "Running dict test...\n");
+    if(run_dict_test()){
+        fprintf(stderr, "*** Test failed! ***\n");
+        return 1;
+    }
+    fprintf(stderr, "Test ok!\n");
+
+    fprintf(stderr, "Running shape test...\n");
+    if(run_shape_test()){
+        fprintf(stderr, "*** Test failed! ***\n");
+        return 1;
+    }
+    fprintf(stderr, "Test ok!\n");
+
+    fprintf(stderr, "Running binary test...\n");
+    if(run_binary_test()){
+        fprintf(stderr, "*** Test failed! ***\n");
+        return 1;
+    }
+    fprintf(stderr, "Test ok!\n");
+
+    fprintf(stderr, "Running image test...\n");
+    if(run_image_test()){
+        fprintf(stderr, "*** Test failed! ***\n");
+        return 1;
+    }
+    fprintf(stderr, "Test ok!\n");
+
+    fprintf(stderr, "Running json test...\n");
+    if(run_json_test()){
+        fprintf(stderr, "*** Test failed! ***\n");
+        return 1;
+    }
+    fprintf(stderr, "Test ok!\n");
+
+    fprintf(stderr, "Running eq test...\n");
+    if(run_eq_test()){
+        fprintf(stderr, "*** Test failed! ***\n");
+        return 1;
+    }
+    fprintf(stderr, "Test ok!\n");
+
+    fprintf(stderr, "Running hashcons test...\n");
+    if(run_hashcons_test()){
+        fprintf(stderr, "*** Test failed! ***\n");
+        return 1;
+    }
+    fprintf(stderr, "Test ok!\n");
+
+    fprintf(stderr, "Running copy test...\n");
+    if(run_copy_test()){
+        fprintf(stderr, "*** Test failed! ***\n");
+        return 1;
+    }
+    fprintf(stderr, "Test ok!\n");
+
+    fprintf(stderr, "Running list test...\n");
+    if(run_list_test()){
+        fprintf(stderr, "*** Test failed! ***\n");
+        return 1;
+    }
+    fprintf(stderr, "Test ok!\n");
+
+    fprintf(stderr, "Running vec test...\n");
+    if(run_vec_test()){
+        fprintf(stderr, "*** Test failed! ***\n");
+        return 1;
+    }
+    fprintf(stderr, "Test ok!\n");
+
+    fprintf(stderr, "Running sort test...\n");
+    if(run_sort_test()){
+        fprintf(stderr, "*** Test failed! ***\n");
+        return 1;
+    }
+    fprintf(stderr, "Test ok!\n");
+
+    fprintf(stderr, "Running intarr test...\n");
+    if(run_intarr_test()){
+        fprintf(stderr, "*** Test failed! ***\n");
+        return 1;
+    }
+    fprintf(stderr, "Test ok!\n");
+    fprintf(stderr, "Running strbuf test...\n");
+    if(run_strbuf_test()){
+        fprintf(stderr, "*** Test failed! ***\n");
+        return 1;
+    }
+    fprintf(stderr, "Test ok!\n");
+    fprintf(stderr, "Running str test...\n");
+    if(run_str_test()){
+        fprintf(stderr, "*** Test failed! ***\n");
+        return 1;
+    }
+    fprintf(stderr, "Test ok!\n");
+    fprintf(stderr, "Running map test...\n");
+    if(run_map_test()){
+        fprintf(stderr, "*** Test failed! ***\n");
+        return 1;
+    }
+    fprintf(stderr, "Test ok!\n");
+    fprintf(stderr, "Running omap test...\n");
+    if(run_omap_test()){
+        fprintf(stderr, "*** Test failed! ***\n");
+        return 1;
+    }
+    fprintf(stderr, "Test ok!\n");
+    fprintf(stderr, "Running pqueue test...\n");
+    if(run_pqueue_test()){
         fprintf(stderr, "*** Test failed! ***\n");
         return 1;
     }
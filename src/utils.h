@@ -6,6 +6,11 @@
 #include <stdbool.h>
 #include <string.h>
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 
 static int strlen_of_int(int i){
     /* Basically log(i), except that strlen of "0" is 1, and strlen of a
@@ -84,4 +89,48 @@ err:
     return NULL;
 }
 
+static char *map_file(const char* filename, size_t *size_ptr){
+    /* Maps file into memory with a private, writable mapping: pages
+    are shared with other processes until written to.
+    Returns NULL on error, or if file is empty. */
+    const char *ERRMSG = "nothing";
+    char *data = NULL;
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0){
+        ERRMSG = "open";
+        goto err;
+    }
+    struct stat st;
+    if(fstat(fd, &st)){
+        ERRMSG = "fstat";
+        goto err;
+    }
+    size_t size = st.st_size;
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if(data == MAP_FAILED){
+        data = NULL;
+        ERRMSG = "mmap";
+        goto err;
+    }
+    if(close(fd)){
+        fd = -1;
+        ERRMSG = "close";
+        goto err;
+    }
+
+    *size_ptr = size;
+    return data;
+
+err:
+    fprintf(stderr, "map_file(%s): ", filename);
+    perror(ERRMSG);
+    if(data)munmap(data, size);
+    if(fd >= 0)close(fd);
+    return NULL;
+}
+
+static void unmap_file(char *data, size_t size){
+    if(data && munmap(data, size))perror("munmap");
+}
+
 #endif
\ No newline at end of file